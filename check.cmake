@@ -0,0 +1,276 @@
+################
+## Checks of the tools on a generated corpus, run by ctest:
+##     inflate -- every inflate backend, with and without splitting, gives
+##         the same counters and stats
+##     index -- warc_entry_by_index gives the same bytes with and without
+##         the .idx sidecar
+##     merge -- warc_merge of shards gives the totals of an unsharded run
+##     resume -- --resume skips the files of the checkpoint
+##     cache -- *.warc.lxc of every codec give the counters of *.warc.gz
+## WARC_CHECK_INFLATE and WARC_CHECK_CODECS are comma-separated lists of
+## what the build has.
+#########################
+cmake_policy(SET CMP0007 NEW)
+
+IF(NOT WARC_BIN_DIR OR NOT WARC_CHECK OR NOT WARC_CHECK_WORK_DIR)
+    message(FATAL_ERROR "WARC_BIN_DIR, WARC_CHECK and WARC_CHECK_WORK_DIR"
+                        " must be set")
+ENDIF()
+
+IF(NOT WARC_CHECK_INFLATE)
+    set(WARC_CHECK_INFLATE "zlib")
+ENDIF()
+
+IF(NOT WARC_CHECK_CODECS)
+    set(WARC_CHECK_CODECS "none")
+ENDIF()
+
+string(REPLACE "," ";" check_inflates "${WARC_CHECK_INFLATE}")
+string(REPLACE "," ";" check_codecs "${WARC_CHECK_CODECS}")
+
+set(check_corpus "${WARC_CHECK_WORK_DIR}/corpus")
+set(check_keys "files|filtered|compressed|decompressed|documents")
+
+# Runs a tool, its stdout goes to <name>.out of the work directory.
+function(check_run name)
+    execute_process(COMMAND ${ARGN}
+                    OUTPUT_FILE "${WARC_CHECK_WORK_DIR}/${name}.out"
+                    RESULT_VARIABLE check_result
+                    TIMEOUT 300)
+
+    IF(NOT check_result EQUAL 0)
+        string(REPLACE ";" " " check_command "${ARGN}")
+        message(FATAL_ERROR "${name}: failed (${check_result}):"
+                            " ${check_command}")
+    ENDIF()
+endfunction()
+
+# Runs warc_test in multi mode, <name>.sum and <name>.json are written.
+function(check_warc_test name dir)
+    check_run("${name}" "${WARC_BIN_DIR}/warc_test" -v 0 ${ARGN}
+              --summary "${WARC_CHECK_WORK_DIR}/${name}.sum"
+              --stats-json "${WARC_CHECK_WORK_DIR}/${name}.json"
+              multi "${WARC_CHECK_WORK_DIR}/${name}.log" "${dir}")
+endfunction()
+
+# Counters of a summary, the keys are a regex alternation.
+function(check_counts result name keys)
+    file(STRINGS "${WARC_CHECK_WORK_DIR}/${name}.sum" check_lines
+         REGEX "^(${keys}) ")
+
+    set(${result} "${check_lines}" PARENT_SCOPE)
+endfunction()
+
+# Stats of a run without timings, entries are in the order workers met
+# them, so the lines are sorted.
+function(check_stats result name)
+    file(READ "${WARC_CHECK_WORK_DIR}/${name}.json" check_json)
+
+    string(REGEX REPLACE ", \"seconds\": [0-9.]+, \"mb_s\": [0-9.]+" ""
+           check_json "${check_json}")
+    string(REPLACE ";" "," check_json "${check_json}")
+    string(REGEX REPLACE ",?\n" ";" check_json "${check_json}")
+    list(SORT check_json)
+    string(REPLACE ";" "\n" check_json "${check_json}")
+
+    set(${result} "${check_json}" PARENT_SCOPE)
+endfunction()
+
+# Top level counters of a warc_merge JSON report.
+function(check_merged result name keys)
+    file(READ "${WARC_CHECK_WORK_DIR}/${name}.json" check_json)
+
+    set(check_values "")
+
+    foreach(check_key ${keys})
+        string(REGEX MATCH "\"${check_key}\": [0-9]+" check_value
+               "${check_json}")
+
+        IF(NOT check_value)
+            message(FATAL_ERROR "${name}: no ${check_key} in the report")
+        ENDIF()
+
+        list(APPEND check_values "${check_value}")
+    endforeach()
+
+    set(${result} "${check_values}" PARENT_SCOPE)
+endfunction()
+
+function(check_same what expected actual)
+    IF(NOT "${expected}" STREQUAL "${actual}")
+        message(FATAL_ERROR "${what} differ\nexpected:\n${expected}\n"
+                            "actual:\n${actual}")
+    ENDIF()
+endfunction()
+
+file(REMOVE_RECURSE "${WARC_CHECK_WORK_DIR}")
+file(MAKE_DIRECTORY "${check_corpus}")
+
+# Members of about 32K, so files of 1-2 MB are split with -j.
+check_run("gen" "${WARC_BIN_DIR}/warc_gen" --seed 7 --files 3 --records 200
+          --size 1K:64K "${check_corpus}")
+
+IF(WARC_CHECK STREQUAL "inflate")
+    list(GET check_inflates 0 check_first)
+
+    check_warc_test("ref" "${check_corpus}" --inflate "${check_first}")
+    check_counts(check_expected "ref" "${check_keys}")
+    check_stats(check_expected_stats "ref")
+
+    foreach(check_inflate ${check_inflates})
+        foreach(check_threads 1 2)
+            set(check_name "${check_inflate}-j${check_threads}")
+
+            check_warc_test("${check_name}" "${check_corpus}"
+                            --inflate "${check_inflate}"
+                            -j "${check_threads}" --split-size 256K)
+            check_counts(check_actual "${check_name}" "${check_keys}")
+            check_stats(check_actual_stats "${check_name}")
+
+            check_same("${check_name}: counters" "${check_expected}"
+                       "${check_actual}")
+            check_same("${check_name}: stats" "${check_expected_stats}"
+                       "${check_actual_stats}")
+        endforeach()
+    endforeach()
+
+ELSEIF(WARC_CHECK STREQUAL "index")
+    set(check_file "${WARC_CHECK_WORK_DIR}/gen-00000.warc.gz")
+    set(check_records "0,3,17-40,150,200")
+
+    file(COPY "${check_corpus}/gen-00000.warc.gz"
+         DESTINATION "${WARC_CHECK_WORK_DIR}")
+
+    check_run("scan" "${WARC_BIN_DIR}/warc_entry_by_index"
+              "${check_records}" "${check_file}")
+
+    check_run("index" "${WARC_BIN_DIR}/warc_index" "${check_file}")
+
+    IF(NOT EXISTS "${check_file}.idx")
+        message(FATAL_ERROR "warc_index wrote no ${check_file}.idx")
+    ENDIF()
+
+    file(READ "${WARC_CHECK_WORK_DIR}/scan.out" check_expected HEX)
+
+    IF(NOT check_expected)
+        message(FATAL_ERROR "warc_entry_by_index wrote nothing")
+    ENDIF()
+
+    foreach(check_inflate ${check_inflates})
+        check_run("idx-${check_inflate}"
+                  "${WARC_BIN_DIR}/warc_entry_by_index"
+                  --inflate "${check_inflate}"
+                  "${check_records}" "${check_file}")
+
+        file(READ "${WARC_CHECK_WORK_DIR}/idx-${check_inflate}.out"
+             check_actual HEX)
+
+        check_same("idx-${check_inflate}: records" "${check_expected}"
+                   "${check_actual}")
+    endforeach()
+
+ELSEIF(WARC_CHECK STREQUAL "merge")
+    set(check_totals "compressed_bytes;decompressed_bytes;documents")
+
+    check_warc_test("all" "${check_corpus}")
+    check_run("merge-all" "${WARC_BIN_DIR}/warc_merge"
+              --json "${WARC_CHECK_WORK_DIR}/merge-all.json"
+              "${WARC_CHECK_WORK_DIR}/all.sum")
+    check_merged(check_expected "merge-all" "${check_totals}")
+    check_merged(check_documents "merge-all" "documents")
+
+    # Shards by record inflate every file, only documents add up.
+    foreach(check_by file record)
+        set(check_summaries "")
+
+        foreach(check_shard 0 1 2)
+            set(check_name "${check_by}-${check_shard}")
+
+            check_warc_test("${check_name}" "${check_corpus}"
+                            --shard "${check_shard}/3"
+                            --shard-by "${check_by}")
+
+            list(APPEND check_summaries
+                 "${WARC_CHECK_WORK_DIR}/${check_name}.sum")
+        endforeach()
+
+        check_run("merge-${check_by}" "${WARC_BIN_DIR}/warc_merge"
+                  --json "${WARC_CHECK_WORK_DIR}/merge-${check_by}.json"
+                  ${check_summaries})
+
+        IF(check_by STREQUAL "file")
+            check_merged(check_actual "merge-${check_by}" "${check_totals}")
+            check_same("merge-${check_by}: totals" "${check_expected}"
+                       "${check_actual}")
+        ELSE()
+            check_merged(check_actual "merge-${check_by}" "documents")
+            check_same("merge-${check_by}: documents" "${check_documents}"
+                       "${check_actual}")
+        ENDIF()
+    endforeach()
+
+ELSEIF(WARC_CHECK STREQUAL "resume")
+    set(check_dir "${WARC_CHECK_WORK_DIR}/resume")
+    set(check_point "${WARC_CHECK_WORK_DIR}/checkpoint")
+
+    file(MAKE_DIRECTORY "${check_dir}")
+    file(COPY "${check_corpus}/gen-00000.warc.gz"
+              "${check_corpus}/gen-00001.warc.gz"
+         DESTINATION "${check_dir}")
+
+    check_warc_test("first" "${check_dir}" --checkpoint "${check_point}")
+
+    # Only the new file is processed, it counts as a run over it alone.
+    file(MAKE_DIRECTORY "${WARC_CHECK_WORK_DIR}/last")
+    file(COPY "${check_corpus}/gen-00002.warc.gz"
+         DESTINATION "${WARC_CHECK_WORK_DIR}/last")
+    file(COPY "${check_corpus}/gen-00002.warc.gz"
+         DESTINATION "${check_dir}")
+
+    check_warc_test("last" "${WARC_CHECK_WORK_DIR}/last")
+    check_warc_test("second" "${check_dir}" --checkpoint "${check_point}"
+                    --resume)
+
+    check_counts(check_expected "last" "${check_keys}")
+    check_counts(check_actual "second" "${check_keys}")
+    check_same("second: counters" "${check_expected}" "${check_actual}")
+
+    check_warc_test("third" "${check_dir}" --checkpoint "${check_point}"
+                    --resume)
+
+    check_counts(check_actual "third" "files|documents")
+    check_same("third: counters" "files 0;documents 0" "${check_actual}")
+
+ELSEIF(WARC_CHECK STREQUAL "cache")
+    set(check_keys "files|filtered|decompressed|documents")
+
+    check_warc_test("gz" "${check_corpus}")
+    check_counts(check_expected "gz" "${check_keys}")
+    check_stats(check_expected_stats "gz")
+
+    foreach(check_codec ${check_codecs})
+        set(check_dir "${WARC_CHECK_WORK_DIR}/${check_codec}")
+
+        file(MAKE_DIRECTORY "${check_dir}")
+
+        check_run("cache-${check_codec}" "${WARC_BIN_DIR}/warc_cache"
+                  --codec "${check_codec}" "${check_dir}" "${check_corpus}")
+
+        foreach(check_threads 1 2)
+            set(check_name "${check_codec}-j${check_threads}")
+
+            check_warc_test("${check_name}" "${check_dir}"
+                            -j "${check_threads}" --split-size 256K)
+            check_counts(check_actual "${check_name}" "${check_keys}")
+            check_stats(check_actual_stats "${check_name}")
+
+            check_same("${check_name}: counters" "${check_expected}"
+                       "${check_actual}")
+            check_same("${check_name}: stats" "${check_expected_stats}"
+                       "${check_actual_stats}")
+        endforeach()
+    endforeach()
+
+ELSE()
+    message(FATAL_ERROR "Unknown check: ${WARC_CHECK}")
+ENDIF()
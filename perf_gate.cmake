@@ -0,0 +1,95 @@
+################
+## Performance gate, run by the perf_gate and perf_baseline targets:
+##     warc_test runs WARC_PERF_RUNS times over a fixed corpus, warc_gate
+##     compares the medians with WARC_PERF_BASELINE or, with
+##     WARC_PERF_WRITE, writes them there.
+## The corpus is made by warc_gen with a fixed seed unless
+## WARC_PERF_CORPUS already has files.
+#########################
+IF(NOT WARC_BIN_DIR OR NOT WARC_PERF_CORPUS OR NOT WARC_PERF_BASELINE)
+    message(FATAL_ERROR "WARC_BIN_DIR, WARC_PERF_CORPUS and"
+                        " WARC_PERF_BASELINE must be set")
+ENDIF()
+
+IF(NOT WARC_PERF_RUNS)
+    set(WARC_PERF_RUNS 7)
+ENDIF()
+
+IF(NOT WARC_PERF_THRESHOLD)
+    set(WARC_PERF_THRESHOLD 5)
+ENDIF()
+
+IF(NOT WARC_PERF_WORK_DIR)
+    set(WARC_PERF_WORK_DIR "${WARC_PERF_CORPUS}.runs")
+ENDIF()
+
+# Timings hold only for one machine, so no baseline comes with the sources.
+IF(WARC_PERF_WRITE)
+    get_filename_component(perf_baseline_dir "${WARC_PERF_BASELINE}" PATH)
+    file(MAKE_DIRECTORY "${perf_baseline_dir}")
+ELSEIF(NOT EXISTS "${WARC_PERF_BASELINE}")
+    message(FATAL_ERROR "No baseline: ${WARC_PERF_BASELINE}, run"
+                        " make perf_baseline on a known good build or set"
+                        " WARC_PERF_BASELINE")
+ENDIF()
+
+separate_arguments(perf_args UNIX_COMMAND "${WARC_PERF_ARGS}")
+
+file(GLOB perf_files "${WARC_PERF_CORPUS}/*.warc.gz"
+                     "${WARC_PERF_CORPUS}/*.warc.lxc")
+
+IF(NOT perf_files)
+    message(STATUS "Generating the corpus: ${WARC_PERF_CORPUS}")
+
+    file(MAKE_DIRECTORY "${WARC_PERF_CORPUS}")
+
+    execute_process(COMMAND "${WARC_BIN_DIR}/warc_gen" --seed 1 --files 4
+                            --records 1000 "${WARC_PERF_CORPUS}"
+                    RESULT_VARIABLE perf_result OUTPUT_QUIET)
+
+    IF(NOT perf_result EQUAL 0)
+        message(FATAL_ERROR "warc_gen failed")
+    ENDIF()
+ENDIF()
+
+file(REMOVE_RECURSE "${WARC_PERF_WORK_DIR}")
+file(MAKE_DIRECTORY "${WARC_PERF_WORK_DIR}")
+
+# Run 0 warms up the page cache and is not counted.
+set(perf_summaries "")
+
+foreach(perf_run RANGE ${WARC_PERF_RUNS})
+    set(perf_summary "${WARC_PERF_WORK_DIR}/run-${perf_run}.sum")
+
+    message(STATUS "warc_test run ${perf_run}/${WARC_PERF_RUNS}")
+
+    execute_process(COMMAND "${WARC_BIN_DIR}/warc_test" -v 0 ${perf_args}
+                            --summary "${perf_summary}" multi
+                            "${WARC_PERF_WORK_DIR}/warc.log"
+                            "${WARC_PERF_CORPUS}"
+                    RESULT_VARIABLE perf_result OUTPUT_QUIET)
+
+    IF(NOT perf_result EQUAL 0)
+        message(FATAL_ERROR "warc_test failed, see"
+                            " ${WARC_PERF_WORK_DIR}/warc.log")
+    ENDIF()
+
+    IF(perf_run GREATER 0)
+        list(APPEND perf_summaries "${perf_summary}")
+    ENDIF()
+endforeach()
+
+IF(WARC_PERF_WRITE)
+    set(perf_write "--write")
+ELSE()
+    set(perf_write "")
+ENDIF()
+
+execute_process(COMMAND "${WARC_BIN_DIR}/warc_gate" ${perf_write}
+                        --threshold "${WARC_PERF_THRESHOLD}"
+                        "${WARC_PERF_BASELINE}" ${perf_summaries}
+                RESULT_VARIABLE perf_result)
+
+IF(NOT perf_result EQUAL 0)
+    message(FATAL_ERROR "Performance gate failed")
+ENDIF()
@@ -0,0 +1,30 @@
+/*
+* Copyright (C) 2019 Alexander Borisov
+*
+* Author: Alexander Borisov <borisov@lexbor.com>
+*/
+
+#ifndef PRGM_ARGS_H
+#define PRGM_ARGS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "lexbor/utils/base.h"
+
+
+/*
+ * A size of command line options: a number with an optional k, m or g
+ * suffix, binary. With end NULL the whole string must be the size,
+ * otherwise end is set to the first byte after it.
+ */
+bool
+prgm_args_size(const char *str, const char **end, size_t *size);
+
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* PRGM_ARGS_H */
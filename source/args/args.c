@@ -0,0 +1,64 @@
+/*
+* Copyright (C) 2019 Alexander Borisov
+*
+* Author: Alexander Borisov <borisov@lexbor.com>
+*/
+
+#include <limits.h>
+
+#include <lexbor/core/conv.h>
+
+#include "args.h"
+
+
+bool
+prgm_args_size(const char *str, const char **end, size_t *size)
+{
+    unsigned long num, mul;
+    const lxb_char_t *data = (const lxb_char_t *) str;
+
+    num = lexbor_conv_data_to_ulong(&data, strlen(str));
+
+    if ((const char *) data == str) {
+        return false;
+    }
+
+    switch (*data) {
+        case 'k':
+        case 'K':
+            mul = 1024;
+            data++;
+            break;
+
+        case 'm':
+        case 'M':
+            mul = 1024 * 1024;
+            data++;
+            break;
+
+        case 'g':
+        case 'G':
+            mul = 1024 * 1024 * 1024;
+            data++;
+            break;
+
+        default:
+            mul = 1;
+            break;
+    }
+
+    if (num > ULONG_MAX / mul) {
+        return false;
+    }
+
+    if (end != NULL) {
+        *end = (const char *) data;
+    }
+    else if (*data != 0x00) {
+        return false;
+    }
+
+    *size = (size_t) (num * mul);
+
+    return true;
+}
@@ -0,0 +1,270 @@
+/*
+* Copyright (C) 2019 Alexander Borisov
+*
+* Author: Alexander Borisov <borisov@lexbor.com>
+*/
+
+#ifndef PRGM_BENCH_H
+#define PRGM_BENCH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "lexbor/utils/base.h"
+
+#include <stdint.h>
+#include <time.h>
+
+#include "perf.h"
+
+
+#define PRGM_BENCH_DEPTH         8
+#define PRGM_BENCH_SLOWEST       10
+#define PRGM_BENCH_SLOWEST_MAX   10000
+
+/* Log-linear histogram: 32 buckets for every power of two, about 3%. */
+#define PRGM_BENCH_HIST_SUB_BITS 5
+#define PRGM_BENCH_HIST_SUB      (1 << PRGM_BENCH_HIST_SUB_BITS)
+#define PRGM_BENCH_HIST_SIZE     ((64 - PRGM_BENCH_HIST_SUB_BITS + 1)         \
+                                  * PRGM_BENCH_HIST_SUB)
+
+
+typedef enum {
+    PRGM_BENCH_OTHER = 0,   /* outside of any stage */
+    PRGM_BENCH_READ,
+    PRGM_BENCH_INFLATE,
+    PRGM_BENCH_WARC,
+    PRGM_BENCH_HTTP,
+    PRGM_BENCH_ENCODING,    /* encoding detection */
+    PRGM_BENCH_TRANSCODE,
+    PRGM_BENCH_TREE,
+    PRGM_BENCH_STAGE_LAST
+}
+prgm_bench_stage_t;
+
+/* One slow document. */
+typedef struct {
+    uint64_t         time;       /* ns */
+    const lxb_char_t *path;      /* must live until the report */
+    size_t           record;     /* warc->count */
+}
+prgm_bench_slow_t;
+
+/*
+ * Time of every stage without the stages entered from it, so the stage
+ * times of a thread add up to the time it was running.
+ * Documents are timed one by one into a histogram and a list of the
+ * slowest ones. With counters the hardware counters of the thread are
+ * split between the stages the same way.
+ * One object per thread, merged at the end.
+ */
+typedef struct {
+    bool               enabled;
+
+    uint64_t           time[PRGM_BENCH_STAGE_LAST];    /* ns */
+
+    prgm_bench_stage_t stack[PRGM_BENCH_DEPTH];
+    size_t             depth;
+    prgm_bench_stage_t current;
+    uint64_t           last;
+
+    uint64_t           wall;        /* ns, set by the caller */
+
+    size_t             compressed;
+    size_t             decompressed;
+    size_t             documents;
+
+    uint64_t           hist[PRGM_BENCH_HIST_SIZE];
+    size_t             hist_count;
+    uint64_t           hist_max;
+
+    size_t             doc_mem_max;  /* bytes of the biggest document */
+    uint64_t           doc_mem_sum;
+    size_t             mem_peak;     /* of a worker, max after merge */
+    size_t             rss_peak;
+
+    prgm_bench_slow_t  *slow;        /* unordered */
+    size_t             slow_length;
+    size_t             slow_size;
+    size_t             slow_min;     /* index of the fastest of them */
+
+    bool               counters;     /* hardware counters are wanted */
+    prgm_perf_t        *perf;        /* of the thread, NULL without them */
+    size_t             counted;      /* benches with counters, after merge */
+    uint64_t           count[PRGM_BENCH_STAGE_LAST][PRGM_PERF_LAST];
+    uint64_t           count_last[PRGM_PERF_LAST];
+}
+prgm_bench_t;
+
+/* What was measured, for the report. */
+typedef struct {
+    const char *mode;
+    const char *input;
+    const char *inflate;
+    unsigned   threads;
+}
+prgm_bench_info_t;
+
+
+lxb_status_t
+prgm_bench_init(prgm_bench_t *bench, bool enabled, size_t slowest);
+
+prgm_bench_t *
+prgm_bench_destroy(prgm_bench_t *bench, bool self_destroy);
+
+void
+prgm_bench_start(prgm_bench_t *bench);
+
+void
+prgm_bench_stop(prgm_bench_t *bench);
+
+void
+prgm_bench_merge(prgm_bench_t *dst, const prgm_bench_t *src);
+
+void
+prgm_bench_clear(prgm_bench_t *bench);
+
+void
+prgm_bench_document(prgm_bench_t *bench, uint64_t begin,
+                    const lxb_char_t *path, size_t record);
+
+void
+prgm_bench_slow(prgm_bench_t *bench, uint64_t time, const lxb_char_t *path,
+                size_t record);
+
+uint64_t
+prgm_bench_percentile(const prgm_bench_t *bench, double percent);
+
+size_t
+prgm_bench_rss(void);
+
+void
+prgm_bench_print(prgm_bench_t *bench, const prgm_bench_info_t *info,
+                 FILE *fh);
+
+void
+prgm_bench_json(prgm_bench_t *bench, const prgm_bench_info_t *info,
+                FILE *fh);
+
+const char *
+prgm_bench_stage_name(prgm_bench_stage_t stage);
+
+void
+prgm_bench_json_string(FILE *fh, const lxb_char_t *str);
+
+
+/*
+ * Inline functions
+ */
+
+/* Counters since the last call go to the current stage, as the time. */
+lxb_inline void
+prgm_bench_count(prgm_bench_t *bench)
+{
+    size_t i;
+    uint64_t values[PRGM_PERF_LAST];
+
+    if (prgm_perf_read(bench->perf, values) != LXB_STATUS_OK) {
+        return;
+    }
+
+    for (i = 0; i < PRGM_PERF_LAST; i++) {
+        bench->count[bench->current][i] += values[i] - bench->count_last[i];
+        bench->count_last[i] = values[i];
+    }
+}
+
+lxb_inline uint64_t
+prgm_bench_now(void)
+{
+    struct timespec ts;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+/* Start time of a document, 0 if disabled. */
+lxb_inline uint64_t
+prgm_bench_begin(prgm_bench_t *bench)
+{
+    return (bench->enabled) ? prgm_bench_now() : 0;
+}
+
+/* Memory of a document when it was done and of its worker at that time. */
+lxb_inline void
+prgm_bench_memory(prgm_bench_t *bench, size_t document, size_t worker)
+{
+    if (document > bench->doc_mem_max) {
+        bench->doc_mem_max = document;
+    }
+
+    if (worker > bench->mem_peak) {
+        bench->mem_peak = worker;
+    }
+
+    bench->doc_mem_sum += document;
+}
+
+lxb_inline void
+prgm_bench_enter(prgm_bench_t *bench, prgm_bench_stage_t stage)
+{
+    uint64_t now;
+
+    if (!bench->enabled) {
+        return;
+    }
+
+    /* Too deep, counted to the enclosing stage. */
+    if (bench->depth >= PRGM_BENCH_DEPTH) {
+        bench->depth++;
+        return;
+    }
+
+    now = prgm_bench_now();
+
+    bench->time[bench->current] += now - bench->last;
+
+    if (bench->perf != NULL) {
+        prgm_bench_count(bench);
+    }
+
+    bench->stack[bench->depth++] = bench->current;
+
+    bench->current = stage;
+    bench->last = now;
+}
+
+lxb_inline void
+prgm_bench_leave(prgm_bench_t *bench)
+{
+    uint64_t now;
+
+    if (!bench->enabled || bench->depth == 0) {
+        return;
+    }
+
+    if (bench->depth > PRGM_BENCH_DEPTH) {
+        bench->depth--;
+        return;
+    }
+
+    now = prgm_bench_now();
+
+    bench->time[bench->current] += now - bench->last;
+
+    if (bench->perf != NULL) {
+        prgm_bench_count(bench);
+    }
+
+    bench->current = bench->stack[--bench->depth];
+    bench->last = now;
+}
+
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* PRGM_BENCH_H */
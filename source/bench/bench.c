@@ -0,0 +1,669 @@
+/*
+* Copyright (C) 2019 Alexander Borisov
+*
+* Author: Alexander Borisov <borisov@lexbor.com>
+*/
+
+#include <inttypes.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+
+#define PRGM_BENCH_MB 1000000.0
+#define PRGM_BENCH_NS 1000000000.0
+#define PRGM_BENCH_MS 1000000.0
+#define PRGM_BENCH_KB 1000.0
+
+#ifdef LEXBOR_VERSION_STRING
+    #define PRGM_BENCH_LEXBOR LEXBOR_VERSION_STRING
+#else
+    #define PRGM_BENCH_LEXBOR "unknown"
+#endif
+
+
+static const char *prgm_bench_stage_names[PRGM_BENCH_STAGE_LAST] = {
+    "other", "read", "inflate", "warc", "http", "encoding", "transcode",
+    "tree"
+};
+
+
+static double
+prgm_bench_rate(double value, uint64_t ns);
+
+static uint64_t
+prgm_bench_busy(const prgm_bench_t *bench);
+
+static size_t
+prgm_bench_hist_index(uint64_t value);
+
+static uint64_t
+prgm_bench_hist_value(size_t idx);
+
+static void
+prgm_bench_slow_add(prgm_bench_t *bench, const prgm_bench_slow_t *slow);
+
+static int
+prgm_bench_slow_cmp(const void *a, const void *b);
+
+static void
+prgm_bench_slow_sort(prgm_bench_t *bench);
+
+static void
+prgm_bench_counters_print(const prgm_bench_t *bench, FILE *fh);
+
+static void
+prgm_bench_counters_json(const prgm_bench_t *bench, FILE *fh);
+
+
+lxb_status_t
+prgm_bench_init(prgm_bench_t *bench, bool enabled, size_t slowest)
+{
+    if (bench == NULL) {
+        return LXB_STATUS_ERROR_OBJECT_IS_NULL;
+    }
+
+    memset(bench, 0, sizeof(prgm_bench_t));
+
+    bench->enabled = enabled;
+
+    if (!enabled || slowest == 0) {
+        return LXB_STATUS_OK;
+    }
+
+    bench->slow = lexbor_malloc(slowest * sizeof(prgm_bench_slow_t));
+    if (bench->slow == NULL) {
+        return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+    }
+
+    bench->slow_size = slowest;
+
+    return LXB_STATUS_OK;
+}
+
+prgm_bench_t *
+prgm_bench_destroy(prgm_bench_t *bench, bool self_destroy)
+{
+    if (bench == NULL) {
+        return NULL;
+    }
+
+    if (bench->slow != NULL) {
+        bench->slow = lexbor_free(bench->slow);
+    }
+
+    bench->perf = prgm_perf_destroy(bench->perf);
+
+    if (self_destroy) {
+        return lexbor_free(bench);
+    }
+
+    return bench;
+}
+
+/*
+ * Starts the clock of the calling thread, time goes to PRGM_BENCH_OTHER.
+ * Counters are opened by the first start in the thread; if the kernel
+ * does not give them, there is only the time.
+ */
+void
+prgm_bench_start(prgm_bench_t *bench)
+{
+    bench->depth = 0;
+    bench->current = PRGM_BENCH_OTHER;
+
+    if (bench->enabled && bench->counters && bench->perf == NULL) {
+        bench->perf = prgm_perf_create();
+        bench->counters = bench->perf != NULL;
+    }
+
+    if (bench->perf != NULL
+        && prgm_perf_read(bench->perf, bench->count_last) == LXB_STATUS_OK)
+    {
+        bench->counted = 1;
+    }
+
+    bench->last = prgm_bench_now();
+}
+
+void
+prgm_bench_stop(prgm_bench_t *bench)
+{
+    if (!bench->enabled) {
+        return;
+    }
+
+    bench->time[bench->current] += prgm_bench_now() - bench->last;
+
+    if (bench->perf != NULL) {
+        prgm_bench_count(bench);
+    }
+
+    bench->depth = 0;
+    bench->current = PRGM_BENCH_OTHER;
+}
+
+/* Adds counters, the wall time of dst is kept. */
+void
+prgm_bench_merge(prgm_bench_t *dst, const prgm_bench_t *src)
+{
+    size_t i, c;
+
+    for (i = 0; i < PRGM_BENCH_STAGE_LAST; i++) {
+        dst->time[i] += src->time[i];
+
+        for (c = 0; c < PRGM_PERF_LAST; c++) {
+            dst->count[i][c] += src->count[i][c];
+        }
+    }
+
+    dst->counted += src->counted;
+
+    dst->compressed += src->compressed;
+    dst->decompressed += src->decompressed;
+    dst->documents += src->documents;
+
+    if (src->doc_mem_max > dst->doc_mem_max) {
+        dst->doc_mem_max = src->doc_mem_max;
+    }
+
+    if (src->mem_peak > dst->mem_peak) {
+        dst->mem_peak = src->mem_peak;
+    }
+
+    if (src->rss_peak > dst->rss_peak) {
+        dst->rss_peak = src->rss_peak;
+    }
+
+    dst->doc_mem_sum += src->doc_mem_sum;
+
+    for (i = 0; i < PRGM_BENCH_HIST_SIZE; i++) {
+        dst->hist[i] += src->hist[i];
+    }
+
+    dst->hist_count += src->hist_count;
+
+    if (src->hist_max > dst->hist_max) {
+        dst->hist_max = src->hist_max;
+    }
+
+    for (i = 0; i < src->slow_length; i++) {
+        prgm_bench_slow_add(dst, &src->slow[i]);
+    }
+}
+
+/*
+ * All counters back to zero, the storage of the slowest list and the
+ * hardware counters of the thread are kept.
+ */
+void
+prgm_bench_clear(prgm_bench_t *bench)
+{
+    bool enabled, counters;
+    size_t slow_size;
+    prgm_perf_t *perf;
+    prgm_bench_slow_t *slow;
+
+    enabled = bench->enabled;
+    counters = bench->counters;
+    perf = bench->perf;
+    slow = bench->slow;
+    slow_size = bench->slow_size;
+
+    memset(bench, 0, sizeof(prgm_bench_t));
+
+    bench->enabled = enabled;
+    bench->counters = counters;
+    bench->perf = perf;
+    bench->slow = slow;
+    bench->slow_size = slow_size;
+}
+
+/* Called when a document started at begin is done. */
+void
+prgm_bench_document(prgm_bench_t *bench, uint64_t begin,
+                    const lxb_char_t *path, size_t record)
+{
+    prgm_bench_slow_t slow;
+
+    if (!bench->enabled) {
+        return;
+    }
+
+    slow.time = prgm_bench_now() - begin;
+    slow.path = path;
+    slow.record = record;
+
+    bench->hist[prgm_bench_hist_index(slow.time)]++;
+    bench->hist_count++;
+
+    if (slow.time > bench->hist_max) {
+        bench->hist_max = slow.time;
+    }
+
+    prgm_bench_slow_add(bench, &slow);
+}
+
+/* A document timed elsewhere, for example read from a summary. */
+void
+prgm_bench_slow(prgm_bench_t *bench, uint64_t time, const lxb_char_t *path,
+                size_t record)
+{
+    prgm_bench_slow_t slow;
+
+    slow.time = time;
+    slow.path = path;
+    slow.record = record;
+
+    prgm_bench_slow_add(bench, &slow);
+}
+
+/*
+ * Upper bound of the bucket with the given percentile, never more than
+ * the real maximum.
+ */
+uint64_t
+prgm_bench_percentile(const prgm_bench_t *bench, double percent)
+{
+    size_t i;
+    uint64_t value, need, seen;
+
+    if (bench->hist_count == 0) {
+        return 0;
+    }
+
+    need = (uint64_t) (bench->hist_count * percent / 100.0 + 0.5);
+    if (need == 0) {
+        need = 1;
+    }
+
+    seen = 0;
+
+    for (i = 0; i < PRGM_BENCH_HIST_SIZE; i++) {
+        seen += bench->hist[i];
+
+        if (seen >= need) {
+            value = prgm_bench_hist_value(i);
+
+            return (value < bench->hist_max) ? value : bench->hist_max;
+        }
+    }
+
+    return bench->hist_max;
+}
+
+/* Resident set size of the process, 0 if unknown. */
+size_t
+prgm_bench_rss(void)
+{
+    FILE *fh;
+    long page;
+    unsigned long size, resident;
+
+    fh = fopen("/proc/self/statm", "rb");
+    if (fh == NULL) {
+        return 0;
+    }
+
+    if (fscanf(fh, "%lu %lu", &size, &resident) != 2) {
+        resident = 0;
+    }
+
+    fclose(fh);
+
+    page = sysconf(_SC_PAGESIZE);
+
+    return (page > 0) ? (size_t) resident * (size_t) page : 0;
+}
+
+void
+prgm_bench_print(prgm_bench_t *bench, const prgm_bench_info_t *info,
+                 FILE *fh)
+{
+    size_t i;
+    uint64_t busy;
+
+    busy = prgm_bench_busy(bench);
+
+    prgm_bench_slow_sort(bench);
+
+    fprintf(fh, "Bench: %s, input %s, inflate %s, %u threads, lexbor %s\n",
+            info->mode, info->input, info->inflate, info->threads,
+            PRGM_BENCH_LEXBOR);
+    fprintf(fh, "Wall time:    %.3f s\n", bench->wall / PRGM_BENCH_NS);
+    fprintf(fh, "Compressed:   %.1f MB, %.1f MB/s\n",
+            bench->compressed / PRGM_BENCH_MB,
+            prgm_bench_rate(bench->compressed / PRGM_BENCH_MB, bench->wall));
+    fprintf(fh, "Decompressed: %.1f MB, %.1f MB/s\n",
+            bench->decompressed / PRGM_BENCH_MB,
+            prgm_bench_rate(bench->decompressed / PRGM_BENCH_MB,
+                            bench->wall));
+    fprintf(fh, "Documents:    "LEXBOR_FORMAT_Z", %.1f docs/s\n",
+            bench->documents,
+            prgm_bench_rate((double) bench->documents, bench->wall));
+    fprintf(fh, "Memory:       RSS peak %.1f MB, worker peak %.1f MB\n",
+            bench->rss_peak / PRGM_BENCH_MB, bench->mem_peak / PRGM_BENCH_MB);
+    fprintf(fh, "Document:     peak %.1f MB, mean %.1f KB\n",
+            bench->doc_mem_max / PRGM_BENCH_MB,
+            (bench->hist_count != 0)
+            ? bench->doc_mem_sum / 1000.0 / bench->hist_count : 0.0);
+    fprintf(fh, "Stage        thread s   share\n");
+
+    for (i = 0; i < PRGM_BENCH_STAGE_LAST; i++) {
+        fprintf(fh, "%-10s %10.3f %6.1f%%\n", prgm_bench_stage_names[i],
+                bench->time[i] / PRGM_BENCH_NS,
+                (busy != 0) ? 100.0 * bench->time[i] / busy : 0.0);
+    }
+
+    fprintf(fh, "Document latency, ms: p50 %.3f, p99 %.3f, p99.9 %.3f,"
+            " max %.3f\n",
+            prgm_bench_percentile(bench, 50.0) / PRGM_BENCH_MS,
+            prgm_bench_percentile(bench, 99.0) / PRGM_BENCH_MS,
+            prgm_bench_percentile(bench, 99.9) / PRGM_BENCH_MS,
+            bench->hist_max / PRGM_BENCH_MS);
+
+    prgm_bench_counters_print(bench, fh);
+
+    if (bench->slow_length == 0) {
+        return;
+    }
+
+    fprintf(fh, "Slowest documents: <ms> <record> <file>\n");
+
+    for (i = 0; i < bench->slow_length; i++) {
+        fprintf(fh, "%10.3f "LEXBOR_FORMAT_Z" %s\n",
+                bench->slow[i].time / PRGM_BENCH_MS, bench->slow[i].record,
+                (const char *) bench->slow[i].path);
+    }
+}
+
+void
+prgm_bench_json(prgm_bench_t *bench, const prgm_bench_info_t *info,
+                FILE *fh)
+{
+    size_t i;
+    uint64_t busy;
+
+    busy = prgm_bench_busy(bench);
+
+    prgm_bench_slow_sort(bench);
+
+    fprintf(fh, "{\n");
+    fprintf(fh, "  \"lexbor\": \"%s\",\n", PRGM_BENCH_LEXBOR);
+    fprintf(fh, "  \"mode\": \"%s\",\n", info->mode);
+    fprintf(fh, "  \"input\": \"%s\",\n", info->input);
+    fprintf(fh, "  \"inflate\": \"%s\",\n", info->inflate);
+    fprintf(fh, "  \"threads\": %u,\n", info->threads);
+    fprintf(fh, "  \"wall_seconds\": %.6f,\n", bench->wall / PRGM_BENCH_NS);
+    fprintf(fh, "  \"compressed_bytes\": "LEXBOR_FORMAT_Z",\n",
+            bench->compressed);
+    fprintf(fh, "  \"decompressed_bytes\": "LEXBOR_FORMAT_Z",\n",
+            bench->decompressed);
+    fprintf(fh, "  \"documents\": "LEXBOR_FORMAT_Z",\n", bench->documents);
+    fprintf(fh, "  \"compressed_mb_s\": %.3f,\n",
+            prgm_bench_rate(bench->compressed / PRGM_BENCH_MB, bench->wall));
+    fprintf(fh, "  \"decompressed_mb_s\": %.3f,\n",
+            prgm_bench_rate(bench->decompressed / PRGM_BENCH_MB,
+                            bench->wall));
+    fprintf(fh, "  \"documents_s\": %.3f,\n",
+            prgm_bench_rate((double) bench->documents, bench->wall));
+    fprintf(fh, "  \"rss_peak_bytes\": "LEXBOR_FORMAT_Z",\n",
+            bench->rss_peak);
+    fprintf(fh, "  \"worker_peak_bytes\": "LEXBOR_FORMAT_Z",\n",
+            bench->mem_peak);
+    fprintf(fh, "  \"document_peak_bytes\": "LEXBOR_FORMAT_Z",\n",
+            bench->doc_mem_max);
+    fprintf(fh, "  \"document_mean_bytes\": %.0f,\n",
+            (bench->hist_count != 0)
+            ? (double) bench->doc_mem_sum / bench->hist_count : 0.0);
+    fprintf(fh, "  \"stages\": {\n");
+
+    for (i = 0; i < PRGM_BENCH_STAGE_LAST; i++) {
+        fprintf(fh, "    \"%s\": {\"seconds\": %.6f, \"share\": %.4f}%s\n",
+                prgm_bench_stage_names[i], bench->time[i] / PRGM_BENCH_NS,
+                (busy != 0) ? (double) bench->time[i] / busy : 0.0,
+                (i + 1 < PRGM_BENCH_STAGE_LAST) ? "," : "");
+    }
+
+    fprintf(fh, "  },\n");
+
+    prgm_bench_counters_json(bench, fh);
+
+    fprintf(fh, "  \"latency_ms\": {\"count\": "LEXBOR_FORMAT_Z
+            ", \"p50\": %.6f, \"p99\": %.6f, \"p99_9\": %.6f,"
+            " \"max\": %.6f},\n", bench->hist_count,
+            prgm_bench_percentile(bench, 50.0) / PRGM_BENCH_MS,
+            prgm_bench_percentile(bench, 99.0) / PRGM_BENCH_MS,
+            prgm_bench_percentile(bench, 99.9) / PRGM_BENCH_MS,
+            bench->hist_max / PRGM_BENCH_MS);
+    fprintf(fh, "  \"slowest\": [");
+
+    for (i = 0; i < bench->slow_length; i++) {
+        fprintf(fh, "%s\n    {\"ms\": %.6f, \"record\": "LEXBOR_FORMAT_Z
+                ", \"file\": \"", (i != 0) ? "," : "",
+                bench->slow[i].time / PRGM_BENCH_MS, bench->slow[i].record);
+
+        prgm_bench_json_string(fh, bench->slow[i].path);
+
+        fprintf(fh, "\"}");
+    }
+
+    fprintf(fh, "%s]\n", (bench->slow_length != 0) ? "\n  " : "");
+    fprintf(fh, "}\n");
+}
+
+const char *
+prgm_bench_stage_name(prgm_bench_stage_t stage)
+{
+    if (stage >= PRGM_BENCH_STAGE_LAST) {
+        return "unknown";
+    }
+
+    return prgm_bench_stage_names[stage];
+}
+
+static double
+prgm_bench_rate(double value, uint64_t ns)
+{
+    return (ns != 0) ? value * PRGM_BENCH_NS / ns : 0.0;
+}
+
+/* Sum of the time of all threads in all stages. */
+static uint64_t
+prgm_bench_busy(const prgm_bench_t *bench)
+{
+    size_t i;
+    uint64_t busy = 0;
+
+    for (i = 0; i < PRGM_BENCH_STAGE_LAST; i++) {
+        busy += bench->time[i];
+    }
+
+    return busy;
+}
+
+/*
+ * Values below 64 have own buckets, bigger ones are shifted right until
+ * they are below 64, the shift selects a row of 32 buckets.
+ */
+static size_t
+prgm_bench_hist_index(uint64_t value)
+{
+    unsigned shift = 0;
+
+    while ((value >> shift) >= 2 * PRGM_BENCH_HIST_SUB) {
+        shift++;
+    }
+
+    return (size_t) shift * PRGM_BENCH_HIST_SUB + (size_t) (value >> shift);
+}
+
+/* The biggest value of the bucket. */
+static uint64_t
+prgm_bench_hist_value(size_t idx)
+{
+    unsigned shift;
+
+    if (idx < 2 * PRGM_BENCH_HIST_SUB) {
+        return idx;
+    }
+
+    shift = (unsigned) (idx / PRGM_BENCH_HIST_SUB) - 1;
+
+    return ((uint64_t) (idx - shift * PRGM_BENCH_HIST_SUB + 1) << shift) - 1;
+}
+
+/* Keeps the slow_size slowest, replacing the fastest of them. */
+static void
+prgm_bench_slow_add(prgm_bench_t *bench, const prgm_bench_slow_t *slow)
+{
+    size_t i;
+
+    if (bench->slow_length < bench->slow_size) {
+        bench->slow[bench->slow_length] = *slow;
+
+        if (bench->slow_length == 0
+            || slow->time < bench->slow[bench->slow_min].time)
+        {
+            bench->slow_min = bench->slow_length;
+        }
+
+        bench->slow_length++;
+
+        return;
+    }
+
+    if (bench->slow_size == 0
+        || slow->time <= bench->slow[bench->slow_min].time)
+    {
+        return;
+    }
+
+    bench->slow[bench->slow_min] = *slow;
+
+    for (i = 0; i < bench->slow_length; i++) {
+        if (bench->slow[i].time < bench->slow[bench->slow_min].time) {
+            bench->slow_min = i;
+        }
+    }
+}
+
+/* Slowest first, the fastest kept one stays known. */
+static void
+prgm_bench_slow_sort(prgm_bench_t *bench)
+{
+    if (bench->slow_length == 0) {
+        return;
+    }
+
+    qsort(bench->slow, bench->slow_length, sizeof(prgm_bench_slow_t),
+          prgm_bench_slow_cmp);
+
+    bench->slow_min = bench->slow_length - 1;
+}
+
+static int
+prgm_bench_slow_cmp(const void *a, const void *b)
+{
+    const prgm_bench_slow_t *sa = a, *sb = b;
+
+    if (sa->time != sb->time) {
+        return (sa->time < sb->time) ? 1 : -1;
+    }
+
+    return (sa->record > sb->record) - (sa->record < sb->record);
+}
+
+/*
+ * IPC and misses per KB of decompressed data of every stage, so stages
+ * that see the same bytes can be compared.
+ */
+static void
+prgm_bench_counters_print(const prgm_bench_t *bench, FILE *fh)
+{
+    size_t i;
+    double kb;
+    const uint64_t *count;
+
+    if (bench->counted == 0) {
+        if (bench->counters) {
+            fprintf(fh, "Counters:     not available, timing only\n");
+        }
+
+        return;
+    }
+
+    kb = bench->decompressed / PRGM_BENCH_KB;
+
+    fprintf(fh, "Stage        cycles M      IPC  cache miss/KB"
+            "  branch miss/KB\n");
+
+    for (i = 0; i < PRGM_BENCH_STAGE_LAST; i++) {
+        count = bench->count[i];
+
+        fprintf(fh, "%-10s %10.1f %8.2f %14.3f %15.3f\n",
+                prgm_bench_stage_names[i],
+                count[PRGM_PERF_CYCLES] / PRGM_BENCH_MB,
+                (count[PRGM_PERF_CYCLES] != 0)
+                ? (double) count[PRGM_PERF_INSTRUCTIONS]
+                  / count[PRGM_PERF_CYCLES] : 0.0,
+                (kb > 0.0) ? count[PRGM_PERF_CACHE_MISSES] / kb : 0.0,
+                (kb > 0.0) ? count[PRGM_PERF_BRANCH_MISSES] / kb : 0.0);
+    }
+}
+
+static void
+prgm_bench_counters_json(const prgm_bench_t *bench, FILE *fh)
+{
+    size_t i, c;
+    double kb;
+    const uint64_t *count;
+
+    if (bench->counted == 0) {
+        fprintf(fh, "  \"counters\": null,\n");
+        return;
+    }
+
+    kb = bench->decompressed / PRGM_BENCH_KB;
+
+    fprintf(fh, "  \"counters\": {\n");
+
+    for (i = 0; i < PRGM_BENCH_STAGE_LAST; i++) {
+        count = bench->count[i];
+
+        fprintf(fh, "    \"%s\": {", prgm_bench_stage_names[i]);
+
+        for (c = 0; c < PRGM_PERF_LAST; c++) {
+            fprintf(fh, "\"%s\": %"PRIu64", ",
+                    prgm_perf_name((prgm_perf_counter_t) c), count[c]);
+        }
+
+        fprintf(fh, "\"ipc\": %.4f, \"cache_misses_kb\": %.4f,"
+                " \"branch_misses_kb\": %.4f}%s\n",
+                (count[PRGM_PERF_CYCLES] != 0)
+                ? (double) count[PRGM_PERF_INSTRUCTIONS]
+                  / count[PRGM_PERF_CYCLES] : 0.0,
+                (kb > 0.0) ? count[PRGM_PERF_CACHE_MISSES] / kb : 0.0,
+                (kb > 0.0) ? count[PRGM_PERF_BRANCH_MISSES] / kb : 0.0,
+                (i + 1 < PRGM_BENCH_STAGE_LAST) ? "," : "");
+    }
+
+    fprintf(fh, "  },\n");
+}
+
+/* Writes str without the quotes, escaped for a JSON string. */
+void
+prgm_bench_json_string(FILE *fh, const lxb_char_t *str)
+{
+    for (; *str != 0x00; str++) {
+        if (*str == '"' || *str == '\\') {
+            fprintf(fh, "\\%c", *str);
+        }
+        else if (*str < 0x20) {
+            fprintf(fh, "\\u%04x", *str);
+        }
+        else {
+            fputc(*str, fh);
+        }
+    }
+}
@@ -0,0 +1,127 @@
+/*
+* Copyright (C) 2019 Alexander Borisov
+*
+* Author: Alexander Borisov <borisov@lexbor.com>
+*/
+
+#ifndef PRGM_CACHE_H
+#define PRGM_CACHE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "lexbor/utils/base.h"
+
+#include <stdio.h>
+
+#include "gzip.h"
+
+
+#define PRGM_CACHE_EXT          ".warc.lxc"
+#define PRGM_CACHE_MAGIC        "LXBWARCC"
+#define PRGM_CACHE_VERSION      1
+
+#define PRGM_CACHE_HEADER_SIZE  32
+#define PRGM_CACHE_FRAME_SIZE   24
+
+
+/*
+ * A WARC file with every gzip member inflated once, for runs that should
+ * measure parsing and not inflate. All numbers are little-endian.
+ *
+ * Header, PRGM_CACHE_HEADER_SIZE bytes:
+ *     magic[8] version:u32 codec:u32 members:u64 table:u64
+ * Frame per member, PRGM_CACHE_FRAME_SIZE bytes and the stored data:
+ *     stored:u32 length:u32 codec:u32 reserved:u32 source:u64
+ * Table, a frame with codec PRGM_CACHE_TABLE and no length:
+ *     offset:u64 of every member frame
+ *
+ * source is the offset of the member in the original file. A frame is
+ * stored as is when compression does not make it smaller. zstd stores
+ * less, LZ4 (block format, default mode) decodes faster; level is for
+ * zstd only.
+ */
+typedef enum {
+    PRGM_CACHE_NONE  = 0,
+    PRGM_CACHE_ZSTD  = 1,
+    PRGM_CACHE_LZ4   = 2,
+    PRGM_CACHE_TABLE = 0xff
+}
+prgm_cache_codec_t;
+
+typedef struct {
+    prgm_cache_codec_t codec;    /* asked for, frames may still be NONE */
+    uint64_t           members;
+    uint64_t           table;    /* offset of the table frame */
+}
+prgm_cache_header_t;
+
+typedef struct {
+    uint32_t           stored;
+    uint32_t           length;
+    prgm_cache_codec_t codec;
+    uint64_t           source;
+}
+prgm_cache_frame_t;
+
+typedef struct {
+    FILE               *fh;
+    prgm_cache_codec_t codec;
+    int                level;
+
+    uint64_t           *offsets;
+    size_t             length;
+    size_t             size;
+    uint64_t           offset;   /* where the next frame goes */
+
+    lxb_char_t         *buf;     /* compressed frame */
+    size_t             buf_size;
+    void               *cctx;
+}
+prgm_cache_writer_t;
+
+
+lxb_status_t
+prgm_cache_writer_open(prgm_cache_writer_t *writer, const char *path,
+                       prgm_cache_codec_t codec, int level);
+
+lxb_status_t
+prgm_cache_writer_add(prgm_cache_writer_t *writer, const lxb_char_t *data,
+                      size_t length, size_t source);
+
+lxb_status_t
+prgm_cache_writer_close(prgm_cache_writer_t *writer);
+
+void
+prgm_cache_writer_abort(prgm_cache_writer_t *writer);
+
+lxb_status_t
+prgm_cache_header_parse(prgm_cache_header_t *header, const lxb_char_t *data,
+                        size_t size);
+
+void
+prgm_cache_frame_parse(prgm_cache_frame_t *frame, const lxb_char_t *data);
+
+lxb_status_t
+prgm_cache_members_load(prgm_gzip_members_t *members, FILE *fh,
+                        size_t *end);
+
+lxb_status_t
+prgm_cache_frame_next(const char *path, size_t offset, size_t *next);
+
+bool
+prgm_cache_codec_by_name(const char *name, prgm_cache_codec_t *codec);
+
+const char *
+prgm_cache_codec_name(prgm_cache_codec_t codec);
+
+bool
+prgm_cache_name_is(const lxb_char_t *name, size_t length);
+
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* PRGM_CACHE_H */
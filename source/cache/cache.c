@@ -0,0 +1,552 @@
+/*
+* Copyright (C) 2019 Alexander Borisov
+*
+* Author: Alexander Borisov <borisov@lexbor.com>
+*/
+
+#include <string.h>
+
+#include <lexbor/core/str.h>
+
+#include "cache.h"
+
+#ifdef PRGM_HAVE_ZSTD
+    #include <zstd.h>
+#endif
+
+#ifdef PRGM_HAVE_LZ4
+    #include <lz4.h>
+#endif
+
+
+static lxb_status_t
+prgm_cache_write(prgm_cache_writer_t *writer, const void *data, size_t size);
+
+static void
+prgm_cache_frame_write(lxb_char_t *out, uint32_t stored, uint32_t length,
+                       prgm_cache_codec_t codec, uint64_t source);
+
+static void
+prgm_cache_header_write(lxb_char_t *out, prgm_cache_codec_t codec,
+                        uint64_t members, uint64_t table);
+
+static lxb_status_t
+prgm_cache_compress(prgm_cache_writer_t *writer, const lxb_char_t *data,
+                    size_t length, size_t *stored);
+
+#if defined(PRGM_HAVE_ZSTD) || defined(PRGM_HAVE_LZ4)
+static lxb_status_t
+prgm_cache_buf_reserve(prgm_cache_writer_t *writer, size_t size);
+#endif
+
+
+lxb_inline void
+prgm_cache_put32(lxb_char_t *out, uint32_t value)
+{
+    out[0] = (lxb_char_t) value;
+    out[1] = (lxb_char_t) (value >> 8);
+    out[2] = (lxb_char_t) (value >> 16);
+    out[3] = (lxb_char_t) (value >> 24);
+}
+
+lxb_inline void
+prgm_cache_put64(lxb_char_t *out, uint64_t value)
+{
+    prgm_cache_put32(out, (uint32_t) value);
+    prgm_cache_put32(out + 4, (uint32_t) (value >> 32));
+}
+
+lxb_inline uint32_t
+prgm_cache_get32(const lxb_char_t *data)
+{
+    return (uint32_t) data[0] | ((uint32_t) data[1] << 8)
+           | ((uint32_t) data[2] << 16) | ((uint32_t) data[3] << 24);
+}
+
+lxb_inline uint64_t
+prgm_cache_get64(const lxb_char_t *data)
+{
+    return (uint64_t) prgm_cache_get32(data)
+           | ((uint64_t) prgm_cache_get32(data + 4) << 32);
+}
+
+
+/*
+ * The header is written again by close with the real counts, a file left
+ * by a crash has no table and is refused by readers.
+ */
+lxb_status_t
+prgm_cache_writer_open(prgm_cache_writer_t *writer, const char *path,
+                       prgm_cache_codec_t codec, int level)
+{
+    lxb_char_t header[PRGM_CACHE_HEADER_SIZE];
+
+    memset(writer, 0, sizeof(prgm_cache_writer_t));
+
+    writer->codec = codec;
+    writer->level = level;
+
+    switch (codec) {
+        case PRGM_CACHE_NONE:
+            break;
+
+#ifdef PRGM_HAVE_ZSTD
+        case PRGM_CACHE_ZSTD:
+            writer->cctx = ZSTD_createCCtx();
+            if (writer->cctx == NULL) {
+                return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+            }
+
+            break;
+#endif
+
+#ifdef PRGM_HAVE_LZ4
+        case PRGM_CACHE_LZ4:
+            break;
+#endif
+
+        default:
+            return LXB_STATUS_ERROR_WRONG_ARGS;
+    }
+
+    writer->size = 4096;
+    writer->offsets = lexbor_malloc(sizeof(uint64_t) * writer->size);
+    if (writer->offsets == NULL) {
+        prgm_cache_writer_abort(writer);
+        return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+    }
+
+    writer->fh = fopen(path, "wb");
+    if (writer->fh == NULL) {
+        prgm_cache_writer_abort(writer);
+        return LXB_STATUS_ERROR;
+    }
+
+    prgm_cache_header_write(header, codec, 0, 0);
+
+    return prgm_cache_write(writer, header, sizeof(header));
+}
+
+lxb_status_t
+prgm_cache_writer_add(prgm_cache_writer_t *writer, const lxb_char_t *data,
+                      size_t length, size_t source)
+{
+    size_t stored;
+    uint64_t *offsets;
+    lxb_status_t status;
+    prgm_cache_codec_t codec;
+    lxb_char_t frame[PRGM_CACHE_FRAME_SIZE];
+
+    if (length > PRGM_GZIP_MEMBER_MAX) {
+        return LXB_STATUS_ERROR_OVERFLOW;
+    }
+
+    if (writer->length == writer->size) {
+        offsets = lexbor_realloc(writer->offsets,
+                                 sizeof(uint64_t) * writer->size * 2);
+        if (offsets == NULL) {
+            return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+        }
+
+        writer->offsets = offsets;
+        writer->size *= 2;
+    }
+
+    writer->offsets[writer->length++] = writer->offset;
+
+    codec = PRGM_CACHE_NONE;
+    stored = length;
+
+    if (writer->codec != PRGM_CACHE_NONE && length != 0) {
+        status = prgm_cache_compress(writer, data, length, &stored);
+        if (status != LXB_STATUS_OK) {
+            return status;
+        }
+
+        if (stored < length) {
+            codec = writer->codec;
+        }
+        else {
+            stored = length;
+        }
+    }
+
+    prgm_cache_frame_write(frame, (uint32_t) stored, (uint32_t) length,
+                           codec, source);
+
+    status = prgm_cache_write(writer, frame, sizeof(frame));
+    if (status != LXB_STATUS_OK) {
+        return status;
+    }
+
+    return prgm_cache_write(writer, (codec == PRGM_CACHE_NONE) ? data
+                                                              : writer->buf,
+                            stored);
+}
+
+lxb_status_t
+prgm_cache_writer_close(prgm_cache_writer_t *writer)
+{
+    size_t i;
+    uint64_t table;
+    lxb_status_t status;
+    lxb_char_t buf[PRGM_CACHE_HEADER_SIZE];
+
+    table = writer->offset;
+
+    prgm_cache_frame_write(buf, (uint32_t) (writer->length * 8), 0,
+                           PRGM_CACHE_TABLE, 0);
+
+    status = prgm_cache_write(writer, buf, PRGM_CACHE_FRAME_SIZE);
+
+    for (i = 0; i < writer->length && status == LXB_STATUS_OK; i++) {
+        prgm_cache_put64(buf, writer->offsets[i]);
+
+        status = prgm_cache_write(writer, buf, 8);
+    }
+
+    if (status == LXB_STATUS_OK) {
+        prgm_cache_header_write(buf, writer->codec, writer->length, table);
+
+        if (fseek(writer->fh, 0, SEEK_SET) != 0
+            || fwrite(buf, 1, PRGM_CACHE_HEADER_SIZE, writer->fh)
+               != PRGM_CACHE_HEADER_SIZE)
+        {
+            status = LXB_STATUS_ERROR;
+        }
+    }
+
+    if (fclose(writer->fh) != 0 && status == LXB_STATUS_OK) {
+        status = LXB_STATUS_ERROR;
+    }
+
+    writer->fh = NULL;
+
+    prgm_cache_writer_abort(writer);
+
+    return status;
+}
+
+/* Frees the writer, an open file is closed as it is. */
+void
+prgm_cache_writer_abort(prgm_cache_writer_t *writer)
+{
+    if (writer->fh != NULL) {
+        fclose(writer->fh);
+        writer->fh = NULL;
+    }
+
+    if (writer->offsets != NULL) {
+        writer->offsets = lexbor_free(writer->offsets);
+    }
+
+    if (writer->buf != NULL) {
+        writer->buf = lexbor_free(writer->buf);
+    }
+
+#ifdef PRGM_HAVE_ZSTD
+    if (writer->cctx != NULL) {
+        ZSTD_freeCCtx(writer->cctx);
+        writer->cctx = NULL;
+    }
+#endif
+}
+
+static lxb_status_t
+prgm_cache_write(prgm_cache_writer_t *writer, const void *data, size_t size)
+{
+    if (size != 0 && fwrite(data, 1, size, writer->fh) != size) {
+        return LXB_STATUS_ERROR;
+    }
+
+    writer->offset += size;
+
+    return LXB_STATUS_OK;
+}
+
+static lxb_status_t
+prgm_cache_compress(prgm_cache_writer_t *writer, const lxb_char_t *data,
+                    size_t length, size_t *stored)
+{
+#if defined(PRGM_HAVE_ZSTD) || defined(PRGM_HAVE_LZ4)
+    size_t size;
+    lxb_status_t status;
+#endif
+
+    switch (writer->codec) {
+#ifdef PRGM_HAVE_ZSTD
+        case PRGM_CACHE_ZSTD:
+            status = prgm_cache_buf_reserve(writer,
+                                            ZSTD_compressBound(length));
+            if (status != LXB_STATUS_OK) {
+                return status;
+            }
+
+            size = ZSTD_compressCCtx(writer->cctx, writer->buf,
+                                     writer->buf_size, data, length,
+                                     writer->level);
+            if (ZSTD_isError(size)) {
+                return LXB_STATUS_ERROR;
+            }
+
+            *stored = size;
+
+            return LXB_STATUS_OK;
+#endif
+
+#ifdef PRGM_HAVE_LZ4
+        case PRGM_CACHE_LZ4:
+            /* Members are at most PRGM_GZIP_MEMBER_MAX, below the LZ4 limit. */
+            size = (size_t) LZ4_compressBound((int) length);
+
+            status = prgm_cache_buf_reserve(writer, size);
+            if (status != LXB_STATUS_OK) {
+                return status;
+            }
+
+            size = (size_t) LZ4_compress_default((const char *) data,
+                                                 (char *) writer->buf,
+                                                 (int) length, (int) size);
+            if (size == 0) {
+                return LXB_STATUS_ERROR;
+            }
+
+            *stored = size;
+
+            return LXB_STATUS_OK;
+#endif
+
+        default:
+            (void) data;
+            (void) length;
+            (void) stored;
+
+            return LXB_STATUS_ERROR_WRONG_ARGS;
+    }
+}
+
+#if defined(PRGM_HAVE_ZSTD) || defined(PRGM_HAVE_LZ4)
+static lxb_status_t
+prgm_cache_buf_reserve(prgm_cache_writer_t *writer, size_t size)
+{
+    lxb_char_t *buf;
+
+    if (size <= writer->buf_size) {
+        return LXB_STATUS_OK;
+    }
+
+    buf = lexbor_realloc(writer->buf, size);
+    if (buf == NULL) {
+        return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+    }
+
+    writer->buf = buf;
+    writer->buf_size = size;
+
+    return LXB_STATUS_OK;
+}
+#endif
+
+static void
+prgm_cache_frame_write(lxb_char_t *out, uint32_t stored, uint32_t length,
+                       prgm_cache_codec_t codec, uint64_t source)
+{
+    prgm_cache_put32(out, stored);
+    prgm_cache_put32(out + 4, length);
+    prgm_cache_put32(out + 8, (uint32_t) codec);
+    prgm_cache_put32(out + 12, 0);
+    prgm_cache_put64(out + 16, source);
+}
+
+static void
+prgm_cache_header_write(lxb_char_t *out, prgm_cache_codec_t codec,
+                        uint64_t members, uint64_t table)
+{
+    memcpy(out, PRGM_CACHE_MAGIC, 8);
+
+    prgm_cache_put32(out + 8, PRGM_CACHE_VERSION);
+    prgm_cache_put32(out + 12, (uint32_t) codec);
+    prgm_cache_put64(out + 16, members);
+    prgm_cache_put64(out + 24, table);
+}
+
+lxb_status_t
+prgm_cache_header_parse(prgm_cache_header_t *header, const lxb_char_t *data,
+                        size_t size)
+{
+    if (size < PRGM_CACHE_HEADER_SIZE
+        || memcmp(data, PRGM_CACHE_MAGIC, 8) != 0
+        || prgm_cache_get32(data + 8) != PRGM_CACHE_VERSION)
+    {
+        return LXB_STATUS_ERROR_UNEXPECTED_DATA;
+    }
+
+    header->codec = (prgm_cache_codec_t) prgm_cache_get32(data + 12);
+    header->members = prgm_cache_get64(data + 16);
+    header->table = prgm_cache_get64(data + 24);
+
+    /* Written by close, zero when the writer did not finish. */
+    if (header->table < PRGM_CACHE_HEADER_SIZE) {
+        return LXB_STATUS_ERROR_UNEXPECTED_DATA;
+    }
+
+    return LXB_STATUS_OK;
+}
+
+void
+prgm_cache_frame_parse(prgm_cache_frame_t *frame, const lxb_char_t *data)
+{
+    frame->stored = prgm_cache_get32(data);
+    frame->length = prgm_cache_get32(data + 4);
+    frame->codec = (prgm_cache_codec_t) prgm_cache_get32(data + 8);
+    frame->source = prgm_cache_get64(data + 16);
+}
+
+/*
+ * Offsets of all member frames from the table, as the gzip scan gives
+ * them for a WARC file. end is the offset of the table.
+ */
+lxb_status_t
+prgm_cache_members_load(prgm_gzip_members_t *members, FILE *fh, size_t *end)
+{
+    size_t i;
+    size_t *list;
+    prgm_cache_frame_t frame;
+    prgm_cache_header_t header;
+    lxb_char_t buf[PRGM_CACHE_HEADER_SIZE];
+
+    if (fseek(fh, 0, SEEK_SET) != 0
+        || fread(buf, 1, PRGM_CACHE_HEADER_SIZE, fh) != PRGM_CACHE_HEADER_SIZE
+        || prgm_cache_header_parse(&header, buf, PRGM_CACHE_HEADER_SIZE)
+           != LXB_STATUS_OK)
+    {
+        return LXB_STATUS_ERROR_UNEXPECTED_DATA;
+    }
+
+    if (fseek(fh, (long) header.table, SEEK_SET) != 0
+        || fread(buf, 1, PRGM_CACHE_FRAME_SIZE, fh) != PRGM_CACHE_FRAME_SIZE)
+    {
+        return LXB_STATUS_ERROR_UNEXPECTED_DATA;
+    }
+
+    prgm_cache_frame_parse(&frame, buf);
+
+    if (frame.codec != PRGM_CACHE_TABLE
+        || frame.stored != header.members * 8)
+    {
+        return LXB_STATUS_ERROR_UNEXPECTED_DATA;
+    }
+
+    if (header.members > members->size) {
+        list = lexbor_realloc(members->list,
+                              sizeof(size_t) * (size_t) header.members);
+        if (list == NULL) {
+            return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+        }
+
+        members->list = list;
+        members->size = (size_t) header.members;
+    }
+
+    for (i = 0; i < header.members; i++) {
+        if (fread(buf, 1, 8, fh) != 8) {
+            return LXB_STATUS_ERROR_UNEXPECTED_DATA;
+        }
+
+        members->list[i] = (size_t) prgm_cache_get64(buf);
+    }
+
+    members->length = (size_t) header.members;
+
+    *end = (size_t) header.table;
+
+    return LXB_STATUS_OK;
+}
+
+/* Offset of the frame after the one at offset, for a resume past it. */
+lxb_status_t
+prgm_cache_frame_next(const char *path, size_t offset, size_t *next)
+{
+    FILE *fh;
+    size_t read_length;
+    prgm_cache_frame_t frame;
+    lxb_char_t buf[PRGM_CACHE_FRAME_SIZE];
+
+    fh = fopen(path, "rb");
+    if (fh == NULL) {
+        return LXB_STATUS_ERROR_NOT_EXISTS;
+    }
+
+    read_length = 0;
+
+    if (fseek(fh, (long) offset, SEEK_SET) == 0) {
+        read_length = fread(buf, 1, PRGM_CACHE_FRAME_SIZE, fh);
+    }
+
+    fclose(fh);
+
+    if (read_length != PRGM_CACHE_FRAME_SIZE) {
+        return LXB_STATUS_ERROR_UNEXPECTED_DATA;
+    }
+
+    prgm_cache_frame_parse(&frame, buf);
+
+    if (frame.codec == PRGM_CACHE_TABLE) {
+        return LXB_STATUS_ERROR_UNEXPECTED_DATA;
+    }
+
+    *next = offset + PRGM_CACHE_FRAME_SIZE + frame.stored;
+
+    return LXB_STATUS_OK;
+}
+
+bool
+prgm_cache_codec_by_name(const char *name, prgm_cache_codec_t *codec)
+{
+    if (strcmp(name, "none") == 0) {
+        *codec = PRGM_CACHE_NONE;
+    }
+#ifdef PRGM_HAVE_ZSTD
+    else if (strcmp(name, "zstd") == 0) {
+        *codec = PRGM_CACHE_ZSTD;
+    }
+#endif
+#ifdef PRGM_HAVE_LZ4
+    else if (strcmp(name, "lz4") == 0) {
+        *codec = PRGM_CACHE_LZ4;
+    }
+#endif
+    else {
+        return false;
+    }
+
+    return true;
+}
+
+const char *
+prgm_cache_codec_name(prgm_cache_codec_t codec)
+{
+    switch (codec) {
+        case PRGM_CACHE_NONE:
+            return "none";
+
+        case PRGM_CACHE_ZSTD:
+            return "zstd";
+
+        case PRGM_CACHE_LZ4:
+            return "lz4";
+
+        default:
+            return "unknown";
+    }
+}
+
+bool
+prgm_cache_name_is(const lxb_char_t *name, size_t length)
+{
+    return length > sizeof(PRGM_CACHE_EXT) - 1
+        && lexbor_str_data_ncasecmp((const lxb_char_t *) PRGM_CACHE_EXT,
+                                    &name[length - (sizeof(PRGM_CACHE_EXT)
+                                                    - 1)],
+                                    sizeof(PRGM_CACHE_EXT) - 1);
+}
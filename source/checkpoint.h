@@ -0,0 +1,79 @@
+/*
+* Copyright (C) 2019 Alexander Borisov
+*
+* Author: Alexander Borisov <borisov@lexbor.com>
+*/
+
+#ifndef PRGM_CHECKPOINT_H
+#define PRGM_CHECKPOINT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "lexbor/utils/base.h"
+
+#include <pthread.h>
+
+
+#define PRGM_CHECKPOINT_MAGIC   "warc_checkpoint"
+#define PRGM_CHECKPOINT_VERSION 1
+
+
+/*
+ * Text file, one line per finished WARC file:
+ *     done <documents> <filtered> <skipped> <path>
+ *     failed <status> <path>
+ *
+ * A line is appended with one write(2), a line without '\n' at the end is
+ * a write cut by a crash and is ignored.
+ */
+typedef struct {
+    lxb_char_t       *path;      /* WARC file */
+    const lxb_char_t *name;      /* in path, without directories */
+    size_t           documents;
+    size_t           filtered;
+    size_t           skipped;    /* not inflated, by the index */
+}
+prgm_checkpoint_entry_t;
+
+typedef struct {
+    char                    *path;
+    int                     fd;      /* -1 until prgm_checkpoint_open() */
+
+    /* Done files of prgm_checkpoint_load(), sorted by name. */
+    prgm_checkpoint_entry_t *list;
+    size_t                  length;
+    size_t                  size;
+
+    pthread_mutex_t         lock;
+}
+prgm_checkpoint_t;
+
+
+lxb_status_t
+prgm_checkpoint_init(prgm_checkpoint_t *cp, const char *path);
+
+prgm_checkpoint_t *
+prgm_checkpoint_destroy(prgm_checkpoint_t *cp, bool self_destroy);
+
+lxb_status_t
+prgm_checkpoint_load(prgm_checkpoint_t *cp);
+
+const prgm_checkpoint_entry_t *
+prgm_checkpoint_find(const prgm_checkpoint_t *cp, const lxb_char_t *path,
+                     size_t length);
+
+lxb_status_t
+prgm_checkpoint_open(prgm_checkpoint_t *cp);
+
+lxb_status_t
+prgm_checkpoint_add(prgm_checkpoint_t *cp,
+                    const prgm_checkpoint_entry_t *entry, lxb_status_t status);
+
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* PRGM_CHECKPOINT_H */
@@ -0,0 +1,377 @@
+/*
+* Copyright (C) 2019 Alexander Borisov
+*
+* Author: Alexander Borisov <borisov@lexbor.com>
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+
+
+static lxb_status_t
+prgm_checkpoint_line(prgm_checkpoint_t *cp, char *line);
+
+static const lxb_char_t *
+prgm_checkpoint_name(const lxb_char_t *path, size_t length);
+
+static int
+prgm_checkpoint_cmp(const void *a, const void *b);
+
+static lxb_status_t
+prgm_checkpoint_write(int fd, const char *data, size_t length);
+
+
+lxb_status_t
+prgm_checkpoint_init(prgm_checkpoint_t *cp, const char *path)
+{
+    size_t length;
+
+    memset(cp, 0, sizeof(prgm_checkpoint_t));
+
+    cp->fd = -1;
+
+    length = strlen(path);
+
+    cp->path = lexbor_malloc(length + 1);
+    if (cp->path == NULL) {
+        return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+    }
+
+    memcpy(cp->path, path, length + 1);
+
+    if (pthread_mutex_init(&cp->lock, NULL) != 0) {
+        cp->path = lexbor_free(cp->path);
+        return LXB_STATUS_ERROR;
+    }
+
+    return LXB_STATUS_OK;
+}
+
+prgm_checkpoint_t *
+prgm_checkpoint_destroy(prgm_checkpoint_t *cp, bool self_destroy)
+{
+    size_t i;
+
+    if (cp == NULL) {
+        return NULL;
+    }
+
+    if (cp->path == NULL) {
+        goto done;
+    }
+
+    for (i = 0; i < cp->length; i++) {
+        lexbor_free(cp->list[i].path);
+    }
+
+    if (cp->list != NULL) {
+        cp->list = lexbor_free(cp->list);
+    }
+
+    if (cp->fd != -1) {
+        (void) close(cp->fd);
+        cp->fd = -1;
+    }
+
+    (void) pthread_mutex_destroy(&cp->lock);
+
+    cp->path = lexbor_free(cp->path);
+    cp->length = 0;
+    cp->size = 0;
+
+done:
+
+    if (self_destroy) {
+        return lexbor_free(cp);
+    }
+
+    return cp;
+}
+
+/*
+ * Reads the done files of an earlier run. Failed files are not taken,
+ * they are tried again.
+ */
+lxb_status_t
+prgm_checkpoint_load(prgm_checkpoint_t *cp)
+{
+    FILE *fh;
+    int version;
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t length;
+    lxb_status_t status;
+
+    fh = fopen(cp->path, "rb");
+    if (fh == NULL) {
+        return LXB_STATUS_ERROR_NOT_EXISTS;
+    }
+
+    length = getline(&line, &size, fh);
+
+    if (length <= 0
+        || sscanf(line, PRGM_CHECKPOINT_MAGIC" %d", &version) != 1
+        || version < 1 || version > PRGM_CHECKPOINT_VERSION)
+    {
+        free(line);
+        fclose(fh);
+
+        return LXB_STATUS_ERROR_UNEXPECTED_DATA;
+    }
+
+    status = LXB_STATUS_OK;
+
+    while ((length = getline(&line, &size, fh)) > 0) {
+        /* Cut by a crash, nothing can follow it. */
+        if (line[length - 1] != '\n') {
+            break;
+        }
+
+        line[length - 1] = 0x00;
+
+        status = prgm_checkpoint_line(cp, line);
+        if (status != LXB_STATUS_OK) {
+            break;
+        }
+    }
+
+    free(line);
+    fclose(fh);
+
+    if (status != LXB_STATUS_OK) {
+        return status;
+    }
+
+    qsort(cp->list, cp->length, sizeof(prgm_checkpoint_entry_t),
+          prgm_checkpoint_cmp);
+
+    return LXB_STATUS_OK;
+}
+
+static lxb_status_t
+prgm_checkpoint_line(prgm_checkpoint_t *cp, char *line)
+{
+    int offset;
+    size_t size, length;
+    prgm_checkpoint_entry_t *entry, *list;
+
+    if (strncmp(line, "done ", 5) != 0) {
+        return LXB_STATUS_OK;
+    }
+
+    if (cp->length == cp->size) {
+        size = (cp->size == 0) ? 256 : cp->size * 2;
+
+        list = lexbor_realloc(cp->list,
+                              sizeof(prgm_checkpoint_entry_t) * size);
+        if (list == NULL) {
+            return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+        }
+
+        cp->list = list;
+        cp->size = size;
+    }
+
+    entry = &cp->list[cp->length];
+
+    offset = 0;
+
+    if (sscanf(line + 5, "%zu %zu %zu %n", &entry->documents,
+               &entry->filtered, &entry->skipped, &offset) != 3
+        || offset == 0 || line[5 + offset] == 0x00)
+    {
+        return LXB_STATUS_ERROR_UNEXPECTED_DATA;
+    }
+
+    line += 5 + offset;
+    length = strlen(line);
+
+    entry->path = lexbor_malloc(length + 1);
+    if (entry->path == NULL) {
+        return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+    }
+
+    memcpy(entry->path, line, length + 1);
+
+    entry->name = prgm_checkpoint_name(entry->path, length);
+
+    cp->length++;
+
+    return LXB_STATUS_OK;
+}
+
+/*
+ * Files are found by the name without directories, a resumed run can see
+ * the crawl at another path.
+ */
+const prgm_checkpoint_entry_t *
+prgm_checkpoint_find(const prgm_checkpoint_t *cp, const lxb_char_t *path,
+                     size_t length)
+{
+    prgm_checkpoint_entry_t key;
+
+    if (cp->length == 0) {
+        return NULL;
+    }
+
+    key.name = prgm_checkpoint_name(path, length);
+
+    return bsearch(&key, cp->list, cp->length,
+                   sizeof(prgm_checkpoint_entry_t), prgm_checkpoint_cmp);
+}
+
+static const lxb_char_t *
+prgm_checkpoint_name(const lxb_char_t *path, size_t length)
+{
+    const lxb_char_t *p = path + length;
+
+    while (p > path && p[-1] != '/') {
+        p--;
+    }
+
+    return p;
+}
+
+static int
+prgm_checkpoint_cmp(const void *a, const void *b)
+{
+    return strcmp((const char *) ((const prgm_checkpoint_entry_t *) a)->name,
+                  (const char *) ((const prgm_checkpoint_entry_t *) b)->name);
+}
+
+/*
+ * Writes the loaded done files to a new checkpoint and replaces the old
+ * one by rename(2), then keeps it open for appending. Without load this
+ * starts an empty checkpoint.
+ */
+lxb_status_t
+prgm_checkpoint_open(prgm_checkpoint_t *cp)
+{
+    FILE *fh;
+    char *tmp;
+    size_t i, len;
+    prgm_checkpoint_entry_t *entry;
+
+    len = strlen(cp->path);
+
+    tmp = lexbor_malloc(len + 5);
+    if (tmp == NULL) {
+        return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+    }
+
+    memcpy(tmp, cp->path, len);
+    memcpy(tmp + len, ".tmp", 5);
+
+    fh = fopen(tmp, "wb");
+    if (fh == NULL) {
+        lexbor_free(tmp);
+        return LXB_STATUS_ERROR;
+    }
+
+    fprintf(fh, "%s %d\n", PRGM_CHECKPOINT_MAGIC, PRGM_CHECKPOINT_VERSION);
+
+    for (i = 0; i < cp->length; i++) {
+        entry = &cp->list[i];
+
+        fprintf(fh, "done "LEXBOR_FORMAT_Z" "LEXBOR_FORMAT_Z" "
+                LEXBOR_FORMAT_Z" %s\n", entry->documents, entry->filtered,
+                entry->skipped, (const char *) entry->path);
+    }
+
+    if (fflush(fh) != 0 || fsync(fileno(fh)) != 0) {
+        fclose(fh);
+        goto failed;
+    }
+
+    if (fclose(fh) != 0 || rename(tmp, cp->path) != 0) {
+        goto failed;
+    }
+
+    lexbor_free(tmp);
+
+    cp->fd = open(cp->path, O_WRONLY | O_APPEND);
+    if (cp->fd == -1) {
+        return LXB_STATUS_ERROR;
+    }
+
+    return LXB_STATUS_OK;
+
+failed:
+
+    (void) remove(tmp);
+
+    lexbor_free(tmp);
+
+    return LXB_STATUS_ERROR;
+}
+
+/* Thread-safe, the line is on disk when it returns. */
+lxb_status_t
+prgm_checkpoint_add(prgm_checkpoint_t *cp,
+                    const prgm_checkpoint_entry_t *entry, lxb_status_t status)
+{
+    int length;
+    size_t size;
+    char *line;
+
+    size = strlen((const char *) entry->path) + 128;
+
+    line = lexbor_malloc(size);
+    if (line == NULL) {
+        return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+    }
+
+    if (status == LXB_STATUS_OK) {
+        length = snprintf(line, size, "done "LEXBOR_FORMAT_Z" "
+                          LEXBOR_FORMAT_Z" "LEXBOR_FORMAT_Z" %s\n",
+                          entry->documents, entry->filtered, entry->skipped,
+                          (const char *) entry->path);
+    }
+    else {
+        length = snprintf(line, size, "failed %d %s\n", (int) status,
+                          (const char *) entry->path);
+    }
+
+    pthread_mutex_lock(&cp->lock);
+
+    status = prgm_checkpoint_write(cp->fd, line, (size_t) length);
+
+    if (status == LXB_STATUS_OK && fsync(cp->fd) != 0) {
+        status = LXB_STATUS_ERROR;
+    }
+
+    pthread_mutex_unlock(&cp->lock);
+
+    lexbor_free(line);
+
+    return status;
+}
+
+static lxb_status_t
+prgm_checkpoint_write(int fd, const char *data, size_t length)
+{
+    ssize_t size;
+
+    while (length != 0) {
+        size = write(fd, data, length);
+
+        if (size < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return LXB_STATUS_ERROR;
+        }
+
+        data += size;
+        length -= (size_t) size;
+    }
+
+    return LXB_STATUS_OK;
+}
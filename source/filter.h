@@ -0,0 +1,152 @@
+/*
+* Copyright (C) 2019 Alexander Borisov
+*
+* Author: Alexander Borisov <borisov@lexbor.com>
+*/
+
+#ifndef PRGM_FILTER_H
+#define PRGM_FILTER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "lexbor/utils/base.h"
+
+#include <stdint.h>
+
+
+typedef enum {
+    PRGM_FILTER_TYPE = 0,   /* WARC-Type, case-insensitive */
+    PRGM_FILTER_PAYLOAD,    /* WARC-Identified-Payload-Type, may end with * */
+    PRGM_FILTER_URI,        /* WARC-Target-URI, fnmatch(3) pattern */
+    PRGM_FILTER_LAST
+}
+prgm_filter_field_t;
+
+/* Prepared once, so a record is checked without allocations. */
+typedef struct {
+    lxb_char_t *data;     /* lowercase for type and payload */
+    size_t     length;
+    bool       prefix;    /* ended with '*', compare the first length bytes */
+    bool       glob;      /* URI with other wildcards, goes to fnmatch(3) */
+}
+prgm_filter_pattern_t;
+
+typedef struct {
+    prgm_filter_pattern_t *list;
+    size_t                length;
+    size_t                size;
+}
+prgm_filter_list_t;
+
+typedef struct {
+    prgm_filter_list_t include[PRGM_FILTER_LAST];
+    prgm_filter_list_t exclude[PRGM_FILTER_LAST];
+
+    size_t             min_length;   /* WARC Content-Length */
+    size_t             max_length;   /* SIZE_MAX if not set */
+
+    unsigned           fields;       /* 1 << field for every field in use */
+
+    unsigned           shard;        /* this one of shards */
+    unsigned           shards;       /* 1 without sharding */
+    bool               shard_records; /* records are sharded, not files */
+    uint64_t           sample;       /* keys below pass, UINT64_MAX is all */
+    uint64_t           seed;
+}
+prgm_filter_t;
+
+/*
+ * Fields of one record, NULL or 0 length if the record has no such field.
+ * The URI must be NUL-terminated for patterns with wildcards.
+ */
+typedef struct {
+    const lxb_char_t *value[PRGM_FILTER_LAST];
+    size_t           length[PRGM_FILTER_LAST];
+    size_t           content_length;
+    uint64_t         key;   /* prgm_filter_key() of the file and record */
+}
+prgm_filter_record_t;
+
+
+lxb_status_t
+prgm_filter_init(prgm_filter_t *filter);
+
+prgm_filter_t *
+prgm_filter_destroy(prgm_filter_t *filter, bool self_destroy);
+
+lxb_status_t
+prgm_filter_add(prgm_filter_t *filter, prgm_filter_field_t field,
+                bool exclude, const char *patterns);
+
+bool
+prgm_filter_match(const prgm_filter_t *filter,
+                  const prgm_filter_record_t *record);
+
+const lxb_char_t *
+prgm_filter_field_name(prgm_filter_field_t field, size_t *length);
+
+bool
+prgm_filter_field_by_name(const char *name, prgm_filter_field_t *field);
+
+lxb_status_t
+prgm_filter_shard_set(prgm_filter_t *filter, const char *shard);
+
+lxb_status_t
+prgm_filter_sample_set(prgm_filter_t *filter, const char *rate);
+
+double
+prgm_filter_sample_rate(const prgm_filter_t *filter);
+
+uint64_t
+prgm_filter_file_hash(const lxb_char_t *path, size_t length);
+
+bool
+prgm_filter_file(const prgm_filter_t *filter, uint64_t file_hash);
+
+
+/*
+ * Inline functions
+ */
+lxb_inline bool
+prgm_filter_active(const prgm_filter_t *filter)
+{
+    return filter->fields != 0 || filter->min_length != 0
+        || filter->max_length != SIZE_MAX || filter->sample != UINT64_MAX
+        || (filter->shard_records && filter->shards > 1);
+}
+
+/* splitmix64 finalizer, spreads every input bit over the whole value. */
+lxb_inline uint64_t
+prgm_filter_mix(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+
+    return x;
+}
+
+/* The same record of the same file has the same key on every node. */
+lxb_inline uint64_t
+prgm_filter_key(uint64_t file_hash, size_t record)
+{
+    return prgm_filter_mix(file_hash ^ ((uint64_t) record
+                                        * 0x9e3779b97f4a7c15ULL));
+}
+
+lxb_inline bool
+prgm_filter_uses(const prgm_filter_t *filter, prgm_filter_field_t field)
+{
+    return (filter->fields & (1u << field)) != 0;
+}
+
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* PRGM_FILTER_H */
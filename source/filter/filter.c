@@ -0,0 +1,470 @@
+/*
+* Copyright (C) 2019 Alexander Borisov
+*
+* Author: Alexander Borisov <borisov@lexbor.com>
+*/
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fnmatch.h>
+
+#include <lexbor/core/str.h>
+
+#include "filter.h"
+
+
+typedef struct {
+    const char *option;   /* --include-<option>, --exclude-<option> */
+    const char *name;     /* WARC header field */
+    size_t     length;
+}
+prgm_filter_field_entry_t;
+
+
+static const prgm_filter_field_entry_t prgm_filter_fields[PRGM_FILTER_LAST] =
+{
+    {"type", "WARC-Type", 9},
+    {"payload", "WARC-Identified-Payload-Type", 28},
+    {"uri", "WARC-Target-URI", 15}
+};
+
+
+static lxb_status_t
+prgm_filter_pattern_add(prgm_filter_list_t *list, prgm_filter_field_t field,
+                        const char *data, size_t length);
+
+static bool
+prgm_filter_list_match(const prgm_filter_list_t *list,
+                       prgm_filter_field_t field,
+                       const lxb_char_t *value, size_t length);
+
+
+lxb_status_t
+prgm_filter_init(prgm_filter_t *filter)
+{
+    if (filter == NULL) {
+        return LXB_STATUS_ERROR_OBJECT_IS_NULL;
+    }
+
+    memset(filter, 0, sizeof(prgm_filter_t));
+
+    filter->max_length = SIZE_MAX;
+    filter->shards = 1;
+    filter->sample = UINT64_MAX;
+
+    return LXB_STATUS_OK;
+}
+
+prgm_filter_t *
+prgm_filter_destroy(prgm_filter_t *filter, bool self_destroy)
+{
+    size_t i, f;
+    prgm_filter_list_t *list;
+
+    if (filter == NULL) {
+        return NULL;
+    }
+
+    for (f = 0; f < PRGM_FILTER_LAST; f++) {
+        list = &filter->include[f];
+
+        for (i = 0; i < list->length; i++) {
+            lexbor_free(list->list[i].data);
+        }
+
+        lexbor_free(list->list);
+
+        list = &filter->exclude[f];
+
+        for (i = 0; i < list->length; i++) {
+            lexbor_free(list->list[i].data);
+        }
+
+        lexbor_free(list->list);
+    }
+
+    if (self_destroy) {
+        return lexbor_free(filter);
+    }
+
+    (void) prgm_filter_init(filter);
+
+    return filter;
+}
+
+/*
+ * Types and payload types are a comma-separated list, a URI is always one
+ * pattern, commas are valid in URIs.
+ */
+lxb_status_t
+prgm_filter_add(prgm_filter_t *filter, prgm_filter_field_t field,
+                bool exclude, const char *patterns)
+{
+    const char *p, *end;
+    lxb_status_t status;
+    prgm_filter_list_t *list;
+
+    list = (exclude) ? &filter->exclude[field] : &filter->include[field];
+
+    if (field == PRGM_FILTER_URI) {
+        if (*patterns == 0x00) {
+            return LXB_STATUS_ERROR_WRONG_ARGS;
+        }
+
+        status = prgm_filter_pattern_add(list, field, patterns,
+                                         strlen(patterns));
+        if (status != LXB_STATUS_OK) {
+            return status;
+        }
+
+        filter->fields |= 1u << field;
+
+        return LXB_STATUS_OK;
+    }
+
+    p = patterns;
+
+    for (;;) {
+        while (*p == ' ') {
+            p++;
+        }
+
+        end = p;
+
+        while (*end != 0x00 && *end != ',') {
+            end++;
+        }
+
+        while (end > p && end[-1] == ' ') {
+            end--;
+        }
+
+        if (end == p) {
+            return LXB_STATUS_ERROR_WRONG_ARGS;
+        }
+
+        status = prgm_filter_pattern_add(list, field, p, end - p);
+        if (status != LXB_STATUS_OK) {
+            return status;
+        }
+
+        while (*end == ' ') {
+            end++;
+        }
+
+        if (*end == 0x00) {
+            break;
+        }
+
+        p = end + 1;
+    }
+
+    filter->fields |= 1u << field;
+
+    return LXB_STATUS_OK;
+}
+
+static lxb_status_t
+prgm_filter_pattern_add(prgm_filter_list_t *list, prgm_filter_field_t field,
+                        const char *data, size_t length)
+{
+    size_t i, size;
+    prgm_filter_pattern_t *pattern, *patterns;
+
+    if (list->length == list->size) {
+        size = (list->size == 0) ? 8 : list->size * 2;
+
+        patterns = lexbor_realloc(list->list,
+                                  sizeof(prgm_filter_pattern_t) * size);
+        if (patterns == NULL) {
+            return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+        }
+
+        list->list = patterns;
+        list->size = size;
+    }
+
+    pattern = &list->list[list->length];
+
+    pattern->data = lexbor_malloc(length + 1);
+    if (pattern->data == NULL) {
+        return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+    }
+
+    memcpy(pattern->data, data, length);
+    pattern->data[length] = 0x00;
+
+    pattern->length = length;
+    pattern->prefix = false;
+    pattern->glob = false;
+
+    if (field == PRGM_FILTER_URI) {
+        /* The only wildcard '*' at the end is a prefix, others fnmatch. */
+        for (i = 0; i < length; i++) {
+            if (data[i] == '*' || data[i] == '?' || data[i] == '['
+                || data[i] == '\\')
+            {
+                break;
+            }
+        }
+
+        if (i == length - 1 && data[i] == '*') {
+            pattern->prefix = true;
+            pattern->length = i;
+        }
+        else if (i != length) {
+            pattern->glob = true;
+        }
+    }
+    else {
+        for (i = 0; i < length; i++) {
+            pattern->data[i] = (lxb_char_t) tolower(pattern->data[i]);
+        }
+
+        if (pattern->data[length - 1] == '*') {
+            pattern->prefix = true;
+            pattern->length = length - 1;
+        }
+    }
+
+    list->length++;
+
+    return LXB_STATUS_OK;
+}
+
+/*
+ * A record passes if every field with include patterns matches one of them
+ * and no field matches an exclude pattern. A missing field matches nothing.
+ */
+bool
+prgm_filter_match(const prgm_filter_t *filter,
+                  const prgm_filter_record_t *record)
+{
+    size_t i, f, length;
+    const lxb_char_t *value;
+
+    if (record->content_length < filter->min_length
+        || record->content_length > filter->max_length)
+    {
+        return false;
+    }
+
+    if (filter->shard_records && filter->shards > 1
+        && record->key % filter->shards != filter->shard)
+    {
+        return false;
+    }
+
+    if (filter->sample != UINT64_MAX
+        && prgm_filter_mix(record->key + filter->seed) >= filter->sample)
+    {
+        return false;
+    }
+
+    for (f = 0; f < PRGM_FILTER_LAST; f++) {
+        if ((filter->fields & (1u << f)) == 0) {
+            continue;
+        }
+
+        value = record->value[f];
+        length = (value != NULL) ? record->length[f] : 0;
+
+        /* "text/html; charset=utf-8" is "text/html". */
+        if (f == PRGM_FILTER_PAYLOAD) {
+            for (i = 0; i < length; i++) {
+                if (value[i] == ';' || value[i] == ' ') {
+                    length = i;
+                    break;
+                }
+            }
+        }
+
+        if (filter->include[f].length != 0
+            && !prgm_filter_list_match(&filter->include[f], f, value, length))
+        {
+            return false;
+        }
+
+        if (prgm_filter_list_match(&filter->exclude[f], f, value, length)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool
+prgm_filter_list_match(const prgm_filter_list_t *list,
+                       prgm_filter_field_t field,
+                       const lxb_char_t *value, size_t length)
+{
+    size_t i;
+    const prgm_filter_pattern_t *pattern;
+
+    if (length == 0) {
+        return false;
+    }
+
+    for (i = 0; i < list->length; i++) {
+        pattern = &list->list[i];
+
+        if (pattern->glob) {
+            if (fnmatch((const char *) pattern->data, (const char *) value,
+                        0) == 0)
+            {
+                return true;
+            }
+
+            continue;
+        }
+
+        if (pattern->prefix) {
+            if (length < pattern->length) {
+                continue;
+            }
+        }
+        else if (length != pattern->length) {
+            continue;
+        }
+
+        if (field == PRGM_FILTER_URI) {
+            if (memcmp(value, pattern->data, pattern->length) == 0) {
+                return true;
+            }
+        }
+        else if (lexbor_str_data_ncasecmp(value, pattern->data,
+                                          pattern->length))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+const lxb_char_t *
+prgm_filter_field_name(prgm_filter_field_t field, size_t *length)
+{
+    *length = prgm_filter_fields[field].length;
+
+    return (const lxb_char_t *) prgm_filter_fields[field].name;
+}
+
+bool
+prgm_filter_field_by_name(const char *name, prgm_filter_field_t *field)
+{
+    unsigned f;
+
+    for (f = 0; f < PRGM_FILTER_LAST; f++) {
+        if (strcmp(name, prgm_filter_fields[f].option) == 0) {
+            *field = (prgm_filter_field_t) f;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* "3/16" is the fourth of 16 shards. */
+lxb_status_t
+prgm_filter_shard_set(prgm_filter_t *filter, const char *shard)
+{
+    char *end;
+    unsigned long index, count;
+
+    index = strtoul(shard, &end, 10);
+    if (end == shard || *end != '/') {
+        return LXB_STATUS_ERROR_WRONG_ARGS;
+    }
+
+    shard = end + 1;
+
+    count = strtoul(shard, &end, 10);
+    if (end == shard || *end != 0x00 || count == 0 || index >= count
+        || count > UINT32_MAX)
+    {
+        return LXB_STATUS_ERROR_WRONG_ARGS;
+    }
+
+    filter->shard = (unsigned) index;
+    filter->shards = (unsigned) count;
+
+    return LXB_STATUS_OK;
+}
+
+/* "1%" or "0.01", from 0 exclusive to 1. */
+lxb_status_t
+prgm_filter_sample_set(prgm_filter_t *filter, const char *rate)
+{
+    char *end;
+    double value;
+
+    value = strtod(rate, &end);
+    if (end == rate) {
+        return LXB_STATUS_ERROR_WRONG_ARGS;
+    }
+
+    if (*end == '%') {
+        value /= 100.0;
+        end++;
+    }
+
+    if (*end != 0x00 || !(value > 0.0) || value > 1.0) {
+        return LXB_STATUS_ERROR_WRONG_ARGS;
+    }
+
+    /* 2^64, the share of all keys. */
+    filter->sample = (value < 1.0) ? (uint64_t) (value * 18446744073709551616.0)
+                                   : UINT64_MAX;
+
+    return LXB_STATUS_OK;
+}
+
+double
+prgm_filter_sample_rate(const prgm_filter_t *filter)
+{
+    if (filter->sample == UINT64_MAX) {
+        return 1.0;
+    }
+
+    return (double) filter->sample / 18446744073709551616.0;
+}
+
+/*
+ * FNV-1a of the file name without directories, so nodes with the crawl
+ * mounted at different paths agree on shards.
+ */
+uint64_t
+prgm_filter_file_hash(const lxb_char_t *path, size_t length)
+{
+    uint64_t hash;
+    const lxb_char_t *p, *end;
+
+    end = path + length;
+    p = end;
+
+    while (p > path && p[-1] != '/') {
+        p--;
+    }
+
+    hash = 0xcbf29ce484222325ULL;
+
+    for (; p < end; p++) {
+        hash ^= *p;
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+/* Whole files go to shards unless records are sharded. */
+bool
+prgm_filter_file(const prgm_filter_t *filter, uint64_t file_hash)
+{
+    if (filter->shards <= 1 || filter->shard_records) {
+        return true;
+    }
+
+    return prgm_filter_mix(file_hash) % filter->shards == filter->shard;
+}
@@ -18,39 +18,167 @@ extern "C" {
 
 #define LXB_UTILS_GZIP_CHUNK 4096 * 4
 
+/* Minimal size of a gzip member: 10 bytes header + 8 bytes trailer. */
+#define PRGM_GZIP_HEADER_SIZE 10
+
+/* Inflated member buffer: first and biggest size. */
+#define PRGM_GZIP_MEMBER_SIZE (1024 * 1024)
+#define PRGM_GZIP_MEMBER_MAX  (256 * 1024 * 1024)
+
+#ifdef PRGM_HAVE_LIBDEFLATE
+    #define PRGM_GZIP_DEFAULT PRGM_GZIP_LIBDEFLATE
+#else
+    #define PRGM_GZIP_DEFAULT PRGM_GZIP_ZLIB_MEMBER
+#endif
+
+
+typedef enum {
+    PRGM_GZIP_ZLIB = 0,     /* streaming, callback per out_buf */
+    PRGM_GZIP_ZLIB_MEMBER,  /* streaming, callback per member or per
+                               PRGM_GZIP_MEMBER_MAX of a bigger one */
+    PRGM_GZIP_LIBDEFLATE,   /* member at a time, callback as for
+                               PRGM_GZIP_ZLIB_MEMBER */
+    PRGM_GZIP_CACHE         /* frames of warc_cache, callback per member */
+}
+prgm_gzip_type_t;
 
 typedef struct prgm_gzip prgm_gzip_t;
 
 typedef lxb_status_t
 (*prgm_gzip_cb_f)(prgm_gzip_t *gzip, const lxb_char_t *data, size_t size);
 
+typedef struct {
+    const char   *name;
+
+    lxb_status_t (*init)(prgm_gzip_t *gzip);
+    void         (*destroy)(prgm_gzip_t *gzip);
+    lxb_status_t (*inflate)(prgm_gzip_t *gzip, const lxb_char_t *data,
+                            unsigned size);
+    lxb_status_t (*finish)(prgm_gzip_t *gzip);
+    void         (*reset)(prgm_gzip_t *gzip);
+}
+prgm_gzip_backend_t;
+
 struct prgm_gzip {
-    z_stream       stream;
+    const prgm_gzip_backend_t *backend;
+
+    z_stream                  stream;
+
+    int                       ret;
+    unsigned                  in_size;
+    unsigned                  out_size;
+
+    size_t                    count;
+    size_t                    offset;      /* of the current member */
 
-    int            ret;
-    unsigned       in_size;
-    unsigned       out_size;
+    prgm_gzip_cb_f            cb;
+    void                      *ctx;
 
-    size_t         count;
+    lxb_char_t                *out_buf;
+    unsigned                  out_buf_size;
 
-    prgm_gzip_cb_f cb;
-    void           *ctx;
+    /* Callback per member */
+    void                      *decompressor;
 
-    lxb_char_t     *out_buf;
-    unsigned       out_buf_size;
+    lxb_char_t                *member;     /* grows, kept until destroy */
+    size_t                    member_length;
+    size_t                    member_size;
+
+    lxb_char_t                *pending;    /* start of an incomplete member */
+    size_t                    pending_length;
+    size_t                    pending_size;
+    size_t                    retry;       /* pending_length for next try */
+    bool                      streaming;   /* member over the cap, by zlib */
 };
 
 
 /* Inflate */
 lxb_status_t
-prgm_gzip_inflate_init(prgm_gzip_t *gzip, lxb_char_t *out_buf,
-                          unsigned out_size, prgm_gzip_cb_f cb, void *ctx);
+prgm_gzip_inflate_init(prgm_gzip_t *gzip, prgm_gzip_type_t type,
+                       lxb_char_t *out_buf, unsigned out_size,
+                       prgm_gzip_cb_f cb, void *ctx);
 
 prgm_gzip_t *
 prgm_gzip_inflate_destroy(prgm_gzip_t *gzip, bool self_destroy);
 
 lxb_status_t
-prgm_gzip_inflate(prgm_gzip_t *gzip, lxb_char_t *data, unsigned size);
+prgm_gzip_inflate(prgm_gzip_t *gzip, const lxb_char_t *data, unsigned size);
+
+lxb_status_t
+prgm_gzip_inflate_finish(prgm_gzip_t *gzip);
+
+void
+prgm_gzip_inflate_reset(prgm_gzip_t *gzip);
+
+lxb_status_t
+prgm_gzip_member_grow(prgm_gzip_t *gzip);
+
+lxb_status_t
+prgm_gzip_member_reserve(prgm_gzip_t *gzip, size_t size);
+
+size_t
+prgm_gzip_memory(prgm_gzip_t *gzip);
+
+bool
+prgm_gzip_type_by_name(const char *name, prgm_gzip_type_t *type);
+
+
+/* Backends */
+extern const prgm_gzip_backend_t prgm_gzip_zlib;
+extern const prgm_gzip_backend_t prgm_gzip_zlib_member;
+extern const prgm_gzip_backend_t prgm_gzip_cache;
+
+#ifdef PRGM_HAVE_LIBDEFLATE
+extern const prgm_gzip_backend_t prgm_gzip_libdeflate;
+#endif
+
+lxb_status_t
+prgm_gzip_zlib_member_part(prgm_gzip_t *gzip, const lxb_char_t *data,
+                           size_t size, size_t *used);
+
+
+/* Members */
+typedef struct {
+    size_t *list;
+    size_t length;
+    size_t size;
+}
+prgm_gzip_members_t;
+
+lxb_status_t
+prgm_gzip_members_init(prgm_gzip_members_t *members, size_t size);
+
+prgm_gzip_members_t *
+prgm_gzip_members_destroy(prgm_gzip_members_t *members, bool self_destroy);
+
+lxb_status_t
+prgm_gzip_members_scan(prgm_gzip_members_t *members, FILE *fh,
+                       lxb_char_t *buf, size_t buf_size);
+
+size_t
+prgm_gzip_members_lower(prgm_gzip_members_t *members, size_t offset);
+
+lxb_status_t
+prgm_gzip_members_count(prgm_gzip_members_t *members, FILE *fh,
+                        size_t first, size_t last, const lxb_char_t *expect,
+                        size_t expect_len, size_t *count);
+
+
+/*
+ * Inline functions
+ */
+lxb_inline bool
+prgm_gzip_header_is(const lxb_char_t *data)
+{
+    /*
+     * ID1, ID2, CM = deflate, no reserved FLG bits,
+     * XFL in {0, 2, 4}, OS in {0..13, 255}.
+     */
+    return data[0] == 0x1f && data[1] == 0x8b && data[2] == 0x08
+        && (data[3] & 0xe0) == 0
+        && (data[8] == 0x00 || data[8] == 0x02 || data[8] == 0x04)
+        && (data[9] <= 0x0d || data[9] == 0xff);
+}
 
 
 #ifdef __cplusplus
@@ -0,0 +1,395 @@
+/*
+* Copyright (C) 2019 Alexander Borisov
+*
+* Author: Alexander Borisov <borisov@lexbor.com>
+*/
+
+#include "cache.h"
+
+#ifdef PRGM_HAVE_ZSTD
+    #include <zstd.h>
+#endif
+
+#ifdef PRGM_HAVE_LZ4
+    #include <lz4.h>
+#endif
+
+
+typedef struct {
+    size_t skip;       /* bytes of the table frame still to come */
+    void   *dctx;
+}
+prgm_gzip_cache_t;
+
+
+static lxb_status_t
+prgm_gzip_cache_init(prgm_gzip_t *gzip);
+
+static void
+prgm_gzip_cache_destroy(prgm_gzip_t *gzip);
+
+static lxb_status_t
+prgm_gzip_cache_inflate(prgm_gzip_t *gzip, const lxb_char_t *data,
+                        unsigned size);
+
+static lxb_status_t
+prgm_gzip_cache_finish(prgm_gzip_t *gzip);
+
+static void
+prgm_gzip_cache_reset(prgm_gzip_t *gzip);
+
+static size_t
+prgm_gzip_cache_need(prgm_gzip_t *gzip, const lxb_char_t *data, size_t size);
+
+static lxb_status_t
+prgm_gzip_cache_frame(prgm_gzip_t *gzip, const lxb_char_t *data,
+                      size_t size, size_t *used);
+
+static lxb_status_t
+prgm_gzip_cache_decode(prgm_gzip_t *gzip, const prgm_cache_frame_t *frame,
+                       const lxb_char_t *data);
+
+static lxb_status_t
+prgm_gzip_cache_pending(prgm_gzip_t *gzip, const lxb_char_t *data,
+                        size_t size);
+
+
+const prgm_gzip_backend_t prgm_gzip_cache = {
+    .name = "cache",
+    .init = prgm_gzip_cache_init,
+    .destroy = prgm_gzip_cache_destroy,
+    .inflate = prgm_gzip_cache_inflate,
+    .finish = prgm_gzip_cache_finish,
+    .reset = prgm_gzip_cache_reset
+};
+
+
+static lxb_status_t
+prgm_gzip_cache_init(prgm_gzip_t *gzip)
+{
+    gzip->decompressor = lexbor_calloc(1, sizeof(prgm_gzip_cache_t));
+    if (gzip->decompressor == NULL) {
+        return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+    }
+
+    return LXB_STATUS_OK;
+}
+
+static void
+prgm_gzip_cache_destroy(prgm_gzip_t *gzip)
+{
+    prgm_gzip_cache_t *cache = gzip->decompressor;
+
+    if (cache != NULL) {
+#ifdef PRGM_HAVE_ZSTD
+        if (cache->dctx != NULL) {
+            ZSTD_freeDCtx(cache->dctx);
+        }
+#endif
+        gzip->decompressor = lexbor_free(cache);
+    }
+
+    if (gzip->pending != NULL) {
+        gzip->pending = lexbor_free(gzip->pending);
+    }
+}
+
+/*
+ * Frames are passed to the callback right from the input when they are
+ * whole in it, stored frames without a copy. Only a frame cut by the end
+ * of the input block is collected in pending. The length of a frame is in
+ * its header, so pending is processed once it has exactly that much.
+ */
+static lxb_status_t
+prgm_gzip_cache_inflate(prgm_gzip_t *gzip, const lxb_char_t *data,
+                        unsigned size)
+{
+    size_t left, used, need, take;
+    lxb_status_t status;
+    prgm_gzip_cache_t *cache = gzip->decompressor;
+
+    left = size;
+
+    while (left != 0) {
+        if (cache->skip != 0) {
+            take = (left < cache->skip) ? left : cache->skip;
+
+            cache->skip -= take;
+            gzip->offset += take;
+
+            data += take;
+            left -= take;
+
+            continue;
+        }
+
+        if (gzip->pending_length == 0) {
+            status = prgm_gzip_cache_frame(gzip, data, left, &used);
+            if (status == LXB_STATUS_NEXT) {
+                return prgm_gzip_cache_pending(gzip, data, left);
+            }
+
+            if (status != LXB_STATUS_OK) {
+                return status;
+            }
+
+            data += used;
+            left -= used;
+
+            continue;
+        }
+
+        /* The frame header first, then the rest it asks for. */
+        need = prgm_gzip_cache_need(gzip, gzip->pending,
+                                    gzip->pending_length);
+        if (need == 0) {
+            return LXB_STATUS_ERROR_UNEXPECTED_DATA;
+        }
+
+        take = need - gzip->pending_length;
+
+        if (take > left) {
+            take = left;
+        }
+
+        status = prgm_gzip_cache_pending(gzip, data, take);
+        if (status != LXB_STATUS_OK) {
+            return status;
+        }
+
+        data += take;
+        left -= take;
+
+        if (gzip->pending_length < need) {
+            continue;
+        }
+
+        status = prgm_gzip_cache_frame(gzip, gzip->pending,
+                                       gzip->pending_length, &used);
+
+        /* The header is whole now, the frame is asked for again. */
+        if (status == LXB_STATUS_NEXT) {
+            continue;
+        }
+
+        if (status != LXB_STATUS_OK) {
+            return status;
+        }
+
+        gzip->pending_length -= used;
+        memmove(gzip->pending, gzip->pending + used, gzip->pending_length);
+    }
+
+    return LXB_STATUS_OK;
+}
+
+static lxb_status_t
+prgm_gzip_cache_finish(prgm_gzip_t *gzip)
+{
+    prgm_gzip_cache_t *cache = gzip->decompressor;
+
+    if (gzip->pending_length != 0 || cache->skip != 0) {
+        gzip->pending_length = 0;
+        cache->skip = 0;
+
+        return LXB_STATUS_ERROR_UNEXPECTED_DATA;
+    }
+
+    return LXB_STATUS_OK;
+}
+
+static void
+prgm_gzip_cache_reset(prgm_gzip_t *gzip)
+{
+    prgm_gzip_cache_t *cache = gzip->decompressor;
+
+    cache->skip = 0;
+}
+
+/*
+ * Bytes the thing at the start of data takes: the file header at offset
+ * 0, a frame header or the whole frame. 0 for bad data.
+ */
+static size_t
+prgm_gzip_cache_need(prgm_gzip_t *gzip, const lxb_char_t *data, size_t size)
+{
+    prgm_cache_frame_t frame;
+
+    if (gzip->offset == 0) {
+        return PRGM_CACHE_HEADER_SIZE;
+    }
+
+    if (size < PRGM_CACHE_FRAME_SIZE) {
+        return PRGM_CACHE_FRAME_SIZE;
+    }
+
+    prgm_cache_frame_parse(&frame, data);
+
+    /* The table is skipped as it comes, not collected. */
+    if (frame.codec == PRGM_CACHE_TABLE) {
+        return PRGM_CACHE_FRAME_SIZE;
+    }
+
+    if (frame.stored > PRGM_GZIP_MEMBER_MAX) {
+        return 0;
+    }
+
+    return PRGM_CACHE_FRAME_SIZE + frame.stored;
+}
+
+/*
+ * Passes one frame from the start of data to the callback.
+ * LXB_STATUS_NEXT means the frame is not complete.
+ */
+static lxb_status_t
+prgm_gzip_cache_frame(prgm_gzip_t *gzip, const lxb_char_t *data,
+                      size_t size, size_t *used)
+{
+    size_t need;
+    lxb_status_t status;
+    prgm_cache_frame_t frame;
+    prgm_cache_header_t header;
+    prgm_gzip_cache_t *cache = gzip->decompressor;
+
+    need = prgm_gzip_cache_need(gzip, data, size);
+    if (need == 0) {
+        return LXB_STATUS_ERROR_UNEXPECTED_DATA;
+    }
+
+    if (size < need) {
+        return LXB_STATUS_NEXT;
+    }
+
+    if (gzip->offset == 0) {
+        status = prgm_cache_header_parse(&header, data, size);
+        if (status != LXB_STATUS_OK) {
+            return status;
+        }
+
+        gzip->offset = PRGM_CACHE_HEADER_SIZE;
+        *used = PRGM_CACHE_HEADER_SIZE;
+
+        return LXB_STATUS_OK;
+    }
+
+    prgm_cache_frame_parse(&frame, data);
+
+    if (frame.codec == PRGM_CACHE_TABLE) {
+        cache->skip = frame.stored;
+
+        gzip->offset += PRGM_CACHE_FRAME_SIZE;
+        *used = PRGM_CACHE_FRAME_SIZE;
+
+        return LXB_STATUS_OK;
+    }
+
+    status = prgm_gzip_cache_decode(gzip, &frame,
+                                    data + PRGM_CACHE_FRAME_SIZE);
+    if (status != LXB_STATUS_OK) {
+        return (status == LXB_STATUS_STOP) ? LXB_STATUS_STOP
+                                           : LXB_STATUS_ERROR;
+    }
+
+    gzip->count++;
+    gzip->offset += need;
+
+    *used = need;
+
+    return LXB_STATUS_OK;
+}
+
+static lxb_status_t
+prgm_gzip_cache_decode(prgm_gzip_t *gzip, const prgm_cache_frame_t *frame,
+                       const lxb_char_t *data)
+{
+#ifdef PRGM_HAVE_ZSTD
+    size_t size;
+    prgm_gzip_cache_t *cache = gzip->decompressor;
+#endif
+#if defined(PRGM_HAVE_ZSTD) || defined(PRGM_HAVE_LZ4)
+    lxb_status_t status;
+#endif
+#ifdef PRGM_HAVE_LZ4
+    int decoded;
+#endif
+
+    if (frame->codec == PRGM_CACHE_NONE) {
+        if (frame->stored != frame->length) {
+            return LXB_STATUS_ERROR_UNEXPECTED_DATA;
+        }
+
+        return gzip->cb(gzip, data, frame->length);
+    }
+
+#ifdef PRGM_HAVE_ZSTD
+    if (frame->codec == PRGM_CACHE_ZSTD) {
+        if (cache->dctx == NULL) {
+            cache->dctx = ZSTD_createDCtx();
+            if (cache->dctx == NULL) {
+                return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+            }
+        }
+
+        while (gzip->member_size < frame->length) {
+            status = prgm_gzip_member_grow(gzip);
+            if (status != LXB_STATUS_OK) {
+                return status;
+            }
+        }
+
+        size = ZSTD_decompressDCtx(cache->dctx, gzip->member,
+                                   gzip->member_size, data, frame->stored);
+        if (ZSTD_isError(size) || size != frame->length) {
+            return LXB_STATUS_ERROR_UNEXPECTED_DATA;
+        }
+
+        return gzip->cb(gzip, gzip->member, size);
+    }
+#endif
+
+#ifdef PRGM_HAVE_LZ4
+    if (frame->codec == PRGM_CACHE_LZ4) {
+        status = prgm_gzip_member_reserve(gzip, frame->length);
+        if (status != LXB_STATUS_OK) {
+            return status;
+        }
+
+        decoded = LZ4_decompress_safe((const char *) data,
+                                      (char *) gzip->member,
+                                      (int) frame->stored,
+                                      (int) frame->length);
+        if (decoded < 0 || (size_t) decoded != frame->length) {
+            return LXB_STATUS_ERROR_UNEXPECTED_DATA;
+        }
+
+        return gzip->cb(gzip, gzip->member, frame->length);
+    }
+#endif
+
+    return LXB_STATUS_ERROR_UNEXPECTED_DATA;
+}
+
+static lxb_status_t
+prgm_gzip_cache_pending(prgm_gzip_t *gzip, const lxb_char_t *data,
+                        size_t size)
+{
+    size_t new_size;
+    lxb_char_t *pending;
+
+    if (gzip->pending_length + size > gzip->pending_size) {
+        new_size = (gzip->pending_length + size) * 2;
+
+        pending = lexbor_realloc(gzip->pending, new_size);
+        if (pending == NULL) {
+            return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+        }
+
+        gzip->pending = pending;
+        gzip->pending_size = new_size;
+    }
+
+    memcpy(gzip->pending + gzip->pending_length, data, size);
+    gzip->pending_length += size;
+
+    return LXB_STATUS_OK;
+}
@@ -7,27 +7,33 @@
 #include "gzip.h"
 
 
+static const prgm_gzip_backend_t *
+prgm_gzip_backend(prgm_gzip_type_t type);
+
+
 lxb_status_t
-prgm_gzip_inflate_init(prgm_gzip_t *gzip, lxb_char_t *out_buf,
-                       unsigned out_size, prgm_gzip_cb_f cb, void *ctx)
+prgm_gzip_inflate_init(prgm_gzip_t *gzip, prgm_gzip_type_t type,
+                       lxb_char_t *out_buf, unsigned out_size,
+                       prgm_gzip_cb_f cb, void *ctx)
 {
+    const prgm_gzip_backend_t *backend;
+
     if (gzip == NULL) {
         return LXB_STATUS_ERROR_OBJECT_IS_NULL;
     }
 
+    memset(gzip, 0, sizeof(prgm_gzip_t));
+
     if (out_buf == NULL || out_size == 0 || cb == NULL) {
         return LXB_STATUS_ERROR_WRONG_ARGS;
     }
 
-    memset(gzip, 0, sizeof(prgm_gzip_t));
-
-    gzip->stream.zalloc = Z_NULL;
-    gzip->stream.zfree = Z_NULL;
-    gzip->stream.opaque = Z_NULL;
+    backend = prgm_gzip_backend(type);
+    if (backend == NULL) {
+        return LXB_STATUS_ERROR_WRONG_ARGS;
+    }
 
-    /* Fake buffer before call inflateInit2. */
-    gzip->stream.avail_in = out_size;
-    gzip->stream.next_in = out_buf;
+    gzip->backend = backend;
 
     gzip->cb = cb;
     gzip->ctx = ctx;
@@ -35,12 +41,7 @@ prgm_gzip_inflate_init(prgm_gzip_t *gzip, lxb_char_t *out_buf,
     gzip->out_buf = out_buf;
     gzip->out_buf_size = out_size;
 
-    gzip->ret = inflateInit2(&gzip->stream, (32 + MAX_WBITS));
-    if (gzip->ret != Z_OK) {
-        return LXB_STATUS_ERROR;
-    }
-
-    return LXB_STATUS_OK;
+    return backend->init(gzip);
 }
 
 prgm_gzip_t *
@@ -50,7 +51,13 @@ prgm_gzip_inflate_destroy(prgm_gzip_t *gzip, bool self_destroy)
         return NULL;
     }
 
-    (void) inflateEnd(&gzip->stream);
+    if (gzip->backend != NULL) {
+        gzip->backend->destroy(gzip);
+    }
+
+    if (gzip->member != NULL) {
+        gzip->member = lexbor_free(gzip->member);
+    }
 
     if (self_destroy) {
         return lexbor_free(gzip);
@@ -60,81 +67,132 @@ prgm_gzip_inflate_destroy(prgm_gzip_t *gzip, bool self_destroy)
 }
 
 lxb_status_t
-prgm_gzip_inflate(prgm_gzip_t *gzip, lxb_char_t *data, unsigned size)
+prgm_gzip_inflate(prgm_gzip_t *gzip, const lxb_char_t *data, unsigned size)
 {
-    lxb_status_t status;
-    unsigned have;
-
-next_chunk:
+    return gzip->backend->inflate(gzip, data, size);
+}
 
-    do {
-        gzip->stream.next_in = data;
-        gzip->stream.avail_in = size;
+/*
+ * Prepares the object for a new stream, allocated buffers are kept.
+ * Works after an error too.
+ */
+void
+prgm_gzip_inflate_reset(prgm_gzip_t *gzip)
+{
+    gzip->count = 0;
+    gzip->offset = 0;
+    gzip->member_length = 0;
+    gzip->pending_length = 0;
+    gzip->retry = 0;
+    gzip->streaming = false;
+
+    gzip->backend->reset(gzip);
+}
 
-        do {
-            gzip->stream.avail_out = gzip->out_buf_size;
-            gzip->stream.next_out = gzip->out_buf;
+/*
+ * Doubles the member buffer, the first size is PRGM_GZIP_MEMBER_SIZE.
+ * Data in it is kept.
+ */
+lxb_status_t
+prgm_gzip_member_grow(prgm_gzip_t *gzip)
+{
+    size_t size;
 
-            gzip->ret = inflate(&gzip->stream, Z_NO_FLUSH);
+    size = (gzip->member_size < PRGM_GZIP_MEMBER_SIZE) ? PRGM_GZIP_MEMBER_SIZE
+                                                       : gzip->member_size * 2;
 
-            switch (gzip->ret) {
-                case Z_NEED_DICT:
-                case Z_DATA_ERROR:
-                case Z_MEM_ERROR:
-                    goto failed;
+    return prgm_gzip_member_reserve(gzip, size);
+}
 
-                case Z_BUF_ERROR:
-                    return LXB_STATUS_OK;
+/*
+ * Makes the member buffer at least size bytes, not less than
+ * PRGM_GZIP_MEMBER_SIZE. Data in it is kept.
+ */
+lxb_status_t
+prgm_gzip_member_reserve(prgm_gzip_t *gzip, size_t size)
+{
+    lxb_char_t *member;
 
-                default:
-                    break;
-            }
+    if (size <= gzip->member_size) {
+        return LXB_STATUS_OK;
+    }
 
-            have = gzip->out_buf_size - gzip->stream.avail_out;
+    if (size > PRGM_GZIP_MEMBER_MAX) {
+        return LXB_STATUS_ERROR_OVERFLOW;
+    }
 
-            status = gzip->cb(gzip, gzip->out_buf, have);
-            if (status != LXB_STATUS_OK) {
-                if (status == LXB_STATUS_STOP) {
-                    return LXB_STATUS_STOP;
-                }
+    if (size < PRGM_GZIP_MEMBER_SIZE) {
+        size = PRGM_GZIP_MEMBER_SIZE;
+    }
 
-                goto failed;
-            }
+    member = lexbor_realloc(gzip->member, size);
+    if (member == NULL) {
+        return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+    }
 
-            if (gzip->ret == Z_STREAM_END) {
-                gzip->count++;
+    gzip->member = member;
+    gzip->member_size = size;
 
-                data += size - gzip->stream.avail_in;
-                size = gzip->stream.avail_in;
+    return LXB_STATUS_OK;
+}
 
-                (void) inflateEnd(&gzip->stream);
+/* Bytes of buffers owned by the object, out_buf is the caller's. */
+size_t
+prgm_gzip_memory(prgm_gzip_t *gzip)
+{
+    return gzip->member_size + gzip->pending_size;
+}
 
-                status = prgm_gzip_inflate_init(gzip, gzip->out_buf,
-                                                gzip->out_buf_size,
-                                                gzip->cb, gzip->ctx);
-                if (status != LXB_STATUS_OK) {
-                    return status;
-                }
+/*
+ * Called after the last input. Member-at-a-time backends inflate what is
+ * left; an incomplete last member is an error for all backends.
+ */
+lxb_status_t
+prgm_gzip_inflate_finish(prgm_gzip_t *gzip)
+{
+    return gzip->backend->finish(gzip);
+}
 
-                if (gzip->stream.avail_in == 0) {
-                    return LXB_STATUS_OK;
-                }
+bool
+prgm_gzip_type_by_name(const char *name, prgm_gzip_type_t *type)
+{
+    if (strcmp(name, "zlib") == 0) {
+        *type = PRGM_GZIP_ZLIB;
+    }
+    else if (strcmp(name, "zlib-member") == 0) {
+        *type = PRGM_GZIP_ZLIB_MEMBER;
+    }
+#ifdef PRGM_HAVE_LIBDEFLATE
+    else if (strcmp(name, "libdeflate") == 0) {
+        *type = PRGM_GZIP_LIBDEFLATE;
+    }
+#endif
+    else {
+        return false;
+    }
 
-                goto next_chunk;
-            }
-        }
-        while (gzip->stream.avail_out == 0);
+    return true;
+}
 
-        data += size - gzip->stream.avail_in;
-        size = gzip->stream.avail_in;
-    }
-    while (size != 0);
+static const prgm_gzip_backend_t *
+prgm_gzip_backend(prgm_gzip_type_t type)
+{
+    switch (type) {
+        case PRGM_GZIP_ZLIB:
+            return &prgm_gzip_zlib;
 
-    return LXB_STATUS_OK;
+        case PRGM_GZIP_ZLIB_MEMBER:
+            return &prgm_gzip_zlib_member;
 
-failed:
+        case PRGM_GZIP_CACHE:
+            return &prgm_gzip_cache;
 
-    (void) inflateEnd(&gzip->stream);
+#ifdef PRGM_HAVE_LIBDEFLATE
+        case PRGM_GZIP_LIBDEFLATE:
+            return &prgm_gzip_libdeflate;
+#endif
 
-    return LXB_STATUS_ERROR;
+        default:
+            return NULL;
+    }
 }
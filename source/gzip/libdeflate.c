@@ -0,0 +1,488 @@
+/*
+* Copyright (C) 2019 Alexander Borisov
+*
+* Author: Alexander Borisov <borisov@lexbor.com>
+*/
+
+#include "gzip.h"
+
+#ifdef PRGM_HAVE_LIBDEFLATE
+
+#include <libdeflate.h>
+
+
+static lxb_status_t
+prgm_gzip_libdeflate_init(prgm_gzip_t *gzip);
+
+static void
+prgm_gzip_libdeflate_destroy(prgm_gzip_t *gzip);
+
+static lxb_status_t
+prgm_gzip_libdeflate_inflate(prgm_gzip_t *gzip, const lxb_char_t *data,
+                             unsigned size);
+
+static lxb_status_t
+prgm_gzip_libdeflate_finish(prgm_gzip_t *gzip);
+
+static void
+prgm_gzip_libdeflate_reset(prgm_gzip_t *gzip);
+
+static lxb_status_t
+prgm_gzip_libdeflate_members(prgm_gzip_t *gzip, const lxb_char_t *data,
+                             size_t size, bool retry, bool last, size_t *done);
+
+static lxb_status_t
+prgm_gzip_libdeflate_member(prgm_gzip_t *gzip, const lxb_char_t *data,
+                            size_t size, bool last, size_t *used);
+
+static lxb_status_t
+prgm_gzip_libdeflate_sized(prgm_gzip_t *gzip, const lxb_char_t *data,
+                           size_t size, bool last, size_t *used);
+
+static lxb_status_t
+prgm_gzip_libdeflate_done(prgm_gzip_t *gzip, lxb_char_t *out,
+                          size_t out_used, size_t in_used, size_t *used);
+
+static lxb_status_t
+prgm_gzip_libdeflate_stream(prgm_gzip_t *gzip, const lxb_char_t *data,
+                            size_t size, size_t *used);
+
+static lxb_status_t
+prgm_gzip_libdeflate_pending(prgm_gzip_t *gzip, const lxb_char_t *data,
+                             size_t size);
+
+static bool
+prgm_gzip_libdeflate_followed(prgm_gzip_t *gzip, const lxb_char_t *data,
+                              size_t size);
+
+
+const prgm_gzip_backend_t prgm_gzip_libdeflate = {
+    .name = "libdeflate",
+    .init = prgm_gzip_libdeflate_init,
+    .destroy = prgm_gzip_libdeflate_destroy,
+    .inflate = prgm_gzip_libdeflate_inflate,
+    .finish = prgm_gzip_libdeflate_finish,
+    .reset = prgm_gzip_libdeflate_reset
+};
+
+
+static lxb_status_t
+prgm_gzip_libdeflate_init(prgm_gzip_t *gzip)
+{
+    gzip->decompressor = libdeflate_alloc_decompressor();
+    if (gzip->decompressor == NULL) {
+        return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+    }
+
+    /* For members over the cap. */
+    return prgm_gzip_zlib_member.init(gzip);
+}
+
+static void
+prgm_gzip_libdeflate_destroy(prgm_gzip_t *gzip)
+{
+    if (gzip->decompressor != NULL) {
+        libdeflate_free_decompressor(gzip->decompressor);
+        gzip->decompressor = NULL;
+    }
+
+    prgm_gzip_zlib_member.destroy(gzip);
+
+    if (gzip->pending != NULL) {
+        gzip->pending = lexbor_free(gzip->pending);
+    }
+}
+
+/*
+ * libdeflate needs a whole member. Members that are complete in the
+ * input are inflated in place; the tail of an incomplete one is kept in
+ * pending until enough input comes. The tail is tried again only when it
+ * has doubled, so a big member costs O(size) and not O(size^2). A member
+ * that grows the tail to PRGM_GZIP_MEMBER_MAX, or whose output is bigger,
+ * is inflated by zlib as in zlib-member, the rest of the input goes on
+ * to libdeflate.
+ */
+static lxb_status_t
+prgm_gzip_libdeflate_inflate(prgm_gzip_t *gzip, const lxb_char_t *data,
+                             unsigned size)
+{
+    size_t used, done, left;
+    lxb_status_t status;
+
+    left = size;
+
+    if (gzip->streaming) {
+        status = prgm_gzip_zlib_member_part(gzip, data, left, &used);
+        if (status != LXB_STATUS_OK) {
+            return (status == LXB_STATUS_NEXT) ? LXB_STATUS_OK : status;
+        }
+
+        gzip->streaming = false;
+
+        data += used;
+        left -= used;
+    }
+
+    if (gzip->pending_length != 0) {
+        status = prgm_gzip_libdeflate_pending(gzip, data, left);
+        if (status != LXB_STATUS_OK) {
+            return status;
+        }
+
+        if (gzip->pending_length < gzip->retry
+            && gzip->pending_length < PRGM_GZIP_MEMBER_MAX)
+        {
+            return LXB_STATUS_OK;
+        }
+
+        status = prgm_gzip_libdeflate_members(gzip, gzip->pending,
+                                              gzip->pending_length,
+                                              true, false, &done);
+        if (status != LXB_STATUS_NEXT) {
+            gzip->pending_length = 0;
+
+            return status;
+        }
+
+        gzip->pending_length -= done;
+        memmove(gzip->pending, gzip->pending + done, gzip->pending_length);
+
+        gzip->retry = gzip->pending_length * 2;
+
+        return LXB_STATUS_OK;
+    }
+
+    status = prgm_gzip_libdeflate_members(gzip, data, left, false, false,
+                                          &done);
+    if (status != LXB_STATUS_NEXT) {
+        return status;
+    }
+
+    gzip->retry = (left - done) * 2;
+
+    return prgm_gzip_libdeflate_pending(gzip, data + done, left - done);
+}
+
+static lxb_status_t
+prgm_gzip_libdeflate_finish(prgm_gzip_t *gzip)
+{
+    size_t done;
+    lxb_status_t status;
+
+    if (gzip->streaming) {
+        gzip->streaming = false;
+        gzip->pending_length = 0;
+
+        return LXB_STATUS_ERROR_UNEXPECTED_DATA;
+    }
+
+    status = prgm_gzip_libdeflate_members(gzip, gzip->pending,
+                                          gzip->pending_length,
+                                          true, true, &done);
+    gzip->pending_length = 0;
+
+    if (status == LXB_STATUS_NEXT || gzip->streaming) {
+        gzip->streaming = false;
+
+        return LXB_STATUS_ERROR_UNEXPECTED_DATA;
+    }
+
+    return status;
+}
+
+static void
+prgm_gzip_libdeflate_reset(prgm_gzip_t *gzip)
+{
+    /* Only a member inflated by zlib is kept between calls. */
+    prgm_gzip_zlib_member.reset(gzip);
+}
+
+/*
+ * Inflates the members that data begins with. LXB_STATUS_NEXT means that
+ * the member at done is not complete. Bad data and a cut member look the
+ * same to libdeflate, so they are told apart only when the tail is tried
+ * again (retry): a member followed by another one is bad.
+ */
+static lxb_status_t
+prgm_gzip_libdeflate_members(prgm_gzip_t *gzip, const lxb_char_t *data,
+                             size_t size, bool retry, bool last, size_t *done)
+{
+    size_t used;
+    lxb_status_t status;
+
+    *done = 0;
+
+    while (*done < size) {
+        status = prgm_gzip_libdeflate_member(gzip, data + *done,
+                                             size - *done, last, &used);
+        if (status == LXB_STATUS_NEXT) {
+            if (gzip->streaming) {
+                /* zlib took all the rest. */
+                *done = size;
+
+                return LXB_STATUS_OK;
+            }
+
+            if (!retry) {
+                return LXB_STATUS_NEXT;
+            }
+
+            if (size - *done >= PRGM_GZIP_MEMBER_MAX) {
+                status = prgm_gzip_libdeflate_stream(gzip, data + *done,
+                                                     size - *done, &used);
+                if (status == LXB_STATUS_NEXT) {
+                    *done = size;
+
+                    return LXB_STATUS_OK;
+                }
+            }
+            else if (!last && prgm_gzip_libdeflate_followed(gzip,
+                                                            data + *done,
+                                                            size - *done))
+            {
+                return LXB_STATUS_ERROR_UNEXPECTED_DATA;
+            }
+            else {
+                return LXB_STATUS_NEXT;
+            }
+        }
+
+        if (status != LXB_STATUS_OK) {
+            return status;
+        }
+
+        *done += used;
+        retry = false;
+    }
+
+    return LXB_STATUS_OK;
+}
+
+/*
+ * Inflates one member from the start of data and passes all its output
+ * to the callback. LXB_STATUS_NEXT means the member is not complete or
+ * is bad, or, with gzip->streaming set, that zlib took all data. With last
+ * the member may end at the end of data.
+ */
+static lxb_status_t
+prgm_gzip_libdeflate_member(prgm_gzip_t *gzip, const lxb_char_t *data,
+                            size_t size, bool last, size_t *used)
+{
+    size_t out_size, in_used, out_used;
+    lxb_char_t *out;
+    enum libdeflate_result res;
+
+    if (size >= 2 && (data[0] != 0x1f || data[1] != 0x8b)) {
+        return LXB_STATUS_ERROR;
+    }
+
+    if (gzip->member_size > gzip->out_buf_size) {
+        out = gzip->member;
+        out_size = gzip->member_size;
+    }
+    else {
+        out = gzip->out_buf;
+        out_size = gzip->out_buf_size;
+    }
+
+    res = libdeflate_gzip_decompress_ex(gzip->decompressor, data, size,
+                                        out, out_size, &in_used, &out_used);
+    if (res == LIBDEFLATE_INSUFFICIENT_SPACE) {
+        return prgm_gzip_libdeflate_sized(gzip, data, size, last, used);
+    }
+
+    if (res != LIBDEFLATE_SUCCESS) {
+        return LXB_STATUS_NEXT;
+    }
+
+    return prgm_gzip_libdeflate_done(gzip, out, out_used, in_used, used);
+}
+
+/*
+ * The output does not fit the buffer. A member ends where the next one
+ * begins and its last 4 bytes (ISIZE) are the output size, so the buffer
+ * is made that big and the member is inflated once more. A gzip header
+ * may show up inside compressed data, then the size is wrong and the next
+ * header is tried. Output over the cap is streamed by zlib.
+ */
+static lxb_status_t
+prgm_gzip_libdeflate_sized(prgm_gzip_t *gzip, const lxb_char_t *data,
+                           size_t size, bool last, size_t *used)
+{
+    size_t isize, in_used, out_used;
+    lxb_status_t status;
+    const lxb_char_t *p, *end, *stop;
+    enum libdeflate_result res;
+
+    if (size < PRGM_GZIP_HEADER_SIZE * 2) {
+        return LXB_STATUS_NEXT;
+    }
+
+    p = data + PRGM_GZIP_HEADER_SIZE * 2;
+    end = data + size;
+    stop = end - PRGM_GZIP_HEADER_SIZE + 1;
+
+    while (p <= end) {
+        if (p < stop) {
+            p = memchr(p, 0x1f, stop - p);
+            if (p == NULL) {
+                p = end;
+            }
+        }
+        else {
+            p = end;
+        }
+
+        if ((p == end) ? !last : !prgm_gzip_header_is(p)) {
+            p++;
+            continue;
+        }
+
+        isize = (size_t) p[-4] | (size_t) p[-3] << 8
+                | (size_t) p[-2] << 16 | (size_t) p[-1] << 24;
+
+        if (isize > PRGM_GZIP_MEMBER_MAX) {
+            return prgm_gzip_libdeflate_stream(gzip, data, size, used);
+        }
+
+        if (isize > gzip->out_buf_size && isize > gzip->member_size) {
+            status = prgm_gzip_member_reserve(gzip, isize);
+            if (status != LXB_STATUS_OK) {
+                return status;
+            }
+
+            res = libdeflate_gzip_decompress_ex(gzip->decompressor,
+                                                data, p - data,
+                                                gzip->member,
+                                                gzip->member_size,
+                                                &in_used, &out_used);
+            if (res == LIBDEFLATE_SUCCESS) {
+                return prgm_gzip_libdeflate_done(gzip, gzip->member,
+                                                 out_used, in_used, used);
+            }
+        }
+
+        p++;
+    }
+
+    return LXB_STATUS_NEXT;
+}
+
+static lxb_status_t
+prgm_gzip_libdeflate_done(prgm_gzip_t *gzip, lxb_char_t *out,
+                          size_t out_used, size_t in_used, size_t *used)
+{
+    lxb_status_t status;
+
+    status = gzip->cb(gzip, out, out_used);
+    if (status != LXB_STATUS_OK) {
+        return (status == LXB_STATUS_STOP) ? LXB_STATUS_STOP
+                                           : LXB_STATUS_ERROR;
+    }
+
+    gzip->count++;
+    gzip->offset += in_used;
+
+    *used = in_used;
+
+    return LXB_STATUS_OK;
+}
+
+/*
+ * The member at data goes to zlib. LXB_STATUS_NEXT means that it takes
+ * all data and goes on in the next input.
+ */
+static lxb_status_t
+prgm_gzip_libdeflate_stream(prgm_gzip_t *gzip, const lxb_char_t *data,
+                            size_t size, size_t *used)
+{
+    lxb_status_t status;
+
+    gzip->streaming = true;
+    gzip->member_length = 0;
+
+    status = prgm_gzip_zlib_member_part(gzip, data, size, used);
+    if (status != LXB_STATUS_NEXT) {
+        gzip->streaming = false;
+    }
+
+    return status;
+}
+
+static lxb_status_t
+prgm_gzip_libdeflate_pending(prgm_gzip_t *gzip, const lxb_char_t *data,
+                             size_t size)
+{
+    size_t new_size;
+    lxb_char_t *pending;
+
+    if (gzip->pending_length + size > gzip->pending_size) {
+        new_size = (gzip->pending_length + size) * 2;
+
+        /* The tail goes to zlib as soon as it reaches the cap. */
+        if (new_size > PRGM_GZIP_MEMBER_MAX) {
+            new_size = gzip->pending_length + size;
+        }
+
+        pending = lexbor_realloc(gzip->pending, new_size);
+        if (pending == NULL) {
+            return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+        }
+
+        gzip->pending = pending;
+        gzip->pending_size = new_size;
+    }
+
+    memcpy(gzip->pending + gzip->pending_length, data, size);
+    gzip->pending_length += size;
+
+    return LXB_STATUS_OK;
+}
+
+/*
+ * A member that failed again is not cut if another member follows it in
+ * data. Compressed bytes may look like a gzip header, so the next member
+ * only counts once it inflates too; a member bigger than the output
+ * buffer is taken as real as soon as the buffer fills without an error.
+ */
+static bool
+prgm_gzip_libdeflate_followed(prgm_gzip_t *gzip, const lxb_char_t *data,
+                              size_t size)
+{
+    size_t in_used, out_used;
+    const lxb_char_t *p, *end;
+    enum libdeflate_result res;
+
+    if (size < PRGM_GZIP_HEADER_SIZE * 2) {
+        return false;
+    }
+
+    p = data + PRGM_GZIP_HEADER_SIZE;
+    end = data + size - PRGM_GZIP_HEADER_SIZE + 1;
+
+    while (p < end) {
+        p = memchr(p, 0x1f, end - p);
+        if (p == NULL) {
+            return false;
+        }
+
+        if (prgm_gzip_header_is(p)) {
+            res = libdeflate_gzip_decompress_ex(gzip->decompressor, p,
+                                                data + size - p,
+                                                gzip->out_buf,
+                                                gzip->out_buf_size,
+                                                &in_used, &out_used);
+            if (res == LIBDEFLATE_SUCCESS
+                || res == LIBDEFLATE_INSUFFICIENT_SPACE)
+            {
+                return true;
+            }
+        }
+
+        p++;
+    }
+
+    return false;
+}
+
+#endif /* PRGM_HAVE_LIBDEFLATE */
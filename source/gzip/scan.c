@@ -0,0 +1,272 @@
+/*
+* Copyright (C) 2019 Alexander Borisov
+*
+* Author: Alexander Borisov <borisov@lexbor.com>
+*/
+
+#include "gzip.h"
+
+
+#define PRGM_GZIP_CHECK_SIZE (4096 * 16)
+#define PRGM_GZIP_CHECK_STEP 4096
+
+
+static lxb_status_t
+prgm_gzip_members_append(prgm_gzip_members_t *members, size_t offset);
+
+
+lxb_status_t
+prgm_gzip_members_init(prgm_gzip_members_t *members, size_t size)
+{
+    if (members == NULL) {
+        return LXB_STATUS_ERROR_OBJECT_IS_NULL;
+    }
+
+    if (size == 0) {
+        return LXB_STATUS_ERROR_WRONG_ARGS;
+    }
+
+    members->list = lexbor_malloc(sizeof(size_t) * size);
+    if (members->list == NULL) {
+        return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+    }
+
+    members->length = 0;
+    members->size = size;
+
+    return LXB_STATUS_OK;
+}
+
+prgm_gzip_members_t *
+prgm_gzip_members_destroy(prgm_gzip_members_t *members, bool self_destroy)
+{
+    if (members == NULL) {
+        return NULL;
+    }
+
+    if (members->list != NULL) {
+        members->list = lexbor_free(members->list);
+    }
+
+    if (self_destroy) {
+        return lexbor_free(members);
+    }
+
+    return members;
+}
+
+static lxb_status_t
+prgm_gzip_members_append(prgm_gzip_members_t *members, size_t offset)
+{
+    size_t *list;
+
+    if (members->length == members->size) {
+        list = lexbor_realloc(members->list,
+                              sizeof(size_t) * members->size * 2);
+        if (list == NULL) {
+            return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+        }
+
+        members->list = list;
+        members->size *= 2;
+    }
+
+    members->list[members->length++] = offset;
+
+    return LXB_STATUS_OK;
+}
+
+/*
+ * Collects offsets of everything that looks like a gzip member header.
+ * The gzip format has no index and no sync marker, so a candidate can also
+ * be a random match inside compressed data; the header sanity check makes it
+ * unlikely, prgm_gzip_members_count() skips the rest and callers must
+ * still check the member count they actually inflate.
+ */
+lxb_status_t
+prgm_gzip_members_scan(prgm_gzip_members_t *members, FILE *fh,
+                       lxb_char_t *buf, size_t buf_size)
+{
+    size_t size, tail, offset;
+    lxb_status_t status;
+    const lxb_char_t *p, *end;
+
+    static const size_t keep = PRGM_GZIP_HEADER_SIZE - 1;
+
+    if (buf_size <= PRGM_GZIP_HEADER_SIZE) {
+        return LXB_STATUS_ERROR_WRONG_ARGS;
+    }
+
+    if (fseek(fh, 0, SEEK_SET) != 0) {
+        return LXB_STATUS_ERROR;
+    }
+
+    tail = 0;
+    offset = 0;
+
+    do {
+        size = fread(buf + tail, 1, buf_size - tail, fh);
+        if (size != buf_size - tail && ferror(fh)) {
+            return LXB_STATUS_ERROR;
+        }
+
+        size += tail;
+
+        if (size < PRGM_GZIP_HEADER_SIZE) {
+            break;
+        }
+
+        p = buf;
+        end = buf + size - keep;
+
+        while ((p = memchr(p, 0x1f, end - p)) != NULL) {
+            if (prgm_gzip_header_is(p)) {
+                status = prgm_gzip_members_append(members,
+                                                  offset + (p - buf));
+                if (status != LXB_STATUS_OK) {
+                    return status;
+                }
+            }
+
+            p++;
+        }
+
+        /* Header can be cut by the end of buffer. */
+        memmove(buf, end, keep);
+
+        offset += size - keep;
+        tail = keep;
+    }
+    while (!feof(fh));
+
+    return LXB_STATUS_OK;
+}
+
+/*
+ * Index of the first member starting at or after offset.
+ */
+size_t
+prgm_gzip_members_lower(prgm_gzip_members_t *members, size_t offset)
+{
+    size_t left, right, mid;
+
+    left = 0;
+    right = members->length;
+
+    while (left < right) {
+        mid = left + (right - left) / 2;
+
+        if (members->list[mid] < offset) {
+            left = mid + 1;
+        }
+        else {
+            right = mid;
+        }
+    }
+
+    return left;
+}
+
+/*
+ * Inflates the start of the member at offset with a stream made by
+ * inflateInit2() and compares it with expect. Input is read a step at a
+ * time, the first deflate block is rarely longer than a step.
+ */
+static bool
+prgm_gzip_member_expect(z_stream *stream, FILE *fh, size_t offset,
+                        lxb_char_t *in, const lxb_char_t *expect,
+                        size_t expect_len)
+{
+    int ret;
+    size_t size, total;
+    lxb_char_t out[64];
+
+    if (expect_len > sizeof(out)
+        || fseek(fh, (long) offset, SEEK_SET) != 0)
+    {
+        return false;
+    }
+
+    size = fread(in, 1, PRGM_GZIP_CHECK_STEP, fh);
+    if (size < PRGM_GZIP_HEADER_SIZE || !prgm_gzip_header_is(in)) {
+        return false;
+    }
+
+    if (inflateReset(stream) != Z_OK) {
+        return false;
+    }
+
+    total = size;
+
+    stream->next_in = in;
+    stream->avail_in = (unsigned) size;
+    stream->next_out = out;
+    stream->avail_out = (unsigned) expect_len;
+
+    for (;;) {
+        ret = inflate(stream, Z_NO_FLUSH);
+
+        if (ret != Z_OK || stream->avail_out == 0) {
+            break;
+        }
+
+        if (stream->avail_in != 0) {
+            continue;
+        }
+
+        if (total >= PRGM_GZIP_CHECK_SIZE) {
+            return false;
+        }
+
+        size = fread(in, 1, PRGM_GZIP_CHECK_STEP, fh);
+        if (size == 0) {
+            return false;
+        }
+
+        total += size;
+
+        stream->next_in = in;
+        stream->avail_in = (unsigned) size;
+    }
+
+    if ((ret != Z_OK && ret != Z_STREAM_END) || stream->avail_out != 0) {
+        return false;
+    }
+
+    return memcmp(out, expect, expect_len) == 0;
+}
+
+/*
+ * Counts the members found by the scan from first to last (exclusive) that
+ * start with expect when inflated. A gzip header that is a random match
+ * inside compressed data does not inflate and is not counted.
+ */
+lxb_status_t
+prgm_gzip_members_count(prgm_gzip_members_t *members, FILE *fh,
+                        size_t first, size_t last, const lxb_char_t *expect,
+                        size_t expect_len, size_t *count)
+{
+    size_t i;
+    z_stream stream;
+    lxb_char_t in[PRGM_GZIP_CHECK_STEP];
+
+    memset(&stream, 0, sizeof(z_stream));
+
+    if (inflateInit2(&stream, (16 + MAX_WBITS)) != Z_OK) {
+        return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+    }
+
+    *count = 0;
+
+    for (i = first; i < last && i < members->length; i++) {
+        if (prgm_gzip_member_expect(&stream, fh, members->list[i], in,
+                                    expect, expect_len))
+        {
+            (*count)++;
+        }
+    }
+
+    (void) inflateEnd(&stream);
+
+    return LXB_STATUS_OK;
+}
@@ -0,0 +1,281 @@
+/*
+* Copyright (C) 2019 Alexander Borisov
+*
+* Author: Alexander Borisov <borisov@lexbor.com>
+*/
+
+#include "gzip.h"
+
+
+static lxb_status_t
+prgm_gzip_zlib_init(prgm_gzip_t *gzip);
+
+static void
+prgm_gzip_zlib_destroy(prgm_gzip_t *gzip);
+
+static lxb_status_t
+prgm_gzip_zlib_inflate(prgm_gzip_t *gzip, const lxb_char_t *data,
+                       unsigned size);
+
+static lxb_status_t
+prgm_gzip_zlib_member_inflate(prgm_gzip_t *gzip, const lxb_char_t *data,
+                              unsigned size);
+
+static lxb_status_t
+prgm_gzip_zlib_finish(prgm_gzip_t *gzip);
+
+static void
+prgm_gzip_zlib_reset(prgm_gzip_t *gzip);
+
+
+const prgm_gzip_backend_t prgm_gzip_zlib = {
+    .name = "zlib",
+    .init = prgm_gzip_zlib_init,
+    .destroy = prgm_gzip_zlib_destroy,
+    .inflate = prgm_gzip_zlib_inflate,
+    .finish = prgm_gzip_zlib_finish,
+    .reset = prgm_gzip_zlib_reset
+};
+
+const prgm_gzip_backend_t prgm_gzip_zlib_member = {
+    .name = "zlib-member",
+    .init = prgm_gzip_zlib_init,
+    .destroy = prgm_gzip_zlib_destroy,
+    .inflate = prgm_gzip_zlib_member_inflate,
+    .finish = prgm_gzip_zlib_finish,
+    .reset = prgm_gzip_zlib_reset
+};
+
+
+static lxb_status_t
+prgm_gzip_zlib_init(prgm_gzip_t *gzip)
+{
+    gzip->stream.zalloc = Z_NULL;
+    gzip->stream.zfree = Z_NULL;
+    gzip->stream.opaque = Z_NULL;
+
+    /* Fake buffer before call inflateInit2. */
+    gzip->stream.avail_in = gzip->out_buf_size;
+    gzip->stream.next_in = gzip->out_buf;
+
+    gzip->ret = inflateInit2(&gzip->stream, (32 + MAX_WBITS));
+    if (gzip->ret != Z_OK) {
+        return LXB_STATUS_ERROR;
+    }
+
+    return LXB_STATUS_OK;
+}
+
+static void
+prgm_gzip_zlib_destroy(prgm_gzip_t *gzip)
+{
+    (void) inflateEnd(&gzip->stream);
+}
+
+static lxb_status_t
+prgm_gzip_zlib_inflate(prgm_gzip_t *gzip, const lxb_char_t *data,
+                       unsigned size)
+{
+    lxb_status_t status;
+    unsigned have;
+
+next_chunk:
+
+    do {
+        gzip->stream.next_in = (Bytef *) data;
+        gzip->stream.avail_in = size;
+
+        do {
+            gzip->stream.avail_out = gzip->out_buf_size;
+            gzip->stream.next_out = gzip->out_buf;
+
+            gzip->ret = inflate(&gzip->stream, Z_NO_FLUSH);
+
+            switch (gzip->ret) {
+                case Z_NEED_DICT:
+                case Z_DATA_ERROR:
+                case Z_MEM_ERROR:
+                    goto failed;
+
+                case Z_BUF_ERROR:
+                    return LXB_STATUS_OK;
+
+                default:
+                    break;
+            }
+
+            have = gzip->out_buf_size - gzip->stream.avail_out;
+
+            status = gzip->cb(gzip, gzip->out_buf, have);
+            if (status != LXB_STATUS_OK) {
+                if (status == LXB_STATUS_STOP) {
+                    return LXB_STATUS_STOP;
+                }
+
+                goto failed;
+            }
+
+            if (gzip->ret == Z_STREAM_END) {
+                gzip->count++;
+                gzip->offset += gzip->stream.total_in;
+
+                data += size - gzip->stream.avail_in;
+                size = gzip->stream.avail_in;
+
+                /* Keep the allocated state for the next member. */
+                gzip->ret = inflateReset(&gzip->stream);
+                if (gzip->ret != Z_OK) {
+                    goto failed;
+                }
+
+                if (size == 0) {
+                    return LXB_STATUS_OK;
+                }
+
+                goto next_chunk;
+            }
+        }
+        while (gzip->stream.avail_out == 0);
+
+        data += size - gzip->stream.avail_in;
+        size = gzip->stream.avail_in;
+    }
+    while (size != 0);
+
+    return LXB_STATUS_OK;
+
+failed:
+
+    return LXB_STATUS_ERROR;
+}
+
+/*
+ * Output of a member is collected in one buffer and goes to the callback
+ * as a whole when the member ends. A member cut by the end of the input
+ * is continued on the next call, the input is not copied. A member bigger
+ * than PRGM_GZIP_MEMBER_MAX is streamed: the full buffer goes to the
+ * callback and is reused.
+ */
+static lxb_status_t
+prgm_gzip_zlib_member_inflate(prgm_gzip_t *gzip, const lxb_char_t *data,
+                              unsigned size)
+{
+    size_t used;
+    lxb_status_t status;
+
+    do {
+        status = prgm_gzip_zlib_member_part(gzip, data, size, &used);
+        if (status != LXB_STATUS_OK) {
+            return (status == LXB_STATUS_NEXT) ? LXB_STATUS_OK : status;
+        }
+
+        data += used;
+        size -= used;
+    }
+    while (size != 0);
+
+    return LXB_STATUS_OK;
+}
+
+/*
+ * Inflates data up to the end of the current member, as described above.
+ * LXB_STATUS_NEXT means that all data is used and the member goes on.
+ */
+lxb_status_t
+prgm_gzip_zlib_member_part(prgm_gzip_t *gzip, const lxb_char_t *data,
+                           size_t size, size_t *used)
+{
+    lxb_status_t status;
+
+    gzip->stream.next_in = (Bytef *) data;
+    gzip->stream.avail_in = (unsigned) size;
+
+    /* A full buffer can mean more output without more input. */
+    while (gzip->stream.avail_in != 0
+           || gzip->member_length == gzip->member_size)
+    {
+        if (gzip->member_length == gzip->member_size) {
+            status = prgm_gzip_member_grow(gzip);
+
+            if (status == LXB_STATUS_ERROR_OVERFLOW) {
+                status = gzip->cb(gzip, gzip->member, gzip->member_length);
+                if (status != LXB_STATUS_OK) {
+                    return (status == LXB_STATUS_STOP) ? LXB_STATUS_STOP
+                                                       : LXB_STATUS_ERROR;
+                }
+
+                gzip->member_length = 0;
+            }
+            else if (status != LXB_STATUS_OK) {
+                return status;
+            }
+        }
+
+        gzip->stream.next_out = gzip->member + gzip->member_length;
+        gzip->stream.avail_out = (unsigned) (gzip->member_size
+                                             - gzip->member_length);
+
+        gzip->ret = inflate(&gzip->stream, Z_NO_FLUSH);
+
+        switch (gzip->ret) {
+            case Z_NEED_DICT:
+            case Z_DATA_ERROR:
+            case Z_MEM_ERROR:
+                return LXB_STATUS_ERROR;
+
+            case Z_BUF_ERROR:
+                *used = size;
+                return LXB_STATUS_NEXT;
+
+            default:
+                break;
+        }
+
+        gzip->member_length = gzip->member_size - gzip->stream.avail_out;
+
+        if (gzip->ret != Z_STREAM_END) {
+            continue;
+        }
+
+        status = gzip->cb(gzip, gzip->member, gzip->member_length);
+        if (status != LXB_STATUS_OK) {
+            return (status == LXB_STATUS_STOP) ? LXB_STATUS_STOP
+                                               : LXB_STATUS_ERROR;
+        }
+
+        gzip->member_length = 0;
+
+        gzip->count++;
+        gzip->offset += gzip->stream.total_in;
+
+        gzip->ret = inflateReset(&gzip->stream);
+        if (gzip->ret != Z_OK) {
+            return LXB_STATUS_ERROR;
+        }
+
+        *used = size - gzip->stream.avail_in;
+
+        return LXB_STATUS_OK;
+    }
+
+    *used = size;
+
+    return LXB_STATUS_NEXT;
+}
+
+/* After the last member the stream is reset and has taken nothing. */
+static lxb_status_t
+prgm_gzip_zlib_finish(prgm_gzip_t *gzip)
+{
+    if (gzip->stream.total_in != 0) {
+        return LXB_STATUS_ERROR_UNEXPECTED_DATA;
+    }
+
+    return LXB_STATUS_OK;
+}
+
+static void
+prgm_gzip_zlib_reset(prgm_gzip_t *gzip)
+{
+    gzip->ret = inflateReset(&gzip->stream);
+}
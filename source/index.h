@@ -0,0 +1,124 @@
+/*
+* Copyright (C) 2019 Alexander Borisov
+*
+* Author: Alexander Borisov <borisov@lexbor.com>
+*/
+
+#ifndef PRGM_INDEX_H
+#define PRGM_INDEX_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "lexbor/utils/base.h"
+
+#include <stdint.h>
+
+
+#define PRGM_INDEX_MAGIC   "WARCIDX1"
+#define PRGM_INDEX_VERSION 1
+#define PRGM_INDEX_EXT     ".idx"
+
+
+/*
+ * Sidecar file layout, host byte order:
+ *     prgm_index_header_t
+ *     prgm_index_entry_t[count]
+ *     string pool, every string is NUL-terminated
+ *
+ * Entries have fixed size, so the entry for record N is read with one seek.
+ */
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t entry_size;
+    uint64_t count;
+    uint64_t file_size;     /* size of the indexed *.warc.gz */
+    int64_t  file_mtime;    /* mtime of the indexed *.warc.gz */
+    uint64_t strings;       /* offset of the string pool */
+    uint64_t strings_size;
+}
+prgm_index_header_t;
+
+typedef struct {
+    uint64_t offset;         /* compressed offset of the gzip member */
+    uint64_t length;         /* compressed length of the gzip member */
+    uint64_t content_length; /* WARC Content-Length */
+    uint64_t type;           /* WARC-Type, offset in the string pool */
+    uint64_t uri;            /* WARC-Target-URI */
+    uint64_t payload;        /* WARC-Identified-Payload-Type */
+    uint32_t type_len;
+    uint32_t uri_len;
+    uint32_t payload_len;
+    uint32_t skip;           /* records before this one in the same member */
+}
+prgm_index_entry_t;
+
+typedef struct {
+    prgm_index_header_t header;
+
+    prgm_index_entry_t  *entries;
+    size_t              length;
+    size_t              size;
+
+    lxb_char_t          *strings;
+    size_t              strings_length;
+    size_t              strings_size;
+}
+prgm_index_t;
+
+
+lxb_status_t
+prgm_index_init(prgm_index_t *index, size_t size);
+
+prgm_index_t *
+prgm_index_destroy(prgm_index_t *index, bool self_destroy);
+
+lxb_status_t
+prgm_index_append(prgm_index_t *index, size_t offset, size_t content_length,
+                  const lxb_char_t *type, size_t type_len,
+                  const lxb_char_t *uri, size_t uri_len,
+                  const lxb_char_t *payload, size_t payload_len);
+
+void
+prgm_index_finish(prgm_index_t *index, size_t end);
+
+lxb_status_t
+prgm_index_save(prgm_index_t *index, const char *warc_path);
+
+lxb_status_t
+prgm_index_load(prgm_index_t *index, const char *warc_path);
+
+lxb_status_t
+prgm_index_lookup(const char *warc_path, size_t num, prgm_index_entry_t *entry);
+
+char *
+prgm_index_path(const char *warc_path);
+
+
+/*
+ * Inline functions
+ */
+lxb_inline const lxb_char_t *
+prgm_index_string(prgm_index_t *index, uint64_t pos)
+{
+    return index->strings + pos;
+}
+
+lxb_inline prgm_index_entry_t *
+prgm_index_entry(prgm_index_t *index, size_t num)
+{
+    if (num >= index->length) {
+        return NULL;
+    }
+
+    return &index->entries[num];
+}
+
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* PRGM_INDEX_H */
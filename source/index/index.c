@@ -0,0 +1,461 @@
+/*
+* Copyright (C) 2019 Alexander Borisov
+*
+* Author: Alexander Borisov <borisov@lexbor.com>
+*/
+
+#include <sys/stat.h>
+
+#include "index.h"
+
+
+static lxb_status_t
+prgm_index_string_append(prgm_index_t *index, const lxb_char_t *data,
+                         size_t length, uint64_t *pos, uint32_t *len);
+
+static lxb_status_t
+prgm_index_header_read(FILE *fh, const char *warc_path,
+                       prgm_index_header_t *header);
+
+static bool
+prgm_index_string_in(const prgm_index_t *index, uint64_t pos, uint32_t len);
+
+
+lxb_status_t
+prgm_index_init(prgm_index_t *index, size_t size)
+{
+    if (index == NULL) {
+        return LXB_STATUS_ERROR_OBJECT_IS_NULL;
+    }
+
+    if (size == 0) {
+        return LXB_STATUS_ERROR_WRONG_ARGS;
+    }
+
+    memset(index, 0, sizeof(prgm_index_t));
+
+    index->entries = lexbor_malloc(sizeof(prgm_index_entry_t) * size);
+    if (index->entries == NULL) {
+        return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+    }
+
+    index->size = size;
+
+    index->strings = lexbor_malloc(4096);
+    if (index->strings == NULL) {
+        index->entries = lexbor_free(index->entries);
+        index->size = 0;
+
+        return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+    }
+
+    /* Position 0 is the empty string for absent fields. */
+    index->strings[0] = 0x00;
+    index->strings_length = 1;
+    index->strings_size = 4096;
+
+    return LXB_STATUS_OK;
+}
+
+prgm_index_t *
+prgm_index_destroy(prgm_index_t *index, bool self_destroy)
+{
+    if (index == NULL) {
+        return NULL;
+    }
+
+    if (index->entries != NULL) {
+        index->entries = lexbor_free(index->entries);
+    }
+
+    if (index->strings != NULL) {
+        index->strings = lexbor_free(index->strings);
+    }
+
+    if (self_destroy) {
+        return lexbor_free(index);
+    }
+
+    return index;
+}
+
+static lxb_status_t
+prgm_index_string_append(prgm_index_t *index, const lxb_char_t *data,
+                         size_t length, uint64_t *pos, uint32_t *len)
+{
+    size_t size;
+    lxb_char_t *strings;
+
+    if (data == NULL || length == 0) {
+        *pos = 0;
+        *len = 0;
+
+        return LXB_STATUS_OK;
+    }
+
+    if (length > UINT32_MAX) {
+        length = UINT32_MAX;
+    }
+
+    if (index->strings_length + length + 1 > index->strings_size) {
+        size = (index->strings_size + length + 1) * 2;
+
+        strings = lexbor_realloc(index->strings, size);
+        if (strings == NULL) {
+            return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+        }
+
+        index->strings = strings;
+        index->strings_size = size;
+    }
+
+    memcpy(index->strings + index->strings_length, data, length);
+
+    *pos = index->strings_length;
+    *len = (uint32_t) length;
+
+    index->strings_length += length;
+    index->strings[index->strings_length++] = 0x00;
+
+    return LXB_STATUS_OK;
+}
+
+lxb_status_t
+prgm_index_append(prgm_index_t *index, size_t offset, size_t content_length,
+                  const lxb_char_t *type, size_t type_len,
+                  const lxb_char_t *uri, size_t uri_len,
+                  const lxb_char_t *payload, size_t payload_len)
+{
+    lxb_status_t status;
+    prgm_index_entry_t *entry, *entries;
+
+    if (index->length == index->size) {
+        entries = lexbor_realloc(index->entries,
+                                 sizeof(prgm_index_entry_t) * index->size * 2);
+        if (entries == NULL) {
+            return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+        }
+
+        index->entries = entries;
+        index->size *= 2;
+    }
+
+    entry = &index->entries[index->length];
+
+    memset(entry, 0, sizeof(prgm_index_entry_t));
+
+    entry->offset = offset;
+    entry->content_length = content_length;
+
+    if (index->length != 0 && entry[-1].offset == offset) {
+        entry->skip = entry[-1].skip + 1;
+    }
+
+    status = prgm_index_string_append(index, type, type_len,
+                                      &entry->type, &entry->type_len);
+    if (status != LXB_STATUS_OK) {
+        return status;
+    }
+
+    status = prgm_index_string_append(index, uri, uri_len,
+                                      &entry->uri, &entry->uri_len);
+    if (status != LXB_STATUS_OK) {
+        return status;
+    }
+
+    status = prgm_index_string_append(index, payload, payload_len,
+                                      &entry->payload, &entry->payload_len);
+    if (status != LXB_STATUS_OK) {
+        return status;
+    }
+
+    index->length++;
+
+    return LXB_STATUS_OK;
+}
+
+/*
+ * Member lengths are known only when the next member starts,
+ * end is the compressed offset where the last member ends.
+ */
+void
+prgm_index_finish(prgm_index_t *index, size_t end)
+{
+    size_t i, next;
+    prgm_index_entry_t *entries = index->entries;
+
+    next = end;
+
+    for (i = index->length; i != 0; i--) {
+        if (i < index->length && entries[i].offset != entries[i - 1].offset) {
+            next = entries[i].offset;
+        }
+
+        entries[i - 1].length = next - entries[i - 1].offset;
+    }
+}
+
+lxb_status_t
+prgm_index_save(prgm_index_t *index, const char *warc_path)
+{
+    FILE *fh;
+    char *path, *tmp;
+    size_t len;
+    struct stat st;
+    prgm_index_header_t *header = &index->header;
+
+    if (stat(warc_path, &st) != 0) {
+        return LXB_STATUS_ERROR_NOT_EXISTS;
+    }
+
+    memset(header, 0, sizeof(prgm_index_header_t));
+    memcpy(header->magic, PRGM_INDEX_MAGIC, sizeof(header->magic));
+
+    header->version = PRGM_INDEX_VERSION;
+    header->entry_size = sizeof(prgm_index_entry_t);
+    header->count = index->length;
+    header->file_size = (uint64_t) st.st_size;
+    header->file_mtime = (int64_t) st.st_mtime;
+    header->strings = sizeof(prgm_index_header_t)
+                      + sizeof(prgm_index_entry_t) * index->length;
+    header->strings_size = index->strings_length;
+
+    path = prgm_index_path(warc_path);
+    if (path == NULL) {
+        return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+    }
+
+    len = strlen(path);
+
+    tmp = lexbor_malloc(len + 5);
+    if (tmp == NULL) {
+        lexbor_free(path);
+        return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+    }
+
+    memcpy(tmp, path, len);
+    memcpy(tmp + len, ".tmp", 5);
+
+    fh = fopen(tmp, "wb");
+    if (fh == NULL) {
+        goto failed;
+    }
+
+    if (fwrite(header, sizeof(prgm_index_header_t), 1, fh) != 1
+        || fwrite(index->entries, sizeof(prgm_index_entry_t),
+                  index->length, fh) != index->length
+        || fwrite(index->strings, 1,
+                  index->strings_length, fh) != index->strings_length)
+    {
+        fclose(fh);
+        goto failed;
+    }
+
+    if (fclose(fh) != 0 || rename(tmp, path) != 0) {
+        goto failed;
+    }
+
+    lexbor_free(tmp);
+    lexbor_free(path);
+
+    return LXB_STATUS_OK;
+
+failed:
+
+    (void) remove(tmp);
+
+    lexbor_free(tmp);
+    lexbor_free(path);
+
+    return LXB_STATUS_ERROR;
+}
+
+static lxb_status_t
+prgm_index_header_read(FILE *fh, const char *warc_path,
+                       prgm_index_header_t *header)
+{
+    struct stat st;
+
+    if (fread(header, sizeof(prgm_index_header_t), 1, fh) != 1) {
+        return LXB_STATUS_ERROR_UNEXPECTED_DATA;
+    }
+
+    if (memcmp(header->magic, PRGM_INDEX_MAGIC, sizeof(header->magic)) != 0
+        || header->version != PRGM_INDEX_VERSION
+        || header->entry_size != sizeof(prgm_index_entry_t))
+    {
+        return LXB_STATUS_ERROR_UNEXPECTED_DATA;
+    }
+
+    /* Stale index is the same as no index. */
+    if (stat(warc_path, &st) != 0
+        || header->file_size != (uint64_t) st.st_size
+        || header->file_mtime != (int64_t) st.st_mtime)
+    {
+        return LXB_STATUS_ERROR_NOT_EXISTS;
+    }
+
+    return LXB_STATUS_OK;
+}
+
+lxb_status_t
+prgm_index_load(prgm_index_t *index, const char *warc_path)
+{
+    FILE *fh;
+    char *path;
+    size_t i;
+    lxb_status_t status;
+    prgm_index_entry_t *entry;
+    prgm_index_header_t *header = &index->header;
+
+    memset(index, 0, sizeof(prgm_index_t));
+
+    path = prgm_index_path(warc_path);
+    if (path == NULL) {
+        return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+    }
+
+    fh = fopen(path, "rb");
+    lexbor_free(path);
+
+    if (fh == NULL) {
+        return LXB_STATUS_ERROR_NOT_EXISTS;
+    }
+
+    status = prgm_index_header_read(fh, warc_path, header);
+    if (status != LXB_STATUS_OK) {
+        goto done;
+    }
+
+    if (header->strings_size == 0 || header->count > SIZE_MAX
+        / sizeof(prgm_index_entry_t))
+    {
+        status = LXB_STATUS_ERROR_UNEXPECTED_DATA;
+        goto done;
+    }
+
+    index->size = (header->count != 0) ? (size_t) header->count : 1;
+    index->entries = lexbor_malloc(sizeof(prgm_index_entry_t) * index->size);
+    index->strings = lexbor_malloc((size_t) header->strings_size);
+
+    if (index->entries == NULL || index->strings == NULL) {
+        status = LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+        goto done;
+    }
+
+    index->length = (size_t) header->count;
+    index->strings_length = (size_t) header->strings_size;
+    index->strings_size = index->strings_length;
+
+    if (fread(index->entries, sizeof(prgm_index_entry_t),
+              index->length, fh) != index->length
+        || fseek(fh, (long) header->strings, SEEK_SET) != 0
+        || fread(index->strings, 1,
+                 index->strings_length, fh) != index->strings_length)
+    {
+        status = LXB_STATUS_ERROR_UNEXPECTED_DATA;
+        goto done;
+    }
+
+    /* Strings are used as C strings, keep the pool terminated. */
+    index->strings[index->strings_length - 1] = 0x00;
+
+    for (i = 0; i < index->length; i++) {
+        entry = &index->entries[i];
+
+        if (!prgm_index_string_in(index, entry->type, entry->type_len)
+            || !prgm_index_string_in(index, entry->uri, entry->uri_len)
+            || !prgm_index_string_in(index, entry->payload,
+                                     entry->payload_len))
+        {
+            status = LXB_STATUS_ERROR_UNEXPECTED_DATA;
+            goto done;
+        }
+    }
+
+    status = LXB_STATUS_OK;
+
+done:
+
+    fclose(fh);
+
+    if (status != LXB_STATUS_OK) {
+        (void) prgm_index_destroy(index, false);
+    }
+
+    return status;
+}
+
+lxb_status_t
+prgm_index_lookup(const char *warc_path, size_t num, prgm_index_entry_t *entry)
+{
+    FILE *fh;
+    char *path;
+    lxb_status_t status;
+    prgm_index_header_t header;
+
+    path = prgm_index_path(warc_path);
+    if (path == NULL) {
+        return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+    }
+
+    fh = fopen(path, "rb");
+    lexbor_free(path);
+
+    if (fh == NULL) {
+        return LXB_STATUS_ERROR_NOT_EXISTS;
+    }
+
+    status = prgm_index_header_read(fh, warc_path, &header);
+    if (status != LXB_STATUS_OK) {
+        goto done;
+    }
+
+    if (num >= header.count) {
+        status = LXB_STATUS_ERROR_OVERFLOW;
+        goto done;
+    }
+
+    if (fseek(fh, (long) (sizeof(prgm_index_header_t)
+                          + sizeof(prgm_index_entry_t) * num), SEEK_SET) != 0
+        || fread(entry, sizeof(prgm_index_entry_t), 1, fh) != 1)
+    {
+        status = LXB_STATUS_ERROR_UNEXPECTED_DATA;
+        goto done;
+    }
+
+    status = LXB_STATUS_OK;
+
+done:
+
+    fclose(fh);
+
+    return status;
+}
+
+/* A string and its terminator must be in the pool. */
+static bool
+prgm_index_string_in(const prgm_index_t *index, uint64_t pos, uint32_t len)
+{
+    return pos < index->strings_length
+        && len < index->strings_length - pos;
+}
+
+char *
+prgm_index_path(const char *warc_path)
+{
+    char *path;
+    size_t len;
+
+    len = strlen(warc_path);
+
+    path = lexbor_malloc(len + sizeof(PRGM_INDEX_EXT));
+    if (path == NULL) {
+        return NULL;
+    }
+
+    memcpy(path, warc_path, len);
+    memcpy(path + len, PRGM_INDEX_EXT, sizeof(PRGM_INDEX_EXT));
+
+    return path;
+}
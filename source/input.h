@@ -0,0 +1,134 @@
+/*
+* Copyright (C) 2019 Alexander Borisov
+*
+* Author: Alexander Borisov <borisov@lexbor.com>
+*/
+
+#ifndef PRGM_INPUT_H
+#define PRGM_INPUT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "lexbor/utils/base.h"
+
+
+#define PRGM_INPUT_BLOCK_SIZE     (4 * 1024 * 1024)
+#define PRGM_INPUT_BLOCK_SIZE_MIN (64 * 1024)
+#define PRGM_INPUT_BLOCK_SIZE_MAX (1024 * 1024 * 1024)
+#define PRGM_INPUT_DEPTH          4
+#define PRGM_INPUT_DEPTH_MAX      64
+
+
+typedef enum {
+    PRGM_INPUT_MMAP = 0,   /* map the whole file, no copy */
+    PRGM_INPUT_READ,       /* read(2) into one large block */
+    PRGM_INPUT_URING       /* depth reads in flight, io_uring or a thread */
+}
+prgm_input_type_t;
+
+typedef struct prgm_input_ahead prgm_input_ahead_t;
+
+/* One read of the read-ahead ring. */
+typedef struct {
+    lxb_char_t *data;
+    int        fd;
+    size_t     offset;
+    size_t     size;
+
+    long       result;   /* bytes read or -errno */
+    bool       pending;  /* submitted, not yet taken by wait */
+    bool       done;     /* set by the backend */
+}
+prgm_input_slot_t;
+
+/*
+ * Gives a byte range of a file as blocks of at most block_size bytes.
+ * With PRGM_INPUT_MMAP the blocks point into the mapping; if the file can
+ * not be mapped it is read as with PRGM_INPUT_READ.
+ * With PRGM_INPUT_URING the next depth blocks of the range are always
+ * being read while the caller works on the current one.
+ */
+typedef struct {
+    prgm_input_type_t  type;
+    size_t             block_size;
+
+    int                fd;
+    size_t             file_size;
+
+    lxb_char_t         *map;
+    lxb_char_t         *buf;
+
+    size_t             pos;
+    size_t             end;
+
+    /* PRGM_INPUT_URING */
+    prgm_input_ahead_t *ahead;
+    prgm_input_slot_t  *slots;
+    size_t             depth;
+    size_t             head;     /* slot with the block at pos */
+    size_t             issued;   /* offset of the next read to submit */
+    bool               taken;    /* the slot before head is with the caller */
+}
+prgm_input_t;
+
+
+lxb_status_t
+prgm_input_init(prgm_input_t *input, prgm_input_type_t type,
+                size_t block_size, size_t depth);
+
+prgm_input_t *
+prgm_input_destroy(prgm_input_t *input, bool self_destroy);
+
+lxb_status_t
+prgm_input_open(prgm_input_t *input, const char *path);
+
+void
+prgm_input_close(prgm_input_t *input);
+
+void
+prgm_input_range(prgm_input_t *input, size_t begin, size_t end);
+
+lxb_status_t
+prgm_input_next(prgm_input_t *input, const lxb_char_t **data, size_t *size);
+
+void
+prgm_input_prefetch(prgm_input_t *input, const char *path);
+
+const char *
+prgm_input_backend(prgm_input_t *input);
+
+size_t
+prgm_input_memory(prgm_input_t *input);
+
+bool
+prgm_input_type_by_name(const char *name, prgm_input_type_t *type);
+
+
+/* Read-ahead backends */
+prgm_input_ahead_t *
+prgm_input_ahead_create(size_t depth);
+
+prgm_input_ahead_t *
+prgm_input_ahead_destroy(prgm_input_ahead_t *ahead);
+
+lxb_status_t
+prgm_input_ahead_submit(prgm_input_ahead_t *ahead, prgm_input_slot_t *slot);
+
+lxb_status_t
+prgm_input_ahead_wait(prgm_input_ahead_t *ahead, prgm_input_slot_t *slot);
+
+void
+prgm_input_ahead_prefetch(prgm_input_ahead_t *ahead, const char *path,
+                          size_t size);
+
+const char *
+prgm_input_ahead_name(prgm_input_ahead_t *ahead);
+
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* PRGM_INPUT_H */
@@ -0,0 +1,602 @@
+/*
+* Copyright (C) 2019 Alexander Borisov
+*
+* Author: Alexander Borisov <borisov@lexbor.com>
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#ifdef PRGM_HAVE_URING
+    #include <sys/syscall.h>
+    #include <linux/io_uring.h>
+
+    #ifndef __NR_io_uring_setup
+        #undef PRGM_HAVE_URING
+    #endif
+#endif
+
+#include "input.h"
+
+
+/*
+ * Reads are done by io_uring when the kernel allows it, otherwise by
+ * one reader thread per input. Both complete slots in any order; the
+ * input waits for them in file order.
+ */
+struct prgm_input_ahead {
+    bool                uring;
+
+#ifdef PRGM_HAVE_URING
+    int                 ring_fd;
+
+    lxb_char_t          *sq_ptr;
+    size_t              sq_size;
+    lxb_char_t          *cq_ptr;
+    size_t              cq_size;
+    struct io_uring_sqe *sqes;
+    size_t              sqes_size;
+
+    unsigned            *sq_tail;
+    unsigned            *sq_mask;
+    unsigned            *sq_array;
+    unsigned            *cq_head;
+    unsigned            *cq_tail;
+    unsigned            *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    int                 prefetch_fd;
+#endif
+
+    /* Reader thread */
+    pthread_t           thread;
+    pthread_mutex_t     lock;
+    pthread_cond_t      work;
+    pthread_cond_t      done;
+
+    prgm_input_slot_t   **queue;
+    size_t              queue_size;
+    size_t              queue_head;
+    size_t              queue_length;
+
+    char                *prefetch;
+    size_t              prefetch_size;
+
+    bool                stop;
+};
+
+
+static prgm_input_ahead_t *
+prgm_input_thread_create(prgm_input_ahead_t *ahead, size_t depth);
+
+static void *
+prgm_input_thread(void *arg);
+
+static void
+prgm_input_slot_read(prgm_input_slot_t *slot, size_t got);
+
+#ifdef PRGM_HAVE_URING
+static bool
+prgm_input_uring_create(prgm_input_ahead_t *ahead, size_t depth);
+
+static void
+prgm_input_uring_destroy(prgm_input_ahead_t *ahead);
+
+static struct io_uring_sqe *
+prgm_input_uring_sqe(prgm_input_ahead_t *ahead);
+
+static lxb_status_t
+prgm_input_uring_enter(prgm_input_ahead_t *ahead, unsigned submit,
+                       unsigned wait);
+
+static lxb_status_t
+prgm_input_uring_reap(prgm_input_ahead_t *ahead);
+#endif
+
+
+prgm_input_ahead_t *
+prgm_input_ahead_create(size_t depth)
+{
+    prgm_input_ahead_t *ahead;
+
+    ahead = lexbor_calloc(1, sizeof(prgm_input_ahead_t));
+    if (ahead == NULL) {
+        return NULL;
+    }
+
+#ifdef PRGM_HAVE_URING
+    if (prgm_input_uring_create(ahead, depth)) {
+        ahead->uring = true;
+        return ahead;
+    }
+#endif
+
+    return prgm_input_thread_create(ahead, depth);
+}
+
+prgm_input_ahead_t *
+prgm_input_ahead_destroy(prgm_input_ahead_t *ahead)
+{
+    if (ahead == NULL) {
+        return NULL;
+    }
+
+#ifdef PRGM_HAVE_URING
+    if (ahead->uring) {
+        prgm_input_uring_destroy(ahead);
+        return lexbor_free(ahead);
+    }
+#endif
+
+    pthread_mutex_lock(&ahead->lock);
+
+    ahead->stop = true;
+    pthread_cond_signal(&ahead->work);
+
+    pthread_mutex_unlock(&ahead->lock);
+
+    (void) pthread_join(ahead->thread, NULL);
+
+    (void) pthread_cond_destroy(&ahead->done);
+    (void) pthread_cond_destroy(&ahead->work);
+    (void) pthread_mutex_destroy(&ahead->lock);
+
+    if (ahead->prefetch != NULL) {
+        lexbor_free(ahead->prefetch);
+    }
+
+    lexbor_free(ahead->queue);
+
+    return lexbor_free(ahead);
+}
+
+lxb_status_t
+prgm_input_ahead_submit(prgm_input_ahead_t *ahead, prgm_input_slot_t *slot)
+{
+#ifdef PRGM_HAVE_URING
+    struct io_uring_sqe *sqe;
+
+    if (ahead->uring) {
+        sqe = prgm_input_uring_sqe(ahead);
+
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = slot->fd;
+        sqe->off = slot->offset;
+        sqe->addr = (uintptr_t) slot->data;
+        sqe->len = (unsigned) slot->size;
+        sqe->user_data = (uintptr_t) slot;
+
+        return prgm_input_uring_enter(ahead, 1, 0);
+    }
+#endif
+
+    pthread_mutex_lock(&ahead->lock);
+
+    ahead->queue[(ahead->queue_head + ahead->queue_length)
+                 % ahead->queue_size] = slot;
+    ahead->queue_length++;
+
+    pthread_cond_signal(&ahead->work);
+    pthread_mutex_unlock(&ahead->lock);
+
+    return LXB_STATUS_OK;
+}
+
+lxb_status_t
+prgm_input_ahead_wait(prgm_input_ahead_t *ahead, prgm_input_slot_t *slot)
+{
+    lxb_status_t status = LXB_STATUS_OK;
+
+#ifdef PRGM_HAVE_URING
+    if (ahead->uring) {
+        while (!slot->done) {
+            status = prgm_input_uring_reap(ahead);
+            if (status != LXB_STATUS_OK) {
+                break;
+            }
+        }
+
+        slot->pending = false;
+
+        /* Short reads are possible, the rest is read here. */
+        if (slot->result > 0 && (size_t) slot->result < slot->size) {
+            prgm_input_slot_read(slot, (size_t) slot->result);
+        }
+
+        return status;
+    }
+#endif
+
+    pthread_mutex_lock(&ahead->lock);
+
+    while (!slot->done) {
+        pthread_cond_wait(&ahead->done, &ahead->lock);
+    }
+
+    pthread_mutex_unlock(&ahead->lock);
+
+    slot->pending = false;
+
+    return status;
+}
+
+/*
+ * Readahead of the first size bytes of a file. Best effort: errors are
+ * ignored and a request is dropped while the previous one is in flight.
+ */
+void
+prgm_input_ahead_prefetch(prgm_input_ahead_t *ahead, const char *path,
+                          size_t size)
+{
+    size_t len;
+
+#ifdef PRGM_HAVE_URING
+    int fd;
+    struct io_uring_sqe *sqe;
+
+    if (ahead->uring) {
+        if (ahead->prefetch_fd >= 0) {
+            return;
+        }
+
+        fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+
+        sqe = prgm_input_uring_sqe(ahead);
+
+        sqe->opcode = IORING_OP_FADVISE;
+        sqe->fd = fd;
+        sqe->off = 0;
+        sqe->len = (unsigned) size;
+        sqe->fadvise_advice = POSIX_FADV_WILLNEED;
+        sqe->user_data = 0;
+
+        /* Closed when the completion is reaped. */
+        ahead->prefetch_fd = fd;
+
+        (void) prgm_input_uring_enter(ahead, 1, 0);
+
+        return;
+    }
+#endif
+
+    pthread_mutex_lock(&ahead->lock);
+
+    if (ahead->prefetch == NULL) {
+        len = strlen(path);
+
+        ahead->prefetch = lexbor_malloc(len + 1);
+        if (ahead->prefetch != NULL) {
+            memcpy(ahead->prefetch, path, len + 1);
+            ahead->prefetch_size = size;
+
+            pthread_cond_signal(&ahead->work);
+        }
+    }
+
+    pthread_mutex_unlock(&ahead->lock);
+}
+
+const char *
+prgm_input_ahead_name(prgm_input_ahead_t *ahead)
+{
+    return (ahead->uring) ? "io_uring" : "thread";
+}
+
+static prgm_input_ahead_t *
+prgm_input_thread_create(prgm_input_ahead_t *ahead, size_t depth)
+{
+    ahead->queue_size = depth;
+
+    ahead->queue = lexbor_calloc(depth, sizeof(prgm_input_slot_t *));
+    if (ahead->queue == NULL) {
+        return lexbor_free(ahead);
+    }
+
+    if (pthread_mutex_init(&ahead->lock, NULL) != 0) {
+        lexbor_free(ahead->queue);
+        return lexbor_free(ahead);
+    }
+
+    if (pthread_cond_init(&ahead->work, NULL) != 0
+        || pthread_cond_init(&ahead->done, NULL) != 0
+        || pthread_create(&ahead->thread, NULL,
+                          prgm_input_thread, ahead) != 0)
+    {
+        (void) pthread_mutex_destroy(&ahead->lock);
+
+        lexbor_free(ahead->queue);
+        return lexbor_free(ahead);
+    }
+
+    return ahead;
+}
+
+static void *
+prgm_input_thread(void *arg)
+{
+    int fd;
+    char *path;
+    size_t size;
+    prgm_input_slot_t *slot;
+    prgm_input_ahead_t *ahead = arg;
+
+    pthread_mutex_lock(&ahead->lock);
+
+    for (;;) {
+        while (ahead->queue_length == 0 && ahead->prefetch == NULL
+               && !ahead->stop)
+        {
+            pthread_cond_wait(&ahead->work, &ahead->lock);
+        }
+
+        /* Reads of the current file go before the prefetch. */
+        if (ahead->queue_length != 0) {
+            slot = ahead->queue[ahead->queue_head];
+
+            ahead->queue_head = (ahead->queue_head + 1) % ahead->queue_size;
+            ahead->queue_length--;
+
+            pthread_mutex_unlock(&ahead->lock);
+
+            prgm_input_slot_read(slot, 0);
+
+            pthread_mutex_lock(&ahead->lock);
+
+            slot->done = true;
+            pthread_cond_broadcast(&ahead->done);
+
+            continue;
+        }
+
+        if (ahead->prefetch != NULL) {
+            path = ahead->prefetch;
+            size = ahead->prefetch_size;
+
+            pthread_mutex_unlock(&ahead->lock);
+
+            fd = open(path, O_RDONLY);
+            if (fd >= 0) {
+                (void) posix_fadvise(fd, 0, (off_t) size,
+                                     POSIX_FADV_WILLNEED);
+                (void) close(fd);
+            }
+
+            pthread_mutex_lock(&ahead->lock);
+
+            ahead->prefetch = lexbor_free(path);
+
+            continue;
+        }
+
+        break;
+    }
+
+    pthread_mutex_unlock(&ahead->lock);
+
+    return NULL;
+}
+
+static void
+prgm_input_slot_read(prgm_input_slot_t *slot, size_t got)
+{
+    ssize_t len;
+
+    while (got < slot->size) {
+        len = pread(slot->fd, slot->data + got, slot->size - got,
+                    (off_t) (slot->offset + got));
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            slot->result = -errno;
+            return;
+        }
+
+        if (len == 0) {
+            break;
+        }
+
+        got += (size_t) len;
+    }
+
+    slot->result = (long) got;
+}
+
+
+#ifdef PRGM_HAVE_URING
+static bool
+prgm_input_uring_create(prgm_input_ahead_t *ahead, size_t depth)
+{
+    int fd;
+    void *ptr;
+    struct io_uring_params params;
+
+    memset(&params, 0, sizeof(struct io_uring_params));
+
+    /* Reads of the ring and one prefetch. */
+    fd = (int) syscall(__NR_io_uring_setup, (unsigned) depth + 1, &params);
+    if (fd < 0) {
+        return false;
+    }
+
+    /* IORING_OP_READ and IORING_OP_FADVISE came in the same kernel. */
+    if ((params.features & IORING_FEAT_RW_CUR_POS) == 0) {
+        (void) close(fd);
+        return false;
+    }
+
+    ahead->ring_fd = fd;
+    ahead->prefetch_fd = -1;
+
+    ahead->sq_size = params.sq_off.array
+                     + params.sq_entries * sizeof(unsigned);
+    ahead->cq_size = params.cq_off.cqes
+                     + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ahead->cq_size > ahead->sq_size) {
+            ahead->sq_size = ahead->cq_size;
+        }
+
+        ahead->cq_size = 0;
+    }
+
+    ptr = mmap(NULL, ahead->sq_size, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ptr == MAP_FAILED) {
+        goto failed;
+    }
+
+    ahead->sq_ptr = ptr;
+    ahead->cq_ptr = ptr;
+
+    if (ahead->cq_size != 0) {
+        ptr = mmap(NULL, ahead->cq_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (ptr == MAP_FAILED) {
+            goto failed;
+        }
+
+        ahead->cq_ptr = ptr;
+    }
+
+    ahead->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    ptr = mmap(NULL, ahead->sqes_size, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ptr == MAP_FAILED) {
+        goto failed;
+    }
+
+    ahead->sqes = ptr;
+
+    ahead->sq_tail = (unsigned *) (ahead->sq_ptr + params.sq_off.tail);
+    ahead->sq_mask = (unsigned *) (ahead->sq_ptr + params.sq_off.ring_mask);
+    ahead->sq_array = (unsigned *) (ahead->sq_ptr + params.sq_off.array);
+
+    ahead->cq_head = (unsigned *) (ahead->cq_ptr + params.cq_off.head);
+    ahead->cq_tail = (unsigned *) (ahead->cq_ptr + params.cq_off.tail);
+    ahead->cq_mask = (unsigned *) (ahead->cq_ptr + params.cq_off.ring_mask);
+    ahead->cqes = (struct io_uring_cqe *) (ahead->cq_ptr
+                                           + params.cq_off.cqes);
+
+    return true;
+
+failed:
+
+    prgm_input_uring_destroy(ahead);
+
+    return false;
+}
+
+static void
+prgm_input_uring_destroy(prgm_input_ahead_t *ahead)
+{
+    /* Slots are drained by the input, only the prefetch can be left. */
+    while (ahead->prefetch_fd >= 0 && ahead->sqes != NULL) {
+        if (prgm_input_uring_reap(ahead) != LXB_STATUS_OK) {
+            break;
+        }
+    }
+
+    if (ahead->prefetch_fd >= 0) {
+        (void) close(ahead->prefetch_fd);
+        ahead->prefetch_fd = -1;
+    }
+
+    if (ahead->sqes != NULL) {
+        (void) munmap(ahead->sqes, ahead->sqes_size);
+    }
+
+    if (ahead->cq_ptr != NULL && ahead->cq_ptr != ahead->sq_ptr) {
+        (void) munmap(ahead->cq_ptr, ahead->cq_size);
+    }
+
+    if (ahead->sq_ptr != NULL) {
+        (void) munmap(ahead->sq_ptr, ahead->sq_size);
+    }
+
+    (void) close(ahead->ring_fd);
+}
+
+/*
+ * The ring has a place for every slot and the prefetch, and every entry
+ * is submitted right away, so there is always a free entry.
+ */
+static struct io_uring_sqe *
+prgm_input_uring_sqe(prgm_input_ahead_t *ahead)
+{
+    unsigned tail, idx;
+    struct io_uring_sqe *sqe;
+
+    tail = *ahead->sq_tail;
+    idx = tail & *ahead->sq_mask;
+
+    sqe = &ahead->sqes[idx];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+    ahead->sq_array[idx] = idx;
+
+    __atomic_store_n(ahead->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    return sqe;
+}
+
+static lxb_status_t
+prgm_input_uring_enter(prgm_input_ahead_t *ahead, unsigned submit,
+                       unsigned wait)
+{
+    long ret;
+    unsigned flags = (wait != 0) ? IORING_ENTER_GETEVENTS : 0;
+
+    do {
+        ret = syscall(__NR_io_uring_enter, ahead->ring_fd, submit, wait,
+                      flags, NULL, 0);
+    }
+    while (ret < 0 && errno == EINTR);
+
+    return (ret < 0) ? LXB_STATUS_ERROR : LXB_STATUS_OK;
+}
+
+/* Takes one completion, waits for it if there is none. */
+static lxb_status_t
+prgm_input_uring_reap(prgm_input_ahead_t *ahead)
+{
+    unsigned head;
+    lxb_status_t status;
+    prgm_input_slot_t *slot;
+    struct io_uring_cqe *cqe;
+
+    head = *ahead->cq_head;
+
+    while (head == __atomic_load_n(ahead->cq_tail, __ATOMIC_ACQUIRE)) {
+        status = prgm_input_uring_enter(ahead, 0, 1);
+        if (status != LXB_STATUS_OK) {
+            return status;
+        }
+    }
+
+    cqe = &ahead->cqes[head & *ahead->cq_mask];
+    slot = (prgm_input_slot_t *) (uintptr_t) cqe->user_data;
+
+    if (slot != NULL) {
+        slot->result = cqe->res;
+        slot->done = true;
+    }
+    else if (ahead->prefetch_fd >= 0) {
+        (void) close(ahead->prefetch_fd);
+        ahead->prefetch_fd = -1;
+    }
+
+    __atomic_store_n(ahead->cq_head, head + 1, __ATOMIC_RELEASE);
+
+    return LXB_STATUS_OK;
+}
+#endif
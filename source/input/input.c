@@ -0,0 +1,421 @@
+/*
+* Copyright (C) 2019 Alexander Borisov
+*
+* Author: Alexander Borisov <borisov@lexbor.com>
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "input.h"
+
+
+static lxb_status_t
+prgm_input_issue(prgm_input_t *input, prgm_input_slot_t *slot);
+
+static void
+prgm_input_drain(prgm_input_t *input);
+
+static lxb_status_t
+prgm_input_ahead_next(prgm_input_t *input, const lxb_char_t **data,
+                      size_t *size);
+
+
+lxb_status_t
+prgm_input_init(prgm_input_t *input, prgm_input_type_t type,
+                size_t block_size, size_t depth)
+{
+    size_t i;
+
+    if (input == NULL) {
+        return LXB_STATUS_ERROR_OBJECT_IS_NULL;
+    }
+
+    if (block_size < PRGM_INPUT_BLOCK_SIZE_MIN
+        || block_size > PRGM_INPUT_BLOCK_SIZE_MAX
+        || depth == 0 || depth > PRGM_INPUT_DEPTH_MAX)
+    {
+        return LXB_STATUS_ERROR_WRONG_ARGS;
+    }
+
+    memset(input, 0, sizeof(prgm_input_t));
+
+    input->type = type;
+    input->block_size = block_size;
+    input->depth = depth;
+    input->fd = -1;
+
+    if (type != PRGM_INPUT_URING) {
+        return LXB_STATUS_OK;
+    }
+
+    input->slots = lexbor_calloc(depth, sizeof(prgm_input_slot_t));
+    if (input->slots == NULL) {
+        return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+    }
+
+    for (i = 0; i < depth; i++) {
+        input->slots[i].data = lexbor_malloc(block_size);
+        if (input->slots[i].data == NULL) {
+            return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+        }
+    }
+
+    input->ahead = prgm_input_ahead_create(depth);
+    if (input->ahead == NULL) {
+        return LXB_STATUS_ERROR;
+    }
+
+    return LXB_STATUS_OK;
+}
+
+prgm_input_t *
+prgm_input_destroy(prgm_input_t *input, bool self_destroy)
+{
+    size_t i;
+
+    if (input == NULL) {
+        return NULL;
+    }
+
+    prgm_input_close(input);
+
+    if (input->buf != NULL) {
+        input->buf = lexbor_free(input->buf);
+    }
+
+    input->ahead = prgm_input_ahead_destroy(input->ahead);
+
+    if (input->slots != NULL) {
+        for (i = 0; i < input->depth; i++) {
+            lexbor_free(input->slots[i].data);
+        }
+
+        input->slots = lexbor_free(input->slots);
+    }
+
+    if (self_destroy) {
+        return lexbor_free(input);
+    }
+
+    return input;
+}
+
+lxb_status_t
+prgm_input_open(prgm_input_t *input, const char *path)
+{
+    void *map;
+    struct stat st;
+
+    prgm_input_close(input);
+
+    input->fd = open(path, O_RDONLY);
+    if (input->fd < 0) {
+        return LXB_STATUS_ERROR_NOT_EXISTS;
+    }
+
+    if (fstat(input->fd, &st) != 0) {
+        prgm_input_close(input);
+        return LXB_STATUS_ERROR;
+    }
+
+    input->file_size = (size_t) st.st_size;
+
+    if (input->type == PRGM_INPUT_MMAP && input->file_size != 0) {
+        map = mmap(NULL, input->file_size, PROT_READ, MAP_PRIVATE,
+                   input->fd, 0);
+        if (map != MAP_FAILED) {
+            input->map = map;
+
+            (void) madvise(map, input->file_size, MADV_SEQUENTIAL);
+        }
+    }
+
+    /* Files that can not be mapped are read. */
+    if (input->map == NULL && input->slots == NULL && input->buf == NULL) {
+        input->buf = lexbor_malloc(input->block_size);
+        if (input->buf == NULL) {
+            prgm_input_close(input);
+            return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+        }
+    }
+
+    prgm_input_range(input, 0, SIZE_MAX);
+
+    return LXB_STATUS_OK;
+}
+
+void
+prgm_input_close(prgm_input_t *input)
+{
+    prgm_input_drain(input);
+
+    if (input->map != NULL) {
+        (void) munmap(input->map, input->file_size);
+        input->map = NULL;
+    }
+
+    if (input->fd >= 0) {
+        (void) close(input->fd);
+        input->fd = -1;
+    }
+
+    input->file_size = 0;
+    input->pos = 0;
+    input->end = 0;
+}
+
+/*
+ * The end is exclusive, SIZE_MAX or anything past the file is the end
+ * of the file.
+ */
+void
+prgm_input_range(prgm_input_t *input, size_t begin, size_t end)
+{
+    if (end > input->file_size) {
+        end = input->file_size;
+    }
+
+    if (begin > end) {
+        begin = end;
+    }
+
+    prgm_input_drain(input);
+
+    input->pos = begin;
+    input->end = end;
+
+    if (input->map == NULL && input->fd >= 0) {
+        (void) posix_fadvise(input->fd, (off_t) begin, (off_t) (end - begin),
+                             POSIX_FADV_SEQUENTIAL);
+    }
+
+    if (input->slots != NULL) {
+        input->head = 0;
+        input->issued = begin;
+        input->taken = false;
+    }
+}
+
+/*
+ * Returns the next block of the range, size is 0 at the end.
+ * A block stays valid until the next call.
+ */
+lxb_status_t
+prgm_input_next(prgm_input_t *input, const lxb_char_t **data, size_t *size)
+{
+    ssize_t len;
+    size_t left;
+
+    left = input->end - input->pos;
+
+    if (left > input->block_size) {
+        left = input->block_size;
+    }
+
+    if (left == 0) {
+        *data = NULL;
+        *size = 0;
+
+        return LXB_STATUS_OK;
+    }
+
+    if (input->slots != NULL) {
+        return prgm_input_ahead_next(input, data, size);
+    }
+
+    if (input->map != NULL) {
+        *data = input->map + input->pos;
+        *size = left;
+
+        input->pos += left;
+
+        return LXB_STATUS_OK;
+    }
+
+    do {
+        len = pread(input->fd, input->buf, left, (off_t) input->pos);
+    }
+    while (len < 0 && errno == EINTR);
+
+    if (len < 0) {
+        return LXB_STATUS_ERROR;
+    }
+
+    /* The file was truncated after open. */
+    if (len == 0) {
+        input->end = input->pos;
+    }
+
+    *data = input->buf;
+    *size = (size_t) len;
+
+    input->pos += (size_t) len;
+
+    return LXB_STATUS_OK;
+}
+
+/*
+ * Asks the backend to bring the start of a file that will be read soon
+ * into the page cache. Only for PRGM_INPUT_URING, others do nothing.
+ */
+void
+prgm_input_prefetch(prgm_input_t *input, const char *path)
+{
+    if (input->ahead != NULL && path != NULL) {
+        prgm_input_ahead_prefetch(input->ahead, path,
+                                  input->block_size * input->depth);
+    }
+}
+
+const char *
+prgm_input_backend(prgm_input_t *input)
+{
+    switch (input->type) {
+        case PRGM_INPUT_MMAP:
+            return "mmap";
+
+        case PRGM_INPUT_READ:
+            return "read";
+
+        default:
+            return prgm_input_ahead_name(input->ahead);
+    }
+}
+
+/* Bytes of read buffers, a mapping is not counted. */
+size_t
+prgm_input_memory(prgm_input_t *input)
+{
+    if (input->slots != NULL) {
+        return input->block_size * input->depth;
+    }
+
+    return (input->buf != NULL) ? input->block_size : 0;
+}
+
+bool
+prgm_input_type_by_name(const char *name, prgm_input_type_t *type)
+{
+    if (strcmp(name, "mmap") == 0) {
+        *type = PRGM_INPUT_MMAP;
+    }
+    else if (strcmp(name, "read") == 0) {
+        *type = PRGM_INPUT_READ;
+    }
+    else if (strcmp(name, "uring") == 0) {
+        *type = PRGM_INPUT_URING;
+    }
+    else {
+        return false;
+    }
+
+    return true;
+}
+
+static lxb_status_t
+prgm_input_issue(prgm_input_t *input, prgm_input_slot_t *slot)
+{
+    size_t left = input->end - input->issued;
+
+    if (left == 0) {
+        return LXB_STATUS_OK;
+    }
+
+    slot->fd = input->fd;
+    slot->offset = input->issued;
+    slot->size = (left < input->block_size) ? left : input->block_size;
+    slot->result = 0;
+    slot->done = false;
+    slot->pending = true;
+
+    input->issued += slot->size;
+
+    return prgm_input_ahead_submit(input->ahead, slot);
+}
+
+/* Waits for reads still in flight, their buffers must not be reused. */
+static void
+prgm_input_drain(prgm_input_t *input)
+{
+    size_t i;
+
+    if (input->slots == NULL) {
+        return;
+    }
+
+    for (i = 0; i < input->depth; i++) {
+        if (input->slots[i].pending) {
+            (void) prgm_input_ahead_wait(input->ahead, &input->slots[i]);
+        }
+    }
+}
+
+/*
+ * Slots form a ring in file order. The slot given to the caller last
+ * time is refilled with the next unread block before waiting for the
+ * slot at head, so depth - 1 reads are in flight while the caller works.
+ */
+static lxb_status_t
+prgm_input_ahead_next(prgm_input_t *input, const lxb_char_t **data,
+                      size_t *size)
+{
+    size_t i;
+    lxb_status_t status;
+    prgm_input_slot_t *slot;
+
+    if (input->taken) {
+        input->taken = false;
+
+        slot = &input->slots[(input->head + input->depth - 1) % input->depth];
+
+        status = prgm_input_issue(input, slot);
+        if (status != LXB_STATUS_OK) {
+            return status;
+        }
+    }
+    else if (input->issued == input->pos) {
+        /* A new range, fill the whole ring. */
+        for (i = 0; i < input->depth; i++) {
+            status = prgm_input_issue(input, &input->slots[i]);
+            if (status != LXB_STATUS_OK) {
+                return status;
+            }
+        }
+    }
+
+    *data = NULL;
+    *size = 0;
+
+    slot = &input->slots[input->head];
+
+    if (!slot->pending || slot->offset != input->pos) {
+        return LXB_STATUS_OK;
+    }
+
+    status = prgm_input_ahead_wait(input->ahead, slot);
+    if (status != LXB_STATUS_OK || slot->result < 0) {
+        return LXB_STATUS_ERROR;
+    }
+
+    /* The file was truncated after open. */
+    if ((size_t) slot->result < slot->size) {
+        input->end = input->pos + (size_t) slot->result;
+
+        if (slot->result == 0) {
+            return LXB_STATUS_OK;
+        }
+    }
+
+    *data = slot->data;
+    *size = (size_t) slot->result;
+
+    input->pos += (size_t) slot->result;
+    input->head = (input->head + 1) % input->depth;
+    input->taken = true;
+
+    return LXB_STATUS_OK;
+}
@@ -0,0 +1,132 @@
+/*
+* Copyright (C) 2019 Alexander Borisov
+*
+* Author: Alexander Borisov <borisov@lexbor.com>
+*/
+
+#ifndef PRGM_LOG_H
+#define PRGM_LOG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "lexbor/utils/base.h"
+
+#include <stdarg.h>
+#include <pthread.h>
+
+
+#define PRGM_LOG_BLOCK_SIZE (4096 * 16)
+#define PRGM_LOG_BLOCKS     4
+#define PRGM_LOG_CRASH_BUFS 1024  /* buffers a crash flush can reach */
+
+
+typedef enum {
+    PRGM_LOG_ERROR   = 0,   /* errors */
+    PRGM_LOG_SUMMARY = 0,   /* final totals, always with errors */
+    PRGM_LOG_INFO    = 1,   /* one line per file */
+    PRGM_LOG_RECORD  = 2,   /* one line per record */
+    PRGM_LOG_DEBUG   = 3    /* HTML fragments, encoding details */
+}
+prgm_log_level_t;
+
+typedef struct prgm_log prgm_log_t;
+typedef struct prgm_log_buf prgm_log_buf_t;
+typedef struct prgm_log_block prgm_log_block_t;
+
+struct prgm_log_block {
+    lxb_char_t       *data;
+    size_t           length;    /* atomic, read by the crash flush */
+    size_t           size;
+    size_t           seq;       /* order of the owner's blocks */
+
+    prgm_log_buf_t   *owner;   /* NULL for one-off oversized messages */
+    prgm_log_block_t *next;
+};
+
+/*
+ * Per-thread ring of blocks. The owner thread fills the current block,
+ * full blocks go to the writer thread and come back to the free list.
+ */
+struct prgm_log_buf {
+    prgm_log_t       *log;
+
+    prgm_log_block_t blocks[PRGM_LOG_BLOCKS];
+    prgm_log_block_t *free[PRGM_LOG_BLOCKS];
+    size_t           free_length;
+
+    prgm_log_block_t *cur;
+    size_t           seq;       /* of the next block taken */
+
+    prgm_log_buf_t   *next;
+};
+
+struct prgm_log {
+    FILE             *fh;
+    int              fd;        /* of fh, for the crash flush */
+    prgm_log_level_t level;
+
+    pthread_t        writer;
+    pthread_mutex_t  lock;
+    pthread_cond_t   cond;      /* writer waits for blocks */
+    pthread_cond_t   done;      /* owners wait for free blocks and drain */
+
+    prgm_log_block_t *head;
+    prgm_log_block_t *tail;
+    size_t           busy;      /* blocks taken by the writer */
+
+    prgm_log_buf_t   *bufs;
+
+    /* Written before the length, read without locks. */
+    prgm_log_buf_t   *crash[PRGM_LOG_CRASH_BUFS];
+    size_t           crash_length;
+
+    bool             running;
+    bool             stop;
+};
+
+
+lxb_status_t
+prgm_log_init(prgm_log_t *log, const char *path, prgm_log_level_t level);
+
+prgm_log_t *
+prgm_log_destroy(prgm_log_t *log, bool self_destroy);
+
+prgm_log_buf_t *
+prgm_log_buf_create(prgm_log_t *log);
+
+void
+prgm_log_buf_flush(prgm_log_buf_t *buf);
+
+void
+prgm_log_printf(prgm_log_buf_t *buf, const char *format, ...);
+
+void
+prgm_log_vprintf(prgm_log_buf_t *buf, const char *format, va_list args);
+
+void
+prgm_log_flush(prgm_log_t *log);
+
+void
+prgm_log_crash_flush(prgm_log_t *log);
+
+lxb_status_t
+prgm_log_shared(prgm_log_t *log);
+
+
+/*
+ * Inline functions
+ */
+lxb_inline bool
+prgm_log_enabled(prgm_log_buf_t *buf, prgm_log_level_t level)
+{
+    return level <= buf->log->level;
+}
+
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* PRGM_LOG_H */
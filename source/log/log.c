@@ -0,0 +1,456 @@
+/*
+* Copyright (C) 2019 Alexander Borisov
+*
+* Author: Alexander Borisov <borisov@lexbor.com>
+*/
+
+#include <unistd.h>
+
+#include "log.h"
+
+
+static void *
+prgm_log_writer(void *arg);
+
+static void
+prgm_log_submit(prgm_log_t *log, prgm_log_block_t *block);
+
+static prgm_log_block_t *
+prgm_log_block_take(prgm_log_buf_t *buf);
+
+static void
+prgm_log_block_release(prgm_log_block_t *block);
+
+
+lxb_status_t
+prgm_log_init(prgm_log_t *log, const char *path, prgm_log_level_t level)
+{
+    if (log == NULL) {
+        return LXB_STATUS_ERROR_OBJECT_IS_NULL;
+    }
+
+    memset(log, 0, sizeof(prgm_log_t));
+
+    log->fd = -1;
+    log->level = level;
+
+    log->fh = fopen(path, "ab");
+    if (log->fh == NULL) {
+        return LXB_STATUS_ERROR;
+    }
+
+    log->fd = fileno(log->fh);
+
+    if (pthread_mutex_init(&log->lock, NULL) != 0
+        || pthread_cond_init(&log->cond, NULL) != 0
+        || pthread_cond_init(&log->done, NULL) != 0)
+    {
+        fclose(log->fh);
+        log->fh = NULL;
+
+        return LXB_STATUS_ERROR;
+    }
+
+    /* Without the writer thread blocks are written on submit. */
+    log->running = pthread_create(&log->writer, NULL,
+                                  prgm_log_writer, log) == 0;
+
+    return LXB_STATUS_OK;
+}
+
+prgm_log_t *
+prgm_log_destroy(prgm_log_t *log, bool self_destroy)
+{
+    size_t i;
+    prgm_log_buf_t *buf, *next;
+
+    if (log == NULL || log->fh == NULL) {
+        return NULL;
+    }
+
+    prgm_log_flush(log);
+
+    /* Buffers go away, a crash from now on writes nothing. */
+    __atomic_store_n(&log->crash_length, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&log->fd, -1, __ATOMIC_RELEASE);
+
+    if (log->running) {
+        pthread_mutex_lock(&log->lock);
+
+        log->stop = true;
+        pthread_cond_signal(&log->cond);
+
+        pthread_mutex_unlock(&log->lock);
+
+        (void) pthread_join(log->writer, NULL);
+
+        log->running = false;
+    }
+
+    for (buf = log->bufs; buf != NULL; buf = next) {
+        next = buf->next;
+
+        for (i = 0; i < PRGM_LOG_BLOCKS; i++) {
+            lexbor_free(buf->blocks[i].data);
+        }
+
+        lexbor_free(buf);
+    }
+
+    fclose(log->fh);
+    log->fh = NULL;
+
+    (void) pthread_cond_destroy(&log->done);
+    (void) pthread_cond_destroy(&log->cond);
+    (void) pthread_mutex_destroy(&log->lock);
+
+    if (self_destroy) {
+        return lexbor_free(log);
+    }
+
+    return log;
+}
+
+prgm_log_buf_t *
+prgm_log_buf_create(prgm_log_t *log)
+{
+    size_t i;
+    prgm_log_buf_t *buf;
+
+    buf = lexbor_calloc(1, sizeof(prgm_log_buf_t));
+    if (buf == NULL) {
+        return NULL;
+    }
+
+    buf->log = log;
+
+    for (i = 0; i < PRGM_LOG_BLOCKS; i++) {
+        buf->blocks[i].data = lexbor_malloc(PRGM_LOG_BLOCK_SIZE);
+        if (buf->blocks[i].data == NULL) {
+            while (i != 0) {
+                lexbor_free(buf->blocks[--i].data);
+            }
+
+            return lexbor_free(buf);
+        }
+
+        buf->blocks[i].size = PRGM_LOG_BLOCK_SIZE;
+        buf->blocks[i].owner = buf;
+    }
+
+    buf->cur = &buf->blocks[0];
+    buf->cur->seq = buf->seq++;
+
+    for (i = 1; i < PRGM_LOG_BLOCKS; i++) {
+        buf->free[buf->free_length++] = &buf->blocks[i];
+    }
+
+    pthread_mutex_lock(&log->lock);
+
+    buf->next = log->bufs;
+    log->bufs = buf;
+
+    /* Buffers over the limit are not written on a crash. */
+    i = log->crash_length;
+
+    if (i < PRGM_LOG_CRASH_BUFS) {
+        __atomic_store_n(&log->crash[i], buf, __ATOMIC_RELEASE);
+        __atomic_store_n(&log->crash_length, i + 1, __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_unlock(&log->lock);
+
+    return buf;
+}
+
+void
+prgm_log_buf_flush(prgm_log_buf_t *buf)
+{
+    if (buf->cur->length == 0) {
+        return;
+    }
+
+    prgm_log_submit(buf->log, buf->cur);
+
+    buf->cur = prgm_log_block_take(buf);
+}
+
+void
+prgm_log_printf(prgm_log_buf_t *buf, const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    prgm_log_vprintf(buf, format, args);
+    va_end(args);
+}
+
+/*
+ * Every message is one line, the new line is added here.
+ */
+void
+prgm_log_vprintf(prgm_log_buf_t *buf, const char *format, va_list args)
+{
+    int len;
+    va_list copy;
+    prgm_log_block_t *block;
+
+    block = buf->cur;
+
+    va_copy(copy, args);
+    len = vsnprintf((char *) block->data + block->length,
+                    block->size - block->length, format, copy);
+    va_end(copy);
+
+    if (len < 0) {
+        return;
+    }
+
+    if ((size_t) len < block->size - block->length) {
+        block->data[block->length + len] = '\n';
+
+        __atomic_store_n(&block->length, block->length + len + 1,
+                         __ATOMIC_RELEASE);
+        return;
+    }
+
+    /* Keep lines in order: what is buffered goes first. */
+    prgm_log_buf_flush(buf);
+
+    if ((size_t) len < buf->cur->size) {
+        block = buf->cur;
+
+        (void) vsnprintf((char *) block->data, block->size, format, args);
+
+        block->data[len] = '\n';
+
+        __atomic_store_n(&block->length, len + 1, __ATOMIC_RELEASE);
+        return;
+    }
+
+    block = lexbor_malloc(sizeof(prgm_log_block_t) + len + 1);
+    if (block == NULL) {
+        return;
+    }
+
+    block->data = (lxb_char_t *) block + sizeof(prgm_log_block_t);
+    block->size = len + 1;
+    block->owner = NULL;
+
+    (void) vsnprintf((char *) block->data, block->size, format, args);
+
+    block->data[len] = '\n';
+    block->length = len + 1;
+
+    prgm_log_submit(buf->log, block);
+}
+
+/*
+ * Writes everything buffered by all threads and waits for the writer.
+ * Owners of the buffers must not log at the same time.
+ */
+void
+prgm_log_flush(prgm_log_t *log)
+{
+    prgm_log_buf_t *buf;
+
+    for (buf = log->bufs; buf != NULL; buf = buf->next) {
+        prgm_log_buf_flush(buf);
+    }
+
+    pthread_mutex_lock(&log->lock);
+
+    while (log->head != NULL || log->busy != 0) {
+        pthread_cond_wait(&log->done, &log->lock);
+    }
+
+    pthread_mutex_unlock(&log->lock);
+}
+
+/*
+ * For fatal signal handlers: only async-signal-safe calls, no locks and no
+ * stdio, best effort only. Buffers are reached through the array filled
+ * on create, their blocks are written in the order they were filled.
+ * Lines of a block that the writer has in flight can be lost or repeated,
+ * oversized one-off messages waiting for the writer are lost.
+ */
+void
+prgm_log_crash_flush(prgm_log_t *log)
+{
+    int fd;
+    size_t i, j, count, length, seq, first, block_seq;
+    prgm_log_buf_t *buf;
+    prgm_log_block_t *block, *next;
+
+    if (log == NULL) {
+        return;
+    }
+
+    fd = __atomic_load_n(&log->fd, __ATOMIC_ACQUIRE);
+    if (fd < 0) {
+        return;
+    }
+
+    count = __atomic_load_n(&log->crash_length, __ATOMIC_ACQUIRE);
+
+    for (i = 0; i < count; i++) {
+        buf = __atomic_load_n(&log->crash[i], __ATOMIC_ACQUIRE);
+
+        for (seq = 0;; seq = first + 1) {
+            next = NULL;
+            first = SIZE_MAX;
+
+            for (j = 0; j < PRGM_LOG_BLOCKS; j++) {
+                block = &buf->blocks[j];
+                block_seq = __atomic_load_n(&block->seq, __ATOMIC_RELAXED);
+
+                if (block_seq >= seq && block_seq < first) {
+                    next = block;
+                    first = block_seq;
+                }
+            }
+
+            if (next == NULL) {
+                break;
+            }
+
+            length = __atomic_load_n(&next->length, __ATOMIC_ACQUIRE);
+            if (length != 0) {
+                (void) write(fd, next->data, length);
+            }
+        }
+    }
+}
+
+/*
+ * The file is appended by several processes. Every block goes out with
+ * one write(2), blocks hold whole lines, so lines do not mix. Must be
+ * called before anything is logged.
+ */
+lxb_status_t
+prgm_log_shared(prgm_log_t *log)
+{
+    if (setvbuf(log->fh, NULL, _IONBF, 0) != 0) {
+        return LXB_STATUS_ERROR;
+    }
+
+    return LXB_STATUS_OK;
+}
+
+static void
+prgm_log_submit(prgm_log_t *log, prgm_log_block_t *block)
+{
+    block->next = NULL;
+
+    pthread_mutex_lock(&log->lock);
+
+    if (!log->running) {
+        (void) fwrite(block->data, 1, block->length, log->fh);
+        (void) fflush(log->fh);
+
+        prgm_log_block_release(block);
+
+        pthread_mutex_unlock(&log->lock);
+
+        return;
+    }
+
+    if (log->tail != NULL) {
+        log->tail->next = block;
+    }
+    else {
+        log->head = block;
+    }
+
+    log->tail = block;
+
+    pthread_cond_signal(&log->cond);
+    pthread_mutex_unlock(&log->lock);
+}
+
+static prgm_log_block_t *
+prgm_log_block_take(prgm_log_buf_t *buf)
+{
+    prgm_log_block_t *block;
+    prgm_log_t *log = buf->log;
+
+    pthread_mutex_lock(&log->lock);
+
+    while (buf->free_length == 0) {
+        pthread_cond_wait(&log->done, &log->lock);
+    }
+
+    block = buf->free[--buf->free_length];
+
+    pthread_mutex_unlock(&log->lock);
+
+    __atomic_store_n(&block->length, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&block->seq, buf->seq++, __ATOMIC_RELAXED);
+
+    return block;
+}
+
+/* Must be called with the lock held. */
+static void
+prgm_log_block_release(prgm_log_block_t *block)
+{
+    prgm_log_buf_t *buf = block->owner;
+
+    if (buf == NULL) {
+        lexbor_free(block);
+        return;
+    }
+
+    __atomic_store_n(&block->length, 0, __ATOMIC_RELEASE);
+    buf->free[buf->free_length++] = block;
+}
+
+static void *
+prgm_log_writer(void *arg)
+{
+    prgm_log_t *log = arg;
+    prgm_log_block_t *block, *next;
+
+    pthread_mutex_lock(&log->lock);
+
+    for (;;) {
+        while (log->head == NULL && !log->stop) {
+            pthread_cond_wait(&log->cond, &log->lock);
+        }
+
+        if (log->head == NULL) {
+            break;
+        }
+
+        /* Take the whole queue and write it with one flush. */
+        block = log->head;
+
+        log->head = NULL;
+        log->tail = NULL;
+        log->busy = 1;
+
+        pthread_mutex_unlock(&log->lock);
+
+        for (next = block; next != NULL; next = next->next) {
+            (void) fwrite(next->data, 1, next->length, log->fh);
+        }
+
+        (void) fflush(log->fh);
+
+        pthread_mutex_lock(&log->lock);
+
+        while (block != NULL) {
+            next = block->next;
+            prgm_log_block_release(block);
+            block = next;
+        }
+
+        log->busy = 0;
+
+        pthread_cond_broadcast(&log->done);
+    }
+
+    pthread_mutex_unlock(&log->lock);
+
+    return NULL;
+}
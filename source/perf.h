@@ -0,0 +1,54 @@
+/*
+* Copyright (C) 2019 Alexander Borisov
+*
+* Author: Alexander Borisov <borisov@lexbor.com>
+*/
+
+#ifndef PRGM_PERF_H
+#define PRGM_PERF_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "lexbor/utils/base.h"
+
+#include <stdint.h>
+
+
+typedef enum {
+    PRGM_PERF_CYCLES = 0,
+    PRGM_PERF_INSTRUCTIONS,
+    PRGM_PERF_CACHE_MISSES,
+    PRGM_PERF_BRANCH_MISSES,
+    PRGM_PERF_LAST
+}
+prgm_perf_counter_t;
+
+/*
+ * Hardware counters of the calling thread, user space only, opened as one
+ * group through Linux perf_event_open, so they are read together.
+ */
+typedef struct prgm_perf prgm_perf_t;
+
+
+/* NULL if the kernel or the CPU does not give the counters. */
+prgm_perf_t *
+prgm_perf_create(void);
+
+prgm_perf_t *
+prgm_perf_destroy(prgm_perf_t *perf);
+
+/* PRGM_PERF_LAST values counted since create. */
+lxb_status_t
+prgm_perf_read(prgm_perf_t *perf, uint64_t *values);
+
+const char *
+prgm_perf_name(prgm_perf_counter_t counter);
+
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* PRGM_PERF_H */
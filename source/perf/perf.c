@@ -0,0 +1,147 @@
+/*
+* Copyright (C) 2019 Alexander Borisov
+*
+* Author: Alexander Borisov <borisov@lexbor.com>
+*/
+
+#include <unistd.h>
+
+#ifdef PRGM_HAVE_PERF_EVENT
+    #include <sys/ioctl.h>
+    #include <sys/syscall.h>
+    #include <linux/perf_event.h>
+
+    #ifndef __NR_perf_event_open
+        #undef PRGM_HAVE_PERF_EVENT
+    #endif
+#endif
+
+#include "perf.h"
+
+
+struct prgm_perf {
+    int fd[PRGM_PERF_LAST];
+};
+
+
+static const char *prgm_perf_names[PRGM_PERF_LAST] = {
+    "cycles", "instructions", "cache_misses", "branch_misses"
+};
+
+
+#ifdef PRGM_HAVE_PERF_EVENT
+
+static const uint64_t prgm_perf_configs[PRGM_PERF_LAST] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES
+};
+
+
+static int
+prgm_perf_open(uint64_t config, int group)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(struct perf_event_attr));
+
+    attr.size = sizeof(struct perf_event_attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = (group == -1);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+
+    /* This thread on any CPU. */
+    return (int) syscall(__NR_perf_event_open, &attr, 0, -1, group,
+                         PERF_FLAG_FD_CLOEXEC);
+}
+
+#endif
+
+/*
+ * Not permitted by perf_event_paranoid, no PMU in a virtual machine or not
+ * Linux: all of them are NULL and the caller keeps only the timing.
+ */
+prgm_perf_t *
+prgm_perf_create(void)
+{
+#ifdef PRGM_HAVE_PERF_EVENT
+    size_t i;
+    prgm_perf_t *perf;
+
+    perf = lexbor_malloc(sizeof(prgm_perf_t));
+    if (perf == NULL) {
+        return NULL;
+    }
+
+    for (i = 0; i < PRGM_PERF_LAST; i++) {
+        perf->fd[i] = prgm_perf_open(prgm_perf_configs[i],
+                                     (i == 0) ? -1 : perf->fd[0]);
+        if (perf->fd[i] == -1) {
+            while (i != 0) {
+                close(perf->fd[--i]);
+            }
+
+            return lexbor_free(perf);
+        }
+    }
+
+    if (ioctl(perf->fd[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP) != 0
+        || ioctl(perf->fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP)
+           != 0)
+    {
+        return prgm_perf_destroy(perf);
+    }
+
+    return perf;
+#else
+    return NULL;
+#endif
+}
+
+prgm_perf_t *
+prgm_perf_destroy(prgm_perf_t *perf)
+{
+    size_t i;
+
+    if (perf == NULL) {
+        return NULL;
+    }
+
+    for (i = PRGM_PERF_LAST; i != 0; i--) {
+        close(perf->fd[i - 1]);
+    }
+
+    return lexbor_free(perf);
+}
+
+/* One read(2) for the whole group: nr, then the values in open order. */
+lxb_status_t
+prgm_perf_read(prgm_perf_t *perf, uint64_t *values)
+{
+    ssize_t size;
+    uint64_t buf[PRGM_PERF_LAST + 1];
+
+    size = read(perf->fd[0], buf, sizeof(buf));
+
+    if (size != (ssize_t) sizeof(buf) || buf[0] != PRGM_PERF_LAST) {
+        return LXB_STATUS_ERROR;
+    }
+
+    memcpy(values, &buf[1], sizeof(uint64_t) * PRGM_PERF_LAST);
+
+    return LXB_STATUS_OK;
+}
+
+const char *
+prgm_perf_name(prgm_perf_counter_t counter)
+{
+    if (counter >= PRGM_PERF_LAST) {
+        return "unknown";
+    }
+
+    return prgm_perf_names[counter];
+}
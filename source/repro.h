@@ -0,0 +1,53 @@
+/*
+* Copyright (C) 2019 Alexander Borisov
+*
+* Author: Alexander Borisov <borisov@lexbor.com>
+*/
+
+#ifndef PRGM_REPRO_H
+#define PRGM_REPRO_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "lexbor/utils/base.h"
+
+
+#define PRGM_REPRO_READ_SIZE (64 * 1024)
+
+
+/*
+ * One gzip member of a WARC file, read and inflated without the WARC or
+ * HTML parsers: the record in it may be the one that crashed them.
+ */
+typedef struct {
+    lxb_char_t *compressed;
+    size_t     compressed_length;
+
+    lxb_char_t *data;            /* inflated */
+    size_t     length;
+    size_t     size;
+
+    size_t     next;             /* offset of the member after it */
+}
+prgm_repro_member_t;
+
+
+lxb_status_t
+prgm_repro_member_read(prgm_repro_member_t *member, const char *path,
+                       size_t offset);
+
+prgm_repro_member_t *
+prgm_repro_member_destroy(prgm_repro_member_t *member, bool self_destroy);
+
+lxb_status_t
+prgm_repro_save(const prgm_repro_member_t *member, const char *dir,
+                const lxb_char_t *path, size_t record);
+
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* PRGM_REPRO_H */
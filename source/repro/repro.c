@@ -0,0 +1,302 @@
+/*
+* Copyright (C) 2019 Alexander Borisov
+*
+* Author: Alexander Borisov <borisov@lexbor.com>
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include <zlib.h>
+
+#include <lexbor/core/conv.h>
+#include <lexbor/core/str.h>
+
+#include "gzip.h"
+#include "repro.h"
+
+
+static lxb_status_t
+prgm_repro_grow(lxb_char_t **data, size_t *size, size_t need);
+
+static void
+prgm_repro_content(const prgm_repro_member_t *member,
+                   const lxb_char_t **data, size_t *length);
+
+static lxb_status_t
+prgm_repro_write(const char *dir, const lxb_char_t *path, size_t record,
+                 const char *ext, const lxb_char_t *data, size_t length);
+
+
+/*
+ * Inflates the member at offset to its end, so next is exact even if the
+ * data after it only looks like a gzip header.
+ */
+lxb_status_t
+prgm_repro_member_read(prgm_repro_member_t *member, const char *path,
+                       size_t offset)
+{
+    int ret;
+    FILE *fh;
+    size_t size, read_length;
+    z_stream stream;
+    lxb_status_t status;
+
+    memset(member, 0, sizeof(prgm_repro_member_t));
+    memset(&stream, 0, sizeof(z_stream));
+
+    fh = fopen(path, "rb");
+    if (fh == NULL) {
+        return LXB_STATUS_ERROR_NOT_EXISTS;
+    }
+
+    if (fseek(fh, (long) offset, SEEK_SET) != 0) {
+        fclose(fh);
+        return LXB_STATUS_ERROR;
+    }
+
+    if (inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK) {
+        fclose(fh);
+        return LXB_STATUS_ERROR;
+    }
+
+    size = 0;
+    read_length = 0;
+    ret = Z_OK;
+    status = LXB_STATUS_OK;
+
+    while (ret != Z_STREAM_END) {
+        if (stream.avail_in == 0) {
+            status = prgm_repro_grow(&member->compressed, &size,
+                                     read_length + PRGM_REPRO_READ_SIZE);
+            if (status != LXB_STATUS_OK) {
+                goto done;
+            }
+
+            /* The buffer could move, total_in says where we are. */
+            stream.next_in = member->compressed + stream.total_in;
+            stream.avail_in = (uInt) fread(member->compressed + read_length,
+                                           1, PRGM_REPRO_READ_SIZE, fh);
+
+            read_length += stream.avail_in;
+
+            if (stream.avail_in == 0) {
+                /* Cut by the end of the file. */
+                status = LXB_STATUS_ERROR_UNEXPECTED_DATA;
+                goto done;
+            }
+        }
+
+        if (member->length == member->size) {
+            status = prgm_repro_grow(&member->data, &member->size,
+                                     member->size * 2 + PRGM_REPRO_READ_SIZE);
+            if (status != LXB_STATUS_OK) {
+                goto done;
+            }
+
+            if (member->size > PRGM_GZIP_MEMBER_MAX) {
+                status = LXB_STATUS_ERROR_OVERFLOW;
+                goto done;
+            }
+        }
+
+        stream.next_out = member->data + member->length;
+        stream.avail_out = (uInt) (member->size - member->length);
+
+        ret = inflate(&stream, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END) {
+            status = LXB_STATUS_ERROR_UNEXPECTED_DATA;
+            goto done;
+        }
+
+        member->length = member->size - stream.avail_out;
+    }
+
+    member->compressed_length = stream.total_in;
+    member->next = offset + stream.total_in;
+
+done:
+
+    (void) inflateEnd(&stream);
+    fclose(fh);
+
+    return status;
+}
+
+prgm_repro_member_t *
+prgm_repro_member_destroy(prgm_repro_member_t *member, bool self_destroy)
+{
+    if (member == NULL) {
+        return NULL;
+    }
+
+    if (member->compressed != NULL) {
+        member->compressed = lexbor_free(member->compressed);
+    }
+
+    if (member->data != NULL) {
+        member->data = lexbor_free(member->data);
+    }
+
+    member->compressed_length = 0;
+    member->length = 0;
+    member->size = 0;
+
+    if (self_destroy) {
+        return lexbor_free(member);
+    }
+
+    return member;
+}
+
+static lxb_status_t
+prgm_repro_grow(lxb_char_t **data, size_t *size, size_t need)
+{
+    lxb_char_t *tmp;
+
+    if (need <= *size) {
+        return LXB_STATUS_OK;
+    }
+
+    tmp = lexbor_realloc(*data, need);
+    if (tmp == NULL) {
+        return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+    }
+
+    *data = tmp;
+    *size = need;
+
+    return LXB_STATUS_OK;
+}
+
+/*
+ * Writes <dir>/<name>.<record>.rec with the content block of the record,
+ * the same as warc_entry_by_index gives, and <name>.<record>.warc.gz with
+ * the member as it is, which warc_test takes as a one-record file.
+ */
+lxb_status_t
+prgm_repro_save(const prgm_repro_member_t *member, const char *dir,
+                const lxb_char_t *path, size_t record)
+{
+    size_t length;
+    lxb_status_t status;
+    const lxb_char_t *data;
+
+    prgm_repro_content(member, &data, &length);
+
+    status = prgm_repro_write(dir, path, record, "rec", data, length);
+    if (status != LXB_STATUS_OK) {
+        return status;
+    }
+
+    return prgm_repro_write(dir, path, record, "warc.gz", member->compressed,
+                            member->compressed_length);
+}
+
+/* The WARC header ends with an empty line, Content-Length bytes follow. */
+static void
+prgm_repro_content(const prgm_repro_member_t *member,
+                   const lxb_char_t **data, size_t *length)
+{
+    size_t content_length;
+    const lxb_char_t *p, *end, *line, *value;
+
+    static const lxb_char_t name[] = "content-length:";
+
+    p = member->data;
+    end = member->data + member->length;
+
+    *data = p;
+    *length = member->length;
+
+    content_length = SIZE_MAX;
+
+    while (p < end) {
+        line = p;
+
+        while (p < end && *p != '\n') {
+            p++;
+        }
+
+        if (p == end) {
+            return;
+        }
+
+        p++;
+
+        if (p - line <= 2) {
+            break;
+        }
+
+        if ((size_t) (p - line) > sizeof(name) - 1
+            && lexbor_str_data_ncasecmp(line, name, sizeof(name) - 1))
+        {
+            value = line + sizeof(name) - 1;
+
+            while (value < p && *value == ' ') {
+                value++;
+            }
+
+            content_length = lexbor_conv_data_to_ulong(&value, p - value);
+        }
+    }
+
+    *data = p;
+    *length = end - p;
+
+    if (content_length < *length) {
+        *length = content_length;
+    }
+}
+
+static lxb_status_t
+prgm_repro_write(const char *dir, const lxb_char_t *path, size_t record,
+                 const char *ext, const lxb_char_t *data, size_t length)
+{
+    int len;
+    FILE *fh;
+    size_t name_length;
+    const lxb_char_t *name, *end;
+    char out[4096];
+
+    static const char warc_ext[] = ".warc.gz";
+
+    end = path + strlen((const char *) path);
+    name = end;
+
+    while (name > path && name[-1] != '/') {
+        name--;
+    }
+
+    name_length = end - name;
+
+    if (name_length > sizeof(warc_ext) - 1
+        && lexbor_str_data_ncasecmp(end - (sizeof(warc_ext) - 1),
+                                    (const lxb_char_t *) warc_ext,
+                                    sizeof(warc_ext) - 1))
+    {
+        name_length -= sizeof(warc_ext) - 1;
+    }
+
+    len = snprintf(out, sizeof(out), "%s/%.*s."LEXBOR_FORMAT_Z".%s", dir,
+                   (int) name_length, (const char *) name, record, ext);
+    if (len < 0 || (size_t) len >= sizeof(out)) {
+        return LXB_STATUS_ERROR_OVERFLOW;
+    }
+
+    fh = fopen(out, "wb");
+    if (fh == NULL) {
+        return LXB_STATUS_ERROR;
+    }
+
+    if (fwrite(data, 1, length, fh) != length) {
+        fclose(fh);
+        return LXB_STATUS_ERROR;
+    }
+
+    if (fclose(fh) != 0) {
+        return LXB_STATUS_ERROR;
+    }
+
+    return LXB_STATUS_OK;
+}
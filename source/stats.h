@@ -0,0 +1,101 @@
+/*
+* Copyright (C) 2019 Alexander Borisov
+*
+* Author: Alexander Borisov <borisov@lexbor.com>
+*/
+
+#ifndef PRGM_STATS_H
+#define PRGM_STATS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "lexbor/utils/base.h"
+#include "lexbor/encoding/encoding.h"
+
+#include <stdint.h>
+
+
+#define PRGM_STATS_TYPES_MAX 256   /* more payload types go to "other" */
+
+
+/* Where the encoding of a document came from. */
+typedef enum {
+    PRGM_STATS_SOURCE_NONE = 0,   /* not found, bytes go to the parser */
+    PRGM_STATS_SOURCE_HTTP,       /* Content-Type, wins over meta */
+    PRGM_STATS_SOURCE_META,
+    PRGM_STATS_SOURCE_LAST
+}
+prgm_stats_source_t;
+
+typedef struct {
+    size_t   documents;
+    uint64_t bytes;   /* HTTP body */
+    uint64_t time;    /* ns, from the WARC header to the end of the tree */
+}
+prgm_stats_count_t;
+
+typedef struct {
+    lxb_char_t         *name;
+    size_t             length;
+    prgm_stats_count_t count;
+}
+prgm_stats_type_t;
+
+/* One document, filled by the caller while it is parsed. */
+typedef struct {
+    lxb_encoding_t      encoding;   /* LXB_ENCODING_DEFAULT if none */
+    prgm_stats_source_t source;
+    bool                conflict;   /* HTTP and meta name different ones */
+    const lxb_char_t    *type;      /* WARC-Identified-Payload-Type or NULL */
+    size_t              type_length;
+    size_t              bytes;
+    uint64_t            time;
+}
+prgm_stats_doc_t;
+
+/* One object per thread, merged at the end. */
+typedef struct {
+    bool               enabled;
+
+    prgm_stats_count_t encoding[LXB_ENCODING_LAST_ENTRY];
+    size_t             source[PRGM_STATS_SOURCE_LAST];
+    size_t             conflicts;
+
+    prgm_stats_type_t  *types;
+    size_t             types_length;
+    size_t             types_size;
+    prgm_stats_count_t types_other;   /* over PRGM_STATS_TYPES_MAX */
+    prgm_stats_count_t types_none;    /* no payload type in the record */
+}
+prgm_stats_t;
+
+
+lxb_status_t
+prgm_stats_init(prgm_stats_t *stats, bool enabled);
+
+prgm_stats_t *
+prgm_stats_destroy(prgm_stats_t *stats, bool self_destroy);
+
+lxb_status_t
+prgm_stats_document(prgm_stats_t *stats, const prgm_stats_doc_t *doc);
+
+lxb_status_t
+prgm_stats_merge(prgm_stats_t *dst, const prgm_stats_t *src);
+
+void
+prgm_stats_print(prgm_stats_t *stats, FILE *fh);
+
+void
+prgm_stats_json(prgm_stats_t *stats, FILE *fh);
+
+const char *
+prgm_stats_source_name(prgm_stats_source_t source);
+
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* PRGM_STATS_H */
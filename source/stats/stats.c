@@ -0,0 +1,432 @@
+/*
+* Copyright (C) 2019 Alexander Borisov
+*
+* Author: Alexander Borisov <borisov@lexbor.com>
+*/
+
+#include "stats.h"
+#include "bench.h"
+
+
+#define PRGM_STATS_MB 1000000.0
+#define PRGM_STATS_NS 1000000000.0
+
+
+static const char *prgm_stats_source_names[PRGM_STATS_SOURCE_LAST] = {
+    "none", "http", "meta"
+};
+
+
+static void
+prgm_stats_count_add(prgm_stats_count_t *dst, const prgm_stats_count_t *src);
+
+static lxb_status_t
+prgm_stats_type_add(prgm_stats_t *stats, const lxb_char_t *name,
+                    size_t length, const prgm_stats_count_t *count);
+
+static size_t
+prgm_stats_encodings_sort(const prgm_stats_t *stats, lxb_encoding_t *list);
+
+static void
+prgm_stats_types_sort(prgm_stats_t *stats);
+
+static int
+prgm_stats_type_cmp(const void *a, const void *b);
+
+static const prgm_stats_count_t *
+prgm_stats_type_row(const prgm_stats_t *stats, size_t idx, const char **name);
+
+static const char *
+prgm_stats_encoding_name(lxb_encoding_t encoding);
+
+static double
+prgm_stats_rate(const prgm_stats_count_t *count);
+
+static uint64_t
+prgm_stats_busy(const prgm_stats_t *stats);
+
+
+lxb_status_t
+prgm_stats_init(prgm_stats_t *stats, bool enabled)
+{
+    if (stats == NULL) {
+        return LXB_STATUS_ERROR_OBJECT_IS_NULL;
+    }
+
+    memset(stats, 0, sizeof(prgm_stats_t));
+
+    stats->enabled = enabled;
+
+    return LXB_STATUS_OK;
+}
+
+prgm_stats_t *
+prgm_stats_destroy(prgm_stats_t *stats, bool self_destroy)
+{
+    size_t i;
+
+    if (stats == NULL) {
+        return NULL;
+    }
+
+    for (i = 0; i < stats->types_length; i++) {
+        lexbor_free(stats->types[i].name);
+    }
+
+    if (stats->types != NULL) {
+        stats->types = lexbor_free(stats->types);
+    }
+
+    stats->types_length = 0;
+    stats->types_size = 0;
+
+    if (self_destroy) {
+        return lexbor_free(stats);
+    }
+
+    return stats;
+}
+
+lxb_status_t
+prgm_stats_document(prgm_stats_t *stats, const prgm_stats_doc_t *doc)
+{
+    prgm_stats_count_t count;
+
+    if (!stats->enabled) {
+        return LXB_STATUS_OK;
+    }
+
+    count.documents = 1;
+    count.bytes = doc->bytes;
+    count.time = doc->time;
+
+    prgm_stats_count_add(&stats->encoding[doc->encoding], &count);
+
+    stats->source[doc->source]++;
+
+    if (doc->conflict) {
+        stats->conflicts++;
+    }
+
+    if (doc->type == NULL) {
+        prgm_stats_count_add(&stats->types_none, &count);
+        return LXB_STATUS_OK;
+    }
+
+    return prgm_stats_type_add(stats, doc->type, doc->type_length, &count);
+}
+
+lxb_status_t
+prgm_stats_merge(prgm_stats_t *dst, const prgm_stats_t *src)
+{
+    size_t i;
+    lxb_status_t status;
+
+    for (i = 0; i < LXB_ENCODING_LAST_ENTRY; i++) {
+        prgm_stats_count_add(&dst->encoding[i], &src->encoding[i]);
+    }
+
+    for (i = 0; i < PRGM_STATS_SOURCE_LAST; i++) {
+        dst->source[i] += src->source[i];
+    }
+
+    dst->conflicts += src->conflicts;
+
+    for (i = 0; i < src->types_length; i++) {
+        status = prgm_stats_type_add(dst, src->types[i].name,
+                                     src->types[i].length,
+                                     &src->types[i].count);
+        if (status != LXB_STATUS_OK) {
+            return status;
+        }
+    }
+
+    prgm_stats_count_add(&dst->types_other, &src->types_other);
+    prgm_stats_count_add(&dst->types_none, &src->types_none);
+
+    return LXB_STATUS_OK;
+}
+
+/*
+ * MB/s is the body size over the time of these documents in all threads,
+ * time is the share of it in the time of all documents.
+ */
+void
+prgm_stats_print(prgm_stats_t *stats, FILE *fh)
+{
+    size_t i, length;
+    uint64_t busy;
+    const char *name;
+    const prgm_stats_count_t *count;
+    lxb_encoding_t list[LXB_ENCODING_LAST_ENTRY];
+
+    busy = prgm_stats_busy(stats);
+
+    length = prgm_stats_encodings_sort(stats, list);
+
+    fprintf(fh, "Encoding from: http "LEXBOR_FORMAT_Z", meta "LEXBOR_FORMAT_Z
+            ", none "LEXBOR_FORMAT_Z"; http and meta differ "LEXBOR_FORMAT_Z
+            "\n", stats->source[PRGM_STATS_SOURCE_HTTP],
+            stats->source[PRGM_STATS_SOURCE_META],
+            stats->source[PRGM_STATS_SOURCE_NONE], stats->conflicts);
+    fprintf(fh, "%-16s %10s %10s %9s %7s\n", "Encoding", "documents", "MB",
+            "MB/s", "time");
+
+    for (i = 0; i < length; i++) {
+        count = &stats->encoding[list[i]];
+
+        fprintf(fh, "%-16s %10llu %10.1f %9.1f %6.1f%%\n",
+                prgm_stats_encoding_name(list[i]),
+                (unsigned long long) count->documents,
+                count->bytes / PRGM_STATS_MB, prgm_stats_rate(count),
+                (busy != 0) ? 100.0 * count->time / busy : 0.0);
+    }
+
+    prgm_stats_types_sort(stats);
+
+    fprintf(fh, "%-32s %10s %10s %9s %7s\n", "Payload type", "documents",
+            "MB", "MB/s", "time");
+
+    for (i = 0; i < stats->types_length + 2; i++) {
+        count = prgm_stats_type_row(stats, i, &name);
+        if (count->documents == 0) {
+            continue;
+        }
+
+        fprintf(fh, "%-32s %10llu %10.1f %9.1f %6.1f%%\n", name,
+                (unsigned long long) count->documents,
+                count->bytes / PRGM_STATS_MB, prgm_stats_rate(count),
+                (busy != 0) ? 100.0 * count->time / busy : 0.0);
+    }
+}
+
+void
+prgm_stats_json(prgm_stats_t *stats, FILE *fh)
+{
+    size_t i, length;
+    const char *sep, *name;
+    const prgm_stats_count_t *count;
+    lxb_encoding_t list[LXB_ENCODING_LAST_ENTRY];
+
+    length = prgm_stats_encodings_sort(stats, list);
+
+    prgm_stats_types_sort(stats);
+
+    fprintf(fh, "{\n");
+    fprintf(fh, "  \"sources\": {\"http\": "LEXBOR_FORMAT_Z", \"meta\": "
+            LEXBOR_FORMAT_Z", \"none\": "LEXBOR_FORMAT_Z
+            ", \"conflicts\": "LEXBOR_FORMAT_Z"},\n",
+            stats->source[PRGM_STATS_SOURCE_HTTP],
+            stats->source[PRGM_STATS_SOURCE_META],
+            stats->source[PRGM_STATS_SOURCE_NONE], stats->conflicts);
+    fprintf(fh, "  \"encodings\": {");
+
+    for (i = 0; i < length; i++) {
+        count = &stats->encoding[list[i]];
+
+        fprintf(fh, "%s\n    \"%s\": {\"documents\": "LEXBOR_FORMAT_Z
+                ", \"bytes\": %llu, \"seconds\": %.6f, \"mb_s\": %.3f}",
+                (i != 0) ? "," : "", prgm_stats_encoding_name(list[i]),
+                count->documents, (unsigned long long) count->bytes,
+                count->time / PRGM_STATS_NS, prgm_stats_rate(count));
+    }
+
+    fprintf(fh, "%s},\n", (length != 0) ? "\n  " : "");
+    fprintf(fh, "  \"payload_types\": {");
+
+    sep = "";
+
+    for (i = 0; i < stats->types_length + 2; i++) {
+        count = prgm_stats_type_row(stats, i, &name);
+        if (count->documents == 0) {
+            continue;
+        }
+
+        fprintf(fh, "%s\n    \"", sep);
+        prgm_bench_json_string(fh, (const lxb_char_t *) name);
+        fprintf(fh, "\": {\"documents\": "LEXBOR_FORMAT_Z", \"bytes\": %llu"
+                ", \"seconds\": %.6f, \"mb_s\": %.3f}", count->documents,
+                (unsigned long long) count->bytes,
+                count->time / PRGM_STATS_NS, prgm_stats_rate(count));
+
+        sep = ",";
+    }
+
+    fprintf(fh, "%s}\n", (*sep != 0x00) ? "\n  " : "");
+    fprintf(fh, "}\n");
+}
+
+const char *
+prgm_stats_source_name(prgm_stats_source_t source)
+{
+    if (source >= PRGM_STATS_SOURCE_LAST) {
+        return "unknown";
+    }
+
+    return prgm_stats_source_names[source];
+}
+
+static void
+prgm_stats_count_add(prgm_stats_count_t *dst, const prgm_stats_count_t *src)
+{
+    dst->documents += src->documents;
+    dst->bytes += src->bytes;
+    dst->time += src->time;
+}
+
+/* Linear search, there are a few types in a crawl. */
+static lxb_status_t
+prgm_stats_type_add(prgm_stats_t *stats, const lxb_char_t *name,
+                    size_t length, const prgm_stats_count_t *count)
+{
+    size_t i, size;
+    prgm_stats_type_t *types, *type;
+
+    for (i = 0; i < stats->types_length; i++) {
+        if (stats->types[i].length == length
+            && memcmp(stats->types[i].name, name, length) == 0)
+        {
+            prgm_stats_count_add(&stats->types[i].count, count);
+            return LXB_STATUS_OK;
+        }
+    }
+
+    if (stats->types_length >= PRGM_STATS_TYPES_MAX) {
+        prgm_stats_count_add(&stats->types_other, count);
+        return LXB_STATUS_OK;
+    }
+
+    if (stats->types_length == stats->types_size) {
+        size = (stats->types_size == 0) ? 16 : stats->types_size * 2;
+
+        types = lexbor_realloc(stats->types, size * sizeof(prgm_stats_type_t));
+        if (types == NULL) {
+            return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+        }
+
+        stats->types = types;
+        stats->types_size = size;
+    }
+
+    type = &stats->types[stats->types_length];
+
+    type->name = lexbor_malloc(length + 1);
+    if (type->name == NULL) {
+        return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+    }
+
+    memcpy(type->name, name, length);
+    type->name[length] = 0x00;
+
+    type->length = length;
+    type->count = *count;
+
+    stats->types_length++;
+
+    return LXB_STATUS_OK;
+}
+
+/* Encodings that have documents, the most time first. */
+static size_t
+prgm_stats_encodings_sort(const prgm_stats_t *stats, lxb_encoding_t *list)
+{
+    size_t i, j, length = 0;
+    uint64_t time;
+
+    for (i = 0; i < LXB_ENCODING_LAST_ENTRY; i++) {
+        if (stats->encoding[i].documents == 0) {
+            continue;
+        }
+
+        time = stats->encoding[i].time;
+
+        for (j = length; j > 0; j--) {
+            if (stats->encoding[list[j - 1]].time >= time) {
+                break;
+            }
+
+            list[j] = list[j - 1];
+        }
+
+        list[j] = (lxb_encoding_t) i;
+        length++;
+    }
+
+    return length;
+}
+
+/* The most time first. */
+static void
+prgm_stats_types_sort(prgm_stats_t *stats)
+{
+    if (stats->types_length != 0) {
+        qsort(stats->types, stats->types_length, sizeof(prgm_stats_type_t),
+              prgm_stats_type_cmp);
+    }
+}
+
+static int
+prgm_stats_type_cmp(const void *a, const void *b)
+{
+    const prgm_stats_type_t *ta = a, *tb = b;
+
+    if (ta->count.time != tb->count.time) {
+        return (ta->count.time < tb->count.time) ? 1 : -1;
+    }
+
+    return strcmp((const char *) ta->name, (const char *) tb->name);
+}
+
+/* Row idx of the report: the types, then the other and the unknown ones. */
+static const prgm_stats_count_t *
+prgm_stats_type_row(const prgm_stats_t *stats, size_t idx, const char **name)
+{
+    if (idx < stats->types_length) {
+        *name = (const char *) stats->types[idx].name;
+        return &stats->types[idx].count;
+    }
+
+    if (idx == stats->types_length) {
+        *name = "(other)";
+        return &stats->types_other;
+    }
+
+    *name = "(none)";
+
+    return &stats->types_none;
+}
+
+static const char *
+prgm_stats_encoding_name(lxb_encoding_t encoding)
+{
+    const lxb_encoding_data_t *data;
+
+    if (encoding == LXB_ENCODING_DEFAULT) {
+        return "(none)";
+    }
+
+    data = lxb_encoding_data(encoding);
+
+    return (data != NULL) ? (const char *) data->name : "unknown";
+}
+
+static double
+prgm_stats_rate(const prgm_stats_count_t *count)
+{
+    return (count->time != 0)
+           ? count->bytes / PRGM_STATS_MB * PRGM_STATS_NS / count->time : 0.0;
+}
+
+/* Time of all documents. */
+static uint64_t
+prgm_stats_busy(const prgm_stats_t *stats)
+{
+    size_t i;
+    uint64_t busy = 0;
+
+    for (i = 0; i < LXB_ENCODING_LAST_ENTRY; i++) {
+        busy += stats->encoding[i].time;
+    }
+
+    return busy;
+}
@@ -0,0 +1,73 @@
+/*
+* Copyright (C) 2019 Alexander Borisov
+*
+* Author: Alexander Borisov <borisov@lexbor.com>
+*/
+
+#ifndef PRGM_SUMMARY_H
+#define PRGM_SUMMARY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "lexbor/utils/base.h"
+
+#include <stdint.h>
+
+#include "bench.h"
+
+
+#define PRGM_SUMMARY_MAGIC   "warc_summary"
+#define PRGM_SUMMARY_VERSION 1
+#define PRGM_SUMMARY_NAME    32
+
+
+/*
+ * Machine-readable result of one run, one "key values" pair per line,
+ * read back by warc_merge. The histogram is written as it is, so
+ * percentiles of merged runs are as exact as of one run.
+ */
+typedef struct {
+    char       mode[PRGM_SUMMARY_NAME];
+    char       input[PRGM_SUMMARY_NAME];
+    char       inflate[PRGM_SUMMARY_NAME];
+    unsigned   threads;
+
+    unsigned   shard;
+    unsigned   shards;      /* 1 without sharding */
+    bool       shard_records;
+    double     sample;      /* share of records, 1 for all */
+    uint64_t   seed;
+
+    size_t     files;
+    size_t     filtered;    /* records, by the filter, shard or sample */
+    bool       counted;     /* the run had hardware counters */
+
+    /* Paths of the slowest documents, owned after prgm_summary_read(). */
+    lxb_char_t **paths;
+    size_t     paths_length;
+    size_t     paths_size;
+}
+prgm_summary_t;
+
+
+void
+prgm_summary_init(prgm_summary_t *summary);
+
+prgm_summary_t *
+prgm_summary_destroy(prgm_summary_t *summary, bool self_destroy);
+
+void
+prgm_summary_write(const prgm_summary_t *summary, prgm_bench_t *bench,
+                   FILE *fh);
+
+lxb_status_t
+prgm_summary_read(prgm_summary_t *summary, prgm_bench_t *bench, FILE *fh);
+
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* PRGM_SUMMARY_H */
@@ -0,0 +1,394 @@
+/*
+* Copyright (C) 2019 Alexander Borisov
+*
+* Author: Alexander Borisov <borisov@lexbor.com>
+*/
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "summary.h"
+
+
+static lxb_status_t
+prgm_summary_line(prgm_summary_t *summary, prgm_bench_t *bench, char *line);
+
+static void
+prgm_summary_name(char *dst, const char *src);
+
+static bool
+prgm_summary_stage(const char *name, prgm_bench_stage_t *stage);
+
+static lxb_status_t
+prgm_summary_path(prgm_summary_t *summary, const char *path,
+                  const lxb_char_t **result);
+
+
+void
+prgm_summary_init(prgm_summary_t *summary)
+{
+    memset(summary, 0, sizeof(prgm_summary_t));
+
+    summary->shards = 1;
+    summary->sample = 1.0;
+}
+
+prgm_summary_t *
+prgm_summary_destroy(prgm_summary_t *summary, bool self_destroy)
+{
+    size_t i;
+
+    if (summary == NULL) {
+        return NULL;
+    }
+
+    for (i = 0; i < summary->paths_length; i++) {
+        lexbor_free(summary->paths[i]);
+    }
+
+    if (summary->paths != NULL) {
+        summary->paths = lexbor_free(summary->paths);
+    }
+
+    summary->paths_length = 0;
+    summary->paths_size = 0;
+
+    if (self_destroy) {
+        return lexbor_free(summary);
+    }
+
+    return summary;
+}
+
+void
+prgm_summary_write(const prgm_summary_t *summary, prgm_bench_t *bench,
+                   FILE *fh)
+{
+    size_t i;
+
+    fprintf(fh, "%s %d\n", PRGM_SUMMARY_MAGIC, PRGM_SUMMARY_VERSION);
+    fprintf(fh, "mode %s\n", summary->mode);
+    fprintf(fh, "input %s\n", summary->input);
+    fprintf(fh, "inflate %s\n", summary->inflate);
+    fprintf(fh, "threads %u\n", summary->threads);
+    fprintf(fh, "shard %u %u %s\n", summary->shard, summary->shards,
+            (summary->shard_records) ? "record" : "file");
+    fprintf(fh, "sample %.9f %"PRIu64"\n", summary->sample, summary->seed);
+    fprintf(fh, "files "LEXBOR_FORMAT_Z"\n", summary->files);
+    fprintf(fh, "filtered "LEXBOR_FORMAT_Z"\n", summary->filtered);
+    fprintf(fh, "wall %"PRIu64"\n", bench->wall);
+    fprintf(fh, "compressed "LEXBOR_FORMAT_Z"\n", bench->compressed);
+    fprintf(fh, "decompressed "LEXBOR_FORMAT_Z"\n", bench->decompressed);
+    fprintf(fh, "documents "LEXBOR_FORMAT_Z"\n", bench->documents);
+    fprintf(fh, "rss_peak "LEXBOR_FORMAT_Z"\n", bench->rss_peak);
+    fprintf(fh, "worker_peak "LEXBOR_FORMAT_Z"\n", bench->mem_peak);
+    fprintf(fh, "document_peak "LEXBOR_FORMAT_Z"\n", bench->doc_mem_max);
+    fprintf(fh, "document_sum %"PRIu64"\n", bench->doc_mem_sum);
+
+    for (i = 0; i < PRGM_BENCH_STAGE_LAST; i++) {
+        fprintf(fh, "stage %s %"PRIu64"\n",
+                prgm_bench_stage_name((prgm_bench_stage_t) i),
+                bench->time[i]);
+    }
+
+    /* Hardware counters of a stage: cycles, instructions, misses. */
+    for (i = 0; bench->counted != 0 && i < PRGM_BENCH_STAGE_LAST; i++) {
+        fprintf(fh, "counter %s %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64"\n",
+                prgm_bench_stage_name((prgm_bench_stage_t) i),
+                bench->count[i][PRGM_PERF_CYCLES],
+                bench->count[i][PRGM_PERF_INSTRUCTIONS],
+                bench->count[i][PRGM_PERF_CACHE_MISSES],
+                bench->count[i][PRGM_PERF_BRANCH_MISSES]);
+    }
+
+    fprintf(fh, "latency_max %"PRIu64"\n", bench->hist_max);
+
+    /* Only used buckets, most of them are empty. */
+    for (i = 0; i < PRGM_BENCH_HIST_SIZE; i++) {
+        if (bench->hist[i] != 0) {
+            fprintf(fh, "hist "LEXBOR_FORMAT_Z" %"PRIu64"\n", i,
+                    bench->hist[i]);
+        }
+    }
+
+    for (i = 0; i < bench->slow_length; i++) {
+        fprintf(fh, "slow %"PRIu64" "LEXBOR_FORMAT_Z" %s\n",
+                bench->slow[i].time, bench->slow[i].record,
+                (const char *) bench->slow[i].path);
+    }
+}
+
+/*
+ * Adds the counters of the summary to bench, bench must be enabled.
+ * Unknown keys are skipped, so newer summaries can still be read; an
+ * unknown stage is an error, new stages come with a new version.
+ */
+lxb_status_t
+prgm_summary_read(prgm_summary_t *summary, prgm_bench_t *bench, FILE *fh)
+{
+    int version;
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t length;
+    lxb_status_t status;
+
+    length = getline(&line, &size, fh);
+
+    if (length <= 0
+        || sscanf(line, PRGM_SUMMARY_MAGIC" %d", &version) != 1
+        || version < 1 || version > PRGM_SUMMARY_VERSION)
+    {
+        free(line);
+        return LXB_STATUS_ERROR_UNEXPECTED_DATA;
+    }
+
+    status = LXB_STATUS_OK;
+
+    while ((length = getline(&line, &size, fh)) > 0) {
+        if (line[length - 1] == '\n') {
+            line[length - 1] = 0x00;
+        }
+
+        status = prgm_summary_line(summary, bench, line);
+        if (status != LXB_STATUS_OK) {
+            break;
+        }
+    }
+
+    free(line);
+
+    /* One summary is one bench with counters. */
+    if (status == LXB_STATUS_OK && summary->counted) {
+        bench->counted++;
+    }
+
+    return status;
+}
+
+static lxb_status_t
+prgm_summary_line(prgm_summary_t *summary, prgm_bench_t *bench, char *line)
+{
+    size_t c, idx;
+    int offset;
+    uint64_t value, count;
+    uint64_t counts[PRGM_PERF_LAST];
+    lxb_status_t status;
+    const lxb_char_t *path;
+    prgm_bench_stage_t stage;
+    char key[PRGM_SUMMARY_NAME], name[PRGM_SUMMARY_NAME];
+
+    static const char key_format[] = "%31s %n";
+
+    if (sscanf(line, key_format, key, &offset) != 1) {
+        return LXB_STATUS_OK;
+    }
+
+    line += offset;
+
+    if (strcmp(key, "mode") == 0) {
+        prgm_summary_name(summary->mode, line);
+    }
+    else if (strcmp(key, "input") == 0) {
+        prgm_summary_name(summary->input, line);
+    }
+    else if (strcmp(key, "inflate") == 0) {
+        prgm_summary_name(summary->inflate, line);
+    }
+    else if (strcmp(key, "threads") == 0) {
+        if (sscanf(line, "%u", &summary->threads) != 1) {
+            return LXB_STATUS_ERROR_UNEXPECTED_DATA;
+        }
+    }
+    else if (strcmp(key, "shard") == 0) {
+        if (sscanf(line, "%u %u %31s", &summary->shard, &summary->shards,
+                   name) != 3)
+        {
+            return LXB_STATUS_ERROR_UNEXPECTED_DATA;
+        }
+
+        summary->shard_records = strcmp(name, "record") == 0;
+    }
+    else if (strcmp(key, "sample") == 0) {
+        if (sscanf(line, "%lf %"SCNu64, &summary->sample,
+                   &summary->seed) != 2)
+        {
+            return LXB_STATUS_ERROR_UNEXPECTED_DATA;
+        }
+    }
+    else if (strcmp(key, "stage") == 0) {
+        if (sscanf(line, "%31s %"SCNu64, name, &value) != 2
+            || !prgm_summary_stage(name, &stage))
+        {
+            return LXB_STATUS_ERROR_UNEXPECTED_DATA;
+        }
+
+        bench->time[stage] += value;
+    }
+    else if (strcmp(key, "counter") == 0) {
+        if (sscanf(line, "%31s %"SCNu64" %"SCNu64" %"SCNu64" %"SCNu64, name,
+                   &counts[PRGM_PERF_CYCLES], &counts[PRGM_PERF_INSTRUCTIONS],
+                   &counts[PRGM_PERF_CACHE_MISSES],
+                   &counts[PRGM_PERF_BRANCH_MISSES]) != 5
+            || !prgm_summary_stage(name, &stage))
+        {
+            return LXB_STATUS_ERROR_UNEXPECTED_DATA;
+        }
+
+        for (c = 0; c < PRGM_PERF_LAST; c++) {
+            bench->count[stage][c] += counts[c];
+        }
+
+        summary->counted = true;
+    }
+    else if (strcmp(key, "hist") == 0) {
+        if (sscanf(line, "%zu %"SCNu64, &idx, &count) != 2
+            || idx >= PRGM_BENCH_HIST_SIZE)
+        {
+            return LXB_STATUS_ERROR_UNEXPECTED_DATA;
+        }
+
+        bench->hist[idx] += count;
+        bench->hist_count += (size_t) count;
+    }
+    else if (strcmp(key, "slow") == 0) {
+        if (sscanf(line, "%"SCNu64" %zu %n", &value, &idx, &offset) != 2) {
+            return LXB_STATUS_ERROR_UNEXPECTED_DATA;
+        }
+
+        status = prgm_summary_path(summary, line + offset, &path);
+        if (status != LXB_STATUS_OK) {
+            return status;
+        }
+
+        prgm_bench_slow(bench, value, path, idx);
+    }
+    else {
+        if (sscanf(line, "%"SCNu64, &value) != 1) {
+            return LXB_STATUS_OK;
+        }
+
+        if (strcmp(key, "files") == 0) {
+            summary->files += (size_t) value;
+        }
+        else if (strcmp(key, "filtered") == 0) {
+            summary->filtered += (size_t) value;
+        }
+        else if (strcmp(key, "wall") == 0) {
+            /* Runs of a fleet go at the same time. */
+            if (value > bench->wall) {
+                bench->wall = value;
+            }
+        }
+        else if (strcmp(key, "compressed") == 0) {
+            bench->compressed += (size_t) value;
+        }
+        else if (strcmp(key, "decompressed") == 0) {
+            bench->decompressed += (size_t) value;
+        }
+        else if (strcmp(key, "documents") == 0) {
+            bench->documents += (size_t) value;
+        }
+        else if (strcmp(key, "rss_peak") == 0) {
+            if (value > bench->rss_peak) {
+                bench->rss_peak = (size_t) value;
+            }
+        }
+        else if (strcmp(key, "worker_peak") == 0) {
+            if (value > bench->mem_peak) {
+                bench->mem_peak = (size_t) value;
+            }
+        }
+        else if (strcmp(key, "document_peak") == 0) {
+            if (value > bench->doc_mem_max) {
+                bench->doc_mem_max = (size_t) value;
+            }
+        }
+        else if (strcmp(key, "document_sum") == 0) {
+            bench->doc_mem_sum += value;
+        }
+        else if (strcmp(key, "latency_max") == 0) {
+            if (value > bench->hist_max) {
+                bench->hist_max = value;
+            }
+        }
+    }
+
+    return LXB_STATUS_OK;
+}
+
+static void
+prgm_summary_name(char *dst, const char *src)
+{
+    size_t length;
+
+    length = strlen(src);
+    if (length >= PRGM_SUMMARY_NAME) {
+        length = PRGM_SUMMARY_NAME - 1;
+    }
+
+    memcpy(dst, src, length);
+    dst[length] = 0x00;
+}
+
+static bool
+prgm_summary_stage(const char *name, prgm_bench_stage_t *stage)
+{
+    size_t i;
+
+    for (i = 0; i < PRGM_BENCH_STAGE_LAST; i++) {
+        if (strcmp(name, prgm_bench_stage_name((prgm_bench_stage_t) i)) == 0) {
+            *stage = (prgm_bench_stage_t) i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * The bench keeps pointers to paths, they live until the summary dies.
+ * Slow documents of one file usually follow each other, they share a copy.
+ */
+static lxb_status_t
+prgm_summary_path(prgm_summary_t *summary, const char *path,
+                  const lxb_char_t **result)
+{
+    size_t length, size;
+    lxb_char_t *copy, **paths;
+
+    if (summary->paths_length != 0
+        && strcmp((const char *) summary->paths[summary->paths_length - 1],
+                  path) == 0)
+    {
+        *result = summary->paths[summary->paths_length - 1];
+        return LXB_STATUS_OK;
+    }
+
+    if (summary->paths_length == summary->paths_size) {
+        size = (summary->paths_size == 0) ? 64 : summary->paths_size * 2;
+
+        paths = lexbor_realloc(summary->paths, sizeof(lxb_char_t *) * size);
+        if (paths == NULL) {
+            return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+        }
+
+        summary->paths = paths;
+        summary->paths_size = size;
+    }
+
+    length = strlen(path);
+
+    copy = lexbor_malloc(length + 1);
+    if (copy == NULL) {
+        return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+    }
+
+    memcpy(copy, path, length + 1);
+
+    summary->paths[summary->paths_length++] = copy;
+    *result = copy;
+
+    return LXB_STATUS_OK;
+}
@@ -0,0 +1,401 @@
+/*
+* Copyright (C) 2019 Alexander Borisov
+*
+* Author: Alexander Borisov <borisov@lexbor.com>
+*/
+
+#ifndef PRGM_TEST_H
+#define PRGM_TEST_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#include <lexbor/html/encoding.h>
+#include <lexbor/html/parser.h>
+#include <lexbor/html/tokenizer.h>
+#include <lexbor/encoding/encoding.h>
+#include <lexbor/utils/http.h>
+#include <lexbor/utils/warc.h>
+
+#include "bench.h"
+#include "checkpoint.h"
+#include "filter.h"
+#include "gzip.h"
+#include "index.h"
+#include "input.h"
+#include "log.h"
+#include "stats.h"
+#include "text.h"
+
+
+#define TO_LOG(tctx, level, ...)                                               \
+    do {                                                                       \
+        if (prgm_log_enabled((tctx)->log, (level))) {                          \
+            prgm_log_printf((tctx)->log, __VA_ARGS__);                         \
+        }                                                                      \
+    }                                                                          \
+    while (0)
+
+#define LXB_TEST_THREADS_MAX 1024
+#define LXB_TEST_SPLIT_SIZE  (128 * 1024 * 1024)
+#define LXB_TEST_SCAN_SIZE   (1024 * 1024)
+#define LXB_TEST_SIGN        "WARC/" /* every member inflates to it */
+#define LXB_TEST_RECYCLE     (64 * 1024 * 1024)
+#define LXB_TEST_RSS_EVERY   256
+#define LXB_TEST_RSS_WAIT    50    /* ms */
+#define LXB_TEST_ASCII_RUN   16    /* shorter ASCII goes through the decoder */
+#define LXB_TEST_CHUNK_COPY  256   /* shorter UTF-8 is collected in a chunk */
+#define LXB_TEST_POLL        100   /* ms, supervisor of --isolate */
+#define LXB_TEST_KILL_GRACE  1000  /* ms from SIGABRT to SIGKILL */
+
+
+typedef enum {
+    LXB_TEST_MODE_SINGLE = 0,
+    LXB_TEST_MODE_MULTI,
+    LXB_TEST_MODE_RECYCLE,
+    LXB_TEST_MODE_INFLATE,   /* stage modes, each stops after a layer */
+    LXB_TEST_MODE_WARC,
+    LXB_TEST_MODE_HTTP,
+    LXB_TEST_MODE_TOKENIZE,
+    LXB_TEST_MODE_LAST
+}
+lxb_test_mode_t;
+
+
+typedef struct {
+    const lxb_char_t                *fullpath;
+
+    size_t                          begin;
+    size_t                          end;     /* SIZE_MAX for the whole file */
+    size_t                          base;    /* number of the first record */
+    size_t                          members; /* expected, 0 if unknown */
+    size_t                          file;    /* in files of the pool */
+    size_t                          part;    /* range of a split file */
+
+    const lxb_char_t                *prefetch; /* next file or NULL */
+}
+lxb_test_job_t;
+
+/*
+ * Gzip member candidates of a split file. The split verifies only the first
+ * member of every range; each range counts its real members itself and
+ * takes its first record number from the counts of the ranges before it.
+ */
+typedef struct {
+    prgm_gzip_members_t             members;
+    size_t                          *firsts; /* by ranges, parts + 1 */
+    size_t                          *counts; /* SIZE_MAX until counted */
+    size_t                          parts;
+}
+lxb_test_split_t;
+
+/* A file is done when all its ranges are. */
+typedef struct {
+    lxb_test_split_t                *split;  /* NULL if not split */
+    size_t                          parts;   /* ranges not yet done */
+    size_t                          documents;
+    size_t                          filtered;
+    size_t                          skipped;
+    lxb_status_t                    status;  /* the first failed range */
+}
+lxb_test_file_t;
+
+/*
+ * Shared memory of a worker process of --isolate. Only the worker writes
+ * it, the supervisor reads it when a job is done or the worker is gone.
+ */
+typedef struct {
+    size_t                          base;    /* record of the job start */
+    size_t                          record;  /* in flight, base + members */
+    size_t                          member;  /* offset of its gzip member */
+    uint64_t                        beat;    /* the member began, 0 idle */
+
+    size_t                          total;   /* of all jobs of the worker */
+    size_t                          filtered;
+    size_t                          skipped;
+    size_t                          released;
+
+    prgm_bench_t                    bench;   /* of the last job */
+}
+lxb_test_slot_t;
+
+/* A worker process as the supervisor sees it. */
+typedef struct {
+    pid_t                           pid;     /* 0 when not running */
+    int                             jobs;    /* pipe to it, -1 if closed */
+    bool                            busy;
+    lxb_test_job_t                  job;
+    lxb_test_file_t                 before;  /* counters at the job start */
+    uint64_t                        kill;    /* SIGABRT was sent, 0 if not */
+}
+lxb_test_proc_t;
+
+/* A worker process tells that its job is over. */
+typedef struct {
+    unsigned                        worker;
+    lxb_status_t                    status;
+}
+lxb_test_done_t;
+
+typedef struct {
+    lexbor_array_t                  *files;
+    lxb_test_file_t                 *progress; /* by files */
+    size_t                          next;
+
+    lexbor_array_t                  *ranges;
+
+    pthread_mutex_t                 lock;
+
+    prgm_log_t                      log_writer;
+    prgm_log_buf_t                  *log;
+
+    lxb_test_mode_t                 mode;
+    const char                      *log_path;
+    size_t                          recycle_limit;
+    size_t                          max_rss;
+    unsigned                        paused;
+    unsigned                        active;   /* workers not yet done */
+    unsigned                        threads;
+    size_t                          split_size;
+
+    prgm_input_type_t               input_type;
+    size_t                          block_size;
+    size_t                          depth;
+
+    prgm_gzip_type_t                inflate_type;
+
+    prgm_text_single_t              *single;  /* by lxb_encoding_t */
+
+    bool                            bench;
+    bool                            counters; /* hardware, with bench */
+    const char                      *bench_json;
+    const char                      *summary;
+    size_t                          slowest;
+
+    bool                            stats;
+    const char                      *stats_json;
+
+    prgm_filter_t                   filter;
+    unsigned                        fields;   /* header fields to read */
+
+    size_t                          total;
+    size_t                          released;
+    size_t                          filtered;
+    size_t                          skipped;
+
+    prgm_checkpoint_t               checkpoint; /* path is NULL if not used */
+    bool                            resume;
+    bool                            keep_going;
+    size_t                          resumed;       /* files */
+    size_t                          resumed_total; /* their documents */
+    size_t                          failed;        /* files */
+
+    bool                            isolate;  /* workers are processes */
+    const char                      *repro;   /* dir for crashed records */
+    uint64_t                        timeout;  /* ns of one record, 0 off */
+    size_t                          crashed;  /* records */
+
+    size_t                          cached;   /* files of warc_cache */
+
+    bool                            stop;
+    lxb_status_t                    status;
+}
+lxb_test_pool_t;
+
+typedef struct {
+    lxb_test_pool_t                 *pool;
+    lxb_test_slot_t                 *slot;   /* NULL without --isolate */
+
+    lxb_utils_warc_t                *warc;
+    lxb_utils_http_t                *http;
+    lxb_html_parser_t               *parser;
+    lxb_html_tokenizer_t            *tokenizer; /* tokenize mode only */
+
+    const lxb_char_t                *fullpath;
+
+    lxb_html_document_t             *document;
+
+    prgm_log_buf_t                  *log;
+
+    prgm_input_t                    input;
+    prgm_gzip_t                     gzip;
+    prgm_gzip_t                     cache;    /* for files of warc_cache */
+    prgm_gzip_t                     *inflate; /* one of them for the file */
+    size_t                          released;
+    size_t                          mem_document;
+    size_t                          rss_check;
+
+    prgm_bench_t                    bench;
+    uint64_t                        doc_begin;
+    size_t                          doc_record;
+
+    prgm_stats_t                    stats;
+    prgm_stats_doc_t                stats_doc;
+
+    prgm_filter_record_t            record;   /* header fields of the record */
+    uint64_t                        file_hash;
+    size_t                          filtered;
+    size_t                          skipped;  /* not inflated, by the index */
+
+    lxb_utils_warc_header_cb_f      h_cd;
+    lxb_utils_warc_content_cb_f     c_cb;
+    lxb_utils_warc_content_end_cb_f c_end_cb;
+
+    const lxb_encoding_data_t       *enc_data;
+    const lxb_encoding_data_t       *enc_utf_8;
+    const prgm_text_single_t        *single;   /* table of enc_data or NULL */
+
+    lxb_encoding_encode_t           encode;
+    lxb_encoding_decode_t           decode;
+
+    lxb_html_encoding_t             html_em;
+
+    lxb_char_t                      utf_8_tail[4];  /* cut sequence */
+    size_t                          utf_8_tail_length;
+    size_t                          chunk_length;   /* used of buf_encode */
+
+    lxb_codepoint_t                 buf_decode[4096];
+    lxb_char_t                      buf_encode[4096];
+    lxb_char_t                      buf_inflate[LXB_UTILS_GZIP_CHUNK];
+
+    size_t                          total;
+
+    lxb_status_t                    status;
+}
+lxb_test_ctx_t;
+
+typedef struct {
+    lxb_test_pool_t                 *pool;
+    lxb_test_ctx_t                  *ctxs;    /* of the supervisor */
+    lxb_test_proc_t                 *procs;
+    lxb_test_slot_t                 *slots;   /* shared */
+    prgm_bench_slow_t               *slow;    /* shared, slowest per slot */
+    size_t                          slowest;
+    int                             done[2];  /* pipe of lxb_test_done_t */
+    unsigned                        running;
+}
+lxb_test_isolate_t;
+
+
+/* Flushed at exit and on fatal signals, see warc_test.c. */
+extern prgm_log_t *lxb_test_log;
+
+
+/* Worker context and documents */
+lxb_status_t
+lxb_test_ctx_init(lxb_test_ctx_t *tctx, lxb_test_pool_t *pool);
+
+void
+lxb_test_ctx_destroy(lxb_test_ctx_t *tctx);
+
+size_t
+lxb_test_ctx_memory(lxb_test_ctx_t *tctx);
+
+size_t
+lxb_test_rss_sample(lxb_test_ctx_t *tctx);
+
+bool
+lxb_test_record_filter(lxb_test_ctx_t *tctx);
+
+void
+lxb_test_document_begin(lxb_test_ctx_t *tctx);
+
+lxb_status_t
+lxb_test_document_end(lxb_test_ctx_t *tctx);
+
+bool
+lxb_test_document_done(lxb_test_ctx_t *tctx);
+
+void
+lxb_test_document_release(lxb_test_ctx_t *tctx);
+
+lxb_status_t
+lxb_test_document_drop(lxb_test_ctx_t *tctx);
+
+
+/* Callbacks of the modes */
+lxb_status_t
+lxb_test_mode_init(lxb_test_ctx_t *tctx);
+
+lxb_status_t
+lxb_test_gzip_cb(prgm_gzip_t *gzip, const lxb_char_t *data, size_t size);
+
+lxb_status_t
+lxb_test_gzip_inflate_cb(prgm_gzip_t *gzip, const lxb_char_t *data,
+                         size_t size);
+
+
+/* Pool of threads */
+void
+lxb_test_pool_destroy(lxb_test_pool_t *pool, lxb_test_ctx_t *ctxs);
+
+bool
+lxb_test_pool_next(lxb_test_pool_t *pool, lxb_test_job_t *job);
+
+void
+lxb_test_pool_stop(lxb_test_pool_t *pool, lxb_status_t status);
+
+lxb_status_t
+lxb_test_pool_file_done(lxb_test_ctx_t *tctx, const lxb_test_job_t *job,
+                        const lxb_test_file_t *before, lxb_status_t status);
+
+lexbor_action_t
+lxb_test_dir_files_cb(const lxb_char_t *fullpath, size_t fullpath_len,
+                      const lxb_char_t *filename, size_t filename_len,
+                      void *ctx);
+
+void *
+lxb_test_worker_thread(void *arg);
+
+lxb_status_t
+lxb_test_worker_job(lxb_test_ctx_t *tctx, lxb_test_job_t *job);
+
+
+/* Worker processes of --isolate */
+lxb_status_t
+lxb_test_isolate_run(lxb_test_pool_t *pool, lxb_test_ctx_t *ctxs);
+
+void
+lxb_test_slot_count(lxb_test_ctx_t *tctx);
+
+
+/* Files and their ranges */
+lxb_status_t
+lxb_test_file_split(lxb_test_ctx_t *tctx, lxb_test_job_t *job);
+
+lxb_test_split_t *
+lxb_test_file_split_destroy(lxb_test_split_t *split);
+
+lxb_status_t
+lxb_test_file_split_base(lxb_test_ctx_t *tctx, lxb_test_job_t *job);
+
+lxb_status_t
+lxb_test_file_process(lxb_test_ctx_t *tctx, lxb_test_job_t *job,
+                      prgm_index_t *index);
+
+
+/* HTTP and HTML of a record */
+lxb_status_t
+lxb_test_http_header_parse(lxb_test_ctx_t *tctx, const lxb_char_t **data,
+                           const lxb_char_t *end);
+
+lxb_status_t
+lxb_test_http_check_html_type(lxb_test_ctx_t *tctx);
+
+lxb_status_t
+lxb_test_html_transcode_finish(lxb_test_ctx_t *tctx);
+
+lxb_status_t
+lxb_test_warc_content_header_cb(lxb_utils_warc_t *warc,
+                                const lxb_char_t *data, const lxb_char_t *end);
+
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* PRGM_TEST_H */
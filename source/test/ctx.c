@@ -0,0 +1,286 @@
+/*
+* Copyright (C) 2019 Alexander Borisov
+*
+* Author: Alexander Borisov <borisov@lexbor.com>
+*/
+
+#include "test.h"
+
+#ifdef __GLIBC__
+    #include <malloc.h>
+#endif
+
+
+lxb_status_t
+lxb_test_ctx_init(lxb_test_ctx_t *tctx, lxb_test_pool_t *pool)
+{
+    lxb_status_t status;
+    prgm_gzip_cb_f gzip_f;
+
+    tctx->pool = pool;
+
+    tctx->log = prgm_log_buf_create(&pool->log_writer);
+    if (tctx->log == NULL) {
+        return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+    }
+
+    status = lxb_html_encoding_init(&tctx->html_em);
+    if (status != LXB_STATUS_OK) {
+        return status;
+    }
+
+    tctx->enc_utf_8 = lxb_encoding_data(LXB_ENCODING_UTF_8);
+
+    status = prgm_bench_init(&tctx->bench, pool->bench, pool->slowest);
+    if (status != LXB_STATUS_OK) {
+        return status;
+    }
+
+    /* Opened in the thread that runs the jobs, see prgm_bench_start(). */
+    tctx->bench.counters = pool->counters;
+
+    status = prgm_stats_init(&tctx->stats, pool->stats);
+    if (status != LXB_STATUS_OK) {
+        return status;
+    }
+
+    status = prgm_input_init(&tctx->input, pool->input_type,
+                             pool->block_size, pool->depth);
+    if (status != LXB_STATUS_OK) {
+        return status;
+    }
+
+    gzip_f = (pool->mode == LXB_TEST_MODE_INFLATE) ? lxb_test_gzip_inflate_cb
+                                                   : lxb_test_gzip_cb;
+
+    /* One decompressor per worker, its buffers are reused by all files. */
+    status = prgm_gzip_inflate_init(&tctx->gzip, pool->inflate_type,
+                                    tctx->buf_inflate, LXB_UTILS_GZIP_CHUNK,
+                                    gzip_f, tctx);
+    if (status != LXB_STATUS_OK) {
+        return status;
+    }
+
+    status = prgm_gzip_inflate_init(&tctx->cache, PRGM_GZIP_CACHE,
+                                    tctx->buf_inflate, LXB_UTILS_GZIP_CHUNK,
+                                    gzip_f, tctx);
+    if (status != LXB_STATUS_OK) {
+        return status;
+    }
+
+    tctx->inflate = &tctx->gzip;
+
+    return lxb_test_mode_init(tctx);
+}
+
+void
+lxb_test_ctx_destroy(lxb_test_ctx_t *tctx)
+{
+    (void) lxb_html_document_destroy(tctx->document);
+    (void) lxb_html_encoding_destroy(&tctx->html_em, false);
+
+    if (tctx->tokenizer != NULL) {
+        (void) lxb_html_tokenizer_destroy(tctx->tokenizer);
+    }
+
+    /* Contexts after a failed one are never initialized. */
+    if (tctx->input.block_size != 0) {
+        (void) prgm_input_destroy(&tctx->input, false);
+    }
+
+    (void) prgm_gzip_inflate_destroy(&tctx->gzip, false);
+    (void) prgm_gzip_inflate_destroy(&tctx->cache, false);
+    (void) prgm_bench_destroy(&tctx->bench, false);
+    (void) prgm_stats_destroy(&tctx->stats, false);
+}
+
+/* Heap of a worker that we can see: the document and our own buffers. */
+size_t
+lxb_test_ctx_memory(lxb_test_ctx_t *tctx)
+{
+    return tctx->mem_document + prgm_gzip_memory(&tctx->gzip)
+           + prgm_gzip_memory(&tctx->cache) + prgm_input_memory(&tctx->input);
+}
+
+size_t
+lxb_test_rss_sample(lxb_test_ctx_t *tctx)
+{
+    size_t rss = prgm_bench_rss();
+
+    if (rss > tctx->bench.rss_peak) {
+        tctx->bench.rss_peak = rss;
+    }
+
+    return rss;
+}
+
+/*
+ * Looks up the header fields for the filter, the HTML check of single mode
+ * and the statistics once per record, then checks the filter.
+ */
+bool
+lxb_test_record_filter(lxb_test_ctx_t *tctx)
+{
+    size_t f, length;
+    const lxb_char_t *name;
+    lxb_utils_warc_field_t *field;
+    lxb_test_pool_t *pool = tctx->pool;
+    prgm_filter_record_t *record = &tctx->record;
+
+    for (f = 0; f < PRGM_FILTER_LAST; f++) {
+        record->value[f] = NULL;
+        record->length[f] = 0;
+
+        if ((pool->fields & (1u << f)) == 0) {
+            continue;
+        }
+
+        name = prgm_filter_field_name((prgm_filter_field_t) f, &length);
+
+        field = lxb_utils_warc_header_field(tctx->warc, name, length, 0);
+        if (field != NULL) {
+            record->value[f] = field->value.data;
+            record->length[f] = field->value.length;
+        }
+    }
+
+    record->content_length = tctx->warc->content_length;
+    record->key = prgm_filter_key(tctx->file_hash, tctx->warc->count);
+
+    if (!prgm_filter_active(&pool->filter)
+        || prgm_filter_match(&pool->filter, record))
+    {
+        return true;
+    }
+
+    tctx->filtered++;
+
+    TO_LOG(tctx, PRGM_LOG_RECORD, LEXBOR_FORMAT_Z": filtered",
+           tctx->warc->count);
+
+    return false;
+}
+
+/*
+ * Node and text memory of a document. Counted before clean, so it is the
+ * peak of the record just parsed; after clean lexbor keeps the first chunk
+ * of every mraw.
+ */
+static size_t
+test_mraw_size(lexbor_mraw_t *mraw)
+{
+    size_t size = 0;
+    lexbor_mem_chunk_t *chunk;
+
+    if (mraw == NULL || mraw->mem == NULL) {
+        return 0;
+    }
+
+    for (chunk = mraw->mem->chunk_first; chunk != NULL; chunk = chunk->next) {
+        size += chunk->size;
+    }
+
+    return size;
+}
+
+/* A record starts, called from the WARC header callbacks. */
+void
+lxb_test_document_begin(lxb_test_ctx_t *tctx)
+{
+    tctx->doc_begin = (tctx->bench.enabled || tctx->stats.enabled)
+                      ? prgm_bench_now() : 0;
+    tctx->doc_record = tctx->warc->count;
+
+    memset(&tctx->stats_doc, 0, sizeof(prgm_stats_doc_t));
+}
+
+/* The document of a record is done, counted to the bench and stats. */
+lxb_status_t
+lxb_test_document_end(lxb_test_ctx_t *tctx)
+{
+    lxb_status_t status;
+
+    prgm_bench_document(&tctx->bench, tctx->doc_begin, tctx->fullpath,
+                        tctx->doc_record);
+
+    if (!tctx->stats.enabled) {
+        return LXB_STATUS_OK;
+    }
+
+    tctx->stats_doc.type = tctx->record.value[PRGM_FILTER_PAYLOAD];
+    tctx->stats_doc.type_length = tctx->record.length[PRGM_FILTER_PAYLOAD];
+
+    tctx->stats_doc.time = prgm_bench_now() - tctx->doc_begin;
+
+    status = prgm_stats_document(&tctx->stats, &tctx->stats_doc);
+    if (status != LXB_STATUS_OK) {
+        TO_LOG(tctx, PRGM_LOG_ERROR, "Failed to count document statistics");
+    }
+
+    return status;
+}
+
+/*
+ * Accounts the memory of the document just parsed. Every
+ * LXB_TEST_RSS_EVERY documents checks the process RSS; returns true if it
+ * is over --max-rss and the document must give its memory back.
+ */
+bool
+lxb_test_document_done(lxb_test_ctx_t *tctx)
+{
+    lxb_dom_document_t *dom = &tctx->document->dom_document;
+
+    tctx->mem_document = test_mraw_size(dom->mraw);
+
+    if (dom->text != dom->mraw) {
+        tctx->mem_document += test_mraw_size(dom->text);
+    }
+
+    prgm_bench_memory(&tctx->bench, tctx->mem_document,
+                      lxb_test_ctx_memory(tctx));
+
+    if (tctx->pool->max_rss == 0 || ++tctx->rss_check < LXB_TEST_RSS_EVERY) {
+        return false;
+    }
+
+    tctx->rss_check = 0;
+
+    return lxb_test_rss_sample(tctx) > tctx->pool->max_rss;
+}
+
+void
+lxb_test_document_release(lxb_test_ctx_t *tctx)
+{
+    TO_LOG(tctx, PRGM_LOG_INFO, "RSS is over the limit, document of "
+           LEXBOR_FORMAT_Z" bytes released", tctx->mem_document);
+
+    tctx->document = lxb_html_document_destroy(tctx->document);
+    tctx->mem_document = 0;
+    tctx->released++;
+
+#ifdef __GLIBC__
+    /* Freed chunks stay in the process without it. */
+    (void) malloc_trim(0);
+#endif
+}
+
+/* A failed file leaves its last document half parsed, it is not reused. */
+lxb_status_t
+lxb_test_document_drop(lxb_test_ctx_t *tctx)
+{
+    tctx->document = lxb_html_document_destroy(tctx->document);
+    tctx->mem_document = 0;
+
+    if (tctx->tokenizer != NULL) {
+        lxb_html_tokenizer_clean(tctx->tokenizer);
+    }
+
+    if (tctx->pool->mode == LXB_TEST_MODE_SINGLE) {
+        tctx->document = lxb_html_document_create();
+        if (tctx->document == NULL) {
+            return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+        }
+    }
+
+    return LXB_STATUS_OK;
+}
@@ -0,0 +1,603 @@
+/*
+* Copyright (C) 2019 Alexander Borisov
+*
+* Author: Alexander Borisov <borisov@lexbor.com>
+*/
+
+#include "cache.h"
+#include "test.h"
+
+
+static lxb_status_t
+file_split_count(lxb_test_ctx_t *tctx, lxb_test_split_t *split, FILE *fh,
+                 size_t part, size_t *count);
+
+static lxb_status_t
+file_segment(lxb_test_ctx_t *tctx, const lxb_test_job_t *job);
+
+static lxb_status_t
+file_index_process(lxb_test_ctx_t *tctx, lxb_test_job_t *job,
+                   prgm_index_t *index);
+
+
+/*
+ * Splits a big file into byte ranges starting on gzip member boundaries.
+ * The first range stays in job, the others go to the shared queue.
+ * Every WARC record is its own gzip member, so the member number is the
+ * record number. Here only the candidates that ranges start on are
+ * verified; the ranges count the rest in parallel, see
+ * lxb_test_file_split_base().
+ */
+lxb_status_t
+lxb_test_file_split(lxb_test_ctx_t *tctx, lxb_test_job_t *job)
+{
+    FILE *fh;
+    long fsize;
+    bool cached;
+    size_t i, idx, parts, size, count;
+    lxb_char_t *buf = NULL;
+    lxb_status_t status;
+    lxb_test_job_t *range;
+    lxb_test_split_t *split;
+    lxb_test_pool_t *pool = tctx->pool;
+
+    fh = fopen((const char *) job->fullpath, "rb");
+    if (fh == NULL) {
+        /* Let the usual processing report it. */
+        return LXB_STATUS_OK;
+    }
+
+    if (fseek(fh, 0, SEEK_END) != 0 || (fsize = ftell(fh)) < 0) {
+        fclose(fh);
+        return LXB_STATUS_OK;
+    }
+
+    size = (size_t) fsize;
+    parts = size / pool->split_size;
+
+    if (parts > pool->threads) {
+        parts = pool->threads;
+    }
+
+    if (parts < 2) {
+        fclose(fh);
+        return LXB_STATUS_OK;
+    }
+
+    split = lexbor_calloc(1, sizeof(lxb_test_split_t));
+    if (split == NULL) {
+        fclose(fh);
+        return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+    }
+
+    split->firsts = lexbor_calloc(parts + 1, sizeof(size_t));
+    split->counts = lexbor_malloc(sizeof(size_t) * parts);
+    buf = lexbor_malloc(LXB_TEST_SCAN_SIZE);
+
+    if (split->firsts == NULL || split->counts == NULL || buf == NULL) {
+        status = LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+        goto failed;
+    }
+
+    status = prgm_gzip_members_init(&split->members, 4096);
+    if (status != LXB_STATUS_OK) {
+        goto failed;
+    }
+
+    cached = prgm_cache_name_is(job->fullpath,
+                                strlen((const char *) job->fullpath));
+
+    /* A cache has the offsets in its table, ranges end before it. */
+    if (cached) {
+        status = prgm_cache_members_load(&split->members, fh, &size);
+        if (status != LXB_STATUS_OK) {
+            /* Let the usual processing report it. */
+            status = LXB_STATUS_OK;
+            goto failed;
+        }
+    }
+    else {
+        status = prgm_gzip_members_scan(&split->members, fh, buf,
+                                        LXB_TEST_SCAN_SIZE);
+        if (status != LXB_STATUS_OK) {
+            TO_LOG(tctx, PRGM_LOG_ERROR, "Failed to scan gzip members: %s",
+                   (const char *) job->fullpath);
+            goto failed;
+        }
+    }
+
+    if (split->members.length == 0 || split->members.list[0] != 0) {
+        goto failed;
+    }
+
+    /* firsts[] holds member indexes, the first range starts at 0. */
+    for (i = 1; i < parts; i++) {
+        idx = prgm_gzip_members_lower(&split->members, (size / parts) * i);
+
+        if (idx <= split->firsts[i - 1]) {
+            idx = split->firsts[i - 1] + 1;
+        }
+
+        /* A header inside compressed data must not start a range. */
+        while (!cached && idx < split->members.length) {
+            status = prgm_gzip_members_count(&split->members, fh,
+                                             idx, idx + 1,
+                                             (const lxb_char_t *) LXB_TEST_SIGN,
+                                             sizeof(LXB_TEST_SIGN) - 1, &count);
+            if (status != LXB_STATUS_OK) {
+                goto failed;
+            }
+
+            if (count != 0) {
+                break;
+            }
+
+            idx++;
+        }
+
+        if (idx >= split->members.length) {
+            break;
+        }
+
+        split->firsts[i] = idx;
+    }
+
+    parts = i;
+    split->firsts[parts] = split->members.length;
+
+    if (parts < 2) {
+        goto failed;
+    }
+
+    split->parts = parts;
+
+    /* The table of a cache is exact, gzip candidates are counted later. */
+    for (i = 0; i < parts; i++) {
+        split->counts[i] = (cached) ? split->firsts[i + 1] - split->firsts[i]
+                                    : SIZE_MAX;
+    }
+
+    TO_LOG(tctx, PRGM_LOG_INFO, "Split file: %s into "LEXBOR_FORMAT_Z" ranges",
+           (const char *) job->fullpath, parts);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->progress[job->file].split = split;
+    pthread_mutex_unlock(&pool->lock);
+
+    /*
+     * From here the split belongs to the file, lxb_test_pool_file_done()
+     * frees it.
+     */
+    for (i = parts - 1; i > 0; i--) {
+        range = lexbor_malloc(sizeof(lxb_test_job_t));
+        if (range == NULL) {
+            status = LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+            goto done;
+        }
+
+        range->fullpath = job->fullpath;
+        range->begin = split->members.list[split->firsts[i]];
+        range->end = (i + 1 == parts)
+                     ? size : split->members.list[split->firsts[i + 1]];
+        range->base = 0;
+        range->members = 0;
+        range->file = job->file;
+        range->part = i;
+        range->prefetch = NULL;
+
+        pthread_mutex_lock(&pool->lock);
+
+        status = lexbor_array_push(pool->ranges, range);
+        if (status == LXB_STATUS_OK) {
+            pool->progress[job->file].parts++;
+        }
+
+        pthread_mutex_unlock(&pool->lock);
+
+        if (status != LXB_STATUS_OK) {
+            lexbor_free(range);
+            goto done;
+        }
+    }
+
+    job->begin = 0;
+    job->end = split->members.list[split->firsts[1]];
+    job->part = 0;
+
+    goto done;
+
+failed:
+
+    lxb_test_file_split_destroy(split);
+
+done:
+
+    if (buf != NULL) {
+        lexbor_free(buf);
+    }
+
+    fclose(fh);
+
+    return status;
+}
+
+lxb_test_split_t *
+lxb_test_file_split_destroy(lxb_test_split_t *split)
+{
+    if (split == NULL) {
+        return NULL;
+    }
+
+    prgm_gzip_members_destroy(&split->members, false);
+
+    if (split->firsts != NULL) {
+        lexbor_free(split->firsts);
+    }
+
+    if (split->counts != NULL) {
+        lexbor_free(split->counts);
+    }
+
+    return lexbor_free(split);
+}
+
+/*
+ * Takes the first record number of a range of a split file from the
+ * member counts of the ranges before it. A count that is not there yet is
+ * made here, its range may not have started; the own range goes first,
+ * the ranges after it need its count too. Nobody waits for anybody.
+ */
+lxb_status_t
+lxb_test_file_split_base(lxb_test_ctx_t *tctx, lxb_test_job_t *job)
+{
+    FILE *fh;
+    size_t i, count;
+    lxb_status_t status;
+    lxb_test_split_t *split;
+
+    split = tctx->pool->progress[job->file].split;
+
+    fh = fopen((const char *) job->fullpath, "rb");
+    if (fh == NULL) {
+        TO_LOG(tctx, PRGM_LOG_ERROR, "Failed to open file: %s",
+               (const char *) job->fullpath);
+        return LXB_STATUS_ERROR;
+    }
+
+    status = file_split_count(tctx, split, fh, job->part, &job->members);
+
+    job->base = 0;
+
+    for (i = 0; i < job->part && status == LXB_STATUS_OK; i++) {
+        status = file_split_count(tctx, split, fh, i, &count);
+        job->base += count;
+    }
+
+    fclose(fh);
+
+    if (status != LXB_STATUS_OK) {
+        TO_LOG(tctx, PRGM_LOG_ERROR, "Failed to count gzip members: %s",
+               (const char *) job->fullpath);
+    }
+
+    return status;
+}
+
+/* Two workers can count the same range at once, the result is the same. */
+static lxb_status_t
+file_split_count(lxb_test_ctx_t *tctx, lxb_test_split_t *split, FILE *fh,
+                 size_t part, size_t *count)
+{
+    lxb_status_t status;
+    lxb_test_pool_t *pool = tctx->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    *count = split->counts[part];
+    pthread_mutex_unlock(&pool->lock);
+
+    if (*count != SIZE_MAX) {
+        return LXB_STATUS_OK;
+    }
+
+    status = prgm_gzip_members_count(&split->members, fh, split->firsts[part],
+                                     split->firsts[part + 1],
+                                     (const lxb_char_t *) LXB_TEST_SIGN,
+                                     sizeof(LXB_TEST_SIGN) - 1, count);
+    if (status != LXB_STATUS_OK) {
+        return status;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    split->counts[part] = *count;
+    pthread_mutex_unlock(&pool->lock);
+
+    return LXB_STATUS_OK;
+}
+
+lxb_status_t
+lxb_test_file_process(lxb_test_ctx_t *tctx, lxb_test_job_t *job,
+                      prgm_index_t *index)
+{
+    size_t rss;
+
+    tctx->fullpath = job->fullpath;
+    tctx->file_hash = prgm_filter_file_hash(tctx->fullpath,
+                                            strlen((char *) tctx->fullpath));
+
+    tctx->inflate = (prgm_cache_name_is(tctx->fullpath,
+                                        strlen((char *) tctx->fullpath)))
+                    ? &tctx->cache : &tctx->gzip;
+
+    if (job->end == SIZE_MAX) {
+        TO_LOG(tctx, PRGM_LOG_INFO, "Start processing file: %s",
+               (const char *) job->fullpath);
+    }
+    else {
+        TO_LOG(tctx, PRGM_LOG_INFO, "Start processing file: %s, range "
+               LEXBOR_FORMAT_Z"-"LEXBOR_FORMAT_Z", first record "
+               LEXBOR_FORMAT_Z,
+               (const char *) job->fullpath, job->begin, job->end, job->base);
+    }
+
+    /* Create WARC parser */
+    tctx->warc = lxb_utils_warc_create();
+    tctx->status = lxb_utils_warc_init(tctx->warc, tctx->h_cd, tctx->c_cb,
+                                       tctx->c_end_cb, tctx);
+    if (tctx->status != LXB_STATUS_OK) {
+        TO_LOG(tctx, PRGM_LOG_ERROR, "Failed to init warc.");
+
+        lxb_utils_warc_destroy(tctx->warc, true);
+
+        return tctx->status;
+    }
+
+    /* Create HTTP parser */
+    tctx->http = lxb_utils_http_create();
+    tctx->status = lxb_utils_http_init(tctx->http, NULL);
+    if (tctx->status != LXB_STATUS_OK) {
+        TO_LOG(tctx, PRGM_LOG_ERROR, "Failed to init http.");
+
+        lxb_utils_warc_destroy(tctx->warc, true);
+        lxb_utils_http_destroy(tctx->http, true);
+
+        return tctx->status;
+    }
+
+    /* Open and read GZIP file */
+    tctx->status = prgm_input_open(&tctx->input,
+                                   (const char *) job->fullpath);
+    if (tctx->status != LXB_STATUS_OK) {
+        TO_LOG(tctx, PRGM_LOG_ERROR, "Failed to open file: %s",
+               (const char *) job->fullpath);
+
+        goto failed;
+    }
+
+    /* Warm up the page cache for the file after this one. */
+    prgm_input_prefetch(&tctx->input, (const char *) job->prefetch);
+
+    if (index != NULL) {
+        tctx->status = file_index_process(tctx, job, index);
+    }
+    else {
+        tctx->status = file_segment(tctx, job);
+    }
+
+    if (tctx->status != LXB_STATUS_OK) {
+        goto failed;
+    }
+
+    /* Records are not parsed in inflate mode. */
+    if (job->members != 0
+        && (tctx->inflate->count != job->members
+            || (tctx->pool->mode != LXB_TEST_MODE_INFLATE
+                && tctx->warc->count != job->base + job->members)))
+    {
+        TO_LOG(tctx, PRGM_LOG_ERROR, "Range "LEXBOR_FORMAT_Z"-"LEXBOR_FORMAT_Z
+               " of %s: expected "LEXBOR_FORMAT_Z" members, inflated "
+               LEXBOR_FORMAT_Z" members and "LEXBOR_FORMAT_Z" records;"
+               " record numbers are not reliable",
+               job->begin, job->end, (const char *) job->fullpath,
+               job->members, tctx->inflate->count,
+               tctx->warc->count - job->base);
+
+        tctx->status = LXB_STATUS_ERROR;
+
+        goto failed;
+    }
+
+    lxb_utils_warc_destroy(tctx->warc, true);
+    lxb_utils_http_destroy(tctx->http, true);
+
+    prgm_input_close(&tctx->input);
+
+    /* Sampled at any log level, the peak goes to the bench report. */
+    rss = lxb_test_rss_sample(tctx);
+
+    TO_LOG(tctx, PRGM_LOG_INFO, "Done file: %s, RSS "LEXBOR_FORMAT_Z
+           ", worker memory "LEXBOR_FORMAT_Z, (const char *) job->fullpath,
+           rss, lxb_test_ctx_memory(tctx));
+
+    prgm_log_buf_flush(tctx->log);
+
+    return LXB_STATUS_OK;
+
+failed:
+
+    lxb_utils_warc_destroy(tctx->warc, true);
+    lxb_utils_http_destroy(tctx->http, true);
+
+    prgm_input_close(&tctx->input);
+
+    return tctx->status;
+}
+
+/* Reads and inflates the range of the job from the opened file. */
+static lxb_status_t
+file_segment(lxb_test_ctx_t *tctx, const lxb_test_job_t *job)
+{
+    size_t size;
+    lxb_status_t status;
+    const lxb_char_t *data;
+
+    /* Reuse GZIP decompressor */
+    prgm_gzip_inflate_reset(tctx->inflate);
+
+    tctx->inflate->offset = job->begin;
+    tctx->warc->count = job->base;
+
+    prgm_input_range(&tctx->input, job->begin, job->end);
+
+    for (;;) {
+        prgm_bench_enter(&tctx->bench, PRGM_BENCH_READ);
+
+        status = prgm_input_next(&tctx->input, &data, &size);
+
+        prgm_bench_leave(&tctx->bench);
+
+        if (status != LXB_STATUS_OK) {
+            TO_LOG(tctx, PRGM_LOG_ERROR, "Failed to read file: %s",
+                   (const char *) job->fullpath);
+
+            return status;
+        }
+
+        if (size == 0) {
+            break;
+        }
+
+        tctx->bench.compressed += size;
+
+        prgm_bench_enter(&tctx->bench, PRGM_BENCH_INFLATE);
+
+        status = prgm_gzip_inflate(tctx->inflate, data, (unsigned) size);
+
+        prgm_bench_leave(&tctx->bench);
+
+        if (status != LXB_STATUS_OK) {
+            TO_LOG(tctx, PRGM_LOG_ERROR, "Failed to process inflate.");
+
+            return status;
+        }
+    }
+
+    prgm_bench_enter(&tctx->bench, PRGM_BENCH_INFLATE);
+
+    status = prgm_gzip_inflate_finish(tctx->inflate);
+
+    prgm_bench_leave(&tctx->bench);
+
+    if (status != LXB_STATUS_OK) {
+        TO_LOG(tctx, PRGM_LOG_ERROR, "Unexpected end of gzip data: %s",
+               (const char *) job->fullpath);
+    }
+
+    return status;
+}
+
+/*
+ * Checks the records of the index against the filter and inflates only
+ * gzip members with at least one record that passes. Neighbouring members
+ * are read as one range. The header callbacks check every record of these
+ * members again, a member can hold records that do not pass.
+ */
+static lxb_status_t
+file_index_process(lxb_test_ctx_t *tctx, lxb_test_job_t *job,
+                   prgm_index_t *index)
+{
+    bool keep;
+    size_t i, next, records, skipped;
+    lxb_status_t status;
+    lxb_test_job_t range;
+    prgm_index_entry_t *entry;
+    prgm_filter_record_t record;
+    const prgm_filter_t *filter = &tctx->pool->filter;
+
+    memset(&range, 0, sizeof(lxb_test_job_t));
+
+    range.fullpath = job->fullpath;
+
+    records = 0;
+    skipped = 0;
+
+    for (i = 0; i <= index->length; i = next) {
+        keep = false;
+        next = i;
+
+        /* A member is the entry with skip 0 and the entries after it. */
+        while (next < index->length
+               && (next == i || index->entries[next].skip != 0))
+        {
+            entry = &index->entries[next];
+
+            record.value[PRGM_FILTER_TYPE] = prgm_index_string(index,
+                                                               entry->type);
+            record.length[PRGM_FILTER_TYPE] = entry->type_len;
+            record.value[PRGM_FILTER_PAYLOAD] = prgm_index_string(index,
+                                                              entry->payload);
+            record.length[PRGM_FILTER_PAYLOAD] = entry->payload_len;
+            record.value[PRGM_FILTER_URI] = prgm_index_string(index,
+                                                              entry->uri);
+            record.length[PRGM_FILTER_URI] = entry->uri_len;
+            record.content_length = (size_t) entry->content_length;
+            record.key = prgm_filter_key(tctx->file_hash, next);
+
+            keep = keep || prgm_filter_match(filter, &record);
+
+            next++;
+        }
+
+        entry = (i < index->length) ? &index->entries[i] : NULL;
+
+        if (keep && range.members != 0 && entry->offset == range.end) {
+            range.end = (size_t) (entry->offset + entry->length);
+            range.members++;
+            records += next - i;
+
+            continue;
+        }
+
+        if (range.members != 0) {
+            status = file_segment(tctx, &range);
+            if (status != LXB_STATUS_OK) {
+                return status;
+            }
+
+            if (tctx->inflate->count != range.members
+                || (tctx->pool->mode != LXB_TEST_MODE_INFLATE
+                    && tctx->warc->count != range.base + records))
+            {
+                TO_LOG(tctx, PRGM_LOG_ERROR, "Index of %s does not match"
+                       " the file at record "LEXBOR_FORMAT_Z,
+                       (const char *) job->fullpath, range.base);
+
+                return LXB_STATUS_ERROR;
+            }
+
+            range.members = 0;
+        }
+
+        if (entry == NULL) {
+            break;
+        }
+
+        if (!keep) {
+            skipped += next - i;
+            continue;
+        }
+
+        range.begin = (size_t) entry->offset;
+        range.end = (size_t) (entry->offset + entry->length);
+        range.base = i;
+        range.members = 1;
+        records = next - i;
+    }
+
+    tctx->skipped += skipped;
+
+    TO_LOG(tctx, PRGM_LOG_INFO, "Index of %s: "LEXBOR_FORMAT_Z" of "
+           LEXBOR_FORMAT_Z" records not inflated",
+           (const char *) job->fullpath, skipped, index->length);
+
+    return LXB_STATUS_OK;
+}
@@ -0,0 +1,595 @@
+/*
+* Copyright (C) 2019 Alexander Borisov
+*
+* Author: Alexander Borisov <borisov@lexbor.com>
+*/
+
+#include "test.h"
+
+
+static lxb_status_t
+warc_content_body_cb(lxb_utils_warc_t *warc, const lxb_char_t *data,
+                     const lxb_char_t *end);
+
+
+/*
+ * Parses the HTTP header at the start of the content. LXB_STATUS_NEXT
+ * means it goes on in the next data, other errors are logged.
+ */
+lxb_status_t
+lxb_test_http_header_parse(lxb_test_ctx_t *tctx, const lxb_char_t **data,
+                           const lxb_char_t *end)
+{
+    lxb_status_t status;
+
+    prgm_bench_enter(&tctx->bench, PRGM_BENCH_HTTP);
+
+    status = lxb_utils_http_parse(tctx->http, data, end);
+    if (status == LXB_STATUS_NEXT) {
+        prgm_bench_leave(&tctx->bench);
+        return LXB_STATUS_NEXT;
+    }
+
+    if (status == LXB_STATUS_OK) {
+        status = lxb_utils_http_header_parse_eof(tctx->http);
+    }
+
+    prgm_bench_leave(&tctx->bench);
+
+    if (status == LXB_STATUS_OK) {
+        return LXB_STATUS_OK;
+    }
+
+    if (tctx->http->error != NULL) {
+        TO_LOG(tctx, PRGM_LOG_ERROR, "HTML header parsing error: %s",
+               tctx->http->error);
+    }
+    else {
+        TO_LOG(tctx, PRGM_LOG_ERROR, "HTML header parsing error");
+    }
+
+    return LXB_STATUS_ERROR;
+}
+
+lxb_status_t
+lxb_test_http_check_html_type(lxb_test_ctx_t *tctx)
+{
+    size_t length;
+    const lxb_char_t *value;
+
+    static const lxb_char_t lxb_wtype_val[] = "response";
+    static const lxb_char_t lxb_wident_val_html[] = "text/html";
+    static const lxb_char_t lxb_wident_val_xml[] = "application/xhtml+xml";
+
+    /* Fields were looked up by lxb_test_record_filter(). */
+    value = tctx->record.value[PRGM_FILTER_TYPE];
+    length = tctx->record.length[PRGM_FILTER_TYPE];
+
+    if (value == NULL
+        || length != (sizeof(lxb_wtype_val) - 1)
+        || lexbor_str_data_ncasecmp(value, lxb_wtype_val, length) == false)
+    {
+        goto next;
+    }
+
+    value = tctx->record.value[PRGM_FILTER_PAYLOAD];
+    length = tctx->record.length[PRGM_FILTER_PAYLOAD];
+
+    if (value == NULL) {
+        goto next;
+    }
+
+    TO_LOG(tctx, PRGM_LOG_RECORD, LEXBOR_FORMAT_Z": %s", tctx->warc->count,
+           value);
+
+    if (length == (sizeof(lxb_wident_val_html) - 1)
+        && lexbor_str_data_ncasecmp(value, lxb_wident_val_html, length))
+    {
+        return LXB_STATUS_OK;
+    }
+
+    if (length == (sizeof(lxb_wident_val_xml) - 1)
+        && lexbor_str_data_ncasecmp(value, lxb_wident_val_xml, length))
+    {
+        return LXB_STATUS_OK;
+    }
+
+    return LXB_STATUS_NEXT;
+
+next:
+
+    TO_LOG(tctx, PRGM_LOG_RECORD, LEXBOR_FORMAT_Z, tctx->warc->count);
+
+    return LXB_STATUS_NEXT;
+}
+
+lxb_inline lxb_status_t
+html_parse_chunk(lxb_test_ctx_t *tctx, const lxb_char_t *data, size_t length)
+{
+    lxb_status_t status;
+
+    prgm_bench_enter(&tctx->bench, PRGM_BENCH_TREE);
+
+    if (tctx->tokenizer != NULL) {
+        status = lxb_html_tokenizer_chunk(tctx->tokenizer, data, length);
+    }
+    else {
+        status = lxb_html_document_parse_chunk(tctx->document, data, length);
+    }
+
+    prgm_bench_leave(&tctx->bench);
+
+    if (status != LXB_STATUS_OK) {
+        TO_LOG(tctx, PRGM_LOG_ERROR, "HTML chunk parsing error");
+        return LXB_STATUS_ERROR;
+    }
+
+    return LXB_STATUS_OK;
+}
+
+lxb_inline lxb_status_t
+html_encode(lxb_test_ctx_t *tctx)
+{
+    lxb_status_t status, enc_status;
+    const lxb_codepoint_t *buf, *buf_end;
+
+    buf = tctx->buf_decode;
+    buf_end = tctx->buf_decode + lxb_encoding_decode_buf_used(&tctx->decode);
+
+    do {
+        lxb_encoding_encode_buf_used_set(&tctx->encode, 0);
+
+        enc_status = tctx->enc_utf_8->encode(&tctx->encode, &buf, buf_end);
+
+        status = html_parse_chunk(tctx, tctx->buf_encode,
+                                  tctx->encode.buffer_used);
+        if (status != LXB_STATUS_OK) {
+            return status;
+        }
+    }
+    while (enc_status == LXB_STATUS_SMALL_BUFFER);
+
+    return LXB_STATUS_OK;
+}
+
+/* Decodes data and gives it to the parser in UTF-8. */
+static lxb_status_t
+html_transcode(lxb_test_ctx_t *tctx, const lxb_char_t *data,
+               const lxb_char_t *end)
+{
+    lxb_status_t status, dec_status;
+
+    prgm_bench_enter(&tctx->bench, PRGM_BENCH_TRANSCODE);
+
+    do {
+        lxb_encoding_decode_buf_used_set(&tctx->decode, 0);
+
+        dec_status = tctx->enc_data->decode(&tctx->decode, &data, end);
+
+        status = html_encode(tctx);
+        if (status != LXB_STATUS_OK) {
+            prgm_bench_leave(&tctx->bench);
+            return status;
+        }
+    }
+    while (dec_status == LXB_STATUS_SMALL_BUFFER);
+
+    prgm_bench_leave(&tctx->bench);
+
+    return LXB_STATUS_OK;
+}
+
+/*
+ * Short pieces of valid UTF-8 and replacement characters are collected in
+ * buf_encode, so broken text does not become a parser call per byte. Long
+ * pieces go to the parser as they are.
+ */
+static lxb_status_t
+html_chunk_flush(lxb_test_ctx_t *tctx)
+{
+    size_t length = tctx->chunk_length;
+
+    if (length == 0) {
+        return LXB_STATUS_OK;
+    }
+
+    tctx->chunk_length = 0;
+
+    return html_parse_chunk(tctx, tctx->buf_encode, length);
+}
+
+static lxb_status_t
+html_chunk_append(lxb_test_ctx_t *tctx, const lxb_char_t *data, size_t length)
+{
+    lxb_status_t status;
+
+    if (length >= LXB_TEST_CHUNK_COPY
+        || length > sizeof(tctx->buf_encode) - tctx->chunk_length)
+    {
+        status = html_chunk_flush(tctx);
+        if (status != LXB_STATUS_OK) {
+            return status;
+        }
+
+        if (length >= LXB_TEST_CHUNK_COPY) {
+            return html_parse_chunk(tctx, data, length);
+        }
+    }
+
+    memcpy(tctx->buf_encode + tctx->chunk_length, data, length);
+    tctx->chunk_length += length;
+
+    return LXB_STATUS_OK;
+}
+
+/*
+ * UTF-8 is only validated: an SSE2 ASCII skip with scalar checks of the
+ * multibyte sequences, not a SIMD validator. Invalid sequences are
+ * replaced as the decoder does it. A sequence cut by the end of data
+ * waits for the next data.
+ */
+static lxb_status_t
+html_utf_8(lxb_test_ctx_t *tctx, const lxb_char_t *data,
+           const lxb_char_t *end)
+{
+    int length;
+    size_t tail, valid;
+    lxb_status_t status;
+    lxb_char_t seq[4];
+
+    prgm_bench_enter(&tctx->bench, PRGM_BENCH_TRANSCODE);
+
+    tail = tctx->utf_8_tail_length;
+
+    if (tail != 0) {
+        valid = (size_t) (end - data);
+        if (valid > sizeof(seq) - tail) {
+            valid = sizeof(seq) - tail;
+        }
+
+        memcpy(seq, tctx->utf_8_tail, tail);
+        memcpy(seq + tail, data, valid);
+
+        length = prgm_text_utf_8_sequence(seq, seq + tail + valid);
+
+        if (length > 0) {
+            status = html_chunk_append(tctx, seq, length);
+            data += length - tail;
+        }
+        else if (length < 0) {
+            status = html_chunk_append(tctx, PRGM_TEXT_REPLACEMENT,
+                                       PRGM_TEXT_REPLACEMENT_LEN);
+            data += -length - tail;
+        }
+        else {
+            memcpy(tctx->utf_8_tail, seq, tail + valid);
+            tctx->utf_8_tail_length = tail + valid;
+
+            prgm_bench_leave(&tctx->bench);
+
+            return LXB_STATUS_OK;
+        }
+
+        tctx->utf_8_tail_length = 0;
+
+        if (status != LXB_STATUS_OK) {
+            goto failed;
+        }
+    }
+
+    while (data < end) {
+        valid = prgm_text_utf_8_valid(data, end);
+
+        if (valid != 0) {
+            status = html_chunk_append(tctx, data, valid);
+            if (status != LXB_STATUS_OK) {
+                goto failed;
+            }
+
+            data += valid;
+
+            if (data == end) {
+                break;
+            }
+        }
+
+        length = prgm_text_utf_8_sequence(data, end);
+
+        if (length == 0) {
+            tctx->utf_8_tail_length = end - data;
+            memcpy(tctx->utf_8_tail, data, tctx->utf_8_tail_length);
+            break;
+        }
+
+        status = html_chunk_append(tctx, PRGM_TEXT_REPLACEMENT,
+                                   PRGM_TEXT_REPLACEMENT_LEN);
+        if (status != LXB_STATUS_OK) {
+            goto failed;
+        }
+
+        data += -length;
+    }
+
+    status = html_chunk_flush(tctx);
+
+failed:
+
+    prgm_bench_leave(&tctx->bench);
+
+    return status;
+}
+
+/* A single-byte encoding through its table, buf_encode at a time. */
+static lxb_status_t
+html_single(lxb_test_ctx_t *tctx, const lxb_char_t *data,
+            const lxb_char_t *end)
+{
+    size_t length;
+    lxb_status_t status;
+
+    while (data < end) {
+        prgm_bench_enter(&tctx->bench, PRGM_BENCH_TRANSCODE);
+
+        length = prgm_text_single_transcode(tctx->single, &data, end,
+                                            tctx->buf_encode,
+                                            sizeof(tctx->buf_encode));
+
+        prgm_bench_leave(&tctx->bench);
+
+        status = html_parse_chunk(tctx, tctx->buf_encode, length);
+        if (status != LXB_STATUS_OK) {
+            return status;
+        }
+    }
+
+    return LXB_STATUS_OK;
+}
+
+/*
+ * Runs of ASCII of a single-byte encoding are UTF-8 already, only the rest
+ * goes through the table. A short run between two non-ASCII bytes is not
+ * worth a parser call and is converted with them.
+ */
+static lxb_status_t
+html_ascii(lxb_test_ctx_t *tctx, const lxb_char_t *data,
+           const lxb_char_t *end)
+{
+    size_t length;
+    lxb_status_t status;
+    const lxb_char_t *run;
+
+    while (data < end) {
+        prgm_bench_enter(&tctx->bench, PRGM_BENCH_TRANSCODE);
+
+        run = prgm_text_ascii_run(data, end, LXB_TEST_ASCII_RUN);
+        length = prgm_text_ascii_length(run, end);
+
+        prgm_bench_leave(&tctx->bench);
+
+        if (run != data) {
+            status = html_single(tctx, data, run);
+            if (status != LXB_STATUS_OK) {
+                return status;
+            }
+        }
+
+        if (length != 0) {
+            status = html_parse_chunk(tctx, run, length);
+            if (status != LXB_STATUS_OK) {
+                return status;
+            }
+        }
+
+        data = run + length;
+    }
+
+    return LXB_STATUS_OK;
+}
+
+/* What the decoder or the UTF-8 check keeps at the end of a document. */
+lxb_status_t
+lxb_test_html_transcode_finish(lxb_test_ctx_t *tctx)
+{
+    lxb_status_t status;
+
+    /* Single-byte decoding keeps nothing. */
+    if (tctx->enc_data == NULL || tctx->single != NULL) {
+        return LXB_STATUS_OK;
+    }
+
+    if (tctx->enc_data->encoding == LXB_ENCODING_UTF_8) {
+        if (tctx->utf_8_tail_length == 0) {
+            return LXB_STATUS_OK;
+        }
+
+        tctx->utf_8_tail_length = 0;
+
+        return html_parse_chunk(tctx, PRGM_TEXT_REPLACEMENT,
+                                PRGM_TEXT_REPLACEMENT_LEN);
+    }
+
+    prgm_bench_enter(&tctx->bench, PRGM_BENCH_TRANSCODE);
+
+    lxb_encoding_decode_buf_used_set(&tctx->decode, 0);
+
+    (void) lxb_encoding_decode_finish(&tctx->decode);
+
+    status = LXB_STATUS_OK;
+
+    if (lxb_encoding_decode_buf_used(&tctx->decode) != 0) {
+        status = html_encode(tctx);
+    }
+
+    prgm_bench_leave(&tctx->bench);
+
+    /* No need to call lxb_encoding_encode_finish(). */
+
+    return status;
+}
+
+lxb_status_t
+lxb_test_warc_content_header_cb(lxb_utils_warc_t *warc,
+                                const lxb_char_t *data, const lxb_char_t *end)
+{
+    size_t len;
+    lxb_status_t status;
+    lxb_utils_http_field_t *field;
+    lxb_test_ctx_t *tctx = warc->ctx;
+    lxb_html_encoding_entry_t *enc_entry;
+    const lxb_encoding_data_t *html_enc_data, *http_enc_data;
+    const lxb_char_t *enc_name, *enc_end;
+
+    static const lxb_char_t lxb_ctype[] = "Content-Type";
+
+    status = lxb_test_http_header_parse(tctx, &data, end);
+    if (status != LXB_STATUS_OK) {
+        /* The rest of a broken record is skipped. */
+        return (status == LXB_STATUS_NEXT) ? LXB_STATUS_OK : LXB_STATUS_NEXT;
+    }
+
+    tctx->total++;
+
+    enc_name = NULL;
+    enc_end = NULL;
+    html_enc_data = NULL;
+    tctx->enc_data = NULL;
+    tctx->single = NULL;
+    tctx->utf_8_tail_length = 0;
+    tctx->chunk_length = 0;
+
+    prgm_bench_enter(&tctx->bench, PRGM_BENCH_ENCODING);
+
+    /* Get encoding from HTTP Content-Type */
+    field = lxb_utils_http_header_field(tctx->http, lxb_ctype,
+                                        (sizeof(lxb_ctype) - 1), 0);
+    if (field == NULL) {
+        goto html_encoding;
+    }
+
+    enc_name = lxb_html_encoding_content(field->value.data, field->value.data
+                                         + field->value.length, &enc_end);
+    if (enc_name == NULL) {
+        TO_LOG(tctx, PRGM_LOG_DEBUG, "HTTP encoding not found in \"%s\"",
+               field->value.data);
+        goto html_encoding;
+    }
+
+    tctx->enc_data = lxb_encoding_data_by_pre_name(enc_name,
+                                                   (enc_end - enc_name));
+    if (tctx->enc_data == NULL) {
+        TO_LOG(tctx, PRGM_LOG_DEBUG, "HTTP encoding found but not determine"
+               " by \"%.*s\"", (int) (enc_end - enc_name), enc_name);
+    }
+
+html_encoding:
+
+    http_enc_data = tctx->enc_data;
+
+    status = lxb_html_encoding_determine(&tctx->html_em, data, end);
+
+    if (status != LXB_STATUS_OK) {
+        TO_LOG(tctx, PRGM_LOG_DEBUG,
+               "Failed to determine encoding from HTML stream");
+    }
+    else {
+        len = lxb_html_encoding_meta_length(&tctx->html_em);
+
+        if (len == 0) {
+            if (tctx->enc_data != NULL) {
+                TO_LOG(tctx, PRGM_LOG_DEBUG, "HTML encoding not determined"
+                       " but found in header: \"%.*s\"",
+                       (int) (enc_end - enc_name), enc_name);
+            }
+
+            TO_LOG(tctx, PRGM_LOG_DEBUG, "HTML fragment to determine"
+                   " encoding by meta tag:\n%.*s", (int) (end - data), data);
+        }
+        else {
+            enc_entry = lxb_html_encoding_meta_entry(&tctx->html_em, 0);
+
+            html_enc_data = lxb_encoding_data_by_pre_name(enc_entry->name,
+                                            (enc_entry->end - enc_entry->name));
+            if (html_enc_data == NULL) {
+                TO_LOG(tctx, PRGM_LOG_DEBUG, "HTML meta encoding found but"
+                       " not determine by \"%.*s\"",
+                       (int) (enc_entry->end - enc_entry->name),
+                       enc_entry->name);
+            }
+
+            if (tctx->enc_data == NULL) {
+                tctx->enc_data = html_enc_data;
+            }
+        }
+    }
+
+    lxb_html_encoding_clean(&tctx->html_em);
+
+    /* HTTP wins over meta. */
+    if (http_enc_data != NULL) {
+        tctx->stats_doc.source = PRGM_STATS_SOURCE_HTTP;
+        tctx->stats_doc.conflict = (html_enc_data != NULL
+                                    && html_enc_data->encoding
+                                       != http_enc_data->encoding);
+    }
+    else if (tctx->enc_data != NULL) {
+        tctx->stats_doc.source = PRGM_STATS_SOURCE_META;
+    }
+
+    if (tctx->enc_data != NULL) {
+        tctx->stats_doc.encoding = tctx->enc_data->encoding;
+    }
+
+    prgm_bench_leave(&tctx->bench);
+
+    /* Single-byte encodings are converted by a table, not the decoder. */
+    if (tctx->enc_data != NULL
+        && prgm_text_ascii_compatible(tctx->enc_data->encoding))
+    {
+        tctx->single = &tctx->pool->single[tctx->enc_data->encoding];
+    }
+    else if (tctx->enc_data != NULL) {
+        lxb_encoding_encode_init(&tctx->encode, tctx->enc_utf_8,
+                                 tctx->buf_encode, sizeof(tctx->buf_encode));
+
+        tctx->encode.replace_to = (const lxb_char_t *) "?";
+        tctx->encode.replace_len = 1;
+
+        lxb_encoding_decode_init(&tctx->decode, tctx->enc_data, tctx->buf_decode,
+                                 sizeof(tctx->buf_decode) / sizeof(lxb_codepoint_t));
+
+        tctx->decode.replace_to = LXB_ENCODING_REPLACEMENT_BUFFER;
+        tctx->decode.replace_len = LXB_ENCODING_REPLACEMENT_BUFFER_LEN;
+    }
+
+    status = warc_content_body_cb(warc, data, end);
+    if (status != LXB_STATUS_OK) {
+        return status;
+    }
+
+    warc->content_cb = warc_content_body_cb;
+
+    return LXB_STATUS_OK;
+}
+
+static lxb_status_t
+warc_content_body_cb(lxb_utils_warc_t *warc, const lxb_char_t *data,
+                     const lxb_char_t *end)
+{
+    lxb_test_ctx_t *tctx = warc->ctx;
+
+    tctx->stats_doc.bytes += end - data;
+
+    if (tctx->enc_data == NULL) {
+        return html_parse_chunk(tctx, data, (end - data));
+    }
+
+    if (tctx->enc_data->encoding == LXB_ENCODING_UTF_8) {
+        return html_utf_8(tctx, data, end);
+    }
+
+    if (tctx->single != NULL) {
+        return html_ascii(tctx, data, end);
+    }
+
+    return html_transcode(tctx, data, end);
+}
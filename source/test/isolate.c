@@ -0,0 +1,626 @@
+/*
+* Copyright (C) 2019 Alexander Borisov
+*
+* Author: Alexander Borisov <borisov@lexbor.com>
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "cache.h"
+#include "repro.h"
+#include "test.h"
+
+
+static lxb_status_t
+isolate_spawn(lxb_test_isolate_t *iso, unsigned w);
+
+static void
+isolate_worker(lxb_test_isolate_t *iso, unsigned w, int jobs);
+
+static void
+isolate_send(lxb_test_isolate_t *iso, unsigned w);
+
+static void
+isolate_done(lxb_test_isolate_t *iso, const lxb_test_done_t *done);
+
+static void
+isolate_reap(lxb_test_isolate_t *iso);
+
+static void
+isolate_crash(lxb_test_isolate_t *iso, unsigned w, int wstatus);
+
+static void
+isolate_timeouts(lxb_test_isolate_t *iso);
+
+static void
+test_slot_publish(lxb_test_ctx_t *tctx);
+
+static void
+test_slot_sync(lxb_test_ctx_t *tctx, const lxb_test_slot_t *slot);
+
+
+/*
+ * --isolate: the workers are processes fed with jobs by the main process
+ * over pipes. A worker that dies on a record takes only that record with
+ * it: its file goes on from the next gzip member in a new worker, and the
+ * member is saved for a repro.
+ */
+lxb_status_t
+lxb_test_isolate_run(lxb_test_pool_t *pool, lxb_test_ctx_t *ctxs)
+{
+    unsigned w;
+    ssize_t size;
+    struct pollfd pfd;
+    lxb_status_t status;
+    lxb_test_done_t done;
+    lxb_test_isolate_t iso;
+
+    memset(&iso, 0, sizeof(lxb_test_isolate_t));
+
+    iso.pool = pool;
+    iso.ctxs = ctxs;
+    iso.done[0] = -1;
+    iso.done[1] = -1;
+    iso.slowest = ctxs[0].bench.slow_size;
+
+    status = LXB_STATUS_ERROR;
+
+    /* Mapped before fork(), the same addresses in every worker. */
+    iso.slots = mmap(NULL, sizeof(lxb_test_slot_t) * pool->threads,
+                     PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                     -1, 0);
+    if (iso.slots == MAP_FAILED) {
+        iso.slots = NULL;
+        goto failed;
+    }
+
+    if (iso.slowest != 0) {
+        iso.slow = mmap(NULL, sizeof(prgm_bench_slow_t) * iso.slowest
+                        * pool->threads, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (iso.slow == MAP_FAILED) {
+            iso.slow = NULL;
+            goto failed;
+        }
+    }
+
+    iso.procs = lexbor_calloc(pool->threads, sizeof(lxb_test_proc_t));
+    if (iso.procs == NULL) {
+        status = LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+        goto failed;
+    }
+
+    if (pipe(iso.done) != 0) {
+        iso.done[0] = -1;
+        iso.done[1] = -1;
+        goto failed;
+    }
+
+    if (fcntl(iso.done[0], F_SETFL, O_NONBLOCK) != 0) {
+        goto failed;
+    }
+
+    /* A job written to a dead worker must not kill the supervisor. */
+    signal(SIGPIPE, SIG_IGN);
+
+    for (w = 0; w < pool->threads; w++) {
+        iso.procs[w].jobs = -1;
+        iso.slots[w].bench.slow = iso.slow + w * iso.slowest;
+    }
+
+    status = LXB_STATUS_OK;
+
+    for (w = 0; w < pool->threads; w++) {
+        status = isolate_spawn(&iso, w);
+        if (status != LXB_STATUS_OK) {
+            TO_LOG(pool, PRGM_LOG_ERROR, "Failed to create worker process");
+
+            lxb_test_pool_stop(pool, status);
+            break;
+        }
+
+        isolate_send(&iso, w);
+    }
+
+    pfd.fd = iso.done[0];
+    pfd.events = POLLIN;
+
+    while (iso.running != 0) {
+        (void) poll(&pfd, 1, LXB_TEST_POLL);
+
+        /* Results first, a worker can exit right after its last one. */
+        for (;;) {
+            size = read(iso.done[0], &done, sizeof(lxb_test_done_t));
+            if (size != sizeof(lxb_test_done_t)) {
+                break;
+            }
+
+            isolate_done(&iso, &done);
+        }
+
+        isolate_reap(&iso);
+        isolate_timeouts(&iso);
+    }
+
+failed:
+
+    if (iso.done[0] != -1) {
+        close(iso.done[0]);
+        close(iso.done[1]);
+    }
+
+    if (iso.procs != NULL) {
+        lexbor_free(iso.procs);
+    }
+
+    /* The slowest of all jobs are in the contexts by now. */
+    if (iso.slow != NULL) {
+        (void) munmap(iso.slow, sizeof(prgm_bench_slow_t) * iso.slowest
+                      * pool->threads);
+    }
+
+    if (iso.slots != NULL) {
+        (void) munmap(iso.slots, sizeof(lxb_test_slot_t) * pool->threads);
+    }
+
+    return status;
+}
+
+static lxb_status_t
+isolate_spawn(lxb_test_isolate_t *iso, unsigned w)
+{
+    int fds[2];
+    pid_t pid;
+    unsigned i;
+    lxb_test_proc_t *proc = &iso->procs[w];
+
+    if (pipe(fds) != 0) {
+        return LXB_STATUS_ERROR;
+    }
+
+    pid = fork();
+
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+
+        return LXB_STATUS_ERROR;
+    }
+
+    if (pid == 0) {
+        close(fds[1]);
+        close(iso->done[0]);
+
+        for (i = 0; i < iso->pool->threads; i++) {
+            if (iso->procs[i].jobs != -1) {
+                close(iso->procs[i].jobs);
+            }
+        }
+
+        isolate_worker(iso, w, fds[0]);
+    }
+
+    close(fds[0]);
+
+    proc->pid = pid;
+    proc->jobs = fds[1];
+    proc->busy = false;
+    proc->kill = 0;
+
+    iso->running++;
+
+    return LXB_STATUS_OK;
+}
+
+/*
+ * Only the forking thread lives on in the child: the log writer thread is
+ * not there, so the worker opens the log again, and its context is made
+ * anew so that nothing is shared with the supervisor or a dead worker.
+ */
+static void
+isolate_worker(lxb_test_isolate_t *iso, unsigned w, int jobs)
+{
+    ssize_t size;
+    lxb_test_job_t job;
+    lxb_test_done_t done;
+    lxb_test_pool_t *pool = iso->pool;
+    lxb_test_ctx_t *tctx = &iso->ctxs[w];
+    lxb_test_slot_t *slot = &iso->slots[w];
+
+    if (prgm_log_init(&pool->log_writer, pool->log_path,
+                      pool->log_writer.level) != LXB_STATUS_OK
+        || prgm_log_shared(&pool->log_writer) != LXB_STATUS_OK)
+    {
+        _exit(EXIT_FAILURE);
+    }
+
+    lxb_test_log = &pool->log_writer;
+
+    pool->log = prgm_log_buf_create(&pool->log_writer);
+
+    memset(tctx, 0, sizeof(lxb_test_ctx_t));
+
+    if (pool->log == NULL || lxb_test_ctx_init(tctx, pool) != LXB_STATUS_OK) {
+        (void) prgm_log_destroy(&pool->log_writer, false);
+        _exit(EXIT_FAILURE);
+    }
+
+    tctx->slot = slot;
+    tctx->total = slot->total;
+    tctx->filtered = slot->filtered;
+    tctx->skipped = slot->skipped;
+    tctx->released = slot->released;
+
+    done.worker = w;
+
+    for (;;) {
+        size = read(jobs, &job, sizeof(lxb_test_job_t));
+
+        if (size < 0 && errno == EINTR) {
+            continue;
+        }
+
+        /* Closed by the supervisor, no more jobs. */
+        if (size != sizeof(lxb_test_job_t)) {
+            break;
+        }
+
+        slot->base = job.base;
+        slot->record = job.base;
+        slot->member = job.begin;
+        slot->beat = prgm_bench_now();
+
+        prgm_bench_start(&tctx->bench);
+
+        done.status = lxb_test_worker_job(tctx, &job);
+
+        if (done.status != LXB_STATUS_OK
+            && lxb_test_document_drop(tctx) != LXB_STATUS_OK)
+        {
+            TO_LOG(tctx, PRGM_LOG_ERROR, "HTML document create error");
+
+            done.status = LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+        }
+
+        prgm_bench_stop(&tctx->bench);
+
+        test_slot_publish(tctx);
+
+        slot->beat = 0;
+
+        if (write(iso->done[1], &done, sizeof(lxb_test_done_t))
+            != sizeof(lxb_test_done_t)
+            || done.status == LXB_STATUS_ERROR_MEMORY_ALLOCATION)
+        {
+            break;
+        }
+    }
+
+    (void) prgm_log_destroy(&pool->log_writer, false);
+
+    _exit(EXIT_SUCCESS);
+}
+
+static void
+isolate_send(lxb_test_isolate_t *iso, unsigned w)
+{
+    ssize_t size;
+    lxb_test_proc_t *proc = &iso->procs[w];
+    lxb_test_ctx_t *tctx = &iso->ctxs[w];
+
+    if (!lxb_test_pool_next(iso->pool, &proc->job)) {
+        close(proc->jobs);
+        proc->jobs = -1;
+
+        return;
+    }
+
+    proc->before.documents = tctx->total;
+    proc->before.filtered = tctx->filtered;
+    proc->before.skipped = tctx->skipped;
+    proc->busy = true;
+
+    iso->slots[w].beat = 0;
+
+    /*
+     * Less than PIPE_BUF, written at once. If the worker is gone,
+     * isolate_reap() finds it busy with a job it never started.
+     */
+    size = write(proc->jobs, &proc->job, sizeof(lxb_test_job_t));
+    (void) size;
+}
+
+static void
+isolate_done(lxb_test_isolate_t *iso, const lxb_test_done_t *done)
+{
+    lxb_status_t status;
+    lxb_test_pool_t *pool = iso->pool;
+    lxb_test_proc_t *proc = &iso->procs[done->worker];
+    lxb_test_ctx_t *tctx = &iso->ctxs[done->worker];
+    lxb_test_slot_t *slot = &iso->slots[done->worker];
+
+    proc->busy = false;
+
+    test_slot_sync(tctx, slot);
+    prgm_bench_merge(&tctx->bench, &slot->bench);
+
+    status = done->status;
+
+    if (status != LXB_STATUS_OK && !pool->keep_going) {
+        lxb_test_pool_stop(pool, status);
+    }
+    else {
+        status = lxb_test_pool_file_done(tctx, &proc->job, &proc->before,
+                                         status);
+        if (status != LXB_STATUS_OK) {
+            lxb_test_pool_stop(pool, status);
+        }
+    }
+
+    isolate_send(iso, done->worker);
+}
+
+static void
+isolate_reap(lxb_test_isolate_t *iso)
+{
+    int wstatus;
+    pid_t pid;
+    unsigned w;
+    lxb_test_pool_t *pool = iso->pool;
+
+    while ((pid = waitpid(-1, &wstatus, WNOHANG)) > 0) {
+        for (w = 0; w < pool->threads; w++) {
+            if (iso->procs[w].pid == pid) {
+                break;
+            }
+        }
+
+        if (w == pool->threads) {
+            continue;
+        }
+
+        iso->procs[w].pid = 0;
+        iso->running--;
+
+        if (iso->procs[w].jobs != -1) {
+            close(iso->procs[w].jobs);
+            iso->procs[w].jobs = -1;
+        }
+
+        if (iso->procs[w].busy) {
+            isolate_crash(iso, w, wstatus);
+        }
+        else if (!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0) {
+            TO_LOG(pool, PRGM_LOG_ERROR, "Worker %u failed", w);
+
+            lxb_test_pool_stop(pool, LXB_STATUS_ERROR);
+        }
+    }
+}
+
+/*
+ * Gzip members are records, so the crashed one is known by its offset and
+ * the range goes on from the member after it in a new worker.
+ */
+static void
+isolate_crash(lxb_test_isolate_t *iso, unsigned w, int wstatus)
+{
+    char reason[64];
+    struct stat st;
+    size_t end, record;
+    lxb_status_t status;
+    lxb_test_job_t *range;
+    prgm_repro_member_t member;
+    lxb_test_pool_t *pool = iso->pool;
+    lxb_test_proc_t *proc = &iso->procs[w];
+    lxb_test_ctx_t *tctx = &iso->ctxs[w];
+    lxb_test_slot_t *slot = &iso->slots[w];
+    const char *path = (const char *) proc->job.fullpath;
+
+    proc->busy = false;
+
+    if (slot->beat == 0) {
+        TO_LOG(pool, PRGM_LOG_ERROR, "Worker %u died before its job: %s",
+               w, path);
+
+        lxb_test_pool_stop(pool, LXB_STATUS_ERROR);
+        return;
+    }
+
+    /* The bench of the job is lost with the worker, counters are not. */
+    test_slot_sync(tctx, slot);
+
+    if (proc->kill != 0) {
+        snprintf(reason, sizeof(reason), "timed out");
+    }
+    else if (WIFSIGNALED(wstatus)) {
+        snprintf(reason, sizeof(reason), "killed by signal %d",
+                 WTERMSIG(wstatus));
+    }
+    else {
+        snprintf(reason, sizeof(reason), "exited with code %d",
+                 WEXITSTATUS(wstatus));
+    }
+
+    record = slot->record;
+
+    TO_LOG(pool, PRGM_LOG_ERROR, "Worker %u %s: %s record "LEXBOR_FORMAT_Z
+           " at offset "LEXBOR_FORMAT_Z, w, reason, path, record,
+           slot->member);
+
+    pool->crashed++;
+
+    /* A cache frame has its length, its record is not saved. */
+    if (prgm_cache_name_is((const lxb_char_t *) path, strlen(path))) {
+        memset(&member, 0, sizeof(prgm_repro_member_t));
+
+        status = prgm_cache_frame_next(path, slot->member, &member.next);
+    }
+    else {
+        status = prgm_repro_member_read(&member, path, slot->member);
+    }
+
+    if (status == LXB_STATUS_OK && pool->repro != NULL
+        && member.compressed != NULL
+        && prgm_repro_save(&member, pool->repro, proc->job.fullpath, record)
+           != LXB_STATUS_OK)
+    {
+        TO_LOG(pool, PRGM_LOG_ERROR, "Failed to save repro of %s record "
+               LEXBOR_FORMAT_Z" to %s", path, record, pool->repro);
+    }
+
+    end = proc->job.end;
+
+    if (end == SIZE_MAX) {
+        end = (stat(path, &st) == 0) ? (size_t) st.st_size : 0;
+    }
+
+    range = NULL;
+
+    if (status != LXB_STATUS_OK) {
+        TO_LOG(pool, PRGM_LOG_ERROR, "Can not read the member of %s record "
+               LEXBOR_FORMAT_Z", the rest of the range is lost", path,
+               record);
+    }
+    else if (member.next < end) {
+        range = lexbor_malloc(sizeof(lxb_test_job_t));
+    }
+
+    if (range != NULL) {
+        *range = proc->job;
+
+        range->begin = member.next;
+        range->end = end;
+        range->base = record + 1;
+        range->members = 0;
+        range->prefetch = NULL;
+
+        pthread_mutex_lock(&pool->lock);
+
+        if (lexbor_array_push(pool->ranges, range) == LXB_STATUS_OK) {
+            pool->progress[range->file].parts++;
+            range = NULL;
+        }
+
+        pthread_mutex_unlock(&pool->lock);
+
+        if (range != NULL) {
+            lexbor_free(range);
+
+            lxb_test_pool_stop(pool, LXB_STATUS_ERROR_MEMORY_ALLOCATION);
+        }
+    }
+
+    (void) prgm_repro_member_destroy(&member, false);
+
+    /* The file goes on, but it is not done well: --resume takes it again. */
+    status = lxb_test_pool_file_done(tctx, &proc->job, &proc->before,
+                                     LXB_STATUS_ABORTED);
+    if (status != LXB_STATUS_OK) {
+        lxb_test_pool_stop(pool, status);
+    }
+
+    if (pool->stop) {
+        return;
+    }
+
+    status = isolate_spawn(iso, w);
+    if (status != LXB_STATUS_OK) {
+        TO_LOG(pool, PRGM_LOG_ERROR, "Failed to create worker process");
+
+        lxb_test_pool_stop(pool, status);
+        return;
+    }
+
+    isolate_send(iso, w);
+}
+
+/* SIGABRT flushes the log of the worker, SIGKILL is for a hung one. */
+static void
+isolate_timeouts(lxb_test_isolate_t *iso)
+{
+    unsigned w;
+    uint64_t now, beat;
+    lxb_test_proc_t *proc;
+    lxb_test_pool_t *pool = iso->pool;
+
+    if (pool->timeout == 0) {
+        return;
+    }
+
+    now = prgm_bench_now();
+
+    for (w = 0; w < pool->threads; w++) {
+        proc = &iso->procs[w];
+
+        if (proc->pid == 0 || !proc->busy) {
+            continue;
+        }
+
+        if (proc->kill != 0) {
+            if (now - proc->kill > LXB_TEST_KILL_GRACE * 1000000ULL) {
+                (void) kill(proc->pid, SIGKILL);
+            }
+
+            continue;
+        }
+
+        beat = iso->slots[w].beat;
+
+        if (beat != 0 && now > beat && now - beat > pool->timeout) {
+            (void) kill(proc->pid, SIGABRT);
+
+            proc->kill = now;
+        }
+    }
+}
+
+/* Counters of the worker for the supervisor, as they are right now. */
+void
+lxb_test_slot_count(lxb_test_ctx_t *tctx)
+{
+    lxb_test_slot_t *slot = tctx->slot;
+
+    slot->total = tctx->total;
+    slot->filtered = tctx->filtered;
+    slot->skipped = tctx->skipped;
+    slot->released = tctx->released;
+}
+
+/* The bench of a finished job goes to the slot, the worker starts anew. */
+static void
+test_slot_publish(lxb_test_ctx_t *tctx)
+{
+    lxb_test_slot_t *slot = tctx->slot;
+    prgm_bench_slow_t *slow = slot->bench.slow;
+
+    slot->bench = tctx->bench;
+    slot->bench.slow = slow;
+    slot->bench.perf = NULL;
+
+    if (tctx->bench.slow_length != 0) {
+        memcpy(slow, tctx->bench.slow,
+               sizeof(prgm_bench_slow_t) * tctx->bench.slow_length);
+    }
+
+    prgm_bench_clear(&tctx->bench);
+
+    lxb_test_slot_count(tctx);
+}
+
+/* In the supervisor: the context of a worker takes its counters. */
+static void
+test_slot_sync(lxb_test_ctx_t *tctx, const lxb_test_slot_t *slot)
+{
+    tctx->total = slot->total;
+    tctx->filtered = slot->filtered;
+    tctx->skipped = slot->skipped;
+    tctx->released = slot->released;
+}
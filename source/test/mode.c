@@ -0,0 +1,568 @@
+/*
+* Copyright (C) 2019 Alexander Borisov
+*
+* Author: Alexander Borisov <borisov@lexbor.com>
+*/
+
+#include "test.h"
+
+
+static lxb_status_t
+warc_single_header_cb(lxb_utils_warc_t *warc);
+
+static lxb_status_t
+warc_single_content_end_cb(lxb_utils_warc_t *warc);
+
+static lxb_status_t
+warc_multi_header_cb(lxb_utils_warc_t *warc);
+
+static lxb_status_t
+warc_multi_content_end_cb(lxb_utils_warc_t *warc);
+
+static lxb_status_t
+warc_recycle_header_cb(lxb_utils_warc_t *warc);
+
+static lxb_status_t
+warc_recycle_content_end_cb(lxb_utils_warc_t *warc);
+
+static lxb_html_token_t *
+tokenize_token_cb(lxb_html_tokenizer_t *tkz, lxb_html_token_t *token,
+                  void *ctx);
+
+static lxb_status_t
+warc_tokenize_header_cb(lxb_utils_warc_t *warc);
+
+static lxb_status_t
+warc_tokenize_content_end_cb(lxb_utils_warc_t *warc);
+
+static lxb_status_t
+warc_stage_header_cb(lxb_utils_warc_t *warc);
+
+static lxb_status_t
+warc_stage_content_cb(lxb_utils_warc_t *warc, const lxb_char_t *data,
+                      const lxb_char_t *end);
+
+static lxb_status_t
+warc_stage_content_end_cb(lxb_utils_warc_t *warc);
+
+static lxb_status_t
+warc_http_content_cb(lxb_utils_warc_t *warc, const lxb_char_t *data,
+                     const lxb_char_t *end);
+
+static lxb_status_t
+warc_http_content_end_cb(lxb_utils_warc_t *warc);
+
+
+/* Callbacks of the WARC parser and the HTML tokenizer by the mode. */
+lxb_status_t
+lxb_test_mode_init(lxb_test_ctx_t *tctx)
+{
+    lxb_status_t status;
+    lxb_test_pool_t *pool = tctx->pool;
+
+    switch (pool->mode) {
+        case LXB_TEST_MODE_SINGLE:
+            tctx->document = lxb_html_document_create();
+            if (tctx->document == NULL) {
+                return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+            }
+
+            tctx->h_cd = warc_single_header_cb;
+            tctx->c_end_cb = warc_single_content_end_cb;
+            break;
+
+        case LXB_TEST_MODE_MULTI:
+            tctx->h_cd = warc_multi_header_cb;
+            tctx->c_end_cb = warc_multi_content_end_cb;
+            break;
+
+        case LXB_TEST_MODE_RECYCLE:
+            tctx->h_cd = warc_recycle_header_cb;
+            tctx->c_end_cb = warc_recycle_content_end_cb;
+            break;
+
+        case LXB_TEST_MODE_INFLATE:
+            break;
+
+        case LXB_TEST_MODE_WARC:
+            tctx->h_cd = warc_stage_header_cb;
+            tctx->c_cb = warc_stage_content_cb;
+            tctx->c_end_cb = warc_stage_content_end_cb;
+
+            return LXB_STATUS_OK;
+
+        case LXB_TEST_MODE_HTTP:
+            tctx->h_cd = warc_stage_header_cb;
+            tctx->c_cb = warc_http_content_cb;
+            tctx->c_end_cb = warc_http_content_end_cb;
+
+            return LXB_STATUS_OK;
+
+        case LXB_TEST_MODE_TOKENIZE:
+            tctx->tokenizer = lxb_html_tokenizer_create();
+            status = lxb_html_tokenizer_init(tctx->tokenizer);
+            if (status != LXB_STATUS_OK) {
+                return status;
+            }
+
+            lxb_html_tokenizer_callback_token_done_set(tctx->tokenizer,
+                                                       tokenize_token_cb,
+                                                       NULL);
+
+            tctx->h_cd = warc_tokenize_header_cb;
+            tctx->c_end_cb = warc_tokenize_content_end_cb;
+            break;
+
+        default:
+            break;
+    }
+
+    tctx->c_cb = lxb_test_warc_content_header_cb;
+
+    return LXB_STATUS_OK;
+}
+
+lxb_status_t
+lxb_test_gzip_cb(prgm_gzip_t *gzip, const lxb_char_t *data, size_t size)
+{
+    lxb_status_t status;
+    lxb_test_ctx_t *tctx = gzip->ctx;
+
+    tctx->bench.decompressed += size;
+
+    /*
+     * Where a crash would be, see isolate_crash(). The output never spans
+     * two members, so the inflate counters are exact for any backend.
+     */
+    if (tctx->slot != NULL) {
+        tctx->slot->record = tctx->slot->base + gzip->count;
+        tctx->slot->member = gzip->offset;
+        tctx->slot->beat = prgm_bench_now();
+    }
+
+    prgm_bench_enter(&tctx->bench, PRGM_BENCH_WARC);
+
+    status = lxb_utils_warc_parse(tctx->warc, &data, (data + size));
+
+    prgm_bench_leave(&tctx->bench);
+
+    if (tctx->slot != NULL) {
+        lxb_test_slot_count(tctx);
+    }
+
+    if (status != LXB_STATUS_OK && tctx->warc->error != NULL) {
+        TO_LOG(tctx, PRGM_LOG_ERROR, "WARC error: %s", tctx->warc->error);
+    }
+
+    return status;
+}
+
+/* Inflate mode, the data goes nowhere. */
+lxb_status_t
+lxb_test_gzip_inflate_cb(prgm_gzip_t *gzip, const lxb_char_t *data,
+                         size_t size)
+{
+    lxb_test_ctx_t *tctx = gzip->ctx;
+
+    (void) data;
+
+    tctx->bench.decompressed += size;
+
+    if (tctx->slot != NULL) {
+        tctx->slot->record = tctx->slot->base + gzip->count;
+        tctx->slot->member = gzip->offset;
+        tctx->slot->beat = prgm_bench_now();
+    }
+
+    return LXB_STATUS_OK;
+}
+
+static lxb_status_t
+warc_single_header_cb(lxb_utils_warc_t *warc)
+{
+    lxb_status_t status;
+    lxb_test_ctx_t *tctx = warc->ctx;
+
+    if (!lxb_test_record_filter(tctx)) {
+        return LXB_STATUS_NEXT;
+    }
+
+    lxb_test_document_begin(tctx);
+
+    if (lxb_test_http_check_html_type(tctx) == LXB_STATUS_NEXT) {
+        return LXB_STATUS_NEXT;
+    }
+
+    prgm_bench_enter(&tctx->bench, PRGM_BENCH_TREE);
+
+    status = lxb_html_document_parse_chunk_begin(tctx->document);
+
+    prgm_bench_leave(&tctx->bench);
+
+    if (status != LXB_STATUS_OK) {
+        TO_LOG(tctx, PRGM_LOG_ERROR, "HTML chunk begin error");
+        return LXB_STATUS_ERROR;
+    }
+
+    return LXB_STATUS_OK;
+}
+
+static lxb_status_t
+warc_single_content_end_cb(lxb_utils_warc_t *warc)
+{
+    lxb_status_t status;
+    lxb_test_ctx_t *tctx = warc->ctx;
+
+    status = lxb_test_html_transcode_finish(tctx);
+    if (status != LXB_STATUS_OK) {
+        return status;
+    }
+
+    lxb_utils_http_clear(tctx->http);
+
+    prgm_bench_enter(&tctx->bench, PRGM_BENCH_TREE);
+
+    status = lxb_html_document_parse_chunk_end(tctx->document);
+
+    prgm_bench_leave(&tctx->bench);
+
+    if (status != LXB_STATUS_OK) {
+        TO_LOG(tctx, PRGM_LOG_ERROR, "HTML chunk end error");
+        return LXB_STATUS_ERROR;
+    }
+
+    if (lxb_test_document_done(tctx)) {
+        lxb_test_document_release(tctx);
+
+        tctx->document = lxb_html_document_create();
+        if (tctx->document == NULL) {
+            TO_LOG(tctx, PRGM_LOG_ERROR, "HTML document create error");
+            return LXB_STATUS_ERROR;
+        }
+    }
+
+    warc->content_cb = lxb_test_warc_content_header_cb;
+
+    return lxb_test_document_end(tctx);
+}
+
+static lxb_status_t
+warc_multi_header_cb(lxb_utils_warc_t *warc)
+{
+    lxb_status_t status;
+    lxb_test_ctx_t *tctx = warc->ctx;
+
+    if (!lxb_test_record_filter(tctx)) {
+        return LXB_STATUS_NEXT;
+    }
+
+    lxb_test_document_begin(tctx);
+
+    prgm_bench_enter(&tctx->bench, PRGM_BENCH_TREE);
+
+    tctx->document = lxb_html_document_create();
+    if (tctx->document == NULL) {
+        prgm_bench_leave(&tctx->bench);
+
+        TO_LOG(tctx, PRGM_LOG_ERROR, "HTML document create error");
+        return LXB_STATUS_ERROR;
+    }
+
+    status = lxb_html_document_parse_chunk_begin(tctx->document);
+
+    prgm_bench_leave(&tctx->bench);
+
+    if (status != LXB_STATUS_OK) {
+        TO_LOG(tctx, PRGM_LOG_ERROR, "HTML chunk begin error");
+        return LXB_STATUS_ERROR;
+    }
+
+    return LXB_STATUS_OK;
+}
+
+static lxb_status_t
+warc_multi_content_end_cb(lxb_utils_warc_t *warc)
+{
+    lxb_status_t status;
+    lxb_test_ctx_t *tctx = warc->ctx;
+
+    status = lxb_test_html_transcode_finish(tctx);
+    if (status != LXB_STATUS_OK) {
+        return status;
+    }
+
+    lxb_utils_http_clear(tctx->http);
+
+    prgm_bench_enter(&tctx->bench, PRGM_BENCH_TREE);
+
+    status = lxb_html_document_parse_chunk_end(tctx->document);
+
+    prgm_bench_leave(&tctx->bench);
+
+    if (status != LXB_STATUS_OK) {
+        TO_LOG(tctx, PRGM_LOG_ERROR, "HTML chunk end error");
+        return LXB_STATUS_ERROR;
+    }
+
+    /* The document goes anyway. */
+    (void) lxb_test_document_done(tctx);
+
+    prgm_bench_enter(&tctx->bench, PRGM_BENCH_TREE);
+
+    tctx->document = lxb_html_document_destroy(tctx->document);
+
+    prgm_bench_leave(&tctx->bench);
+
+    warc->content_cb = lxb_test_warc_content_header_cb;
+
+    return lxb_test_document_end(tctx);
+}
+
+static lxb_status_t
+warc_recycle_header_cb(lxb_utils_warc_t *warc)
+{
+    lxb_status_t status;
+    lxb_test_ctx_t *tctx = warc->ctx;
+
+    if (!lxb_test_record_filter(tctx)) {
+        return LXB_STATUS_NEXT;
+    }
+
+    lxb_test_document_begin(tctx);
+
+    prgm_bench_enter(&tctx->bench, PRGM_BENCH_TREE);
+
+    /* The first record or the document was released after the last one. */
+    if (tctx->document == NULL) {
+        tctx->document = lxb_html_document_create();
+        if (tctx->document == NULL) {
+            prgm_bench_leave(&tctx->bench);
+
+            TO_LOG(tctx, PRGM_LOG_ERROR, "HTML document create error");
+            return LXB_STATUS_ERROR;
+        }
+    }
+
+    status = lxb_html_document_parse_chunk_begin(tctx->document);
+
+    prgm_bench_leave(&tctx->bench);
+
+    if (status != LXB_STATUS_OK) {
+        TO_LOG(tctx, PRGM_LOG_ERROR, "HTML chunk begin error");
+        return LXB_STATUS_ERROR;
+    }
+
+    return LXB_STATUS_OK;
+}
+
+static lxb_status_t
+warc_recycle_content_end_cb(lxb_utils_warc_t *warc)
+{
+    lxb_status_t status;
+    lxb_test_ctx_t *tctx = warc->ctx;
+
+    status = lxb_test_html_transcode_finish(tctx);
+    if (status != LXB_STATUS_OK) {
+        return status;
+    }
+
+    lxb_utils_http_clear(tctx->http);
+
+    prgm_bench_enter(&tctx->bench, PRGM_BENCH_TREE);
+
+    status = lxb_html_document_parse_chunk_end(tctx->document);
+
+    if (status != LXB_STATUS_OK) {
+        prgm_bench_leave(&tctx->bench);
+
+        TO_LOG(tctx, PRGM_LOG_ERROR, "HTML chunk end error");
+        return LXB_STATUS_ERROR;
+    }
+
+    /*
+     * Clean keeps the document with its hashes and the parser buffers,
+     * a document that grew over the limit gives everything back.
+     */
+    if (lxb_test_document_done(tctx)) {
+        lxb_test_document_release(tctx);
+    }
+    else if (tctx->mem_document > tctx->pool->recycle_limit) {
+        tctx->document = lxb_html_document_destroy(tctx->document);
+        tctx->released++;
+
+        TO_LOG(tctx, PRGM_LOG_RECORD, LEXBOR_FORMAT_Z": document of "
+               LEXBOR_FORMAT_Z" bytes released", tctx->doc_record,
+               tctx->mem_document);
+    }
+    else {
+        lxb_html_document_clean(tctx->document);
+    }
+
+    prgm_bench_leave(&tctx->bench);
+
+    warc->content_cb = lxb_test_warc_content_header_cb;
+
+    return lxb_test_document_end(tctx);
+}
+
+/*
+ * Tokenize mode is multi with the tokenizer in place of the tree builder.
+ * The tree builder is what switches the tokenizer to the text states, so
+ * the start tags that do it are handled here the same way.
+ */
+static lxb_html_token_t *
+tokenize_token_cb(lxb_html_tokenizer_t *tkz, lxb_html_token_t *token,
+                  void *ctx)
+{
+    (void) ctx;
+
+    if (token->type & LXB_HTML_TOKEN_TYPE_CLOSE) {
+        return token;
+    }
+
+    switch (token->tag_id) {
+        case LXB_TAG_SCRIPT:
+        case LXB_TAG_STYLE:
+        case LXB_TAG_TEXTAREA:
+        case LXB_TAG_TITLE:
+        case LXB_TAG_XMP:
+        case LXB_TAG_IFRAME:
+        case LXB_TAG_NOEMBED:
+        case LXB_TAG_NOFRAMES:
+        case LXB_TAG_PLAINTEXT:
+            lxb_html_tokenizer_set_state_by_tag(tkz, false, token->tag_id,
+                                                LXB_NS_HTML);
+            break;
+
+        default:
+            break;
+    }
+
+    return token;
+}
+
+static lxb_status_t
+warc_tokenize_header_cb(lxb_utils_warc_t *warc)
+{
+    lxb_status_t status;
+    lxb_test_ctx_t *tctx = warc->ctx;
+
+    if (!lxb_test_record_filter(tctx)) {
+        return LXB_STATUS_NEXT;
+    }
+
+    lxb_test_document_begin(tctx);
+
+    prgm_bench_enter(&tctx->bench, PRGM_BENCH_TREE);
+
+    status = lxb_html_tokenizer_begin(tctx->tokenizer);
+
+    prgm_bench_leave(&tctx->bench);
+
+    if (status != LXB_STATUS_OK) {
+        TO_LOG(tctx, PRGM_LOG_ERROR, "HTML tokenizer begin error");
+        return LXB_STATUS_ERROR;
+    }
+
+    return LXB_STATUS_OK;
+}
+
+static lxb_status_t
+warc_tokenize_content_end_cb(lxb_utils_warc_t *warc)
+{
+    lxb_status_t status;
+    lxb_test_ctx_t *tctx = warc->ctx;
+
+    status = lxb_test_html_transcode_finish(tctx);
+    if (status != LXB_STATUS_OK) {
+        return status;
+    }
+
+    lxb_utils_http_clear(tctx->http);
+
+    prgm_bench_enter(&tctx->bench, PRGM_BENCH_TREE);
+
+    status = lxb_html_tokenizer_end(tctx->tokenizer);
+
+    /* Tokens and the incoming buffers of the record. */
+    lxb_html_tokenizer_clean(tctx->tokenizer);
+
+    prgm_bench_leave(&tctx->bench);
+
+    if (status != LXB_STATUS_OK) {
+        TO_LOG(tctx, PRGM_LOG_ERROR, "HTML tokenizer end error");
+        return LXB_STATUS_ERROR;
+    }
+
+    warc->content_cb = lxb_test_warc_content_header_cb;
+
+    return lxb_test_document_end(tctx);
+}
+
+/* Warc and http modes, every record that passes is a document. */
+static lxb_status_t
+warc_stage_header_cb(lxb_utils_warc_t *warc)
+{
+    lxb_test_ctx_t *tctx = warc->ctx;
+
+    if (!lxb_test_record_filter(tctx)) {
+        return LXB_STATUS_NEXT;
+    }
+
+    lxb_test_document_begin(tctx);
+
+    return LXB_STATUS_OK;
+}
+
+static lxb_status_t
+warc_stage_content_cb(lxb_utils_warc_t *warc, const lxb_char_t *data,
+                      const lxb_char_t *end)
+{
+    (void) warc;
+    (void) data;
+    (void) end;
+
+    return LXB_STATUS_OK;
+}
+
+static lxb_status_t
+warc_stage_content_end_cb(lxb_utils_warc_t *warc)
+{
+    lxb_test_ctx_t *tctx = warc->ctx;
+
+    tctx->total++;
+
+    return lxb_test_document_end(tctx);
+}
+
+static lxb_status_t
+warc_http_content_cb(lxb_utils_warc_t *warc, const lxb_char_t *data,
+                     const lxb_char_t *end)
+{
+    lxb_status_t status;
+    lxb_test_ctx_t *tctx = warc->ctx;
+
+    status = lxb_test_http_header_parse(tctx, &data, end);
+    if (status != LXB_STATUS_OK) {
+        return (status == LXB_STATUS_NEXT) ? LXB_STATUS_OK : LXB_STATUS_NEXT;
+    }
+
+    tctx->total++;
+
+    /* The body is skipped. */
+    warc->content_cb = warc_stage_content_cb;
+
+    return LXB_STATUS_OK;
+}
+
+static lxb_status_t
+warc_http_content_end_cb(lxb_utils_warc_t *warc)
+{
+    lxb_test_ctx_t *tctx = warc->ctx;
+
+    lxb_utils_http_clear(tctx->http);
+
+    warc->content_cb = warc_http_content_cb;
+
+    return lxb_test_document_end(tctx);
+}
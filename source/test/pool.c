@@ -0,0 +1,420 @@
+/*
+* Copyright (C) 2019 Alexander Borisov
+*
+* Author: Alexander Borisov <borisov@lexbor.com>
+*/
+
+#include <time.h>
+
+#include "cache.h"
+#include "test.h"
+
+
+/*
+ * The log is buffered, make sure it reaches the file when the process
+ * exits by exit() or dies on a fatal signal.
+ */
+prgm_log_t *lxb_test_log;
+
+
+static void
+pool_intake_wait(lxb_test_pool_t *pool, lxb_test_ctx_t *tctx);
+
+
+void
+lxb_test_pool_destroy(lxb_test_pool_t *pool, lxb_test_ctx_t *ctxs)
+{
+    size_t i;
+
+    if (ctxs != NULL) {
+        for (i = 0; i < pool->threads; i++) {
+            lxb_test_ctx_destroy(&ctxs[i]);
+        }
+
+        lexbor_free(ctxs);
+    }
+
+    if (pool->progress != NULL) {
+        for (i = 0; i < lexbor_array_length(pool->files); i++) {
+            (void) lxb_test_file_split_destroy(pool->progress[i].split);
+        }
+
+        pool->progress = lexbor_free(pool->progress);
+    }
+
+    if (pool->files != NULL) {
+        for (i = 0; i < lexbor_array_length(pool->files); i++) {
+            lexbor_free(lexbor_array_get(pool->files, i));
+        }
+
+        lexbor_array_destroy(pool->files, true);
+    }
+
+    (void) prgm_checkpoint_destroy(&pool->checkpoint, false);
+
+    if (pool->ranges != NULL) {
+        for (i = 0; i < lexbor_array_length(pool->ranges); i++) {
+            lexbor_free(lexbor_array_get(pool->ranges, i));
+        }
+
+        lexbor_array_destroy(pool->ranges, true);
+    }
+
+    if (pool->single != NULL) {
+        pool->single = prgm_text_single_destroy_all(pool->single);
+    }
+
+    (void) prgm_filter_destroy(&pool->filter, false);
+
+    if (pool->log != NULL) {
+        lxb_test_log = NULL;
+
+        prgm_log_destroy(&pool->log_writer, false);
+    }
+
+    (void) pthread_mutex_destroy(&pool->lock);
+}
+
+/*
+ * Ranges of already split files go first, so that a big file is finished
+ * by all workers together before they take new files.
+ */
+bool
+lxb_test_pool_next(lxb_test_pool_t *pool, lxb_test_job_t *job)
+{
+    bool found = false;
+    lxb_test_job_t *range;
+
+    pthread_mutex_lock(&pool->lock);
+
+    if (pool->stop) {
+        goto done;
+    }
+
+    if (lexbor_array_length(pool->ranges) != 0) {
+        range = lexbor_array_get(pool->ranges,
+                                 lexbor_array_length(pool->ranges) - 1);
+        pool->ranges->length--;
+
+        *job = *range;
+        lexbor_free(range);
+
+        found = true;
+    }
+    else if (pool->next < lexbor_array_length(pool->files)) {
+        job->fullpath = lexbor_array_get(pool->files, pool->next);
+        job->begin = 0;
+        job->end = SIZE_MAX;
+        job->base = 0;
+        job->members = 0;
+        job->file = pool->next;
+        job->part = 0;
+
+        pool->next++;
+
+        job->prefetch = NULL;
+
+        if (pool->next < lexbor_array_length(pool->files)) {
+            job->prefetch = lexbor_array_get(pool->files, pool->next);
+        }
+
+        found = true;
+    }
+
+done:
+
+    pthread_mutex_unlock(&pool->lock);
+
+    return found;
+}
+
+void
+lxb_test_pool_stop(lxb_test_pool_t *pool, lxb_status_t status)
+{
+    pthread_mutex_lock(&pool->lock);
+
+    pool->stop = true;
+
+    if (pool->status == LXB_STATUS_OK) {
+        pool->status = status;
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * A job is over. When it was the last range of its file, the file goes to
+ * the checkpoint as done or failed. Without --keep-going a failed file
+ * stops the run and is not written, it is tried again on resume anyway.
+ */
+lxb_status_t
+lxb_test_pool_file_done(lxb_test_ctx_t *tctx, const lxb_test_job_t *job,
+                        const lxb_test_file_t *before, lxb_status_t status)
+{
+    bool last;
+    lxb_test_file_t *file;
+    prgm_checkpoint_entry_t entry;
+    lxb_test_pool_t *pool = tctx->pool;
+
+    pthread_mutex_lock(&pool->lock);
+
+    file = &pool->progress[job->file];
+
+    file->documents += tctx->total - before->documents;
+    file->filtered += tctx->filtered - before->filtered;
+    file->skipped += tctx->skipped - before->skipped;
+
+    if (status != LXB_STATUS_OK && file->status == LXB_STATUS_OK) {
+        file->status = status;
+    }
+
+    last = --file->parts == 0;
+
+    if (last) {
+        file->split = lxb_test_file_split_destroy(file->split);
+    }
+
+    if (last && file->status != LXB_STATUS_OK) {
+        pool->failed++;
+
+        TO_LOG(tctx, PRGM_LOG_ERROR, "Going on after failed file: %s",
+               (const char *) job->fullpath);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    if (!last || pool->checkpoint.path == NULL) {
+        return LXB_STATUS_OK;
+    }
+
+    /* Other ranges are done, nobody else changes the file now. */
+    entry.path = (lxb_char_t *) job->fullpath;
+    entry.documents = file->documents;
+    entry.filtered = file->filtered;
+    entry.skipped = file->skipped;
+
+    status = prgm_checkpoint_add(&pool->checkpoint, &entry, file->status);
+    if (status != LXB_STATUS_OK) {
+        TO_LOG(tctx, PRGM_LOG_ERROR, "Failed to write checkpoint: %s",
+               pool->checkpoint.path);
+    }
+
+    return status;
+}
+
+/*
+ * Over --max-rss a worker does not take a new file until the RSS went
+ * down. One worker always goes on: the last one that is not waiting, or
+ * any of them if all others are done.
+ */
+static void
+pool_intake_wait(lxb_test_pool_t *pool, lxb_test_ctx_t *tctx)
+{
+    bool go;
+    size_t rss;
+    struct timespec ts;
+
+    if (pool->max_rss == 0) {
+        return;
+    }
+
+    rss = lxb_test_rss_sample(tctx);
+    if (rss <= pool->max_rss) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+
+    go = pool->stop || pool->paused + 1 >= pool->active;
+
+    if (!go) {
+        pool->paused++;
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    if (go) {
+        return;
+    }
+
+    TO_LOG(tctx, PRGM_LOG_INFO, "RSS "LEXBOR_FORMAT_Z" is over the limit,"
+           " worker waits", rss);
+
+    ts.tv_sec = 0;
+    ts.tv_nsec = LXB_TEST_RSS_WAIT * 1000000L;
+
+    do {
+        (void) nanosleep(&ts, NULL);
+
+        pthread_mutex_lock(&pool->lock);
+        go = pool->stop || pool->paused >= pool->active;
+        pthread_mutex_unlock(&pool->lock);
+    }
+    while (!go && lxb_test_rss_sample(tctx) > pool->max_rss);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->paused--;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+lexbor_action_t
+lxb_test_dir_files_cb(const lxb_char_t *fullpath, size_t fullpath_len,
+                      const lxb_char_t *filename, size_t filename_len,
+                      void *ctx)
+{
+    bool cached;
+    lxb_char_t *path;
+    lxb_test_pool_t *pool = ctx;
+    const prgm_checkpoint_entry_t *done;
+
+    cached = prgm_cache_name_is(filename, filename_len);
+
+    if (!cached
+        && (filename_len < 8
+            || lexbor_str_data_ncasecmp((const lxb_char_t *) "warc.gz",
+                                        &filename[filename_len - 7], 7)
+               == false))
+    {
+        return LEXBOR_ACTION_NEXT;
+    }
+
+    /* Files of other shards. */
+    if (!prgm_filter_file(&pool->filter,
+                          prgm_filter_file_hash(filename, filename_len)))
+    {
+        return LEXBOR_ACTION_NEXT;
+    }
+
+    if (pool->resume) {
+        done = prgm_checkpoint_find(&pool->checkpoint, filename,
+                                    filename_len);
+        if (done != NULL) {
+            pool->resumed++;
+            pool->resumed_total += done->documents;
+
+            return LEXBOR_ACTION_NEXT;
+        }
+    }
+
+    path = lexbor_malloc(fullpath_len + 1);
+    if (path == NULL) {
+        pool->status = LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+        return LEXBOR_ACTION_STOP;
+    }
+
+    memcpy(path, fullpath, fullpath_len);
+    path[fullpath_len] = 0x00;
+
+    pool->status = lexbor_array_push(pool->files, path);
+    if (pool->status != LXB_STATUS_OK) {
+        lexbor_free(path);
+        return LEXBOR_ACTION_STOP;
+    }
+
+    pool->cached += cached;
+
+    return LEXBOR_ACTION_OK;
+}
+
+void *
+lxb_test_worker_thread(void *arg)
+{
+    lxb_status_t status;
+    lxb_test_job_t job;
+    lxb_test_file_t before;
+    lxb_test_ctx_t *tctx = arg;
+    lxb_test_pool_t *pool = tctx->pool;
+
+    prgm_bench_start(&tctx->bench);
+
+    for (;;) {
+        pool_intake_wait(pool, tctx);
+
+        if (!lxb_test_pool_next(pool, &job)) {
+            break;
+        }
+
+        before.documents = tctx->total;
+        before.filtered = tctx->filtered;
+        before.skipped = tctx->skipped;
+
+        status = lxb_test_worker_job(tctx, &job);
+
+        /* The file could break off in the middle of a record. */
+        if (status != LXB_STATUS_OK && pool->keep_going
+            && lxb_test_document_drop(tctx) != LXB_STATUS_OK)
+        {
+            TO_LOG(tctx, PRGM_LOG_ERROR, "HTML document create error");
+
+            lxb_test_pool_stop(pool, LXB_STATUS_ERROR_MEMORY_ALLOCATION);
+            break;
+        }
+
+        if (status != LXB_STATUS_OK && !pool->keep_going) {
+            lxb_test_pool_stop(pool, status);
+            break;
+        }
+
+        status = lxb_test_pool_file_done(tctx, &job, &before, status);
+        if (status != LXB_STATUS_OK) {
+            lxb_test_pool_stop(pool, status);
+            break;
+        }
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->active--;
+    pthread_mutex_unlock(&pool->lock);
+
+    prgm_bench_stop(&tctx->bench);
+
+    return NULL;
+}
+
+lxb_status_t
+lxb_test_worker_job(lxb_test_ctx_t *tctx, lxb_test_job_t *job)
+{
+    bool indexed;
+    lxb_status_t status;
+    prgm_index_t index;
+    lxb_test_pool_t *pool = tctx->pool;
+
+    indexed = false;
+
+    /* With an index filtered records are not even read. */
+    if (job->end == SIZE_MAX && prgm_filter_active(&pool->filter)) {
+        status = prgm_index_load(&index, (const char *) job->fullpath);
+
+        if (status == LXB_STATUS_OK) {
+            indexed = true;
+        }
+        else if (status != LXB_STATUS_ERROR_NOT_EXISTS) {
+            TO_LOG(tctx, PRGM_LOG_INFO, "Index of %s is not valid,"
+                   " ignored", (const char *) job->fullpath);
+        }
+    }
+
+    status = LXB_STATUS_OK;
+
+    if (!indexed && job->end == SIZE_MAX && pool->threads > 1
+        && pool->split_size != 0)
+    {
+        status = lxb_test_file_split(tctx, job);
+    }
+
+    if (status == LXB_STATUS_OK && job->end != SIZE_MAX
+        && pool->progress[job->file].split != NULL)
+    {
+        status = lxb_test_file_split_base(tctx, job);
+    }
+
+    if (status == LXB_STATUS_OK) {
+        status = lxb_test_file_process(tctx, job, (indexed) ? &index : NULL);
+    }
+
+    if (indexed) {
+        (void) prgm_index_destroy(&index, false);
+    }
+
+    return status;
+}
@@ -0,0 +1,108 @@
+/*
+* Copyright (C) 2019 Alexander Borisov
+*
+* Author: Alexander Borisov <borisov@lexbor.com>
+*/
+
+#ifndef PRGM_TEXT_H
+#define PRGM_TEXT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "lexbor/utils/base.h"
+#include "lexbor/encoding/encoding.h"
+
+
+/* U+FFFD in UTF-8. */
+#define PRGM_TEXT_REPLACEMENT     ((const lxb_char_t *) "\xEF\xBF\xBD")
+#define PRGM_TEXT_REPLACEMENT_LEN 3
+
+
+/* UTF-8 of one byte of a single-byte encoding, copied as four bytes. */
+typedef struct {
+    lxb_char_t data[3];
+    lxb_char_t length;
+}
+prgm_text_utf_8_char_t;
+
+typedef struct {
+    prgm_text_utf_8_char_t map[256];
+}
+prgm_text_single_t;
+
+
+/*
+ * Number of ASCII bytes at the beginning of data.
+ * Sixteen bytes at a time with SSE2, eight without.
+ */
+size_t
+prgm_text_ascii_length(const lxb_char_t *data, const lxb_char_t *end);
+
+/*
+ * Beginning of the first run of at least min ASCII bytes, or of the ASCII
+ * bytes at the end of data, whatever comes first; end if there is none.
+ */
+const lxb_char_t *
+prgm_text_ascii_run(const lxb_char_t *data, const lxb_char_t *end,
+                    size_t min);
+
+/*
+ * One UTF-8 sequence that starts with a byte >= 0x80, as the WHATWG
+ * decoder sees it. Returns its length if it is valid; minus the number of
+ * bytes replaced with one U+FFFD if it is not, the next byte starts a new
+ * sequence; 0 if it is valid so far but cut by the end of data.
+ */
+int
+prgm_text_utf_8_sequence(const lxb_char_t *data, const lxb_char_t *end);
+
+/*
+ * Number of bytes of valid UTF-8 at the beginning of data. It stops on an
+ * invalid sequence or on one cut by the end of data. ASCII runs go by the
+ * SSE2 ASCII skip above, multibyte sequences are checked one by one.
+ */
+size_t
+prgm_text_utf_8_valid(const lxb_char_t *data, const lxb_char_t *end);
+
+/*
+ * Single-byte encodings where bytes below 0x80 are ASCII, so ASCII runs
+ * are UTF-8 already.
+ */
+bool
+prgm_text_ascii_compatible(lxb_encoding_t encoding);
+
+/*
+ * Fills the table from the lexbor decoder, bytes it does not map become
+ * U+FFFD.
+ */
+lxb_status_t
+prgm_text_single_init(prgm_text_single_t *single,
+                      const lxb_encoding_data_t *encoding);
+
+/*
+ * Tables of all encodings prgm_text_ascii_compatible() accepts, indexed by
+ * lxb_encoding_t; the others are empty.
+ */
+prgm_text_single_t *
+prgm_text_single_create_all(void);
+
+prgm_text_single_t *
+prgm_text_single_destroy_all(prgm_text_single_t *tables);
+
+/*
+ * Converts data to UTF-8 until out is full or data ends, *data is moved
+ * past the converted bytes. Returns the number of bytes written to out,
+ * size must be at least 4.
+ */
+size_t
+prgm_text_single_transcode(const prgm_text_single_t *single,
+                           const lxb_char_t **data, const lxb_char_t *end,
+                           lxb_char_t *out, size_t size);
+
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* PRGM_TEXT_H */
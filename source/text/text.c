@@ -0,0 +1,318 @@
+/*
+* Copyright (C) 2019 Alexander Borisov
+*
+* Author: Alexander Borisov <borisov@lexbor.com>
+*/
+
+#include <string.h>
+
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+
+#include "text.h"
+
+
+size_t
+prgm_text_ascii_length(const lxb_char_t *data, const lxb_char_t *end)
+{
+    const lxb_char_t *p = data;
+
+#ifdef __SSE2__
+    int mask;
+
+    while (end - p >= 16) {
+        mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) p));
+        if (mask != 0) {
+            return (p - data) + __builtin_ctz((unsigned) mask);
+        }
+
+        p += 16;
+    }
+#else
+    uint64_t word;
+
+    while (end - p >= 8) {
+        memcpy(&word, p, sizeof(uint64_t));
+
+        if ((word & 0x8080808080808080ULL) != 0) {
+            break;
+        }
+
+        p += 8;
+    }
+#endif
+
+    while (p < end && *p < 0x80) {
+        p++;
+    }
+
+    return p - data;
+}
+
+const lxb_char_t *
+prgm_text_ascii_run(const lxb_char_t *data, const lxb_char_t *end,
+                    size_t min)
+{
+    size_t length;
+
+    for (;;) {
+        while (data < end && *data >= 0x80) {
+            data++;
+        }
+
+        if (data == end) {
+            return end;
+        }
+
+        length = prgm_text_ascii_length(data, end);
+
+        if (length >= min || data + length == end) {
+            return data;
+        }
+
+        data += length;
+    }
+}
+
+int
+prgm_text_utf_8_sequence(const lxb_char_t *data, const lxb_char_t *end)
+{
+    int i, need;
+    lxb_char_t lower, upper;
+
+    lower = 0x80;
+    upper = 0xBF;
+
+    if (*data >= 0xC2 && *data <= 0xDF) {
+        need = 1;
+    }
+    else if (*data >= 0xE0 && *data <= 0xEF) {
+        need = 2;
+
+        if (*data == 0xE0) {
+            lower = 0xA0;
+        }
+        else if (*data == 0xED) {
+            upper = 0x9F;   /* no surrogates */
+        }
+    }
+    else if (*data >= 0xF0 && *data <= 0xF4) {
+        need = 3;
+
+        if (*data == 0xF0) {
+            lower = 0x90;
+        }
+        else if (*data == 0xF4) {
+            upper = 0x8F;   /* up to U+10FFFF */
+        }
+    }
+    else {
+        return -1;
+    }
+
+    for (i = 1; i <= need; i++) {
+        if (data + i >= end) {
+            return 0;
+        }
+
+        if (data[i] < lower || data[i] > upper) {
+            return -i;
+        }
+
+        lower = 0x80;
+        upper = 0xBF;
+    }
+
+    return need + 1;
+}
+
+size_t
+prgm_text_utf_8_valid(const lxb_char_t *data, const lxb_char_t *end)
+{
+    int length;
+    const lxb_char_t *p = data;
+
+    while (p < end) {
+        if (*p < 0x80) {
+            p += prgm_text_ascii_length(p, end);
+            continue;
+        }
+
+        length = prgm_text_utf_8_sequence(p, end);
+        if (length <= 0) {
+            break;
+        }
+
+        p += length;
+    }
+
+    return p - data;
+}
+
+bool
+prgm_text_ascii_compatible(lxb_encoding_t encoding)
+{
+    switch (encoding) {
+        case LXB_ENCODING_IBM866:
+        case LXB_ENCODING_ISO_8859_2:
+        case LXB_ENCODING_ISO_8859_3:
+        case LXB_ENCODING_ISO_8859_4:
+        case LXB_ENCODING_ISO_8859_5:
+        case LXB_ENCODING_ISO_8859_6:
+        case LXB_ENCODING_ISO_8859_7:
+        case LXB_ENCODING_ISO_8859_8:
+        case LXB_ENCODING_ISO_8859_8_I:
+        case LXB_ENCODING_ISO_8859_10:
+        case LXB_ENCODING_ISO_8859_13:
+        case LXB_ENCODING_ISO_8859_14:
+        case LXB_ENCODING_ISO_8859_15:
+        case LXB_ENCODING_ISO_8859_16:
+        case LXB_ENCODING_KOI8_R:
+        case LXB_ENCODING_KOI8_U:
+        case LXB_ENCODING_MACINTOSH:
+        case LXB_ENCODING_WINDOWS_874:
+        case LXB_ENCODING_WINDOWS_1250:
+        case LXB_ENCODING_WINDOWS_1251:
+        case LXB_ENCODING_WINDOWS_1252:
+        case LXB_ENCODING_WINDOWS_1253:
+        case LXB_ENCODING_WINDOWS_1254:
+        case LXB_ENCODING_WINDOWS_1255:
+        case LXB_ENCODING_WINDOWS_1256:
+        case LXB_ENCODING_WINDOWS_1257:
+        case LXB_ENCODING_WINDOWS_1258:
+        case LXB_ENCODING_X_MAC_CYRILLIC:
+        case LXB_ENCODING_X_USER_DEFINED:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+lxb_status_t
+prgm_text_single_init(prgm_text_single_t *single,
+                      const lxb_encoding_data_t *encoding)
+{
+    unsigned i;
+    lxb_status_t status;
+    lxb_char_t byte, *out;
+    const lxb_char_t *data;
+    lxb_codepoint_t cp;
+    lxb_encoding_decode_t decode;
+
+    for (i = 0; i < 256; i++) {
+        status = lxb_encoding_decode_init(&decode, encoding, &cp, 1);
+        if (status != LXB_STATUS_OK) {
+            return status;
+        }
+
+        decode.replace_to = LXB_ENCODING_REPLACEMENT_BUFFER;
+        decode.replace_len = LXB_ENCODING_REPLACEMENT_BUFFER_LEN;
+
+        byte = (lxb_char_t) i;
+        data = &byte;
+
+        cp = LXB_ENCODING_REPLACEMENT_CODEPOINT;
+
+        (void) encoding->decode(&decode, &data, &byte + 1);
+
+        if (lxb_encoding_decode_buf_used(&decode) == 0 || cp > 0xFFFF) {
+            cp = LXB_ENCODING_REPLACEMENT_CODEPOINT;
+        }
+
+        out = single->map[i].data;
+
+        if (cp < 0x80) {
+            out[0] = (lxb_char_t) cp;
+            single->map[i].length = 1;
+        }
+        else if (cp < 0x800) {
+            out[0] = (lxb_char_t) (0xC0 | (cp >> 6));
+            out[1] = (lxb_char_t) (0x80 | (cp & 0x3F));
+            single->map[i].length = 2;
+        }
+        else {
+            out[0] = (lxb_char_t) (0xE0 | (cp >> 12));
+            out[1] = (lxb_char_t) (0x80 | ((cp >> 6) & 0x3F));
+            out[2] = (lxb_char_t) (0x80 | (cp & 0x3F));
+            single->map[i].length = 3;
+        }
+    }
+
+    return LXB_STATUS_OK;
+}
+
+prgm_text_single_t *
+prgm_text_single_create_all(void)
+{
+    unsigned enc;
+    prgm_text_single_t *tables;
+
+    tables = lexbor_calloc(LXB_ENCODING_LAST_ENTRY,
+                           sizeof(prgm_text_single_t));
+    if (tables == NULL) {
+        return NULL;
+    }
+
+    for (enc = 0; enc < LXB_ENCODING_LAST_ENTRY; enc++) {
+        if (!prgm_text_ascii_compatible((lxb_encoding_t) enc)) {
+            continue;
+        }
+
+        if (prgm_text_single_init(&tables[enc],
+                                  lxb_encoding_data((lxb_encoding_t) enc))
+            != LXB_STATUS_OK)
+        {
+            return lexbor_free(tables);
+        }
+    }
+
+    return tables;
+}
+
+prgm_text_single_t *
+prgm_text_single_destroy_all(prgm_text_single_t *tables)
+{
+    return lexbor_free(tables);
+}
+
+size_t
+prgm_text_single_transcode(const prgm_text_single_t *single,
+                           const lxb_char_t **data, const lxb_char_t *end,
+                           lxb_char_t *out, size_t size)
+{
+    size_t length;
+    lxb_char_t *o, *o_end;
+    const lxb_char_t *p;
+
+    p = *data;
+    o = out;
+    o_end = out + size;
+
+    while (p < end && o_end - o >= 4) {
+        if (*p < 0x80) {
+            length = prgm_text_ascii_length(p, end);
+            if (length > (size_t) (o_end - o)) {
+                length = o_end - o;
+            }
+
+            memcpy(o, p, length);
+
+            o += length;
+            p += length;
+
+            continue;
+        }
+
+        /* Four bytes at once, what is past the character is not used. */
+        memcpy(o, &single->map[*p], sizeof(prgm_text_utf_8_char_t));
+
+        o += single->map[*p].length;
+        p++;
+    }
+
+    *data = p;
+
+    return o - out;
+}
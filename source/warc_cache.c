@@ -0,0 +1,287 @@
+/*
+ * Copyright (C) 2019 Alexander Borisov
+ *
+ * Author: Alexander Borisov <borisov@lexbor.com>
+ */
+
+#include <lexbor/core/conv.h>
+#include <lexbor/core/fs.h>
+#include <lexbor/core/str.h>
+
+#include "cache.h"
+#include "gzip.h"
+#include "input.h"
+
+
+#define FAILED(with_usage, ...)                                                \
+    do {                                                                       \
+        fprintf(stderr, __VA_ARGS__);                                          \
+        fprintf(stderr, "\n");                                                 \
+                                                                               \
+        if (with_usage) {                                                      \
+            usage();                                                           \
+        }                                                                      \
+                                                                               \
+        exit(EXIT_FAILURE);                                                    \
+    }                                                                          \
+    while (0)
+
+#define LXB_CACHE_LEVEL 3
+
+
+typedef struct {
+    const char          *out_dir;
+    prgm_cache_codec_t  codec;
+    int                 level;
+
+    size_t              files;
+    lxb_status_t        status;
+}
+lxb_cache_ctx_t;
+
+
+static lxb_status_t
+cache_file(lxb_cache_ctx_t *ctx, const char *path);
+
+static lexbor_action_t
+cache_dir_cb(const lxb_char_t *fullpath, size_t fullpath_len,
+             const lxb_char_t *filename, size_t filename_len, void *ctx);
+
+static lxb_status_t
+gzip_cb(prgm_gzip_t *gzip, const lxb_char_t *data, size_t size);
+
+
+static void
+usage(void)
+{
+    printf("Usage: warc_cache [options] <out dir> <file.warc.gz|dir>...\n");
+    printf("Inflates every gzip member once and writes <name>"PRGM_CACHE_EXT
+           " to out dir,\n"
+           "warc_test reads these files without inflate\n");
+    printf("[options]:\n");
+    printf("    --codec <none"
+#ifdef PRGM_HAVE_ZSTD
+           "|zstd"
+#endif
+#ifdef PRGM_HAVE_LZ4
+           "|lz4"
+#endif
+           "> -- how members are stored, default none\n");
+#ifdef PRGM_HAVE_ZSTD
+    printf("    --level <N> -- zstd level, default %d\n", LXB_CACHE_LEVEL);
+#endif
+}
+
+int
+main(int argc, const char *argv[])
+{
+    int i;
+    size_t size;
+    unsigned long num;
+    lxb_status_t status;
+    const lxb_char_t *data;
+    lxb_cache_ctx_t ctx = {0};
+
+    ctx.codec = PRGM_CACHE_NONE;
+    ctx.level = LXB_CACHE_LEVEL;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "--codec") == 0 && (i + 1) < argc) {
+            i++;
+
+            if (!prgm_cache_codec_by_name(argv[i], &ctx.codec)) {
+                FAILED(true, "Unknown codec: %s", argv[i]);
+            }
+        }
+        else if (strcmp(argv[i], "--level") == 0 && (i + 1) < argc) {
+            i++;
+
+            data = (const lxb_char_t *) argv[i];
+            num = lexbor_conv_data_to_ulong(&data, strlen(argv[i]));
+
+            if (*data != 0x00 || num == 0 || num > 22) {
+                FAILED(true, "Bad level: %s", argv[i]);
+            }
+
+            ctx.level = (int) num;
+        }
+        else {
+            FAILED(true, "Unknown option: %s", argv[i]);
+        }
+    }
+
+    if ((argc - i) < 2) {
+        usage();
+        return EXIT_SUCCESS;
+    }
+
+    ctx.out_dir = argv[i++];
+
+    for (; i < argc; i++) {
+        size = strlen(argv[i]);
+
+        if (size > 8
+            && lexbor_str_data_ncasecmp((const lxb_char_t *) ".warc.gz",
+                                  (const lxb_char_t *) &argv[i][size - 8], 8))
+        {
+            status = cache_file(&ctx, argv[i]);
+            if (status != LXB_STATUS_OK) {
+                FAILED(false, "Failed to process: %s", argv[i]);
+            }
+
+            continue;
+        }
+
+        status = lexbor_fs_dir_read((const lxb_char_t *) argv[i],
+                                    LEXBOR_FS_DIR_OPT_WITHOUT_HIDDEN
+                                    |LEXBOR_FS_DIR_OPT_WITHOUT_DIR,
+                                    cache_dir_cb, &ctx);
+        if (status != LXB_STATUS_OK || ctx.status != LXB_STATUS_OK) {
+            FAILED(false, "Failed to process: %s", argv[i]);
+        }
+    }
+
+    printf("Files: "LEXBOR_FORMAT_Z"\n", ctx.files);
+
+    return EXIT_SUCCESS;
+}
+
+static lexbor_action_t
+cache_dir_cb(const lxb_char_t *fullpath, size_t fullpath_len,
+             const lxb_char_t *filename, size_t filename_len, void *ctx)
+{
+    lxb_cache_ctx_t *cctx = ctx;
+
+    (void) fullpath_len;
+
+    if (filename_len <= 8
+        || lexbor_str_data_ncasecmp((const lxb_char_t *) ".warc.gz",
+                                    &filename[filename_len - 8], 8) == false)
+    {
+        return LEXBOR_ACTION_NEXT;
+    }
+
+    cctx->status = cache_file(cctx, (const char *) fullpath);
+    if (cctx->status != LXB_STATUS_OK) {
+        fprintf(stderr, "Failed to process: %s\n", (const char *) fullpath);
+        return LEXBOR_ACTION_STOP;
+    }
+
+    return LEXBOR_ACTION_OK;
+}
+
+/* Every member is one frame, in the order of the file. */
+static lxb_status_t
+cache_file(lxb_cache_ctx_t *ctx, const char *path)
+{
+    int len;
+    size_t size, name_length;
+    lxb_status_t status;
+    prgm_input_t input = {.fd = -1};
+    prgm_cache_writer_t writer;
+    const lxb_char_t *data;
+    const char *name, *end;
+    char out[4096];
+
+    prgm_gzip_t gzip;
+    lxb_char_t out_buf[LXB_UTILS_GZIP_CHUNK];
+
+    end = path + strlen(path);
+    name = end;
+
+    while (name > path && name[-1] != '/') {
+        name--;
+    }
+
+    if ((size_t) (end - name) <= sizeof(".warc.gz") - 1) {
+        return LXB_STATUS_ERROR_WRONG_ARGS;
+    }
+
+    name_length = (size_t) (end - name) - (sizeof(".warc.gz") - 1);
+
+    len = snprintf(out, sizeof(out), "%s/%.*s"PRGM_CACHE_EXT, ctx->out_dir,
+                   (int) name_length, name);
+    if (len < 0 || (size_t) len >= sizeof(out)) {
+        return LXB_STATUS_ERROR_OVERFLOW;
+    }
+
+    status = prgm_cache_writer_open(&writer, out, ctx->codec, ctx->level);
+    if (status != LXB_STATUS_OK) {
+        fprintf(stderr, "Failed to create: %s\n", out);
+        return status;
+    }
+
+    status = prgm_gzip_inflate_init(&gzip, PRGM_GZIP_DEFAULT,
+                                    out_buf, LXB_UTILS_GZIP_CHUNK,
+                                    gzip_cb, &writer);
+    if (status != LXB_STATUS_OK) {
+        prgm_cache_writer_abort(&writer);
+        return status;
+    }
+
+    status = prgm_input_init(&input, PRGM_INPUT_MMAP, PRGM_INPUT_BLOCK_SIZE,
+                             PRGM_INPUT_DEPTH);
+    if (status != LXB_STATUS_OK) {
+        goto failed;
+    }
+
+    status = prgm_input_open(&input, path);
+    if (status != LXB_STATUS_OK) {
+        goto failed;
+    }
+
+    for (;;) {
+        status = prgm_input_next(&input, &data, &size);
+        if (status != LXB_STATUS_OK) {
+            goto failed;
+        }
+
+        if (size == 0) {
+            break;
+        }
+
+        status = prgm_gzip_inflate(&gzip, data, (unsigned) size);
+        if (status != LXB_STATUS_OK) {
+            goto failed;
+        }
+    }
+
+    status = prgm_gzip_inflate_finish(&gzip);
+    if (status != LXB_STATUS_OK) {
+        goto failed;
+    }
+
+    status = prgm_cache_writer_close(&writer);
+    if (status != LXB_STATUS_OK) {
+        fprintf(stderr, "Failed to write: %s\n", out);
+        goto done;
+    }
+
+    size = (size_t) writer.offset;
+
+    ctx->files++;
+
+    printf("%s: "LEXBOR_FORMAT_Z" members, "LEXBOR_FORMAT_Z" -> "
+           LEXBOR_FORMAT_Z" bytes, %s\n", out, gzip.count, gzip.offset,
+           size, prgm_cache_codec_name(ctx->codec));
+
+    goto done;
+
+failed:
+
+    prgm_cache_writer_abort(&writer);
+    (void) remove(out);
+
+done:
+
+    prgm_gzip_inflate_destroy(&gzip, false);
+    prgm_input_destroy(&input, false);
+
+    return status;
+}
+
+static lxb_status_t
+gzip_cb(prgm_gzip_t *gzip, const lxb_char_t *data, size_t size)
+{
+    return prgm_cache_writer_add(gzip->ctx, data, size, gzip->offset);
+}
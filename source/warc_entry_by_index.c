@@ -8,7 +8,10 @@
 #include "lexbor/core/conv.h"
 #include <lexbor/utils/warc.h>
 
+#include "args.h"
 #include "gzip.h"
+#include "index.h"
+#include "input.h"
 
 
 #define FAILED(with_usage, ...)                                                \
@@ -25,15 +28,42 @@
     while (0)
 
 
+typedef struct {
+    size_t begin;
+    size_t end;   /* inclusive */
+}
+lxb_test_range_t;
+
 typedef struct {
     lxb_utils_warc_t *warc;
     const lxb_char_t *fullpath;
 
-    unsigned long    index;
+    lxb_test_range_t *ranges;
+    size_t           length;
+    size_t           size;
+    size_t           cur;
+
+    const char       *outdir;
+    FILE             *out;
+    bool             framed;
 }
 lxb_test_ctx_t;
 
 
+static lxb_status_t
+ranges_parse(lxb_test_ctx_t *ctx, const lxb_char_t *data,
+             const lxb_char_t *end);
+
+static lxb_status_t
+ranges_append(lxb_test_ctx_t *ctx, size_t begin, size_t end);
+
+static void
+ranges_merge(lxb_test_ctx_t *ctx);
+
+static lxb_status_t
+segment_process(prgm_gzip_t *gzip, prgm_input_t *input,
+                size_t begin, size_t end);
+
 static lxb_status_t
 gzip_cb(prgm_gzip_t *gzip, const lxb_char_t *data, size_t size);
 
@@ -51,40 +81,113 @@ warc_content_body_cb(lxb_utils_warc_t *warc, const lxb_char_t *data,
 static void
 usage(void)
 {
-    printf("Usage: warc_entry_by_index <index> <file.warc.gz>\n");
-    printf("<index>: begin form 0\n");
+    printf("Usage: warc_entry_by_index [options] <index> <file.warc.gz>\n");
+    printf("<index>: begin form 0; a list like 3,17,100-250"
+           " or @<file> with such a list\n");
     printf("<file.warc.gz>: path to *.warc.gz file\n");
+    printf("[options]:\n");
+    printf("    -o <dir> -- write every record to <dir>/<index>.rec\n");
+    printf("    --input <mmap|read|uring> -- how the file is read,"
+           " default mmap\n");
+    printf("    --block-size <size> -- size of blocks passed to inflate,"
+           " default 4M\n");
+    printf("    --inflate <name> -- inflate backend, as for warc_test\n");
+    printf("One record is written to stdout as is, several records are"
+           " written as a framed stream:\n");
+    printf("    #<index> <length>\\n<length bytes>\\n\n");
+    printf("If <file.warc.gz>"PRGM_INDEX_EXT" made by warc_index exists,"
+           " only the members of requested records are inflated\n");
 }
 
 int
 main(int argc, const char *argv[])
 {
-    FILE *fh;
-    size_t size;
+    int i;
+    size_t r, size, begin, end, block_size;
     lxb_status_t status;
+    lxb_char_t *list = NULL;
     const lxb_char_t *data, *filename;
     lxb_test_ctx_t ctx = {0};
+    lxb_test_range_t *range;
+    prgm_index_entry_t entry;
+    prgm_input_t input = {.fd = -1};
+    prgm_input_type_t input_type = PRGM_INPUT_MMAP;
+    prgm_gzip_type_t inflate_type = PRGM_GZIP_DEFAULT;
 
     prgm_gzip_t gzip;
-    lxb_char_t in_buf[LXB_UTILS_GZIP_CHUNK];
     lxb_char_t out_buf[LXB_UTILS_GZIP_CHUNK];
 
-    if (argc < 3) {
+    block_size = PRGM_INPUT_BLOCK_SIZE;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "-o") == 0 && (i + 1) < argc) {
+            ctx.outdir = argv[++i];
+        }
+        else if (strcmp(argv[i], "--input") == 0 && (i + 1) < argc) {
+            i++;
+
+            if (!prgm_input_type_by_name(argv[i], &input_type)) {
+                FAILED(true, "Bad input type: %s", argv[i]);
+            }
+        }
+        else if (strcmp(argv[i], "--block-size") == 0 && (i + 1) < argc) {
+            i++;
+
+            if (!prgm_args_size(argv[i], NULL, &block_size)
+                || block_size < PRGM_INPUT_BLOCK_SIZE_MIN
+                || block_size > PRGM_INPUT_BLOCK_SIZE_MAX)
+            {
+                FAILED(true, "Bad block size: %s", argv[i]);
+            }
+        }
+        else if (strcmp(argv[i], "--inflate") == 0 && (i + 1) < argc) {
+            i++;
+
+            if (!prgm_gzip_type_by_name(argv[i], &inflate_type)) {
+                FAILED(true, "Unknown inflate backend: %s", argv[i]);
+            }
+        }
+        else {
+            FAILED(true, "Unknown option: %s", argv[i]);
+        }
+    }
+
+    if ((argc - i) < 2) {
         usage();
         return EXIT_SUCCESS;
     }
 
-    data = (const lxb_char_t *) argv[1];
-    size = strlen(argv[1]);
+    if (argv[i][0] == '@') {
+        list = lexbor_fs_file_easy_read((const lxb_char_t *) &argv[i][1],
+                                        &size);
+        if (list == NULL) {
+            FAILED(false, "Failed to read index list: %s", &argv[i][1]);
+        }
 
-    ctx.index = lexbor_conv_data_to_ulong(&data, size);
+        data = list;
+    }
+    else {
+        data = (const lxb_char_t *) argv[i];
+        size = strlen(argv[i]);
+    }
 
-    if ((const char *) data == argv[1]) {
+    status = ranges_parse(&ctx, data, data + size);
+    if (status != LXB_STATUS_OK || ctx.length == 0) {
         FAILED(true, "Bad index.");
     }
 
-    filename = (const lxb_char_t *) argv[2];
-    size = strlen(argv[2]);
+    if (list != NULL) {
+        lexbor_free(list);
+    }
+
+    ranges_merge(&ctx);
+
+    ctx.framed = ctx.outdir == NULL
+                 && (ctx.length > 1
+                     || ctx.ranges[0].begin != ctx.ranges[0].end);
+
+    filename = (const lxb_char_t *) argv[i + 1];
+    size = strlen(argv[i + 1]);
 
     if (size < 8 || lexbor_str_data_ncasecmp((const lxb_char_t *) "warc.gz",
                                              &filename[size - 7], 7) == false)
@@ -100,55 +203,89 @@ main(int argc, const char *argv[])
     }
 
     /* Create GZIP decompressor */
-    status = prgm_gzip_inflate_init(&gzip, out_buf, LXB_UTILS_GZIP_CHUNK,
+    status = prgm_gzip_inflate_init(&gzip, inflate_type,
+                                    out_buf, LXB_UTILS_GZIP_CHUNK,
                                     gzip_cb, &ctx);
     if (status != LXB_STATUS_OK) {
         goto failed;
     }
 
     /* Open and read GZIP file */
-    fh = fopen((const char *) filename, "rb");
-    if (fh == NULL) {
+    status = prgm_input_init(&input, input_type, block_size,
+                             PRGM_INPUT_DEPTH);
+    if (status != LXB_STATUS_OK) {
+        goto failed;
+    }
+
+    status = prgm_input_open(&input, (const char *) filename);
+    if (status != LXB_STATUS_OK) {
         goto failed;
     }
 
-    do {
-        size = fread(in_buf, 1, LXB_UTILS_GZIP_CHUNK, fh);
+    /*
+     * With an index inflate only members of the requested ranges,
+     * without it make one pass over the file.
+     */
+    status = prgm_index_lookup((const char *) filename, ctx.ranges[0].begin,
+                               &entry);
+    if (status != LXB_STATUS_OK && status != LXB_STATUS_ERROR_OVERFLOW) {
+        if (status != LXB_STATUS_ERROR_NOT_EXISTS) {
+            fprintf(stderr, "Bad index file, ignored.\n");
+        }
 
-        if (size != LXB_UTILS_GZIP_CHUNK) {
-            if (feof(fh)) {
-                status = prgm_gzip_inflate(&gzip, in_buf, (unsigned) size);
-                if (status != LXB_STATUS_OK) {
-                    if (status == LXB_STATUS_STOP) {
-                        goto done;
-                    }
+        status = segment_process(&gzip, &input, 0, SIZE_MAX);
+        if (status != LXB_STATUS_OK && status != LXB_STATUS_STOP) {
+            goto failed;
+        }
+
+        goto done;
+    }
 
-                    goto failed;
-                }
+    for (r = 0; r < ctx.length; r++) {
+        range = &ctx.ranges[r];
+        ctx.cur = r;
 
+        status = prgm_index_lookup((const char *) filename, range->begin,
+                                   &entry);
+        if (status != LXB_STATUS_OK) {
+            if (status == LXB_STATUS_ERROR_OVERFLOW) {
                 break;
             }
 
             goto failed;
         }
 
-        status = prgm_gzip_inflate(&gzip, in_buf, (unsigned) size);
+        begin = (size_t) entry.offset;
+        ctx.warc->count = range->begin - entry.skip;
+
+        status = prgm_index_lookup((const char *) filename, range->end,
+                                   &entry);
+        if (status == LXB_STATUS_OK) {
+            end = (size_t) (entry.offset + entry.length);
+        }
+        else if (status == LXB_STATUS_ERROR_OVERFLOW) {
+            end = SIZE_MAX;
+        }
+        else {
+            goto failed;
+        }
+
+        status = segment_process(&gzip, &input, begin, end);
         if (status != LXB_STATUS_OK) {
             if (status == LXB_STATUS_STOP) {
-                goto done;
+                break;
             }
 
             goto failed;
         }
     }
-    while (true);
 
 done:
 
     prgm_gzip_inflate_destroy(&gzip, false);
     lxb_utils_warc_destroy(ctx.warc, true);
-
-    fclose(fh);
+    lexbor_free(ctx.ranges);
+    prgm_input_destroy(&input, false);
 
     return EXIT_SUCCESS;
 
@@ -156,12 +293,153 @@ failed:
 
     prgm_gzip_inflate_destroy(&gzip, false);
     lxb_utils_warc_destroy(ctx.warc, true);
+    lexbor_free(ctx.ranges);
+    prgm_input_destroy(&input, false);
+
+    FAILED(false, "Failed to process inflate.");
+}
+
+static lxb_status_t
+ranges_parse(lxb_test_ctx_t *ctx, const lxb_char_t *data,
+             const lxb_char_t *end)
+{
+    size_t begin, last;
+    lxb_status_t status;
+    const lxb_char_t *p;
+
+    while (data < end) {
+        switch (*data) {
+            case ',':
+            case ' ':
+            case '\t':
+            case '\r':
+            case '\n':
+                data++;
+                continue;
+
+            default:
+                break;
+        }
+
+        p = data;
+        begin = lexbor_conv_data_to_ulong(&data, (end - data));
 
-    if (fh != NULL) {
-        fclose(fh);
+        if (data == p) {
+            return LXB_STATUS_ERROR_UNEXPECTED_DATA;
+        }
+
+        last = begin;
+
+        if (data < end && *data == '-') {
+            p = ++data;
+            last = lexbor_conv_data_to_ulong(&data, (end - data));
+
+            if (data == p || last < begin) {
+                return LXB_STATUS_ERROR_UNEXPECTED_DATA;
+            }
+        }
+
+        if (data < end && *data != ',' && *data != ' ' && *data != '\t'
+            && *data != '\r' && *data != '\n')
+        {
+            return LXB_STATUS_ERROR_UNEXPECTED_DATA;
+        }
+
+        status = ranges_append(ctx, begin, last);
+        if (status != LXB_STATUS_OK) {
+            return status;
+        }
     }
 
-    FAILED(false, "Failed to process inflate.");
+    return LXB_STATUS_OK;
+}
+
+static lxb_status_t
+ranges_append(lxb_test_ctx_t *ctx, size_t begin, size_t end)
+{
+    size_t size;
+    lxb_test_range_t *ranges;
+
+    if (ctx->length == ctx->size) {
+        size = (ctx->size == 0) ? 16 : ctx->size * 2;
+
+        ranges = lexbor_realloc(ctx->ranges, sizeof(lxb_test_range_t) * size);
+        if (ranges == NULL) {
+            return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+        }
+
+        ctx->ranges = ranges;
+        ctx->size = size;
+    }
+
+    ctx->ranges[ctx->length].begin = begin;
+    ctx->ranges[ctx->length].end = end;
+
+    ctx->length++;
+
+    return LXB_STATUS_OK;
+}
+
+static int
+ranges_cmp(const void *first, const void *second)
+{
+    const lxb_test_range_t *a = first, *b = second;
+
+    return (a->begin > b->begin) - (a->begin < b->begin);
+}
+
+/*
+ * Sorted and non-overlapping ranges let the header callback walk them
+ * with one cursor while records go by.
+ */
+static void
+ranges_merge(lxb_test_ctx_t *ctx)
+{
+    size_t i, length;
+    lxb_test_range_t *ranges = ctx->ranges;
+
+    qsort(ranges, ctx->length, sizeof(lxb_test_range_t), ranges_cmp);
+
+    for (i = 1, length = 1; i < ctx->length; i++) {
+        if (ranges[i].begin <= ranges[length - 1].end + 1) {
+            if (ranges[i].end > ranges[length - 1].end) {
+                ranges[length - 1].end = ranges[i].end;
+            }
+
+            continue;
+        }
+
+        ranges[length++] = ranges[i];
+    }
+
+    ctx->length = length;
+}
+
+static lxb_status_t
+segment_process(prgm_gzip_t *gzip, prgm_input_t *input,
+                size_t begin, size_t end)
+{
+    size_t size;
+    lxb_status_t status;
+    const lxb_char_t *data;
+
+    prgm_input_range(input, begin, end);
+
+    for (;;) {
+        status = prgm_input_next(input, &data, &size);
+        if (status != LXB_STATUS_OK) {
+            return status;
+        }
+
+        if (size == 0) {
+            return prgm_gzip_inflate_finish(gzip);
+        }
+
+        status = prgm_gzip_inflate(gzip, data, (unsigned) size);
+        if (status != LXB_STATUS_OK) {
+            return status;
+        }
+    }
 }
 
 static lxb_status_t
@@ -181,12 +459,59 @@ gzip_cb(prgm_gzip_t *gzip, const lxb_char_t *data, size_t size)
 static lxb_status_t
 warc_header_cb(lxb_utils_warc_t *warc)
 {
+    int len;
+    size_t length;
+    const lxb_char_t *data;
+    lxb_utils_warc_field_t *field;
     lxb_test_ctx_t *tctx = warc->ctx;
+    char path[4096];
+
+    static const lxb_char_t lxb_wclen[] = "Content-Length";
 
-    if (tctx->index == tctx->warc->count) {
-        warc->content_cb = warc_content_body_cb;
-        warc->content_end_cb = warc_content_end_cb;
+    while (tctx->cur < tctx->length
+           && tctx->ranges[tctx->cur].end < warc->count)
+    {
+        tctx->cur++;
+    }
+
+    if (tctx->cur == tctx->length
+        || warc->count < tctx->ranges[tctx->cur].begin)
+    {
+        return LXB_STATUS_OK;
+    }
+
+    if (tctx->outdir != NULL) {
+        len = snprintf(path, sizeof(path), "%s/"LEXBOR_FORMAT_Z".rec",
+                       tctx->outdir, warc->count);
+        if (len < 0 || (size_t) len >= sizeof(path)) {
+            FAILED(false, "Output path is too long.");
+        }
+
+        tctx->out = fopen(path, "wb");
+        if (tctx->out == NULL) {
+            FAILED(false, "Failed to open output file: %s", path);
+        }
     }
+    else {
+        tctx->out = stdout;
+
+        if (tctx->framed) {
+            field = lxb_utils_warc_header_field(warc, lxb_wclen,
+                                                (sizeof(lxb_wclen) - 1), 0);
+            length = 0;
+
+            if (field != NULL) {
+                data = field->value.data;
+                length = lexbor_conv_data_to_ulong(&data, field->value.length);
+            }
+
+            fprintf(stdout, "#"LEXBOR_FORMAT_Z" "LEXBOR_FORMAT_Z"\n",
+                    warc->count, length);
+        }
+    }
+
+    warc->content_cb = warc_content_body_cb;
+    warc->content_end_cb = warc_content_end_cb;
 
     return LXB_STATUS_OK;
 }
@@ -198,9 +523,9 @@ warc_content_body_cb(lxb_utils_warc_t *warc, const lxb_char_t *data,
     size_t size;
     lxb_test_ctx_t *tctx = warc->ctx;
 
-    size = fwrite(data, 1, (end - data), stdout);
-    if (size != (end - data)) {
-        FAILED(false, "Failed to write data to stdout.");
+    size = fwrite(data, 1, (end - data), tctx->out);
+    if (size != (size_t) (end - data)) {
+        FAILED(false, "Failed to write record data.");
     }
 
     return LXB_STATUS_OK;
@@ -209,5 +534,25 @@ warc_content_body_cb(lxb_utils_warc_t *warc, const lxb_char_t *data,
 static lxb_status_t
 warc_content_end_cb(lxb_utils_warc_t *warc)
 {
-    return LXB_STATUS_STOP;
+    lxb_test_ctx_t *tctx = warc->ctx;
+
+    if (tctx->out != stdout) {
+        if (fclose(tctx->out) != 0) {
+            FAILED(false, "Failed to write record data.");
+        }
+    }
+    else if (tctx->framed) {
+        fputc('\n', stdout);
+    }
+
+    tctx->out = NULL;
+
+    warc->content_cb = NULL;
+    warc->content_end_cb = NULL;
+
+    if (warc->count == tctx->ranges[tctx->length - 1].end) {
+        return LXB_STATUS_STOP;
+    }
+
+    return LXB_STATUS_OK;
 }
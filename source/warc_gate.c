@@ -0,0 +1,426 @@
+/*
+ * Copyright (C) 2019 Alexander Borisov
+ *
+ * Author: Alexander Borisov <borisov@lexbor.com>
+ */
+
+#include <lexbor/core/conv.h>
+
+#include "bench.h"
+#include "summary.h"
+
+
+#define FAILED(with_usage, ...)                                                \
+    do {                                                                       \
+        fprintf(stderr, __VA_ARGS__);                                          \
+        fprintf(stderr, "\n");                                                 \
+                                                                               \
+        if (with_usage) {                                                      \
+            usage();                                                           \
+        }                                                                      \
+                                                                               \
+        exit(EXIT_FAILURE);                                                    \
+    }                                                                          \
+    while (0)
+
+#define LXB_GATE_THRESHOLD 5.0    /* percent */
+#define LXB_GATE_Z         1.96   /* 95% */
+#define LXB_GATE_JSON_SIZE 4096
+
+
+typedef enum {
+    LXB_GATE_DOCUMENTS_S = 0,
+    LXB_GATE_MB_S,
+    LXB_GATE_P99,
+    LXB_GATE_LAST
+}
+lxb_gate_metric_t;
+
+typedef struct {
+    const char *key;          /* in the baseline */
+    const char *name;         /* in the report */
+    bool       higher;        /* higher is better */
+}
+lxb_gate_metric_info_t;
+
+typedef struct {
+    double median;
+    double low;               /* confidence interval of the median */
+    double high;
+    double baseline;
+}
+lxb_gate_result_t;
+
+
+static const lxb_gate_metric_info_t lxb_gate_metrics[LXB_GATE_LAST] = {
+    {"documents_s",       "documents/s", true},
+    {"decompressed_mb_s", "MB/s",        true},
+    {"p99_ms",            "p99 ms",      false}
+};
+
+
+static void
+usage(void)
+{
+    printf("Usage: warc_gate [options] <baseline> <summary>...\n");
+    printf("Compares runs of warc_test --summary on the same corpus with"
+           " a baseline,\nexits with an error if a metric regressed.\n");
+    printf("[options]:\n");
+    printf("    --threshold <percent> -- allowed change of a median,"
+           " default %.0f\n", LXB_GATE_THRESHOLD);
+    printf("    --write -- write the medians of the runs to baseline"
+           " instead\n");
+}
+
+/* Newton's method, the tool does not need libm for one root. */
+static double
+gate_sqrt(double value)
+{
+    unsigned i;
+    double x;
+
+    if (value <= 0.0) {
+        return 0.0;
+    }
+
+    x = (value > 1.0) ? value : 1.0;
+
+    for (i = 0; i < 64; i++) {
+        x = (x + value / x) / 2.0;
+    }
+
+    return x;
+}
+
+static int
+gate_cmp(const void *a, const void *b)
+{
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * Median and its distribution-free 95% interval by order statistics, no
+ * normal distribution of the runs is assumed. With fewer than six runs
+ * the interval is their whole range.
+ */
+static void
+gate_median(double *values, size_t length, lxb_gate_result_t *result)
+{
+    double half;
+    size_t low, high;
+
+    qsort(values, length, sizeof(double), gate_cmp);
+
+    if (length % 2 == 1) {
+        result->median = values[length / 2];
+    }
+    else {
+        result->median = (values[length / 2 - 1] + values[length / 2]) / 2.0;
+    }
+
+    half = LXB_GATE_Z * gate_sqrt((double) length) / 2.0;
+
+    low = (length / 2.0 - half >= 1.0) ? (size_t) (length / 2.0 - half) : 1;
+    high = (size_t) (length / 2.0 + half + 1.0);
+
+    if (high > length) {
+        high = length;
+    }
+
+    /* Ranks are from 1. */
+    result->low = values[low - 1];
+    result->high = values[high - 1];
+}
+
+static double
+gate_metric(const prgm_bench_t *bench, lxb_gate_metric_t metric)
+{
+    double wall = bench->wall / 1000000000.0;
+
+    switch (metric) {
+        case LXB_GATE_DOCUMENTS_S:
+            return (wall > 0.0) ? bench->documents / wall : 0.0;
+
+        case LXB_GATE_MB_S:
+            return (wall > 0.0) ? bench->decompressed / 1000000.0 / wall
+                                : 0.0;
+
+        case LXB_GATE_P99:
+            return prgm_bench_percentile(bench, 99.0) / 1000000.0;
+
+        default:
+            return 0.0;
+    }
+}
+
+/* Only what warc_gate --write writes: "key": number. */
+static bool
+gate_json_number(const char *data, const char *key, double *value)
+{
+    char *end;
+    size_t length;
+    const char *p;
+    char name[64];
+
+    length = (size_t) snprintf(name, sizeof(name), "\"%s\"", key);
+
+    p = strstr(data, name);
+    if (p == NULL) {
+        return false;
+    }
+
+    p += length;
+
+    while (*p == ' ' || *p == '\t') {
+        p++;
+    }
+
+    if (*p++ != ':') {
+        return false;
+    }
+
+    *value = strtod(p, &end);
+
+    return end != p;
+}
+
+static void
+gate_write(const char *path, lxb_gate_result_t *results, size_t runs,
+           size_t documents)
+{
+    size_t m;
+    FILE *fh;
+
+    fh = fopen(path, "wb");
+    if (fh == NULL) {
+        FAILED(false, "Failed to open baseline: %s", path);
+    }
+
+    fprintf(fh, "{\n");
+    fprintf(fh, "  \"runs\": "LEXBOR_FORMAT_Z",\n", runs);
+    fprintf(fh, "  \"documents\": "LEXBOR_FORMAT_Z, documents);
+
+    for (m = 0; m < LXB_GATE_LAST; m++) {
+        fprintf(fh, ",\n  \"%s\": %.6f", lxb_gate_metrics[m].key,
+                results[m].median);
+    }
+
+    fprintf(fh, "\n}\n");
+
+    if (fclose(fh) != 0) {
+        FAILED(false, "Failed to write baseline: %s", path);
+    }
+
+    printf("Baseline written: %s\n", path);
+}
+
+/* Change in percent, negative is worse whichever way the metric goes. */
+static double
+gate_change(const lxb_gate_metric_info_t *info,
+            const lxb_gate_result_t *result)
+{
+    double change;
+
+    if (result->baseline == 0.0) {
+        return 0.0;
+    }
+
+    change = (result->median - result->baseline) * 100.0 / result->baseline;
+
+    return (info->higher) ? change : -change;
+}
+
+/*
+ * A regression is only what the whole interval shows: one slow run moves
+ * the median, but not the far end of the interval past the limit.
+ */
+static bool
+gate_regressed(const lxb_gate_metric_info_t *info,
+               const lxb_gate_result_t *result, double threshold)
+{
+    if (info->higher) {
+        return result->high < result->baseline * (1.0 - threshold / 100.0);
+    }
+
+    return result->low > result->baseline * (1.0 + threshold / 100.0);
+}
+
+int
+main(int argc, const char *argv[])
+{
+    int i;
+    FILE *fh;
+    bool write, regressed;
+    size_t r, m, runs, documents;
+    double threshold, change, noise, num;
+    double *values;
+    char *end;
+    lxb_status_t status;
+    const char *baseline_path, *verdict;
+    prgm_bench_t *benches;
+    prgm_summary_t summary;
+    lxb_gate_result_t results[LXB_GATE_LAST];
+    char baseline[LXB_GATE_JSON_SIZE];
+
+    write = false;
+    threshold = LXB_GATE_THRESHOLD;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "--threshold") == 0 && (i + 1) < argc) {
+            i++;
+
+            threshold = strtod(argv[i], &end);
+
+            if (*end != 0x00 || end == argv[i] || threshold < 0.0
+                || threshold >= 100.0)
+            {
+                FAILED(true, "Bad threshold: %s", argv[i]);
+            }
+        }
+        else if (strcmp(argv[i], "--write") == 0) {
+            write = true;
+        }
+        else {
+            FAILED(true, "Unknown option: %s", argv[i]);
+        }
+    }
+
+    if ((argc - i) < 2) {
+        usage();
+        return EXIT_SUCCESS;
+    }
+
+    baseline_path = argv[i++];
+    runs = (size_t) (argc - i);
+
+    benches = lexbor_calloc(runs, sizeof(prgm_bench_t));
+    values = lexbor_malloc(runs * sizeof(double));
+
+    if (benches == NULL || values == NULL) {
+        FAILED(false, "Failed to allocate memory");
+    }
+
+    documents = 0;
+
+    for (r = 0; r < runs; r++, i++) {
+        prgm_summary_init(&summary);
+
+        status = prgm_bench_init(&benches[r], true, 0);
+        if (status != LXB_STATUS_OK) {
+            FAILED(false, "Failed to allocate memory");
+        }
+
+        fh = fopen(argv[i], "rb");
+        if (fh == NULL) {
+            FAILED(false, "Failed to open summary: %s", argv[i]);
+        }
+
+        status = prgm_summary_read(&summary, &benches[r], fh);
+
+        fclose(fh);
+        prgm_summary_destroy(&summary, false);
+
+        if (status != LXB_STATUS_OK) {
+            FAILED(false, "Bad summary: %s", argv[i]);
+        }
+
+        if (r == 0) {
+            documents = benches[r].documents;
+        }
+        else if (benches[r].documents != documents) {
+            FAILED(false, "Runs on different corpora: "LEXBOR_FORMAT_Z
+                   " and "LEXBOR_FORMAT_Z" documents in %s", documents,
+                   benches[r].documents, argv[i]);
+        }
+    }
+
+    for (m = 0; m < LXB_GATE_LAST; m++) {
+        for (r = 0; r < runs; r++) {
+            values[r] = gate_metric(&benches[r], (lxb_gate_metric_t) m);
+        }
+
+        gate_median(values, runs, &results[m]);
+    }
+
+    for (r = 0; r < runs; r++) {
+        prgm_bench_destroy(&benches[r], false);
+    }
+
+    lexbor_free(benches);
+    lexbor_free(values);
+
+    if (write) {
+        gate_write(baseline_path, results, runs, documents);
+        return EXIT_SUCCESS;
+    }
+
+    fh = fopen(baseline_path, "rb");
+    if (fh == NULL) {
+        FAILED(false, "Failed to read baseline: %s\n"
+               "Make one with --write on a known good build",
+               baseline_path);
+    }
+
+    r = fread(baseline, 1, sizeof(baseline) - 1, fh);
+    baseline[r] = 0x00;
+
+    fclose(fh);
+
+    if (!gate_json_number(baseline, "documents", &num)) {
+        FAILED(false, "Bad baseline: %s", baseline_path);
+    }
+
+    if ((size_t) num != documents) {
+        FAILED(false, "The corpus differs from the baseline: "
+               LEXBOR_FORMAT_Z" documents, the baseline has %.0f",
+               documents, num);
+    }
+
+    for (m = 0; m < LXB_GATE_LAST; m++) {
+        if (!gate_json_number(baseline, lxb_gate_metrics[m].key,
+                              &results[m].baseline))
+        {
+            FAILED(false, "No %s in baseline: %s", lxb_gate_metrics[m].key,
+                   baseline_path);
+        }
+    }
+
+    printf("Runs: "LEXBOR_FORMAT_Z", documents: "LEXBOR_FORMAT_Z
+           ", threshold: %.1f%%\n", runs, documents, threshold);
+    printf("%-12s %12s %12s %27s %9s\n", "metric", "baseline", "median",
+           "95% CI of median", "gain");
+
+    regressed = false;
+
+    for (m = 0; m < LXB_GATE_LAST; m++) {
+        change = gate_change(&lxb_gate_metrics[m], &results[m]);
+
+        noise = (results[m].median != 0.0)
+                ? (results[m].high - results[m].low) * 50.0
+                  / results[m].median
+                : 0.0;
+
+        if (gate_regressed(&lxb_gate_metrics[m], &results[m], threshold)) {
+            verdict = "  REGRESSED";
+            regressed = true;
+        }
+        else if (change < -threshold || noise > threshold) {
+            verdict = "  noisy";
+        }
+        else {
+            verdict = "";
+        }
+
+        printf("%-12s %12.3f %12.3f [%12.3f, %12.3f] %+8.1f%%%s\n",
+               lxb_gate_metrics[m].name, results[m].baseline,
+               results[m].median, results[m].low, results[m].high, change,
+               verdict);
+    }
+
+    printf("%s\n", (regressed) ? "Failed" : "Passed");
+
+    return (regressed) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,880 @@
+/*
+ * Copyright (C) 2019 Alexander Borisov
+ *
+ * Author: Alexander Borisov <borisov@lexbor.com>
+ */
+
+#include <limits.h>
+#include <stdarg.h>
+
+#include <zlib.h>
+
+#include <lexbor/core/conv.h>
+
+#include "args.h"
+#include "filter.h"
+
+
+#define FAILED(with_usage, ...)                                                \
+    do {                                                                       \
+        fprintf(stderr, __VA_ARGS__);                                          \
+        fprintf(stderr, "\n");                                                 \
+                                                                               \
+        if (with_usage) {                                                      \
+            usage();                                                           \
+        }                                                                      \
+                                                                               \
+        exit(EXIT_FAILURE);                                                    \
+    }                                                                          \
+    while (0)
+
+#define LXB_GEN_RECORDS   1000
+#define LXB_GEN_SIZE_MIN  (1024)
+#define LXB_GEN_SIZE_MAX  (256 * 1024)
+#define LXB_GEN_SIZE_TOP  (64 * 1024 * 1024)
+#define LXB_GEN_DEPTH     32
+#define LXB_GEN_DEPTH_MAX 1024
+#define LXB_GEN_HTTP      40    /* percent */
+#define LXB_GEN_META      40
+#define LXB_GEN_OTHER     10
+#define LXB_GEN_HEAD_SIZE 1024
+#define LXB_GEN_OUT_SIZE  (64 * 1024)
+
+
+typedef struct {
+    const char *name;
+    bool       utf_8;
+}
+lxb_gen_charset_t;
+
+typedef struct {
+    const char *type;
+    const char *magic;    /* NULL for text */
+}
+lxb_gen_payload_t;
+
+typedef struct {
+    lxb_char_t *data;
+    size_t     length;
+    size_t     size;
+}
+lxb_gen_buf_t;
+
+typedef struct {
+    const char      *out_dir;
+    const char      *prefix;
+    uint64_t        seed;
+    size_t          files;
+    size_t          records;
+    size_t          size_min;
+    size_t          size_max;
+    size_t          depth;
+    unsigned        http;
+    unsigned        meta;
+    unsigned        other;
+
+    uint64_t        state;
+    unsigned        *stack;   /* open tags of a block */
+    lxb_gen_buf_t   head;
+    lxb_gen_buf_t   body;
+
+    FILE            *fh;
+    z_stream        zs;
+    size_t          written;
+    lxb_char_t      out[LXB_GEN_OUT_SIZE];
+}
+lxb_gen_ctx_t;
+
+
+/* Declared in the HTTP header or in meta; undeclared documents are UTF-8. */
+static const lxb_gen_charset_t lxb_gen_charsets[] = {
+    {"utf-8",        true},
+    {"windows-1251", false},
+    {"windows-1252", false},
+    {"iso-8859-2",   false},
+    {"koi8-r",       false}
+};
+
+static const lxb_gen_payload_t lxb_gen_payloads[] = {
+    {"text/plain",               NULL},
+    {"application/octet-stream", ""},
+    {"image/jpeg",               "\xFF\xD8\xFF\xE0"},
+    {"application/pdf",          "%PDF-1.4\n"}
+};
+
+/* Nested freely, none of them closes another. */
+static const char *lxb_gen_tags[] = {
+    "div", "section", "article", "span", "em", "strong", "small", "i"
+};
+
+
+static lxb_status_t
+gen_file(lxb_gen_ctx_t *ctx, size_t file);
+
+static lxb_status_t
+gen_warcinfo(lxb_gen_ctx_t *ctx, const char *filename, size_t file);
+
+static lxb_status_t
+gen_response(lxb_gen_ctx_t *ctx, size_t record);
+
+static lxb_status_t
+gen_html(lxb_gen_ctx_t *ctx, size_t size, const lxb_gen_charset_t *charset,
+         bool meta);
+
+static lxb_status_t
+gen_other(lxb_gen_ctx_t *ctx, size_t size, const lxb_gen_payload_t *payload);
+
+static lxb_status_t
+gen_words(lxb_gen_ctx_t *ctx, size_t count, bool utf_8, bool ascii);
+
+static lxb_status_t
+gen_member(lxb_gen_ctx_t *ctx);
+
+static lxb_status_t
+gen_deflate(lxb_gen_ctx_t *ctx, const lxb_char_t *data, size_t length,
+            int flush);
+
+static lxb_status_t
+gen_buf_append(lxb_gen_buf_t *buf, const void *data, size_t length);
+
+static lxb_status_t
+gen_buf_format(lxb_gen_buf_t *buf, const char *format, ...);
+
+
+static void
+usage(void)
+{
+    printf("Usage: warc_gen [options] <out dir>\n");
+    printf("Writes <prefix>-NNNNN.warc.gz files of generated records,"
+           " the same for the same\noptions and seed\n");
+    printf("[options]:\n");
+    printf("    --seed <N> -- another corpus, default 1\n");
+    printf("    --files <N> -- number of files, default 1\n");
+    printf("    --records <N> -- response records per file, default %d,"
+           "\n        a warcinfo record goes first\n", LXB_GEN_RECORDS);
+    printf("    --size <min>:<max> -- payload sizes, log-uniform between"
+           " them,\n        default 1K:256K\n");
+    printf("    --depth <N> -- deepest nesting of elements in HTML,"
+           " default %d\n", LXB_GEN_DEPTH);
+    printf("    --charset <http>:<meta> -- percent of HTML with the"
+           " encoding in the HTTP\n        header and in meta, the rest"
+           " has none, default %d:%d\n", LXB_GEN_HTTP, LXB_GEN_META);
+    printf("    --other <percent> -- records with a non-HTML payload,"
+           " default %d\n", LXB_GEN_OTHER);
+    printf("    --prefix <name> -- file name prefix, default gen\n");
+}
+
+static bool
+gen_number_parse(const char *str, unsigned long max, size_t *value)
+{
+    unsigned long num;
+    const lxb_char_t *data = (const lxb_char_t *) str;
+
+    num = lexbor_conv_data_to_ulong(&data, strlen(str));
+
+    if (*data != 0x00 || (const char *) data == str || num > max) {
+        return false;
+    }
+
+    *value = (size_t) num;
+
+    return true;
+}
+
+int
+main(int argc, const char *argv[])
+{
+    int i;
+    size_t f, num, meta;
+    unsigned long http;
+    const char *end;
+    const lxb_char_t *data;
+    lxb_status_t status;
+    lxb_gen_ctx_t *ctx;
+
+    ctx = lexbor_calloc(1, sizeof(lxb_gen_ctx_t));
+    if (ctx == NULL) {
+        FAILED(false, "Failed to allocate memory");
+    }
+
+    ctx->prefix = "gen";
+    ctx->seed = 1;
+    ctx->files = 1;
+    ctx->records = LXB_GEN_RECORDS;
+    ctx->size_min = LXB_GEN_SIZE_MIN;
+    ctx->size_max = LXB_GEN_SIZE_MAX;
+    ctx->depth = LXB_GEN_DEPTH;
+    ctx->http = LXB_GEN_HTTP;
+    ctx->meta = LXB_GEN_META;
+    ctx->other = LXB_GEN_OTHER;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if ((i + 1) >= argc) {
+            FAILED(true, "Unknown option: %s", argv[i]);
+        }
+
+        if (strcmp(argv[i], "--seed") == 0) {
+            if (!gen_number_parse(argv[++i], ULONG_MAX, &num)) {
+                FAILED(true, "Bad seed: %s", argv[i]);
+            }
+
+            ctx->seed = (uint64_t) num;
+        }
+        else if (strcmp(argv[i], "--files") == 0) {
+            if (!gen_number_parse(argv[++i], 99999, &ctx->files)
+                || ctx->files == 0)
+            {
+                FAILED(true, "Bad number of files: %s", argv[i]);
+            }
+        }
+        else if (strcmp(argv[i], "--records") == 0) {
+            if (!gen_number_parse(argv[++i], ULONG_MAX, &ctx->records)) {
+                FAILED(true, "Bad number of records: %s", argv[i]);
+            }
+        }
+        else if (strcmp(argv[i], "--size") == 0) {
+            i++;
+
+            if (!prgm_args_size(argv[i], &end, &ctx->size_min)
+                || *end != ':'
+                || !prgm_args_size(end + 1, &end, &ctx->size_max)
+                || *end != 0x00 || ctx->size_min == 0
+                || ctx->size_min > ctx->size_max
+                || ctx->size_max > LXB_GEN_SIZE_TOP)
+            {
+                FAILED(true, "Bad size range: %s", argv[i]);
+            }
+        }
+        else if (strcmp(argv[i], "--depth") == 0) {
+            if (!gen_number_parse(argv[++i], LXB_GEN_DEPTH_MAX, &ctx->depth)
+                || ctx->depth == 0)
+            {
+                FAILED(true, "Bad depth: %s", argv[i]);
+            }
+        }
+        else if (strcmp(argv[i], "--charset") == 0) {
+            i++;
+
+            data = (const lxb_char_t *) argv[i];
+            http = lexbor_conv_data_to_ulong(&data, strlen(argv[i]));
+
+            if ((const char *) data == argv[i] || *data != ':'
+                || !gen_number_parse((const char *) data + 1, 100, &meta)
+                || http + meta > 100)
+            {
+                FAILED(true, "Bad charset mix: %s", argv[i]);
+            }
+
+            ctx->http = (unsigned) http;
+            ctx->meta = (unsigned) meta;
+        }
+        else if (strcmp(argv[i], "--other") == 0) {
+            if (!gen_number_parse(argv[++i], 100, &num)) {
+                FAILED(true, "Bad percent of other records: %s", argv[i]);
+            }
+
+            ctx->other = (unsigned) num;
+        }
+        else if (strcmp(argv[i], "--prefix") == 0) {
+            ctx->prefix = argv[++i];
+        }
+        else {
+            FAILED(true, "Unknown option: %s", argv[i]);
+        }
+    }
+
+    if ((argc - i) != 1) {
+        lexbor_free(ctx);
+
+        usage();
+        return EXIT_SUCCESS;
+    }
+
+    ctx->out_dir = argv[i];
+
+    ctx->stack = lexbor_malloc(sizeof(unsigned) * ctx->depth);
+    if (ctx->stack == NULL) {
+        FAILED(false, "Failed to allocate memory");
+    }
+
+    if (deflateInit2(&ctx->zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                     16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        FAILED(false, "Failed to init deflate");
+    }
+
+    for (f = 0; f < ctx->files; f++) {
+        status = gen_file(ctx, f);
+        if (status != LXB_STATUS_OK) {
+            FAILED(false, "Failed to generate file "LEXBOR_FORMAT_Z, f);
+        }
+    }
+
+    printf("Files: "LEXBOR_FORMAT_Z"\n", ctx->files);
+
+    (void) deflateEnd(&ctx->zs);
+
+    lexbor_free(ctx->head.data);
+    lexbor_free(ctx->body.data);
+    lexbor_free(ctx->stack);
+    lexbor_free(ctx);
+
+    return EXIT_SUCCESS;
+}
+
+static uint64_t
+gen_rand(lxb_gen_ctx_t *ctx)
+{
+    ctx->state += 0x9e3779b97f4a7c15ULL;
+
+    return prgm_filter_mix(ctx->state);
+}
+
+static unsigned
+gen_percent(lxb_gen_ctx_t *ctx)
+{
+    return (unsigned) (gen_rand(ctx) % 100);
+}
+
+/*
+ * About log-uniform without libm: a whole number of doublings of min and
+ * a linear step inside the last one.
+ */
+static size_t
+gen_size(lxb_gen_ctx_t *ctx)
+{
+    size_t size, range, bits;
+    uint64_t rnd;
+
+    bits = 0;
+    range = ctx->size_max / ctx->size_min;
+
+    while (range > 1) {
+        range >>= 1;
+        bits++;
+    }
+
+    rnd = gen_rand(ctx);
+    size = ctx->size_min << (rnd % (bits + 1));
+
+    size += (size_t) ((rnd >> 32) % size);
+
+    return (size > ctx->size_max) ? ctx->size_max : size;
+}
+
+/* Every file has its own stream, a file does not depend on the others. */
+static lxb_status_t
+gen_file(lxb_gen_ctx_t *ctx, size_t file)
+{
+    int len;
+    size_t r;
+    lxb_status_t status;
+    char path[4096];
+
+    len = snprintf(path, sizeof(path), "%s/%s-%05zu.warc.gz", ctx->out_dir,
+                   ctx->prefix, file);
+    if (len < 0 || (size_t) len >= sizeof(path)) {
+        return LXB_STATUS_ERROR_OVERFLOW;
+    }
+
+    ctx->state = prgm_filter_mix(ctx->seed ^ ((uint64_t) (file + 1)
+                                              * 0x9e3779b97f4a7c15ULL));
+    ctx->written = 0;
+
+    ctx->fh = fopen(path, "wb");
+    if (ctx->fh == NULL) {
+        fprintf(stderr, "Failed to create: %s\n", path);
+        return LXB_STATUS_ERROR;
+    }
+
+    status = gen_warcinfo(ctx, &path[strlen(ctx->out_dir) + 1], file);
+    if (status != LXB_STATUS_OK) {
+        goto failed;
+    }
+
+    for (r = 0; r < ctx->records; r++) {
+        status = gen_response(ctx, r);
+        if (status != LXB_STATUS_OK) {
+            goto failed;
+        }
+    }
+
+    if (fclose(ctx->fh) != 0) {
+        ctx->fh = NULL;
+        status = LXB_STATUS_ERROR;
+        goto failed;
+    }
+
+    printf("%s: "LEXBOR_FORMAT_Z" records, "LEXBOR_FORMAT_Z" bytes\n", path,
+           ctx->records + 1, ctx->written);
+
+    return LXB_STATUS_OK;
+
+failed:
+
+    if (ctx->fh != NULL) {
+        fclose(ctx->fh);
+    }
+
+    (void) remove(path);
+
+    return status;
+}
+
+static lxb_status_t
+gen_record_id(lxb_gen_ctx_t *ctx)
+{
+    uint64_t a, b;
+
+    a = gen_rand(ctx);
+    b = gen_rand(ctx);
+
+    return gen_buf_format(&ctx->head, "WARC-Record-ID: <urn:uuid:%08x-%04x-"
+                          "4%03x-%04x-%012llx>\r\n", (unsigned) (a >> 32),
+                          (unsigned) (a >> 16) & 0xffff,
+                          (unsigned) a & 0xfff,
+                          ((unsigned) (b >> 48) & 0x3fff) | 0x8000,
+                          (unsigned long long) b & 0xffffffffffffULL);
+}
+
+/* The options in the file, so a corpus says how to make it again. */
+static lxb_status_t
+gen_warcinfo(lxb_gen_ctx_t *ctx, const char *filename, size_t file)
+{
+    lxb_status_t status;
+
+    ctx->body.length = 0;
+    ctx->head.length = 0;
+
+    status = gen_buf_format(&ctx->body, "software: warc_gen\r\n"
+                            "format: WARC File Format 1.0\r\n"
+                            "warc_gen: --seed %llu --records "LEXBOR_FORMAT_Z
+                            " --size "LEXBOR_FORMAT_Z":"LEXBOR_FORMAT_Z
+                            " --depth "LEXBOR_FORMAT_Z" --charset %u:%u"
+                            " --other %u, file "LEXBOR_FORMAT_Z"\r\n",
+                            (unsigned long long) ctx->seed, ctx->records,
+                            ctx->size_min, ctx->size_max, ctx->depth,
+                            ctx->http, ctx->meta, ctx->other, file);
+    if (status != LXB_STATUS_OK) {
+        return status;
+    }
+
+    status = gen_buf_format(&ctx->head, "WARC/1.0\r\n"
+                            "WARC-Type: warcinfo\r\n"
+                            "WARC-Date: 2019-07-15T00:00:00Z\r\n"
+                            "WARC-Filename: %s\r\n", filename);
+    if (status != LXB_STATUS_OK) {
+        return status;
+    }
+
+    status = gen_record_id(ctx);
+    if (status != LXB_STATUS_OK) {
+        return status;
+    }
+
+    status = gen_buf_format(&ctx->head, "Content-Type: application/"
+                            "warc-fields\r\nContent-Length: "LEXBOR_FORMAT_Z
+                            "\r\n\r\n", ctx->body.length);
+    if (status != LXB_STATUS_OK) {
+        return status;
+    }
+
+    return gen_member(ctx);
+}
+
+/*
+ * The payload is made first, the HTTP header with its length goes in
+ * front of it, then the WARC header with the length of both.
+ */
+static lxb_status_t
+gen_response(lxb_gen_ctx_t *ctx, size_t record)
+{
+    bool html, meta;
+    size_t size, http_length;
+    unsigned mix;
+    lxb_status_t status;
+    const char *type, *charset_name;
+    const lxb_gen_charset_t *charset;
+    const lxb_gen_payload_t *payload;
+    char http[LXB_GEN_HEAD_SIZE];
+
+    ctx->body.length = 0;
+    ctx->head.length = 0;
+
+    size = gen_size(ctx);
+    html = gen_percent(ctx) >= ctx->other;
+
+    if (html) {
+        mix = gen_percent(ctx);
+        charset = &lxb_gen_charsets[gen_rand(ctx)
+                                    % (sizeof(lxb_gen_charsets)
+                                       / sizeof(lxb_gen_charset_t))];
+        charset_name = NULL;
+        meta = false;
+
+        if (mix < ctx->http) {
+            charset_name = charset->name;
+        }
+        else if (mix < ctx->http + ctx->meta) {
+            meta = true;
+        }
+        else {
+            charset = &lxb_gen_charsets[0];
+        }
+
+        type = "text/html";
+
+        status = gen_html(ctx, size, charset, meta);
+    }
+    else {
+        payload = &lxb_gen_payloads[gen_rand(ctx)
+                                    % (sizeof(lxb_gen_payloads)
+                                       / sizeof(lxb_gen_payload_t))];
+        charset_name = NULL;
+        type = payload->type;
+
+        status = gen_other(ctx, size, payload);
+    }
+
+    if (status != LXB_STATUS_OK) {
+        return status;
+    }
+
+    http_length = (size_t) snprintf(http, sizeof(http), "HTTP/1.1 200 OK\r\n"
+                                    "Content-Type: %s%s%s\r\n"
+                                    "Content-Length: "LEXBOR_FORMAT_Z"\r\n"
+                                    "\r\n", type,
+                                    (charset_name != NULL) ? "; charset=" : "",
+                                    (charset_name != NULL) ? charset_name : "",
+                                    ctx->body.length);
+
+    status = gen_buf_format(&ctx->head, "WARC/1.0\r\n"
+                            "WARC-Type: response\r\n"
+                            "WARC-Date: 2019-07-15T%02u:%02u:%02uZ\r\n",
+                            (unsigned) (record / 3600) % 24,
+                            (unsigned) (record / 60) % 60,
+                            (unsigned) record % 60);
+    if (status != LXB_STATUS_OK) {
+        return status;
+    }
+
+    status = gen_record_id(ctx);
+    if (status != LXB_STATUS_OK) {
+        return status;
+    }
+
+    status = gen_buf_format(&ctx->head, "Content-Length: "LEXBOR_FORMAT_Z
+                            "\r\nContent-Type: application/http;"
+                            " msgtype=response\r\n"
+                            "WARC-Target-URI: http://site%u.example/"
+                            LEXBOR_FORMAT_Z".html\r\n"
+                            "WARC-Identified-Payload-Type: %s\r\n\r\n%s",
+                            http_length + ctx->body.length,
+                            (unsigned) (gen_rand(ctx) % 10000), record,
+                            type, http);
+    if (status != LXB_STATUS_OK) {
+        return status;
+    }
+
+    return gen_member(ctx);
+}
+
+/* Blocks of elements nested up to the depth, with words inside. */
+static lxb_status_t
+gen_html(lxb_gen_ctx_t *ctx, size_t size, const lxb_gen_charset_t *charset,
+         bool meta)
+{
+    size_t d, depth;
+    unsigned tag;
+    lxb_status_t status;
+    lxb_gen_buf_t *buf = &ctx->body;
+
+    status = gen_buf_format(buf, "<!DOCTYPE html>\n<html>\n<head>\n");
+    if (status != LXB_STATUS_OK) {
+        return status;
+    }
+
+    if (meta) {
+        if (gen_rand(ctx) & 1) {
+            status = gen_buf_format(buf, "<meta charset=\"%s\">\n",
+                                    charset->name);
+        }
+        else {
+            status = gen_buf_format(buf, "<meta http-equiv=\"Content-Type\""
+                                    " content=\"text/html; charset=%s\">\n",
+                                    charset->name);
+        }
+
+        if (status != LXB_STATUS_OK) {
+            return status;
+        }
+    }
+
+    status = gen_buf_format(buf, "<title>");
+    if (status != LXB_STATUS_OK) {
+        return status;
+    }
+
+    status = gen_words(ctx, 6, charset->utf_8, false);
+    if (status != LXB_STATUS_OK) {
+        return status;
+    }
+
+    status = gen_buf_format(buf, "</title>\n</head>\n<body>\n");
+    if (status != LXB_STATUS_OK) {
+        return status;
+    }
+
+    while (buf->length < size) {
+        depth = 1 + (size_t) (gen_rand(ctx) % ctx->depth);
+
+        for (d = 0; d < depth; d++) {
+            tag = (unsigned) (gen_rand(ctx) % (sizeof(lxb_gen_tags)
+                                               / sizeof(const char *)));
+            ctx->stack[d] = tag;
+
+            status = gen_buf_format(buf, "<%s class=\"c%u\">",
+                                    lxb_gen_tags[tag],
+                                    (unsigned) (gen_rand(ctx) % 64));
+            if (status != LXB_STATUS_OK) {
+                return status;
+            }
+        }
+
+        status = gen_words(ctx, 8 + (size_t) (gen_rand(ctx) % 32),
+                           charset->utf_8, false);
+        if (status != LXB_STATUS_OK) {
+            return status;
+        }
+
+        while (depth != 0) {
+            depth--;
+
+            status = gen_buf_format(buf, "</%s>",
+                                    lxb_gen_tags[ctx->stack[depth]]);
+            if (status != LXB_STATUS_OK) {
+                return status;
+            }
+        }
+
+        status = gen_buf_append(buf, "\n", 1);
+        if (status != LXB_STATUS_OK) {
+            return status;
+        }
+    }
+
+    return gen_buf_format(buf, "</body>\n</html>\n");
+}
+
+static lxb_status_t
+gen_other(lxb_gen_ctx_t *ctx, size_t size, const lxb_gen_payload_t *payload)
+{
+    size_t i;
+    uint64_t rnd;
+    lxb_char_t *p;
+    lxb_status_t status;
+    lxb_gen_buf_t *buf = &ctx->body;
+
+    if (payload->magic == NULL) {
+        while (buf->length < size) {
+            status = gen_words(ctx, 16, true, true);
+            if (status != LXB_STATUS_OK) {
+                return status;
+            }
+
+            status = gen_buf_append(buf, "\n", 1);
+            if (status != LXB_STATUS_OK) {
+                return status;
+            }
+        }
+
+        return LXB_STATUS_OK;
+    }
+
+    status = gen_buf_append(buf, payload->magic, strlen(payload->magic));
+    if (status != LXB_STATUS_OK) {
+        return status;
+    }
+
+    /* Little-endian, so a seed gives the same files on every host. */
+    while (buf->length < size) {
+        status = gen_buf_append(buf, NULL, sizeof(uint64_t));
+        if (status != LXB_STATUS_OK) {
+            return status;
+        }
+
+        p = buf->data + buf->length;
+        rnd = gen_rand(ctx);
+
+        for (i = 0; i < sizeof(uint64_t); i++) {
+            *p++ = (lxb_char_t) (rnd >> (i * 8));
+        }
+
+        buf->length = p - buf->data;
+    }
+
+    return LXB_STATUS_OK;
+}
+
+/*
+ * A quarter of the words are of letters above ASCII unless ascii: Cyrillic in
+ * UTF-8, bytes 0xC0-0xFF in a single-byte encoding.
+ */
+static lxb_status_t
+gen_words(lxb_gen_ctx_t *ctx, size_t count, bool utf_8, bool ascii)
+{
+    size_t i, len;
+    unsigned cp;
+    uint64_t rnd;
+    lxb_char_t *p;
+    lxb_status_t status;
+    lxb_gen_buf_t *buf = &ctx->body;
+
+    static const size_t max = 12 * 2 + 1;
+
+    while (count-- != 0) {
+        status = gen_buf_append(buf, NULL, max);
+        if (status != LXB_STATUS_OK) {
+            return status;
+        }
+
+        p = buf->data + buf->length;
+        rnd = gen_rand(ctx);
+        len = 2 + (size_t) (rnd % 10);
+        rnd >>= 8;
+
+        for (i = 0; i < len; i++) {
+            if (ascii || (rnd & 0x03) != 0) {
+                *p++ = (lxb_char_t) ('a' + (gen_rand(ctx) % 26));
+            }
+            else if (utf_8) {
+                cp = 0x0410 + (unsigned) (gen_rand(ctx) & 0x3F);
+
+                *p++ = (lxb_char_t) (0xC0 | (cp >> 6));
+                *p++ = (lxb_char_t) (0x80 | (cp & 0x3F));
+            }
+            else {
+                *p++ = (lxb_char_t) (0xC0 + (gen_rand(ctx) & 0x3F));
+            }
+        }
+
+        *p++ = ' ';
+
+        buf->length = p - buf->data;
+    }
+
+    return LXB_STATUS_OK;
+}
+
+/* The head, the body and the record end in one gzip member. */
+static lxb_status_t
+gen_member(lxb_gen_ctx_t *ctx)
+{
+    lxb_status_t status;
+
+    if (deflateReset(&ctx->zs) != Z_OK) {
+        return LXB_STATUS_ERROR;
+    }
+
+    status = gen_deflate(ctx, ctx->head.data, ctx->head.length, Z_NO_FLUSH);
+    if (status != LXB_STATUS_OK) {
+        return status;
+    }
+
+    status = gen_deflate(ctx, ctx->body.data, ctx->body.length, Z_NO_FLUSH);
+    if (status != LXB_STATUS_OK) {
+        return status;
+    }
+
+    return gen_deflate(ctx, (const lxb_char_t *) "\r\n\r\n", 4, Z_FINISH);
+}
+
+static lxb_status_t
+gen_deflate(lxb_gen_ctx_t *ctx, const lxb_char_t *data, size_t length,
+            int flush)
+{
+    int ret;
+    size_t have;
+    z_stream *zs = &ctx->zs;
+
+    zs->next_in = (Bytef *) data;
+    zs->avail_in = (uInt) length;
+
+    do {
+        zs->next_out = ctx->out;
+        zs->avail_out = LXB_GEN_OUT_SIZE;
+
+        ret = deflate(zs, flush);
+        if (ret == Z_STREAM_ERROR) {
+            return LXB_STATUS_ERROR;
+        }
+
+        have = LXB_GEN_OUT_SIZE - zs->avail_out;
+
+        if (fwrite(ctx->out, 1, have, ctx->fh) != have) {
+            return LXB_STATUS_ERROR;
+        }
+
+        ctx->written += have;
+    }
+    while (zs->avail_out == 0);
+
+    if (flush == Z_FINISH && ret != Z_STREAM_END) {
+        return LXB_STATUS_ERROR;
+    }
+
+    return LXB_STATUS_OK;
+}
+
+/* With data NULL only makes room for length more bytes. */
+static lxb_status_t
+gen_buf_append(lxb_gen_buf_t *buf, const void *data, size_t length)
+{
+    size_t size;
+    lxb_char_t *tmp;
+
+    if (buf->length + length > buf->size) {
+        size = (buf->length + length) * 2;
+
+        tmp = lexbor_realloc(buf->data, size);
+        if (tmp == NULL) {
+            return LXB_STATUS_ERROR_MEMORY_ALLOCATION;
+        }
+
+        buf->data = tmp;
+        buf->size = size;
+    }
+
+    if (data != NULL) {
+        memcpy(buf->data + buf->length, data, length);
+        buf->length += length;
+    }
+
+    return LXB_STATUS_OK;
+}
+
+static lxb_status_t
+gen_buf_format(lxb_gen_buf_t *buf, const char *format, ...)
+{
+    int len;
+    va_list args;
+    lxb_status_t status;
+
+    status = gen_buf_append(buf, NULL, LXB_GEN_HEAD_SIZE);
+    if (status != LXB_STATUS_OK) {
+        return status;
+    }
+
+    va_start(args, format);
+    len = vsnprintf((char *) buf->data + buf->length, LXB_GEN_HEAD_SIZE,
+                    format, args);
+    va_end(args);
+
+    if (len < 0 || len >= LXB_GEN_HEAD_SIZE) {
+        return LXB_STATUS_ERROR_OVERFLOW;
+    }
+
+    buf->length += len;
+
+    return LXB_STATUS_OK;
+}
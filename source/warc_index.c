@@ -0,0 +1,296 @@
+/*
+ * Copyright (C) 2019 Alexander Borisov
+ *
+ * Author: Alexander Borisov <borisov@lexbor.com>
+ */
+
+#include "lexbor/core/conv.h"
+#include <lexbor/utils/warc.h>
+
+#include "gzip.h"
+#include "index.h"
+#include "input.h"
+
+
+#define FAILED(with_usage, ...)                                                \
+    do {                                                                       \
+        fprintf(stderr, __VA_ARGS__);                                          \
+        fprintf(stderr, "\n");                                                 \
+                                                                               \
+        if (with_usage) {                                                      \
+            usage();                                                           \
+        }                                                                      \
+                                                                               \
+        exit(EXIT_FAILURE);                                                    \
+    }                                                                          \
+    while (0)
+
+
+typedef struct {
+    lxb_utils_warc_t *warc;
+    prgm_gzip_t      *gzip;
+    prgm_index_t     *index;
+
+    lxb_status_t     status;
+}
+lxb_index_ctx_t;
+
+
+static lxb_status_t
+index_build(const char *filename);
+
+static lxb_status_t
+index_dump(const char *filename);
+
+static lxb_status_t
+gzip_cb(prgm_gzip_t *gzip, const lxb_char_t *data, size_t size);
+
+static lxb_status_t
+warc_header_cb(lxb_utils_warc_t *warc);
+
+
+static void
+usage(void)
+{
+    printf("Usage: warc_index [-d] <file.warc.gz>...\n");
+    printf("Without options builds <file.warc.gz>"PRGM_INDEX_EXT
+           " sidecar files\n");
+    printf("-d: print the index in CDX-like text form:\n");
+    printf("    <record> <offset> <length> <skip> <content length>"
+           " <WARC-Type> <payload type> <URI>\n");
+}
+
+int
+main(int argc, const char *argv[])
+{
+    int i;
+    bool dump = false;
+    size_t size;
+    lxb_status_t status;
+
+    if (argc < 2) {
+        usage();
+        return EXIT_SUCCESS;
+    }
+
+    i = 1;
+
+    if (strcmp(argv[i], "-d") == 0) {
+        dump = true;
+        i++;
+    }
+
+    if (i == argc) {
+        usage();
+        return EXIT_SUCCESS;
+    }
+
+    for (; i < argc; i++) {
+        size = strlen(argv[i]);
+
+        if (size < 8
+            || lexbor_str_data_ncasecmp((const lxb_char_t *) "warc.gz",
+                                  (const lxb_char_t *) &argv[i][size - 7], 7)
+            == false)
+        {
+            FAILED(true, "Bad file extension: %s", argv[i]);
+        }
+
+        status = (dump) ? index_dump(argv[i]) : index_build(argv[i]);
+        if (status != LXB_STATUS_OK) {
+            FAILED(false, "Failed to process: %s", argv[i]);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static lxb_status_t
+index_build(const char *filename)
+{
+    size_t size;
+    lxb_status_t status;
+    prgm_index_t index;
+    prgm_input_t input;
+    const lxb_char_t *data;
+    lxb_index_ctx_t ctx = {0};
+
+    prgm_gzip_t gzip;
+    lxb_char_t out_buf[LXB_UTILS_GZIP_CHUNK];
+
+    ctx.gzip = &gzip;
+    ctx.index = &index;
+
+    status = prgm_index_init(&index, 4096);
+    if (status != LXB_STATUS_OK) {
+        prgm_index_destroy(&index, false);
+        return status;
+    }
+
+    /* Create WARC parser */
+    ctx.warc = lxb_utils_warc_create();
+    status = lxb_utils_warc_init(ctx.warc, warc_header_cb, NULL, NULL, &ctx);
+    if (status != LXB_STATUS_OK) {
+        lxb_utils_warc_destroy(ctx.warc, true);
+        prgm_index_destroy(&index, false);
+
+        return status;
+    }
+
+    /* Create GZIP decompressor */
+    status = prgm_gzip_inflate_init(&gzip, PRGM_GZIP_DEFAULT,
+                                    out_buf, LXB_UTILS_GZIP_CHUNK,
+                                    gzip_cb, &ctx);
+    if (status != LXB_STATUS_OK) {
+        lxb_utils_warc_destroy(ctx.warc, true);
+        prgm_index_destroy(&index, false);
+
+        return status;
+    }
+
+    /* Open and read GZIP file */
+    (void) prgm_input_init(&input, PRGM_INPUT_MMAP, PRGM_INPUT_BLOCK_SIZE,
+                           PRGM_INPUT_DEPTH);
+
+    status = prgm_input_open(&input, filename);
+    if (status != LXB_STATUS_OK) {
+        goto done;
+    }
+
+    for (;;) {
+        status = prgm_input_next(&input, &data, &size);
+        if (status != LXB_STATUS_OK) {
+            goto done;
+        }
+
+        if (size == 0) {
+            break;
+        }
+
+        status = prgm_gzip_inflate(&gzip, data, (unsigned) size);
+        if (status != LXB_STATUS_OK) {
+            goto done;
+        }
+    }
+
+    status = prgm_gzip_inflate_finish(&gzip);
+    if (status != LXB_STATUS_OK) {
+        goto done;
+    }
+
+    if (ctx.status != LXB_STATUS_OK) {
+        status = ctx.status;
+        goto done;
+    }
+
+    prgm_index_finish(&index, gzip.offset);
+
+    status = prgm_index_save(&index, filename);
+
+done:
+
+    prgm_gzip_inflate_destroy(&gzip, false);
+    lxb_utils_warc_destroy(ctx.warc, true);
+    prgm_index_destroy(&index, false);
+    prgm_input_destroy(&input, false);
+
+    return status;
+}
+
+static lxb_status_t
+index_dump(const char *filename)
+{
+    size_t i;
+    lxb_status_t status;
+    prgm_index_t index;
+    prgm_index_entry_t *entry;
+
+    status = prgm_index_load(&index, filename);
+    if (status != LXB_STATUS_OK) {
+        if (status == LXB_STATUS_ERROR_NOT_EXISTS) {
+            fprintf(stderr, "Index not found or out of date: %s\n", filename);
+        }
+
+        return status;
+    }
+
+    for (i = 0; i < index.length; i++) {
+        entry = prgm_index_entry(&index, i);
+
+        printf(LEXBOR_FORMAT_Z" %llu %llu %u %llu %s %s %s\n", i,
+               (unsigned long long) entry->offset,
+               (unsigned long long) entry->length, entry->skip,
+               (unsigned long long) entry->content_length,
+               (entry->type_len != 0)
+               ? (const char *) prgm_index_string(&index, entry->type) : "-",
+               (entry->payload_len != 0)
+               ? (const char *) prgm_index_string(&index, entry->payload) : "-",
+               (entry->uri_len != 0)
+               ? (const char *) prgm_index_string(&index, entry->uri) : "-");
+    }
+
+    prgm_index_destroy(&index, false);
+
+    return LXB_STATUS_OK;
+}
+
+static lxb_status_t
+gzip_cb(prgm_gzip_t *gzip, const lxb_char_t *data, size_t size)
+{
+    lxb_status_t status;
+    lxb_index_ctx_t *ctx = gzip->ctx;
+
+    status = lxb_utils_warc_parse(ctx->warc, &data, (data + size));
+    if (status != LXB_STATUS_OK && ctx->warc->error != NULL) {
+        fprintf(stderr, "WARC error: %s\n", ctx->warc->error);
+    }
+
+    return status;
+}
+
+static lxb_status_t
+warc_header_cb(lxb_utils_warc_t *warc)
+{
+    size_t length;
+    const lxb_char_t *data;
+    lxb_utils_warc_field_t *type, *uri, *payload, *clen;
+    lxb_index_ctx_t *ctx = warc->ctx;
+
+    static const lxb_char_t lxb_wtype[] = "WARC-Type";
+    static const lxb_char_t lxb_wuri[] = "WARC-Target-URI";
+    static const lxb_char_t lxb_wident[] = "WARC-Identified-Payload-Type";
+    static const lxb_char_t lxb_wclen[] = "Content-Length";
+
+    type = lxb_utils_warc_header_field(warc, lxb_wtype,
+                                       (sizeof(lxb_wtype) - 1), 0);
+    uri = lxb_utils_warc_header_field(warc, lxb_wuri,
+                                      (sizeof(lxb_wuri) - 1), 0);
+    payload = lxb_utils_warc_header_field(warc, lxb_wident,
+                                          (sizeof(lxb_wident) - 1), 0);
+    clen = lxb_utils_warc_header_field(warc, lxb_wclen,
+                                       (sizeof(lxb_wclen) - 1), 0);
+
+    length = 0;
+
+    if (clen != NULL) {
+        data = clen->value.data;
+        length = lexbor_conv_data_to_ulong(&data, clen->value.length);
+    }
+
+    /*
+     * The header is parsed inside the member that holds the record,
+     * so the current member offset is the record offset.
+     */
+    ctx->status = prgm_index_append(ctx->index, ctx->gzip->offset, length,
+                           (type != NULL) ? type->value.data : NULL,
+                           (type != NULL) ? type->value.length : 0,
+                           (uri != NULL) ? uri->value.data : NULL,
+                           (uri != NULL) ? uri->value.length : 0,
+                           (payload != NULL) ? payload->value.data : NULL,
+                           (payload != NULL) ? payload->value.length : 0);
+    if (ctx->status != LXB_STATUS_OK) {
+        return LXB_STATUS_ERROR;
+    }
+
+    return LXB_STATUS_NEXT;
+}
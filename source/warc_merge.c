@@ -0,0 +1,252 @@
+/*
+ * Copyright (C) 2019 Alexander Borisov
+ *
+ * Author: Alexander Borisov <borisov@lexbor.com>
+ */
+
+#include <lexbor/core/conv.h>
+
+#include "bench.h"
+#include "summary.h"
+
+
+#define FAILED(with_usage, ...)                                                \
+    do {                                                                       \
+        fprintf(stderr, __VA_ARGS__);                                          \
+        fprintf(stderr, "\n");                                                 \
+                                                                               \
+        if (with_usage) {                                                      \
+            usage();                                                           \
+        }                                                                      \
+                                                                               \
+        exit(EXIT_FAILURE);                                                    \
+    }                                                                          \
+    while (0)
+
+
+typedef struct {
+    prgm_summary_t summary;
+    prgm_bench_t   bench;
+}
+lxb_merge_run_t;
+
+
+static void
+usage(void)
+{
+    printf("Usage: warc_merge [options] <summary>...\n");
+    printf("Combines summaries of warc_test --summary into fleet-wide"
+           " totals.\n");
+    printf("[options]:\n");
+    printf("    --json <file> -- also write the fleet report as JSON\n");
+    printf("    --slowest <N> -- list N slowest documents of the fleet,"
+           " default 10\n");
+}
+
+static const char *
+merge_name(const char *fleet, const char *run)
+{
+    if (fleet == NULL || strcmp(fleet, run) == 0) {
+        return run;
+    }
+
+    return "mixed";
+}
+
+/* Every shard of the same split must be there once. */
+static bool
+merge_check_shards(lxb_merge_run_t *runs, size_t length)
+{
+    size_t i, count;
+    unsigned shard, shards;
+    bool valid = true;
+
+    shards = runs[0].summary.shards;
+
+    for (i = 1; i < length; i++) {
+        if (runs[i].summary.shards != shards) {
+            fprintf(stderr, "Summaries of different shard counts: %u and"
+                    " %u\n", shards, runs[i].summary.shards);
+            return false;
+        }
+    }
+
+    for (shard = 0; shard < shards; shard++) {
+        count = 0;
+
+        for (i = 0; i < length; i++) {
+            count += runs[i].summary.shard == shard;
+        }
+
+        if (count == 0) {
+            fprintf(stderr, "Shard %u/%u is missing\n", shard, shards);
+            valid = false;
+        }
+        else if (count > 1) {
+            fprintf(stderr, "Shard %u/%u is given "LEXBOR_FORMAT_Z" times\n",
+                    shard, shards, count);
+            valid = false;
+        }
+    }
+
+    return valid;
+}
+
+static void
+merge_print_runs(lxb_merge_run_t *runs, size_t length, FILE *fh)
+{
+    size_t i;
+    double wall;
+    prgm_bench_t *bench;
+
+    fprintf(fh, "%-12s %8s %10s %10s %10s %10s\n", "Shard", "files",
+            "documents", "wall s", "docs/s", "MB/s");
+
+    for (i = 0; i < length; i++) {
+        bench = &runs[i].bench;
+        wall = bench->wall / 1000000000.0;
+
+        fprintf(fh, "%5u/%-6u %8llu %10llu %10.3f %10.1f %10.1f\n",
+                runs[i].summary.shard, runs[i].summary.shards,
+                (unsigned long long) runs[i].summary.files,
+                (unsigned long long) bench->documents, wall,
+                (wall > 0.0) ? bench->documents / wall : 0.0,
+                (wall > 0.0) ? bench->decompressed / 1000000.0 / wall
+                             : 0.0);
+    }
+}
+
+int
+main(int argc, const char *argv[])
+{
+    int i;
+    FILE *fh;
+    bool complete;
+    size_t r, length, slowest, files, filtered;
+    unsigned long num;
+    lxb_status_t status;
+    const lxb_char_t *data;
+    const char *json;
+    prgm_bench_t fleet;
+    prgm_bench_info_t info;
+    lxb_merge_run_t *runs, *run;
+
+    json = NULL;
+    slowest = PRGM_BENCH_SLOWEST;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "--json") == 0 && (i + 1) < argc) {
+            json = argv[++i];
+        }
+        else if (strcmp(argv[i], "--slowest") == 0 && (i + 1) < argc) {
+            i++;
+
+            data = (const lxb_char_t *) argv[i];
+            num = lexbor_conv_data_to_ulong(&data, strlen(argv[i]));
+
+            if (*data != 0x00 || (const char *) data == argv[i]
+                || num > PRGM_BENCH_SLOWEST_MAX)
+            {
+                FAILED(true, "Bad number of slowest documents: %s", argv[i]);
+            }
+
+            slowest = (size_t) num;
+        }
+        else {
+            FAILED(true, "Unknown option: %s", argv[i]);
+        }
+    }
+
+    if (i == argc) {
+        usage();
+        return EXIT_SUCCESS;
+    }
+
+    length = (size_t) (argc - i);
+
+    runs = lexbor_calloc(length, sizeof(lxb_merge_run_t));
+    if (runs == NULL) {
+        FAILED(false, "Failed to allocate memory");
+    }
+
+    status = prgm_bench_init(&fleet, true, slowest);
+    if (status != LXB_STATUS_OK) {
+        FAILED(false, "Failed to allocate memory");
+    }
+
+    memset(&info, 0, sizeof(prgm_bench_info_t));
+
+    files = 0;
+    filtered = 0;
+
+    for (r = 0; r < length; r++, i++) {
+        run = &runs[r];
+
+        prgm_summary_init(&run->summary);
+
+        status = prgm_bench_init(&run->bench, true, slowest);
+        if (status != LXB_STATUS_OK) {
+            FAILED(false, "Failed to allocate memory");
+        }
+
+        fh = fopen(argv[i], "rb");
+        if (fh == NULL) {
+            FAILED(false, "Failed to open summary: %s", argv[i]);
+        }
+
+        status = prgm_summary_read(&run->summary, &run->bench, fh);
+
+        fclose(fh);
+
+        if (status != LXB_STATUS_OK) {
+            FAILED(false, "Bad summary: %s", argv[i]);
+        }
+
+        prgm_bench_merge(&fleet, &run->bench);
+
+        /* Shards run at the same time, the fleet waits for the last. */
+        if (run->bench.wall > fleet.wall) {
+            fleet.wall = run->bench.wall;
+        }
+
+        info.mode = merge_name(info.mode, run->summary.mode);
+        info.input = merge_name(info.input, run->summary.input);
+        info.inflate = merge_name(info.inflate, run->summary.inflate);
+        info.threads += run->summary.threads;
+
+        files += run->summary.files;
+        filtered += run->summary.filtered;
+    }
+
+    complete = merge_check_shards(runs, length);
+
+    merge_print_runs(runs, length, stdout);
+
+    printf("Summaries: "LEXBOR_FORMAT_Z", files: "LEXBOR_FORMAT_Z
+           ", records filtered: "LEXBOR_FORMAT_Z"%s\n", length, files,
+           filtered, (complete) ? "" : ", incomplete");
+
+    prgm_bench_print(&fleet, &info, stdout);
+
+    if (json != NULL) {
+        fh = fopen(json, "wb");
+        if (fh == NULL) {
+            FAILED(false, "Failed to open JSON report: %s", json);
+        }
+
+        prgm_bench_json(&fleet, &info, fh);
+
+        fclose(fh);
+    }
+
+    prgm_bench_destroy(&fleet, false);
+
+    for (r = 0; r < length; r++) {
+        prgm_bench_destroy(&runs[r].bench, false);
+        prgm_summary_destroy(&runs[r].summary, false);
+    }
+
+    lexbor_free(runs);
+
+    return (complete) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
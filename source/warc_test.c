@@ -4,14 +4,15 @@
  * Author: Alexander Borisov <borisov@lexbor.com>
  */
 
+#include <signal.h>
+
 #include <lexbor/core/fs.h>
-#include <lexbor/html/encoding.h>
-#include <lexbor/html/parser.h>
-#include <lexbor/encoding/encoding.h>
-#include <lexbor/utils/http.h>
-#include <lexbor/utils/warc.h>
+#include <lexbor/core/conv.h>
 
-#include "gzip.h"
+#include "args.h"
+#include "cache.h"
+#include "summary.h"
+#include "test.h"
 
 
 #define FAILED(with_usage, ...)                                                \
@@ -27,636 +28,834 @@
     }                                                                          \
     while (0)
 
-#define TO_LOG(tctx, ...)                                                      \
-    do {                                                                       \
-        fprintf((tctx)->log, __VA_ARGS__);                                     \
-        fprintf((tctx)->log, "\n");                                            \
-        fflush((tctx)->log);                                                   \
-    }                                                                          \
-    while (0)
 
+static void
+usage(void)
+{
+    printf("Usage: warc [options] <mode> <log file> <directory>\n");
+    printf("<mode>:\n");
+    printf("    single   -- one parser on all HTML\n");
+    printf("    multi    -- own parser for each HTML\n");
+    printf("    recycle  -- as multi, but one document is cleaned and"
+           " reused\n");
+    printf("    full     -- the same as multi\n");
+    printf("    inflate  -- only inflate, records are not parsed\n");
+    printf("    warc     -- inflate and WARC records, content is skipped\n");
+    printf("    http     -- as warc, also HTTP headers of the content\n");
+    printf("    tokenize -- as multi, but the HTML tokenizer without the"
+           " tree\n");
+    printf("    the last four imply --bench, each adds one layer to the one"
+           " before\n");
+    printf("<log file>: path to log file\n");
+    printf("<directory>: path to directory with *.warc.gz files and"
+           " *"PRGM_CACHE_EXT" files\n"
+           "    of warc_cache\n");
+    printf("[options]:\n");
+    printf("    -j <N> -- number of worker threads, default 1\n");
+    printf("    --split-size <size> -- with -j, split files bigger than\n"
+           "        size on gzip member boundaries, default 128M, 0 is off\n");
+    printf("    -v <level> -- log verbosity, default 3:\n"
+           "        0 -- errors and totals, 1 -- files, 2 -- records,\n"
+           "        3 -- encoding details and HTML fragments\n");
+    printf("    --input <mmap|read|uring> -- how files are read,"
+           " default mmap\n");
+    printf("    --block-size <size> -- size of blocks passed to inflate,\n"
+           "        default 4M\n");
+    printf("    --depth <N> -- with --input uring, reads in flight,"
+           " default 4\n");
+#ifdef PRGM_HAVE_LIBDEFLATE
+    printf("    --inflate <zlib|zlib-member|libdeflate> -- inflate backend,"
+           " default libdeflate\n");
+#else
+    printf("    --inflate <zlib|zlib-member> -- inflate backend,"
+           " default zlib-member\n");
+#endif
+    printf("    --bench -- time every stage, print throughput and the share\n"
+           "        of each stage to stdout at exit\n");
+    printf("    --bench-json <file> -- as --bench, also write the report"
+           " as JSON\n");
+    printf("    --slowest <N> -- with --bench, list N slowest documents,"
+           " default 10\n");
+    printf("    --counters -- as --bench, also count cycles, instructions,"
+           " cache and\n        branch misses of every stage, if the kernel"
+           " allows\n");
+    printf("    --stats -- print documents, bytes and MB/s per encoding and"
+           " payload\n"
+           "        type and where the encoding came from at exit\n");
+    printf("    --stats-json <file> -- as --stats, also write them"
+           " as JSON\n");
+    printf("    --include-type <list>, --exclude-type <list> -- WARC-Type"
+           " values,\n"
+           "        comma-separated, case-insensitive\n");
+    printf("    --include-payload <list>, --exclude-payload <list> --"
+           " WARC-Identified-\n"
+           "        Payload-Type values, \"text/*\" matches all text types\n");
+    printf("    --include-uri <glob>, --exclude-uri <glob> -- WARC-Target-URI"
+           " pattern\n");
+    printf("    --min-length <size>, --max-length <size> -- WARC"
+           " Content-Length limits\n");
+    printf("    --shard <i/N> -- process only shard i of N, picked by hash"
+           " of the file\n"
+           "        name, the same on every node\n");
+    printf("    --shard-by <file|record> -- with --shard, give shards whole"
+           " files\n"
+           "        or records of every file, default file\n");
+    printf("    --sample <rate> -- a reproducible subset of records, like 1%%"
+           " or 0.01\n");
+    printf("    --seed <N> -- with --sample, another subset, default 0\n");
+    printf("    --summary <file> -- as --bench, also write a summary for"
+           " warc_merge\n");
+    printf("    --recycle-limit <size> -- in recycle mode, a document that"
+           " grew\n"
+           "        bigger is destroyed instead of cleaned, default 64M\n");
+    printf("    --max-rss <size> -- above this process RSS documents give\n"
+           "        their memory back and workers wait before new files\n");
+    printf("    --checkpoint <file> -- record every finished file with its"
+           " counters\n");
+    printf("    --resume -- with --checkpoint, skip files done by an earlier"
+           " run\n");
+    printf("    --keep-going -- a failed file does not stop the run, failed"
+           " files\n"
+           "        are listed at the end\n");
+    printf("    --isolate -- the -j workers are processes, a crashed record"
+           " is logged\n"
+           "        and its file goes on in a new worker, no file"
+           " splitting\n");
+    printf("    --repro <dir> -- with --isolate, save a crashed record and"
+           " its gzip\n"
+           "        member to dir\n");
+    printf("    --timeout <sec> -- with --isolate, a record taking longer"
+           " is a crash\n");
+}
+
+static const char *test_mode_names[LXB_TEST_MODE_LAST] = {
+    "single", "multi", "recycle", "inflate", "warc", "http", "tokenize"
+};
 
-typedef struct {
-    lxb_utils_warc_t                *warc;
-    lxb_utils_http_t                *http;
-    lxb_html_parser_t               *parser;
+static void
+test_log_exit(void)
+{
+    if (lxb_test_log != NULL) {
+        prgm_log_flush(lxb_test_log);
+    }
+}
 
-    const lxb_char_t                *fullpath;
+static void
+test_log_signal(int sig)
+{
+    prgm_log_crash_flush(lxb_test_log);
 
-    lxb_html_document_t             *document;
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
 
-    FILE                            *log;
+/* Files of warc_cache are not inflated, the report must not say so. */
+static const char *
+test_inflate_name(lxb_test_pool_t *pool, lxb_test_ctx_t *ctxs)
+{
+    if (pool->cached == 0) {
+        return ctxs[0].gzip.backend->name;
+    }
 
-    lxb_utils_warc_header_cb_f      h_cd;
-    lxb_utils_warc_content_cb_f     c_cb;
-    lxb_utils_warc_content_end_cb_f c_end_cb;
+    if (pool->cached == lexbor_array_length(pool->files)) {
+        return ctxs[0].cache.backend->name;
+    }
 
-    const lxb_encoding_data_t       *enc_data;
-    const lxb_encoding_data_t       *enc_utf_8;
+    return "mixed";
+}
 
-    lxb_encoding_encode_t           encode;
-    lxb_encoding_decode_t           decode;
+static void
+test_bench_report(lxb_test_pool_t *pool, lxb_test_ctx_t *ctxs,
+                  prgm_bench_t *bench)
+{
+    FILE *fh;
+    prgm_bench_info_t info;
 
-    lxb_html_encoding_t             html_em;
+    info.mode = test_mode_names[pool->mode];
+    info.input = prgm_input_backend(&ctxs[0].input);
+    info.inflate = test_inflate_name(pool, ctxs);
+    info.threads = pool->threads;
 
-    lxb_codepoint_t                 buf_decode[4096];
-    lxb_char_t                      buf_encode[4096];
+    prgm_bench_print(bench, &info, stdout);
 
-    size_t                          total;
+    if (pool->bench_json == NULL) {
+        return;
+    }
 
-    lxb_status_t                    status;
-}
-lxb_test_ctx_t;
+    fh = fopen(pool->bench_json, "wb");
+    if (fh == NULL) {
+        TO_LOG(pool, PRGM_LOG_ERROR, "Failed to open bench report: %s",
+               pool->bench_json);
+        return;
+    }
 
+    prgm_bench_json(bench, &info, fh);
 
-static lexbor_action_t
-dir_files_cb(const lxb_char_t *fullpath, size_t fullpath_len,
-             const lxb_char_t *filename, size_t filename_len, void *ctx);
+    fclose(fh);
+}
 
-static lxb_status_t
-gzip_cb(prgm_gzip_t *gzip, const lxb_char_t *data, size_t size);
+static void
+test_summary_report(lxb_test_pool_t *pool, lxb_test_ctx_t *ctxs,
+                    prgm_bench_t *bench)
+{
+    FILE *fh;
+    prgm_summary_t summary;
+
+    prgm_summary_init(&summary);
+
+    snprintf(summary.mode, PRGM_SUMMARY_NAME, "%s",
+             test_mode_names[pool->mode]);
+    snprintf(summary.input, PRGM_SUMMARY_NAME, "%s",
+             prgm_input_backend(&ctxs[0].input));
+    snprintf(summary.inflate, PRGM_SUMMARY_NAME, "%s",
+             test_inflate_name(pool, ctxs));
+
+    summary.threads = pool->threads;
+    summary.shard = pool->filter.shard;
+    summary.shards = pool->filter.shards;
+    summary.shard_records = pool->filter.shard_records;
+    summary.sample = prgm_filter_sample_rate(&pool->filter);
+    summary.seed = pool->filter.seed;
+    summary.files = lexbor_array_length(pool->files);
+    summary.filtered = pool->filtered + pool->skipped;
+
+    fh = fopen(pool->summary, "wb");
+    if (fh == NULL) {
+        TO_LOG(pool, PRGM_LOG_ERROR, "Failed to open summary: %s",
+               pool->summary);
+        return;
+    }
 
-static lxb_status_t
-warc_single_header_cb(lxb_utils_warc_t *warc);
+    prgm_summary_write(&summary, bench, fh);
 
-static lxb_status_t
-warc_single_content_end_cb(lxb_utils_warc_t *warc);
+    fclose(fh);
+}
 
-static lxb_status_t
-warc_multi_header_cb(lxb_utils_warc_t *warc);
+static void
+test_stats_report(lxb_test_pool_t *pool, prgm_stats_t *stats)
+{
+    FILE *fh;
 
-static lxb_status_t
-warc_multi_content_end_cb(lxb_utils_warc_t *warc);
+    prgm_stats_print(stats, stdout);
 
-static lxb_status_t
-warc_content_header_cb(lxb_utils_warc_t *warc, const lxb_char_t *data,
-                       const lxb_char_t *end);
+    if (pool->stats_json == NULL) {
+        return;
+    }
 
-static lxb_status_t
-warc_content_body_cb(lxb_utils_warc_t *warc, const lxb_char_t *data,
-                     const lxb_char_t *end);
+    fh = fopen(pool->stats_json, "wb");
+    if (fh == NULL) {
+        TO_LOG(pool, PRGM_LOG_ERROR, "Failed to open stats report: %s",
+               pool->stats_json);
+        return;
+    }
 
+    prgm_stats_json(stats, fh);
 
-static void
-usage(void)
-{
-    printf("Usage: warc <mode> <log file> <directory>\n");
-    printf("<mode>:\n");
-    printf("    single -- one parser on all HTML\n");
-    printf("    multi  -- own parser for each HTML\n");
-    printf("<log file>: path to log file\n");
-    printf("<directory>: path to directory with *.warc.gz files\n");
+    fclose(fh);
 }
 
 int
 main(int argc, const char *argv[])
 {
+    int i;
     size_t size;
+    unsigned long num;
     lxb_status_t status;
-    const lxb_char_t *dirpath;
-    lxb_test_ctx_t ctx = {0};
+    prgm_filter_field_t field;
+    const lxb_char_t *dirpath, *data;
+    lxb_test_pool_t pool = {0};
+    lxb_test_ctx_t *ctxs = NULL;
+    pthread_t *threads = NULL;
+    unsigned started;
+    prgm_log_level_t level = PRGM_LOG_DEBUG;
+    prgm_bench_t bench;
+    prgm_stats_t stats;
+    uint64_t bench_begin = 0;
+
+    pool.threads = 1;
+    pool.split_size = LXB_TEST_SPLIT_SIZE;
+    pool.input_type = PRGM_INPUT_MMAP;
+    pool.block_size = PRGM_INPUT_BLOCK_SIZE;
+    pool.depth = PRGM_INPUT_DEPTH;
+    pool.inflate_type = PRGM_GZIP_DEFAULT;
+    pool.slowest = PRGM_BENCH_SLOWEST;
+    pool.recycle_limit = LXB_TEST_RECYCLE;
+
+    (void) prgm_filter_init(&pool.filter);
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "-j") == 0 && (i + 1) < argc) {
+            i++;
+
+            data = (const lxb_char_t *) argv[i];
+            num = lexbor_conv_data_to_ulong(&data, strlen(argv[i]));
+
+            if (*data != 0x00 || num == 0 || num > LXB_TEST_THREADS_MAX) {
+                FAILED(true, "Bad number of threads: %s", argv[i]);
+            }
 
-    static const char single[] = "single";
-    static const char multi[] = "multi";
+            pool.threads = (unsigned) num;
+        }
+        else if (strcmp(argv[i], "-v") == 0 && (i + 1) < argc) {
+            i++;
 
-    if (argc < 4) {
-        usage();
-        return EXIT_SUCCESS;
-    }
+            data = (const lxb_char_t *) argv[i];
+            num = lexbor_conv_data_to_ulong(&data, strlen(argv[i]));
 
-    status = lxb_html_encoding_init(&ctx.html_em);
-    if (status != LXB_STATUS_OK) {
-        FAILED(false, "Failed to create HTML encoding determiner");
-    }
+            if (*data != 0x00 || (const char *) data == argv[i]
+                || num > PRGM_LOG_DEBUG)
+            {
+                FAILED(true, "Bad log level: %s", argv[i]);
+            }
 
-    ctx.enc_utf_8 = lxb_encoding_data(LXB_ENCODING_UTF_8);
+            level = (prgm_log_level_t) num;
+        }
+        else if (strcmp(argv[i], "--split-size") == 0 && (i + 1) < argc) {
+            i++;
 
-    size = strlen(argv[1]);
+            if (!prgm_args_size(argv[i], NULL, &pool.split_size)) {
+                FAILED(true, "Bad split size: %s", argv[i]);
+            }
+        }
+        else if (strcmp(argv[i], "--input") == 0 && (i + 1) < argc) {
+            i++;
 
-    if (size == (sizeof(single) - 1)
-        && memcmp(argv[1], single, (sizeof(single) - 1)) == 0)
-    {
-        ctx.document = lxb_html_document_create();
-        if (ctx.document == NULL) {
-            FAILED(false, "Failed to create HTML Document");
+            if (!prgm_input_type_by_name(argv[i], &pool.input_type)) {
+                FAILED(true, "Bad input type: %s", argv[i]);
+            }
         }
+        else if (strcmp(argv[i], "--block-size") == 0 && (i + 1) < argc) {
+            i++;
+
+            if (!prgm_args_size(argv[i], NULL, &pool.block_size)
+                || pool.block_size < PRGM_INPUT_BLOCK_SIZE_MIN
+                || pool.block_size > PRGM_INPUT_BLOCK_SIZE_MAX)
+            {
+                FAILED(true, "Bad block size: %s", argv[i]);
+            }
+        }
+        else if (strcmp(argv[i], "--depth") == 0 && (i + 1) < argc) {
+            i++;
 
-        ctx.h_cd = warc_single_header_cb;
-        ctx.c_end_cb = warc_single_content_end_cb;
-    }
-    else if (size == (sizeof(multi) - 1)
-             && memcmp(argv[1], multi, (sizeof(multi) - 1)) == 0)
-    {
-        ctx.h_cd = warc_multi_header_cb;
-        ctx.c_end_cb = warc_multi_content_end_cb;
-    }
-    else {
-        usage();
-        return EXIT_SUCCESS;
-    }
+            data = (const lxb_char_t *) argv[i];
+            num = lexbor_conv_data_to_ulong(&data, strlen(argv[i]));
 
-    ctx.c_cb = warc_content_header_cb;
+            if (*data != 0x00 || num == 0 || num > PRGM_INPUT_DEPTH_MAX) {
+                FAILED(true, "Bad read depth: %s", argv[i]);
+            }
 
-    ctx.log = fopen((const char *) argv[2], "ab");
-    if (ctx.log == NULL) {
-        goto failed;
-    }
+            pool.depth = (size_t) num;
+        }
+        else if (strcmp(argv[i], "--inflate") == 0 && (i + 1) < argc) {
+            i++;
 
-    dirpath = (const lxb_char_t *) argv[3];
+            if (!prgm_gzip_type_by_name(argv[i], &pool.inflate_type)) {
+                FAILED(true, "Unknown inflate backend: %s", argv[i]);
+            }
+        }
+        else if (strcmp(argv[i], "--bench") == 0) {
+            pool.bench = true;
+        }
+        else if (strcmp(argv[i], "--counters") == 0) {
+            pool.bench = true;
+            pool.counters = true;
+        }
+        else if (strcmp(argv[i], "--bench-json") == 0 && (i + 1) < argc) {
+            i++;
 
-    status = lexbor_fs_dir_read(dirpath, LEXBOR_FS_DIR_OPT_WITHOUT_HIDDEN
-                            |LEXBOR_FS_DIR_OPT_WITHOUT_DIR, dir_files_cb, &ctx);
-    if (status != LXB_STATUS_OK || ctx.status != LXB_STATUS_OK) {
-        goto failed;
-    }
+            pool.bench = true;
+            pool.bench_json = argv[i];
+        }
+        else if (strcmp(argv[i], "--slowest") == 0 && (i + 1) < argc) {
+            i++;
 
-    TO_LOG(&ctx, "Total processed: "LEXBOR_FORMAT_Z, ctx.total);
+            data = (const lxb_char_t *) argv[i];
+            num = lexbor_conv_data_to_ulong(&data, strlen(argv[i]));
 
-    (void) lxb_html_document_destroy(ctx.document);
-    (void) lxb_html_encoding_destroy(&ctx.html_em, false);
+            if (*data != 0x00 || (const char *) data == argv[i]
+                || num > PRGM_BENCH_SLOWEST_MAX)
+            {
+                FAILED(true, "Bad number of slowest documents: %s", argv[i]);
+            }
 
-    return EXIT_SUCCESS;
+            pool.slowest = (size_t) num;
+        }
+        else if (strcmp(argv[i], "--stats") == 0) {
+            pool.stats = true;
+        }
+        else if (strcmp(argv[i], "--stats-json") == 0 && (i + 1) < argc) {
+            i++;
 
-failed:
+            pool.stats = true;
+            pool.stats_json = argv[i];
+        }
+        else if ((strncmp(argv[i], "--include-", 10) == 0
+                  || strncmp(argv[i], "--exclude-", 10) == 0)
+                 && prgm_filter_field_by_name(&argv[i][10], &field)
+                 && (i + 1) < argc)
+        {
+            i++;
+
+            status = prgm_filter_add(&pool.filter, field,
+                                     (argv[i - 1][2] == 'e'), argv[i]);
+            if (status != LXB_STATUS_OK) {
+                FAILED(true, "Bad filter: %s %s", argv[i - 1], argv[i]);
+            }
+        }
+        else if (strcmp(argv[i], "--shard") == 0 && (i + 1) < argc) {
+            i++;
 
-    if (ctx.log != NULL) {
-        TO_LOG(&ctx, "Total processed: "LEXBOR_FORMAT_Z, ctx.total);
-        TO_LOG(&ctx, "Failed");
+            if (prgm_filter_shard_set(&pool.filter, argv[i])
+                != LXB_STATUS_OK)
+            {
+                FAILED(true, "Bad shard: %s", argv[i]);
+            }
+        }
+        else if (strcmp(argv[i], "--shard-by") == 0 && (i + 1) < argc) {
+            i++;
 
-        fclose(ctx.log);
-    }
+            if (strcmp(argv[i], "file") == 0) {
+                pool.filter.shard_records = false;
+            }
+            else if (strcmp(argv[i], "record") == 0) {
+                pool.filter.shard_records = true;
+            }
+            else {
+                FAILED(true, "Bad shard unit: %s", argv[i]);
+            }
+        }
+        else if (strcmp(argv[i], "--sample") == 0 && (i + 1) < argc) {
+            i++;
 
-    (void) lxb_html_document_destroy(ctx.document);
-    (void) lxb_html_encoding_destroy(&ctx.html_em, false);
+            if (prgm_filter_sample_set(&pool.filter, argv[i])
+                != LXB_STATUS_OK)
+            {
+                FAILED(true, "Bad sample rate: %s", argv[i]);
+            }
+        }
+        else if (strcmp(argv[i], "--seed") == 0 && (i + 1) < argc) {
+            i++;
 
-    return EXIT_FAILURE;
-}
+            data = (const lxb_char_t *) argv[i];
+            num = lexbor_conv_data_to_ulong(&data, strlen(argv[i]));
 
-static lexbor_action_t
-dir_files_cb(const lxb_char_t *fullpath, size_t fullpath_len,
-             const lxb_char_t *filename, size_t filename_len, void *ctx)
-{
-    lxb_test_ctx_t *tctx = ctx;
+            if (*data != 0x00 || (const char *) data == argv[i]) {
+                FAILED(true, "Bad seed: %s", argv[i]);
+            }
 
-    prgm_gzip_t gzip;
-    lxb_char_t in_buf[LXB_UTILS_GZIP_CHUNK];
-    lxb_char_t out_buf[LXB_UTILS_GZIP_CHUNK];
+            pool.filter.seed = (uint64_t) num;
+        }
+        else if (strcmp(argv[i], "--summary") == 0 && (i + 1) < argc) {
+            i++;
 
-    FILE *fh = NULL;
-    size_t size;
+            pool.bench = true;
+            pool.summary = argv[i];
+        }
+        else if (strcmp(argv[i], "--min-length") == 0 && (i + 1) < argc) {
+            i++;
 
-    if (filename_len < 8
-        || lexbor_str_data_ncasecmp((const lxb_char_t *) "warc.gz",
-                                    &filename[filename_len - 7], 7) == false)
-    {
-        return LEXBOR_ACTION_NEXT;
-    }
+            if (!prgm_args_size(argv[i], NULL, &pool.filter.min_length)) {
+                FAILED(true, "Bad minimum length: %s", argv[i]);
+            }
+        }
+        else if (strcmp(argv[i], "--max-length") == 0 && (i + 1) < argc) {
+            i++;
 
-    tctx->fullpath = fullpath;
+            if (!prgm_args_size(argv[i], NULL, &pool.filter.max_length)) {
+                FAILED(true, "Bad maximum length: %s", argv[i]);
+            }
+        }
+        else if (strcmp(argv[i], "--max-rss") == 0 && (i + 1) < argc) {
+            i++;
 
-    TO_LOG(tctx, "Start processing file: %s", (const char *) fullpath);
+            if (!prgm_args_size(argv[i], NULL, &pool.max_rss)) {
+                FAILED(true, "Bad RSS limit: %s", argv[i]);
+            }
+        }
+        else if (strcmp(argv[i], "--recycle-limit") == 0 && (i + 1) < argc) {
+            i++;
 
-    /* Create WARC parser */
-    tctx->warc = lxb_utils_warc_create();
-    tctx->status = lxb_utils_warc_init(tctx->warc, tctx->h_cd, tctx->c_cb,
-                                       tctx->c_end_cb, tctx);
-    if (tctx->status != LXB_STATUS_OK) {
-        TO_LOG(tctx, "Failed to init warc.");
+            if (!prgm_args_size(argv[i], NULL, &pool.recycle_limit)) {
+                FAILED(true, "Bad recycle limit: %s", argv[i]);
+            }
+        }
+        else if (strcmp(argv[i], "--checkpoint") == 0 && (i + 1) < argc) {
+            i++;
 
-        return LEXBOR_ACTION_STOP;
-    }
+            if (pool.checkpoint.path != NULL) {
+                FAILED(true, "Checkpoint is given twice: %s", argv[i]);
+            }
 
-    /* Create HTTP parser */
-    tctx->http = lxb_utils_http_create();
-    tctx->status = lxb_utils_http_init(tctx->http, NULL);
-    if (tctx->status != LXB_STATUS_OK) {
-        TO_LOG(tctx, "Failed to init http.");
+            if (prgm_checkpoint_init(&pool.checkpoint, argv[i])
+                != LXB_STATUS_OK)
+            {
+                FAILED(false, "Failed to create checkpoint");
+            }
+        }
+        else if (strcmp(argv[i], "--resume") == 0) {
+            pool.resume = true;
+        }
+        else if (strcmp(argv[i], "--keep-going") == 0) {
+            pool.keep_going = true;
+        }
+        else if (strcmp(argv[i], "--isolate") == 0) {
+            pool.isolate = true;
+        }
+        else if (strcmp(argv[i], "--repro") == 0 && (i + 1) < argc) {
+            pool.repro = argv[++i];
+        }
+        else if (strcmp(argv[i], "--timeout") == 0 && (i + 1) < argc) {
+            i++;
 
-        return LEXBOR_ACTION_STOP;
-    }
+            data = (const lxb_char_t *) argv[i];
+            num = lexbor_conv_data_to_ulong(&data, strlen(argv[i]));
 
-    /* Create GZIP decompressor */
-    tctx->status = prgm_gzip_inflate_init(&gzip, out_buf, LXB_UTILS_GZIP_CHUNK,
-                                          gzip_cb, tctx);
-    if (tctx->status != LXB_STATUS_OK) {
-        TO_LOG(tctx, "Failed to init gzip.");
+            if (*data != 0x00 || num == 0) {
+                FAILED(true, "Bad timeout: %s", argv[i]);
+            }
 
-        goto failed;
+            pool.timeout = (uint64_t) num * 1000000000ULL;
+        }
+        else {
+            FAILED(true, "Unknown option: %s", argv[i]);
+        }
     }
 
-    /* Open and read GZIP file */
-    fh = fopen((const char *) fullpath, "rb");
-    if (fh == NULL) {
-        goto failed;
+    if ((argc - i) < 3) {
+        usage();
+        return EXIT_SUCCESS;
     }
 
-    do {
-        size = fread(in_buf, 1, LXB_UTILS_GZIP_CHUNK, fh);
-
-        if (size != LXB_UTILS_GZIP_CHUNK) {
-            if (feof(fh)) {
-                tctx->status = prgm_gzip_inflate(&gzip, in_buf,
-                                                 (unsigned) size);
-                if (tctx->status != LXB_STATUS_OK) {
-                    TO_LOG(tctx, "Failed to process inflate.");
-
-                    goto failed;
-                }
+    if (pool.resume && pool.checkpoint.path == NULL) {
+        FAILED(true, "--resume needs --checkpoint");
+    }
 
-                break;
-            }
+    if ((pool.repro != NULL || pool.timeout != 0) && !pool.isolate) {
+        FAILED(true, "--repro and --timeout need --isolate");
+    }
 
-            goto failed;
-        }
+    /* Statistics are not carried over from worker processes. */
+    if (pool.isolate && pool.stats) {
+        FAILED(true, "--stats can not be used with --isolate");
+    }
 
-        tctx->status = prgm_gzip_inflate(&gzip, in_buf, (unsigned) size);
-        if (tctx->status != LXB_STATUS_OK) {
-            TO_LOG(tctx, "Failed to process inflate.");
+    argv += i - 1;
 
-            goto failed;
+    for (size = 0; size < LXB_TEST_MODE_LAST; size++) {
+        if (strcmp(argv[1], test_mode_names[size]) == 0) {
+            break;
         }
     }
-    while (true);
 
-    prgm_gzip_inflate_destroy(&gzip, false);
-    lxb_utils_warc_destroy(tctx->warc, true);
-    lxb_utils_http_destroy(tctx->http, true);
+    /* The whole pipeline, named to go with the stage modes. */
+    if (strcmp(argv[1], "full") == 0) {
+        size = LXB_TEST_MODE_MULTI;
+    }
 
-    fclose(fh);
+    if (size == LXB_TEST_MODE_LAST) {
+        usage();
+        return EXIT_SUCCESS;
+    }
 
-    return LEXBOR_ACTION_OK;
+    pool.mode = (lxb_test_mode_t) size;
 
-failed:
+    /* The stage modes are for measuring only. */
+    if (pool.mode >= LXB_TEST_MODE_INFLATE) {
+        pool.bench = true;
+    }
 
-    prgm_gzip_inflate_destroy(&gzip, false);
-    lxb_utils_warc_destroy(tctx->warc, true);
-    lxb_utils_http_destroy(tctx->http, true);
+    /* Header fields are looked up once per record for all users. */
+    pool.fields = pool.filter.fields;
 
-    if (fh != NULL) {
-        fclose(fh);
+    if (pool.mode == LXB_TEST_MODE_SINGLE) {
+        pool.fields |= (1u << PRGM_FILTER_TYPE) | (1u << PRGM_FILTER_PAYLOAD);
     }
 
-    return LEXBOR_ACTION_STOP;
-}
+    if (pool.stats) {
+        pool.fields |= 1u << PRGM_FILTER_PAYLOAD;
+    }
 
-static lxb_status_t
-gzip_cb(prgm_gzip_t *gzip, const lxb_char_t *data, size_t size)
-{
-    lxb_status_t status;
-    lxb_test_ctx_t *tctx = gzip->ctx;
+    if (pthread_mutex_init(&pool.lock, NULL) != 0) {
+        FAILED(false, "Failed to create mutex");
+    }
 
-    status = lxb_utils_warc_parse(tctx->warc, &data, (data + size));
-    if (status != LXB_STATUS_OK && tctx->warc->error != NULL) {
-        TO_LOG(tctx, "WARC error: %s", tctx->warc->error);
+    status = prgm_bench_init(&bench, pool.bench, pool.slowest);
+    if (status != LXB_STATUS_OK) {
+        FAILED(false, "Failed to create bench counters");
     }
 
-    return status;
-}
+    bench.counters = pool.counters;
 
-lxb_inline lxb_status_t
-http_check_html_type(lxb_test_ctx_t *tctx)
-{
-    lxb_utils_warc_field_t *field;
-
-    static const lxb_char_t lxb_wtype[] = "WARC-Type";
-    static const lxb_char_t lxb_wtype_val[] = "response";
-    static const lxb_char_t lxb_wident[] = "WARC-Identified-Payload-Type";
-    static const lxb_char_t lxb_wident_val_html[] = "text/html";
-    static const lxb_char_t lxb_wident_val_xml[] = "application/xhtml+xml";
-
-    field = lxb_utils_warc_header_field(tctx->warc, lxb_wtype,
-                                        (sizeof(lxb_wtype) - 1), 0);
-    if (field == NULL
-        || field->value.length != (sizeof(lxb_wtype_val) - 1)
-        || lexbor_str_data_ncasecmp(field->value.data, lxb_wtype_val,
-                                    field->value.length) == false)
-    {
-        goto next;
+    (void) prgm_stats_init(&stats, pool.stats);
+
+    pool.files = lexbor_array_create();
+    status = lexbor_array_init(pool.files, 128);
+    if (status != LXB_STATUS_OK) {
+        FAILED(false, "Failed to create files list");
     }
 
-    field = lxb_utils_warc_header_field(tctx->warc, lxb_wident,
-                                        (sizeof(lxb_wident) - 1), 0);
-    if (field == NULL) {
-        goto next;
+    pool.ranges = lexbor_array_create();
+    status = lexbor_array_init(pool.ranges, 128);
+    if (status != LXB_STATUS_OK) {
+        FAILED(false, "Failed to create ranges list");
     }
 
-    TO_LOG(tctx, LEXBOR_FORMAT_Z": %s", tctx->warc->count, field->value.data);
+    pool.log_path = argv[2];
 
-    if (field->value.length == (sizeof(lxb_wident_val_html) - 1)
-        && lexbor_str_data_ncasecmp(field->value.data, lxb_wident_val_html,
-                                field->value.length))
-    {
-        return LXB_STATUS_OK;
+    status = prgm_log_init(&pool.log_writer, argv[2], level);
+    if (status == LXB_STATUS_OK && pool.isolate) {
+        status = prgm_log_shared(&pool.log_writer);
     }
 
-    if (field->value.length == (sizeof(lxb_wident_val_xml) - 1)
-        && lexbor_str_data_ncasecmp(field->value.data, lxb_wident_val_xml,
-                                    field->value.length))
-    {
-        return LXB_STATUS_OK;
+    if (status != LXB_STATUS_OK) {
+        FAILED(false, "Failed to open log file: %s", argv[2]);
     }
 
-    return LXB_STATUS_NEXT;
-
-next:
-
-    TO_LOG(tctx, LEXBOR_FORMAT_Z, tctx->warc->count);
+    pool.log = prgm_log_buf_create(&pool.log_writer);
+    if (pool.log == NULL) {
+        prgm_log_destroy(&pool.log_writer, false);
+        FAILED(false, "Failed to create log buffer");
+    }
 
-    return LXB_STATUS_NEXT;
-}
+    lxb_test_log = &pool.log_writer;
 
-lxb_inline lxb_status_t
-html_encode(lxb_test_ctx_t *tctx)
-{
-    lxb_status_t status, enc_status;
-    const lxb_codepoint_t *buf, *buf_end;
+    atexit(test_log_exit);
+    signal(SIGSEGV, test_log_signal);
+    signal(SIGBUS, test_log_signal);
+    signal(SIGFPE, test_log_signal);
+    signal(SIGILL, test_log_signal);
+    signal(SIGABRT, test_log_signal);
 
-    buf = tctx->buf_decode;
-    buf_end = tctx->buf_decode + lxb_encoding_decode_buf_used(&tctx->decode);
+    /* A crash takes a record, the rest of the file goes on from there. */
+    if (pool.isolate && pool.split_size != 0) {
+        pool.split_size = 0;
 
-    do {
-        lxb_encoding_encode_buf_used_set(&tctx->encode, 0);
+        TO_LOG(&pool, PRGM_LOG_INFO, "Files are not split with --isolate");
+    }
 
-        enc_status = tctx->enc_utf_8->encode(&tctx->encode, &buf, buf_end);
+    if (pool.resume) {
+        status = prgm_checkpoint_load(&pool.checkpoint);
 
-        status = lxb_html_document_parse_chunk(tctx->document,
-                                      tctx->buf_encode, tctx->encode.buffer_used);
-        if (status != LXB_STATUS_OK) {
-            TO_LOG(tctx, "HTML chunk parsing error");
-            return LXB_STATUS_ERROR;
+        if (status == LXB_STATUS_ERROR_NOT_EXISTS) {
+            TO_LOG(&pool, PRGM_LOG_INFO, "No checkpoint %s, nothing to"
+                   " resume", pool.checkpoint.path);
+        }
+        else if (status != LXB_STATUS_OK) {
+            TO_LOG(&pool, PRGM_LOG_ERROR, "Bad checkpoint: %s",
+                   pool.checkpoint.path);
+            goto failed;
         }
     }
-    while (enc_status == LXB_STATUS_SMALL_BUFFER);
-
-    return LXB_STATUS_OK;
-}
 
-static lxb_status_t
-warc_single_header_cb(lxb_utils_warc_t *warc)
-{
-    lxb_status_t status;
-    lxb_test_ctx_t *tctx = warc->ctx;
+    dirpath = (const lxb_char_t *) argv[3];
 
-    if (http_check_html_type(tctx) == LXB_STATUS_NEXT) {
-        return LXB_STATUS_NEXT;
+    status = lexbor_fs_dir_read(dirpath, LEXBOR_FS_DIR_OPT_WITHOUT_HIDDEN
+                                |LEXBOR_FS_DIR_OPT_WITHOUT_DIR,
+                                lxb_test_dir_files_cb, &pool);
+    if (status != LXB_STATUS_OK || pool.status != LXB_STATUS_OK) {
+        goto failed;
     }
 
-    status = lxb_html_document_parse_chunk_begin(tctx->document);
-    if (status != LXB_STATUS_OK) {
-        TO_LOG(tctx, "HTML chunk begin error");
-        return LXB_STATUS_ERROR;
+    if (pool.resume) {
+        TO_LOG(&pool, PRGM_LOG_SUMMARY, "Resumed: "LEXBOR_FORMAT_Z" files"
+               " with "LEXBOR_FORMAT_Z" documents done before, "
+               LEXBOR_FORMAT_Z" files left", pool.resumed, pool.resumed_total,
+               lexbor_array_length(pool.files));
     }
 
-    return LXB_STATUS_OK;
-}
+    /* Rewritten before the first file, a cut line of a crash goes away. */
+    if (pool.checkpoint.path != NULL
+        && prgm_checkpoint_open(&pool.checkpoint) != LXB_STATUS_OK)
+    {
+        TO_LOG(&pool, PRGM_LOG_ERROR, "Failed to write checkpoint: %s",
+               pool.checkpoint.path);
+        goto failed;
+    }
 
-static lxb_status_t
-warc_single_content_end_cb(lxb_utils_warc_t *warc)
-{
-    lxb_status_t status;
-    lxb_test_ctx_t *tctx = warc->ctx;
+    pool.progress = lexbor_calloc(lexbor_array_length(pool.files) + 1,
+                                  sizeof(lxb_test_file_t));
+    if (pool.progress == NULL) {
+        TO_LOG(&pool, PRGM_LOG_ERROR, "Failed to allocate files progress");
+        goto failed;
+    }
 
-    if (tctx->enc_data == NULL) {
-        lxb_encoding_decode_buf_used_set(&tctx->decode, 0);
+    for (size = 0; size < lexbor_array_length(pool.files); size++) {
+        pool.progress[size].parts = 1;
+    }
 
-        (void) lxb_encoding_decode_finish(&tctx->decode);
+    pool.single = prgm_text_single_create_all();
+    if (pool.single == NULL) {
+        TO_LOG(&pool, PRGM_LOG_ERROR, "Failed to create encoding tables");
+        goto failed;
+    }
 
-        if (lxb_encoding_decode_buf_used(&tctx->decode) != 0) {
-            status = html_encode(tctx);
-            if (status != LXB_STATUS_OK) {
-                return status;
-            }
-        }
+    ctxs = lexbor_calloc(pool.threads, sizeof(lxb_test_ctx_t));
+    threads = lexbor_calloc(pool.threads, sizeof(pthread_t));
 
-        /* No need to call lxb_encoding_encode_finish(). */
+    if (ctxs == NULL || threads == NULL) {
+        TO_LOG(&pool, PRGM_LOG_ERROR, "Failed to allocate worker contexts");
+        goto failed;
     }
 
-    lxb_utils_http_clear(tctx->http);
-
-    status = lxb_html_document_parse_chunk_end(tctx->document);
-    if (status != LXB_STATUS_OK) {
-        TO_LOG(tctx, "HTML chunk end error");
-        return LXB_STATUS_ERROR;
+    for (i = 0; i < (int) pool.threads; i++) {
+        status = lxb_test_ctx_init(&ctxs[i], &pool);
+        if (status != LXB_STATUS_OK) {
+            TO_LOG(&pool, PRGM_LOG_ERROR, "Failed to init worker context");
+            goto failed;
+        }
     }
 
-    warc->content_cb = warc_content_header_cb;
+    TO_LOG(&pool, PRGM_LOG_INFO, "Input: %s, inflate: %s",
+           prgm_input_backend(&ctxs[0].input),
+           test_inflate_name(&pool, ctxs));
 
-    return LXB_STATUS_OK;
-}
+    bench_begin = prgm_bench_now();
 
-static lxb_status_t
-warc_multi_header_cb(lxb_utils_warc_t *warc)
-{
-    lxb_status_t status;
-    lxb_test_ctx_t *tctx = warc->ctx;
+    pool.active = pool.threads;
 
-    tctx->document = lxb_html_document_create();
-    if (tctx->document == NULL) {
-        TO_LOG(tctx, "HTML document create error");
-        return LXB_STATUS_ERROR;
-    }
+    if (pool.isolate) {
+        status = lxb_test_isolate_run(&pool, ctxs);
+        if (status != LXB_STATUS_OK) {
+            TO_LOG(&pool, PRGM_LOG_ERROR, "Failed to start worker processes");
+            lxb_test_pool_stop(&pool, status);
+        }
 
-    status = lxb_html_document_parse_chunk_begin(tctx->document);
-    if (status != LXB_STATUS_OK) {
-        TO_LOG(tctx, "HTML chunk begin error");
-        return LXB_STATUS_ERROR;
+        goto done;
     }
 
-    return LXB_STATUS_OK;
-}
+    started = pool.threads;
 
-static lxb_status_t
-warc_multi_content_end_cb(lxb_utils_warc_t *warc)
-{
-    lxb_status_t status;
-    lxb_test_ctx_t *tctx = warc->ctx;
+    /*
+     * The first worker always runs on the main thread. Contexts of workers
+     * that did not start stay in pool.threads, lxb_test_pool_destroy() frees
+     * them.
+     */
+    for (i = 1; i < (int) pool.threads; i++) {
+        if (pthread_create(&threads[i], NULL, lxb_test_worker_thread,
+                           &ctxs[i]) != 0)
+        {
+            TO_LOG(&pool, PRGM_LOG_ERROR, "Failed to create worker thread");
 
-    if (tctx->enc_data == NULL) {
-        lxb_encoding_decode_buf_used_set(&tctx->decode, 0);
+            started = (unsigned) i;
 
-        (void) lxb_encoding_decode_finish(&tctx->decode);
+            pthread_mutex_lock(&pool.lock);
+            pool.active -= pool.threads - started;
+            pthread_mutex_unlock(&pool.lock);
 
-        if (lxb_encoding_decode_buf_used(&tctx->decode) != 0) {
-            status = html_encode(tctx);
-            if (status != LXB_STATUS_OK) {
-                return status;
-            }
-        }
+            lxb_test_pool_stop(&pool, LXB_STATUS_ERROR);
 
-        /* No need to call lxb_encoding_encode_finish(). */
+            break;
+        }
     }
 
-    lxb_utils_http_clear(tctx->http);
+    (void) lxb_test_worker_thread(&ctxs[0]);
 
-    status = lxb_html_document_parse_chunk_end(tctx->document);
-    if (status != LXB_STATUS_OK) {
-        TO_LOG(tctx, "HTML chunk end error");
-        return LXB_STATUS_ERROR;
+    for (i = 1; i < (int) started; i++) {
+        (void) pthread_join(threads[i], NULL);
     }
 
-    tctx->document = lxb_html_document_destroy(tctx->document);
+done:
 
-    warc->content_cb = warc_content_header_cb;
-
-    return LXB_STATUS_OK;
-}
+    bench.wall = prgm_bench_now() - bench_begin;
 
-static lxb_status_t
-warc_content_header_cb(lxb_utils_warc_t *warc,
-                       const lxb_char_t *data, const lxb_char_t *end)
-{
-    size_t len;
-    lxb_status_t status;
-    lxb_utils_http_field_t *field;
-    lxb_test_ctx_t *tctx = warc->ctx;
-    lxb_html_encoding_entry_t *enc_entry;
-    const lxb_encoding_data_t *html_enc_data;
-    const lxb_char_t *enc_name, *enc_end;
+    for (i = 0; i < (int) pool.threads; i++) {
+        pool.total += ctxs[i].total;
+        pool.released += ctxs[i].released;
+        pool.filtered += ctxs[i].filtered;
+        pool.skipped += ctxs[i].skipped;
 
-    static const lxb_char_t lxb_ctype[] = "Content-Type";
+        prgm_bench_merge(&bench, &ctxs[i].bench);
 
-    status = lxb_utils_http_parse(tctx->http, &data, end);
-    if (status != LXB_STATUS_OK) {
-        if (status == LXB_STATUS_NEXT) {
-            return LXB_STATUS_OK;
+        if (prgm_stats_merge(&stats, &ctxs[i].stats) != LXB_STATUS_OK) {
+            TO_LOG(&pool, PRGM_LOG_ERROR, "Failed to merge statistics");
         }
-
-        goto failed;
     }
 
-    status = lxb_utils_http_header_parse_eof(tctx->http);
-    if (status != LXB_STATUS_OK) {
+    threads = lexbor_free(threads);
+
+    if (pool.status != LXB_STATUS_OK) {
         goto failed;
     }
 
-    tctx->total++;
-
-    html_enc_data = NULL;
-    tctx->enc_data = NULL;
+    TO_LOG(&pool, PRGM_LOG_SUMMARY, "Total processed: "LEXBOR_FORMAT_Z,
+           pool.total);
 
-    /* Get encoding from HTTP Content-Type */
-    field = lxb_utils_http_header_field(tctx->http, lxb_ctype,
-                                        (sizeof(lxb_ctype) - 1), 0);
-    if (field == NULL) {
-        goto html_encoding;
+    for (i = 0; i < (int) pool.threads; i++) {
+        TO_LOG(&pool, PRGM_LOG_INFO, "Worker %d: memory peak "LEXBOR_FORMAT_Z
+               ", biggest document "LEXBOR_FORMAT_Z, i,
+               ctxs[i].bench.mem_peak, ctxs[i].bench.doc_mem_max);
     }
 
-    enc_name = lxb_html_encoding_content(field->value.data, field->value.data
-                                         + field->value.length, &enc_end);
-    if (enc_name == NULL) {
-        TO_LOG(tctx, "HTTP encoding not found in \"%s\"", field->value.data);
-        goto html_encoding;
+    if (pool.mode == LXB_TEST_MODE_RECYCLE || pool.max_rss != 0) {
+        TO_LOG(&pool, PRGM_LOG_SUMMARY, "Documents released over a memory"
+               " limit: "LEXBOR_FORMAT_Z, pool.released);
     }
 
-    tctx->enc_data = lxb_encoding_data_by_pre_name(enc_name,
-                                                   (enc_end - enc_name));
-    if (tctx->enc_data == NULL) {
-        TO_LOG(tctx, "HTTP encoding found but not determine by \"%.*s\"",
-               (int) (enc_end - enc_name), enc_name);
+    if (prgm_filter_active(&pool.filter)) {
+        TO_LOG(&pool, PRGM_LOG_SUMMARY, "Records filtered: "LEXBOR_FORMAT_Z
+               ", of them not inflated by index: "LEXBOR_FORMAT_Z,
+               pool.filtered + pool.skipped, pool.skipped);
     }
 
-html_encoding:
-
-    status = lxb_html_encoding_determine(&tctx->html_em, data, end);
-
-    if (status != LXB_STATUS_OK) {
-        TO_LOG(tctx, "Failed to determine encoding from HTML stream");
+    if (pool.resume) {
+        TO_LOG(&pool, PRGM_LOG_SUMMARY, "Total with resumed files: "
+               LEXBOR_FORMAT_Z, pool.total + pool.resumed_total);
     }
-    else {
-        len = lxb_html_encoding_meta_length(&tctx->html_em);
 
-        if (len == 0) {
-            if (tctx->enc_data != NULL) {
-                TO_LOG(tctx, "HTML encoding not determined but found in header:"
-                       " \"%.*s\"", (int) (enc_end - enc_name), enc_name);
+    if (pool.keep_going) {
+        for (size = 0; size < lexbor_array_length(pool.files); size++) {
+            if (pool.progress[size].status != LXB_STATUS_OK) {
+                TO_LOG(&pool, PRGM_LOG_ERROR, "Failed file: %s",
+                       (const char *) lexbor_array_get(pool.files, size));
             }
-
-            TO_LOG(tctx, "HTML fragment to determine encoding by meta tag:\n"
-                   "%.*s", (int) (end - data), data);
         }
-        else {
-            enc_entry = lxb_html_encoding_meta_entry(&tctx->html_em, 0);
-
-            html_enc_data = lxb_encoding_data_by_pre_name(enc_entry->name,
-                                            (enc_entry->end - enc_entry->name));
-            if (html_enc_data == NULL) {
-                TO_LOG(tctx, "HTML meta encoding found but not determine by"
-                       " \"%.*s\"", (int) (enc_entry->end - enc_entry->name),
-                       enc_entry->name);
-            }
 
-            if (tctx->enc_data == NULL) {
-                tctx->enc_data = html_enc_data;
-            }
-        }
+        TO_LOG(&pool, PRGM_LOG_SUMMARY, "Failed files: "LEXBOR_FORMAT_Z,
+               pool.failed);
     }
 
-    lxb_html_encoding_clean(&tctx->html_em);
-
-    if (tctx->enc_data != NULL) {
-        lxb_encoding_encode_init(&tctx->encode, tctx->enc_data,
-                                 tctx->buf_encode, sizeof(tctx->buf_encode));
-
-        tctx->encode.replace_to = (const lxb_char_t *) "?";
-        tctx->encode.replace_len = 1;
+    if (pool.isolate) {
+        TO_LOG(&pool, PRGM_LOG_SUMMARY, "Crashed records: "LEXBOR_FORMAT_Z,
+               pool.crashed);
+    }
 
-        lxb_encoding_decode_init(&tctx->decode, tctx->enc_utf_8, tctx->buf_decode,
-                                 sizeof(tctx->buf_decode) / sizeof(lxb_codepoint_t));
+    if (pool.bench) {
+        bench.documents = pool.total;
 
-        tctx->decode.replace_to = LXB_ENCODING_REPLACEMENT_BUFFER;
-        tctx->encode.replace_len = LXB_ENCODING_REPLACEMENT_BUFFER_LEN;
+        test_bench_report(&pool, ctxs, &bench);
     }
 
-    status = warc_content_body_cb(warc, data, end);
-    if (status != LXB_STATUS_OK) {
-        return status;
+    if (pool.summary != NULL) {
+        test_summary_report(&pool, ctxs, &bench);
     }
 
-    warc->content_cb = warc_content_body_cb;
-
-    return LXB_STATUS_OK;
-
-failed:
-
-    if (tctx->http->error != NULL) {
-        TO_LOG(tctx, "HTML header parsing error: %s", tctx->http->error);
-    }
-    else {
-        TO_LOG(tctx, "HTML header parsing error");
+    if (pool.stats) {
+        test_stats_report(&pool, &stats);
     }
 
-    return LXB_STATUS_NEXT;
-}
+    size = pool.failed + pool.crashed;
 
-static lxb_status_t
-warc_content_body_cb(lxb_utils_warc_t *warc, const lxb_char_t *data,
-                     const lxb_char_t *end)
-{
-    lxb_status_t status, dec_status;
-    lxb_test_ctx_t *tctx = warc->ctx;
+    lxb_test_pool_destroy(&pool, ctxs);
+    prgm_bench_destroy(&bench, false);
+    prgm_stats_destroy(&stats, false);
 
-    if (tctx->enc_data == NULL) {
-        status = lxb_html_document_parse_chunk(tctx->document, data,
-                                               (end - data));
-        if (status != LXB_STATUS_OK) {
-            TO_LOG(tctx, "HTML chunk parsing error");
-            return LXB_STATUS_ERROR;
-        }
+    return (size == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 
-        return LXB_STATUS_OK;
-    }
+failed:
 
-    do {
-        lxb_encoding_decode_buf_used_set(&tctx->decode, 0);
+    if (pool.log != NULL) {
+        TO_LOG(&pool, PRGM_LOG_SUMMARY, "Total processed: "LEXBOR_FORMAT_Z,
+               pool.total);
+        TO_LOG(&pool, PRGM_LOG_ERROR, "Failed");
+    }
 
-        dec_status = tctx->enc_data->decode(&tctx->decode, &data, end);
+    lxb_test_pool_destroy(&pool, ctxs);
+    prgm_bench_destroy(&bench, false);
+    prgm_stats_destroy(&stats, false);
 
-        status = html_encode(tctx);
-        if (status != LXB_STATUS_OK) {
-            return status;
-        }
+    if (threads != NULL) {
+        lexbor_free(threads);
     }
-    while (dec_status == LXB_STATUS_SMALL_BUFFER);
 
-    return LXB_STATUS_OK;
+    return EXIT_FAILURE;
 }
@@ -0,0 +1,304 @@
+/*
+ * Copyright (C) 2019 Alexander Borisov
+ *
+ * Author: Alexander Borisov <borisov@lexbor.com>
+ */
+
+#include <lexbor/core/conv.h>
+#include <lexbor/core/fs.h>
+#include <lexbor/encoding/encoding.h>
+
+#include "bench.h"
+#include "text.h"
+
+
+#define FAILED(with_usage, ...)                                                \
+    do {                                                                       \
+        fprintf(stderr, __VA_ARGS__);                                          \
+        fprintf(stderr, "\n");                                                 \
+                                                                               \
+        if (with_usage) {                                                      \
+            usage();                                                           \
+        }                                                                      \
+                                                                               \
+        exit(EXIT_FAILURE);                                                    \
+    }                                                                          \
+    while (0)
+
+#define LXB_TEXT_BENCH_SIZE   16    /* MB */
+#define LXB_TEXT_BENCH_ROUNDS 5
+#define LXB_TEXT_BENCH_BUF    4096  /* as buf_decode and buf_encode */
+
+
+typedef size_t
+(*lxb_text_bench_f)(const lxb_encoding_data_t *encoding,
+                    const prgm_text_single_t *single,
+                    const lxb_char_t *data, const lxb_char_t *end,
+                    lxb_char_t *result);
+
+
+static void
+usage(void)
+{
+    printf("Usage: warc_text_bench [-s <MB>] [-r <rounds>] [file]\n");
+    printf("Compares decode and encode through code points with the tables"
+           " of single-byte encodings.\n");
+    printf("-s <MB>: size of the generated text, default %d\n",
+           LXB_TEXT_BENCH_SIZE);
+    printf("-r <rounds>: runs of every conversion, the best is taken,"
+           " default %d\n", LXB_TEXT_BENCH_ROUNDS);
+    printf("[file]: use the file instead of generated HTML for every"
+           " encoding\n");
+}
+
+/*
+ * HTML-like text: markup in ASCII, words of bytes above 0x7F, which are
+ * letters in most of these encodings.
+ */
+static lxb_char_t *
+text_generate(size_t size)
+{
+    size_t i, len;
+    lxb_char_t *data, *p, *end;
+    unsigned seed = 1;
+
+    static const char open[] = "<p class=\"text\">";
+    static const char close[] = "</p>\n";
+
+    data = lexbor_malloc(size);
+    if (data == NULL) {
+        return NULL;
+    }
+
+    p = data;
+    end = data + size;
+
+    while ((size_t) (end - p) > sizeof(open) + sizeof(close) + 128) {
+        memcpy(p, open, sizeof(open) - 1);
+        p += sizeof(open) - 1;
+
+        for (i = 0; i < 12; i++) {
+            seed = seed * 1103515245 + 12345;
+            len = 3 + (seed >> 16) % 7;
+
+            while (len-- != 0) {
+                seed = seed * 1103515245 + 12345;
+                *p++ = (lxb_char_t) (0xC0 + ((seed >> 16) & 0x3F));
+            }
+
+            *p++ = ' ';
+        }
+
+        memcpy(p, close, sizeof(close) - 1);
+        p += sizeof(close) - 1;
+    }
+
+    memset(p, ' ', end - p);
+
+    return data;
+}
+
+/* As warc_test did it: code points first, then UTF-8. */
+static size_t
+text_bench_decode(const lxb_encoding_data_t *encoding,
+                  const prgm_text_single_t *single,
+                  const lxb_char_t *data, const lxb_char_t *end,
+                  lxb_char_t *result)
+{
+    lxb_status_t dec_status, enc_status;
+    lxb_char_t *r = result;
+    const lxb_codepoint_t *buf, *buf_end;
+    lxb_encoding_decode_t decode;
+    lxb_encoding_encode_t encode;
+    const lxb_encoding_data_t *utf_8;
+    lxb_codepoint_t buf_decode[LXB_TEXT_BENCH_BUF];
+    lxb_char_t buf_encode[LXB_TEXT_BENCH_BUF];
+
+    (void) single;
+
+    utf_8 = lxb_encoding_data(LXB_ENCODING_UTF_8);
+
+    lxb_encoding_decode_init(&decode, encoding, buf_decode,
+                             LXB_TEXT_BENCH_BUF);
+    decode.replace_to = LXB_ENCODING_REPLACEMENT_BUFFER;
+    decode.replace_len = LXB_ENCODING_REPLACEMENT_BUFFER_LEN;
+
+    lxb_encoding_encode_init(&encode, utf_8, buf_encode, LXB_TEXT_BENCH_BUF);
+    encode.replace_to = (const lxb_char_t *) "?";
+    encode.replace_len = 1;
+
+    do {
+        lxb_encoding_decode_buf_used_set(&decode, 0);
+
+        dec_status = encoding->decode(&decode, &data, end);
+
+        buf = buf_decode;
+        buf_end = buf_decode + lxb_encoding_decode_buf_used(&decode);
+
+        do {
+            lxb_encoding_encode_buf_used_set(&encode, 0);
+
+            enc_status = utf_8->encode(&encode, &buf, buf_end);
+
+            memcpy(r, buf_encode, encode.buffer_used);
+            r += encode.buffer_used;
+        }
+        while (enc_status == LXB_STATUS_SMALL_BUFFER);
+    }
+    while (dec_status == LXB_STATUS_SMALL_BUFFER);
+
+    return r - result;
+}
+
+static size_t
+text_bench_table(const lxb_encoding_data_t *encoding,
+                 const prgm_text_single_t *single,
+                 const lxb_char_t *data, const lxb_char_t *end,
+                 lxb_char_t *result)
+{
+    size_t length;
+    lxb_char_t *r = result;
+    lxb_char_t buf_encode[LXB_TEXT_BENCH_BUF];
+
+    (void) encoding;
+
+    while (data < end) {
+        length = prgm_text_single_transcode(single, &data, end, buf_encode,
+                                            LXB_TEXT_BENCH_BUF);
+
+        memcpy(r, buf_encode, length);
+        r += length;
+    }
+
+    return r - result;
+}
+
+/* Best of the rounds, in MB/s of input. */
+static double
+text_bench_run(lxb_text_bench_f func, const lxb_encoding_data_t *encoding,
+               const prgm_text_single_t *single, const lxb_char_t *data,
+               size_t size, lxb_char_t *result, size_t *length,
+               unsigned rounds)
+{
+    unsigned i;
+    uint64_t begin, time, best;
+
+    best = UINT64_MAX;
+
+    for (i = 0; i < rounds; i++) {
+        begin = prgm_bench_now();
+
+        *length = func(encoding, single, data, data + size, result);
+
+        time = prgm_bench_now() - begin;
+        if (time < best) {
+            best = time;
+        }
+    }
+
+    return (best == 0) ? 0.0 : (double) size * 1000.0 / (double) best;
+}
+
+int
+main(int argc, const char *argv[])
+{
+    int i;
+    unsigned enc, rounds;
+    bool differ;
+    size_t size, len_decode, len_table;
+    double before, after;
+    lxb_char_t *data, *res_decode, *res_table;
+    const lxb_char_t *num;
+    const lxb_encoding_data_t *encoding;
+    prgm_text_single_t *tables;
+
+    size = LXB_TEXT_BENCH_SIZE;
+    rounds = LXB_TEXT_BENCH_ROUNDS;
+    data = NULL;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-s") == 0 && (i + 1) < argc) {
+            num = (const lxb_char_t *) argv[++i];
+            size = lexbor_conv_data_to_ulong(&num, strlen(argv[i]));
+
+            if (*num != 0x00 || size == 0) {
+                FAILED(true, "Bad size: %s", argv[i]);
+            }
+        }
+        else if (strcmp(argv[i], "-r") == 0 && (i + 1) < argc) {
+            num = (const lxb_char_t *) argv[++i];
+            rounds = (unsigned) lexbor_conv_data_to_ulong(&num,
+                                                          strlen(argv[i]));
+            if (*num != 0x00 || rounds == 0) {
+                FAILED(true, "Bad number of rounds: %s", argv[i]);
+            }
+        }
+        else if (argv[i][0] == '-' || (i + 1) != argc) {
+            FAILED(true, "Unknown option: %s", argv[i]);
+        }
+        else {
+            data = lexbor_fs_file_easy_read((const lxb_char_t *) argv[i],
+                                            &size);
+            if (data == NULL) {
+                FAILED(false, "Failed to read file: %s", argv[i]);
+            }
+        }
+    }
+
+    if (data == NULL) {
+        size *= 1024 * 1024;
+
+        data = text_generate(size);
+        if (data == NULL) {
+            FAILED(false, "Failed to allocate memory for text");
+        }
+    }
+
+    /* A byte is at most three bytes of UTF-8, the table writes four. */
+    res_decode = lexbor_malloc(size * 3 + 4);
+    res_table = lexbor_malloc(size * 3 + 4);
+    tables = prgm_text_single_create_all();
+
+    if (res_decode == NULL || res_table == NULL || tables == NULL) {
+        FAILED(false, "Failed to allocate memory");
+    }
+
+    differ = false;
+
+    printf("Input: "LEXBOR_FORMAT_Z" bytes, best of %u rounds\n",
+           size, rounds);
+    printf("%-16s %12s %12s %8s\n", "encoding", "decode MB/s", "table MB/s",
+           "speedup");
+
+    for (enc = 0; enc < LXB_ENCODING_LAST_ENTRY; enc++) {
+        if (!prgm_text_ascii_compatible((lxb_encoding_t) enc)) {
+            continue;
+        }
+
+        encoding = lxb_encoding_data((lxb_encoding_t) enc);
+
+        before = text_bench_run(text_bench_decode, encoding, &tables[enc],
+                                data, size, res_decode, &len_decode, rounds);
+        after = text_bench_run(text_bench_table, encoding, &tables[enc],
+                               data, size, res_table, &len_table, rounds);
+
+        printf("%-16s %12.1f %12.1f %7.1fx", (const char *) encoding->name,
+               before, after, (before == 0.0) ? 0.0 : after / before);
+
+        if (len_decode != len_table
+            || memcmp(res_decode, res_table, len_decode) != 0)
+        {
+            differ = true;
+            printf("  output differs");
+        }
+
+        printf("\n");
+    }
+
+    lexbor_free(data);
+    lexbor_free(res_decode);
+    lexbor_free(res_table);
+    (void) prgm_text_single_destroy_all(tables);
+
+    return (differ) ? EXIT_FAILURE : EXIT_SUCCESS;
+}